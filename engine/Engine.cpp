@@ -1,5 +1,24 @@
 #include "Engine.hpp"
+#include "core/Profiler.hpp"
 
 void trb::Engine::gameLoop(){
-    graphics.renderLoop();
-}
\ No newline at end of file
+    // the main thread is worker 0, it runs the frame's jobs while it waits on the frame
+    TRB_PROFILE_THREAD("main");
+    jobs->resetStats();
+    while (graphics.pollEvents()){
+        TRB_PROFILE_ZONE("frame");
+        core::Job* frame = jobs->create(nullptr);
+        graphics.scheduleFrame(jobs, frame);
+        jobs->run(frame);
+        jobs->wait(frame);
+        graphics.endFrame();
+    }
+    graphics.waitIdle();
+    jobs->printStats(std::cout);
+#if TRB_PROFILE
+    // the last frames of every thread, open in chrome://tracing or ui.perfetto.dev
+    if (core::Profiler::writeChromeTrace(DEFAULT_TRACE_PATH)){
+        std::cout << "trace written to " << DEFAULT_TRACE_PATH << std::endl;
+    }
+#endif
+}
@@ -1,6 +1,7 @@
 #ifndef TRB_GFX_Engine_H_
 #define TRB_GFX_Engine_H_
 
+#include "core/JobSystem.hpp"
 #include "graphics/GraphicsManager.hpp"
 #include "graphics/Graphics.hpp"
 
@@ -16,13 +17,18 @@ namespace trb{
     class Engine{
         public:
             Engine()
-                : graphics( trb::grfx::Graphics::create(enableValidationLayers) )
+                : jobs( trb::core::JobSystem::create() )
+                , graphics( trb::grfx::Graphics::create(enableValidationLayers) )
             {};
-            ~Engine(){};
+            ~Engine(){
+                jobs->shutdown();
+            };
 
             void gameLoop();
 
         private:
+            // the job system has to be running before graphics creates its per worker resources
+            core::JobSystem* jobs;
             grfx::GraphicsManager graphics;
 
     };
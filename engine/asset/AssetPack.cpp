@@ -0,0 +1,281 @@
+#include "AssetPack.hpp"
+#include "Lz4.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <atomic>
+
+namespace{
+    /** @brief [offset, offset + size) lies within total bytes, without overflowing */
+    inline bool inRange(uint64_t offset, uint64_t size, uint64_t total){
+        return offset <= total && size <= total - offset;
+    }
+}
+
+bool trb::asset::AssetPack::validate() const {
+    if (!inRange(header->chunkTableOffset, (uint64_t)header->chunkCount * sizeof(TpakChunk), mappedSize) ||
+        !inRange(header->entryTableOffset, (uint64_t)header->entryCount * sizeof(TpakEntry), mappedSize) ||
+        !inRange(header->pathTableOffset, header->pathTableSize, mappedSize)){
+        return false;
+    }
+    const TpakChunk* chunkTable = (const TpakChunk*)(base + header->chunkTableOffset);
+    const TpakEntry* entryTable = (const TpakEntry*)(base + header->entryTableOffset);
+    const char* pathTable = (const char*)(base + header->pathTableOffset);
+    for (uint32_t e = 0; e < header->entryCount; e++){
+        const TpakEntry& entry = entryTable[e];
+        // the path has to end inside the path table
+        if (entry.pathOffset >= header->pathTableSize ||
+            !memchr(pathTable + entry.pathOffset, 0, (size_t)(header->pathTableSize - entry.pathOffset))){
+            return false;
+        }
+        if (entry.flags == eTpakStored){
+            if (!inRange(entry.offset, entry.size, mappedSize)){
+                return false;
+            }
+            continue;
+        }
+        if (entry.flags != eTpakLz4 || entry.chunkCount == 0 || (uint64_t)entry.firstChunk + entry.chunkCount > header->chunkCount){
+            return false;
+        }
+        // read() puts chunk i at i * the first chunk's size, the chunks have to add up to exactly the payload
+        uint64_t chunkSize = chunkTable[entry.firstChunk].size;
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < entry.chunkCount; i++){
+            const TpakChunk& chunk = chunkTable[entry.firstChunk + i];
+            if (!inRange(chunk.offset, chunk.storedSize, mappedSize) || chunk.size > chunkSize ||
+                (i + 1 < entry.chunkCount && chunk.size != chunkSize)){
+                return false;
+            }
+            total += chunk.size;
+        }
+        if (total != entry.size){
+            return false;
+        }
+    }
+    return true;
+}
+
+void trb::asset::AssetPack::open(const std::string& path){
+    close();
+    file.open(path);
+    base = file.data();
+    mappedSize = file.getSize();
+
+    header = (const TpakHeader*)base;
+    if (mappedSize < sizeof(TpakHeader) || header->magic != TPAK_MAGIC || header->version != TPAK_VERSION || !validate()){
+        close();
+        throw std::runtime_error("corrupt asset pack " + path);
+    }
+    chunks = (const TpakChunk*)(base + header->chunkTableOffset);
+    entries = (const TpakEntry*)(base + header->entryTableOffset);
+    paths = (const char*)(base + header->pathTableOffset);
+}
+
+void trb::asset::AssetPack::close(){
+    file.close();
+    base = nullptr;
+    mappedSize = 0;
+    header = nullptr;
+    chunks = nullptr;
+    entries = nullptr;
+    paths = nullptr;
+}
+
+const trb::asset::TpakEntry* trb::asset::AssetPack::find(const std::string& path) const {
+    if (!header){
+        return nullptr;
+    }
+    uint64_t hash = hashPath(path);
+    const TpakEntry* end = entries + header->entryCount;
+    const TpakEntry* it = std::lower_bound(entries, end, hash, [](const TpakEntry& entry, uint64_t value){
+        return entry.hash < value;
+    });
+    if (it == end || it->hash != hash){
+        return nullptr;
+    }
+    return it;
+}
+
+const void* trb::asset::AssetPack::data(const TpakEntry* entry) const {
+    if (entry->flags != eTpakStored){
+        return nullptr;
+    }
+    return base + entry->offset;
+}
+
+bool trb::asset::AssetPack::decompressChunk(const TpakEntry* entry, uint32_t chunk, uint8_t* dst) const {
+    const TpakChunk& c = chunks[entry->firstChunk + chunk];
+    if (c.storedSize == c.size){
+        // did not compress, stored raw
+        memcpy(dst, base + c.offset, c.size);
+        return true;
+    }
+    return lz4::decompress(base + c.offset, c.storedSize, dst, c.size) == (int64_t)c.size;
+}
+
+bool trb::asset::AssetPack::read(const TpakEntry* entry, void* dst, core::JobSystem* jobs) const {
+    if (entry->flags == eTpakStored){
+        memcpy(dst, base + entry->offset, (size_t)entry->size);
+        return true;
+    }
+    // chunk i always decompresses to i * chunkSize, the first chunk holds the size of all but the last one
+    uint64_t chunkSize = chunks[entry->firstChunk].size;
+    uint8_t* out = (uint8_t*)dst;
+    if (!jobs || jobs->getWorkerCount() <= 1 || entry->chunkCount == 1){
+        for (uint32_t i = 0; i < entry->chunkCount; i++){
+            if (!decompressChunk(entry, i, out + i * chunkSize)){
+                return false;
+            }
+        }
+        return true;
+    }
+    std::atomic<bool> ok(true);
+    // chunks are far apart in dst, one per job is fine for false sharing
+    core::Job* root = jobs->parallelFor(entry->chunkCount, CACHE_LINE_SIZE, [this, entry, out, chunkSize, &ok](uint32_t begin, uint32_t end){
+        for (uint32_t i = begin; i < end; i++){
+            if (!decompressChunk(entry, i, out + i * chunkSize)){
+                ok = false;
+            }
+        }
+    });
+    jobs->wait(root);
+    return ok;
+}
+
+void trb::asset::AssetPackBuilder::begin(const std::string& output, uint32_t chunkSize){
+    filename = output;
+    this->chunkSize = chunkSize;
+    out.open(output, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()){
+        throw std::runtime_error("failed to create asset pack " + output);
+    }
+    // the header is written last, reserve its space
+    TpakHeader header;
+    memset(&header, 0, sizeof(header));
+    out.write((const char*)&header, sizeof(header));
+    offset = sizeof(header);
+    pending.clear();
+    chunks.clear();
+    rawBytes = 0;
+    storedBytes = 0;
+}
+
+void trb::asset::AssetPackBuilder::pad(){
+    static const char zeros[TPAK_PAYLOAD_ALIGNMENT] = {};
+    uint64_t aligned = (offset + TPAK_PAYLOAD_ALIGNMENT - 1) / TPAK_PAYLOAD_ALIGNMENT * TPAK_PAYLOAD_ALIGNMENT;
+    out.write(zeros, (std::streamsize)(aligned - offset));
+    offset = aligned;
+}
+
+bool trb::asset::AssetPackBuilder::add(const std::string& path, const void* data, size_t size, core::JobSystem* jobs){
+    uint64_t hash = hashPath(path);
+    for (auto& other : pending){
+        if (other.entry.hash == hash){
+            return false;
+        }
+    }
+    PendingEntry added;
+    added.path = path;
+    TpakEntry& entry = added.entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.hash = hash;
+    entry.size = size;
+    rawBytes += size;
+
+    pad();
+    entry.offset = offset;
+    if (size >= TPAK_COMPRESS_MIN_SIZE){
+        uint32_t chunkCount = (uint32_t)((size + chunkSize - 1) / chunkSize);
+        std::vector<std::vector<uint8_t> > compressed(chunkCount);
+        auto compressRange = [&](uint32_t begin, uint32_t end){
+            for (uint32_t i = begin; i < end; i++){
+                size_t chunkBytes = std::min((size_t)chunkSize, size - (size_t)i * chunkSize);
+                const uint8_t* src = (const uint8_t*)data + (size_t)i * chunkSize;
+                compressed[i].resize(lz4::compressBound(chunkBytes));
+                size_t packed = lz4::compress(src, chunkBytes, compressed[i].data(), compressed[i].size());
+                // keep chunks that do not shrink raw, the reader copies them
+                if (packed == 0 || packed >= chunkBytes){
+                    compressed[i].assign(src, src + chunkBytes);
+                }else{
+                    compressed[i].resize(packed);
+                }
+            }
+        };
+        if (jobs && jobs->getWorkerCount() > 1){
+            jobs->wait(jobs->parallelFor(chunkCount, CACHE_LINE_SIZE, compressRange));
+        }else{
+            compressRange(0, chunkCount);
+        }
+
+        uint64_t packedSize = 0;
+        for (auto& chunk : compressed){
+            packedSize += chunk.size();
+        }
+        // less than 1/8 saved is not worth losing zero copy access
+        if (packedSize < size - size / 8){
+            entry.flags = eTpakLz4;
+            entry.firstChunk = (uint32_t)chunks.size();
+            entry.chunkCount = chunkCount;
+            for (uint32_t i = 0; i < chunkCount; i++){
+                TpakChunk chunk;
+                chunk.offset = offset;
+                chunk.storedSize = (uint32_t)compressed[i].size();
+                chunk.size = (uint32_t)std::min((size_t)chunkSize, size - (size_t)i * chunkSize);
+                chunks.push_back(chunk);
+                out.write((const char*)compressed[i].data(), (std::streamsize)compressed[i].size());
+                offset += compressed[i].size();
+            }
+            entry.storedSize = packedSize;
+        }
+    }
+    if (entry.flags == eTpakStored){
+        out.write((const char*)data, (std::streamsize)size);
+        offset += size;
+        entry.storedSize = size;
+    }
+    storedBytes += entry.storedSize;
+    pending.push_back(added);
+    return (bool)out;
+}
+
+void trb::asset::AssetPackBuilder::finish(){
+    TpakHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TPAK_MAGIC;
+    header.version = TPAK_VERSION;
+    header.entryCount = (uint32_t)pending.size();
+    header.chunkCount = (uint32_t)chunks.size();
+
+    pad();
+    header.chunkTableOffset = offset;
+    out.write((const char*)chunks.data(), (std::streamsize)(chunks.size() * sizeof(TpakChunk)));
+    offset += chunks.size() * sizeof(TpakChunk);
+
+    std::sort(pending.begin(), pending.end(), [](const PendingEntry& a, const PendingEntry& b){
+        return a.entry.hash < b.entry.hash;
+    });
+    std::string pathTable;
+    for (auto& added : pending){
+        added.entry.pathOffset = (uint32_t)pathTable.size();
+        pathTable += added.path;
+        pathTable += '\0';
+    }
+    pad();
+    header.entryTableOffset = offset;
+    for (auto& added : pending){
+        out.write((const char*)&added.entry, sizeof(TpakEntry));
+    }
+    offset += pending.size() * sizeof(TpakEntry);
+    header.pathTableOffset = offset;
+    header.pathTableSize = pathTable.size();
+    out.write(pathTable.data(), (std::streamsize)pathTable.size());
+    offset += pathTable.size();
+
+    out.seekp(0);
+    out.write((const char*)&header, sizeof(header));
+    out.close();
+    if (!out){
+        throw std::runtime_error("failed to write asset pack " + filename);
+    }
+}
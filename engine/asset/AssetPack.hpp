@@ -0,0 +1,173 @@
+#ifndef TRB_ASSET_AssetPack_H_
+#define TRB_ASSET_AssetPack_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "../core/JobSystem.hpp"
+#include "MappedFile.hpp"
+
+#define TPAK_MAGIC 0x4B415054u // "TPAK"
+#define TPAK_VERSION 1
+// Payloads start on this boundary so mapped data can be handed to the GPU copy and cast to structs directly
+#define TPAK_PAYLOAD_ALIGNMENT 256
+// Uncompressed size of an independently compressed chunk
+#define TPAK_DEFAULT_CHUNK_SIZE (256 * 1024)
+// Smaller payloads are stored uncompressed and can be used straight from the mapping
+#define TPAK_COMPRESS_MIN_SIZE (64 * 1024)
+
+namespace trb{
+    namespace asset{
+
+        /**
+        * .tpak layout, little endian:
+        * header | payloads (aligned to TPAK_PAYLOAD_ALIGNMENT) | chunk table | entries sorted by hash | path strings
+        */
+        struct TpakHeader{
+            uint32_t magic;
+            uint32_t version;
+            uint32_t entryCount;
+            uint32_t chunkCount;
+            uint64_t chunkTableOffset;
+            uint64_t entryTableOffset;
+            uint64_t pathTableOffset;
+            uint64_t pathTableSize;
+        };
+
+        enum TpakEntryFlags{
+            eTpakStored = 0,
+            eTpakLz4 = 1
+        };
+
+        struct TpakEntry{
+            /** @brief hashPath() of the path, the table is sorted by it */
+            uint64_t hash;
+            /** @brief Offset of the (first chunk of the) payload in the file */
+            uint64_t offset;
+            /** @brief Uncompressed size */
+            uint64_t size;
+            /** @brief Bytes the payload occupies in the file */
+            uint64_t storedSize;
+            uint32_t firstChunk;
+            uint32_t chunkCount;
+            uint32_t pathOffset;
+            uint32_t flags;
+        };
+
+        struct TpakChunk{
+            uint64_t offset;
+            uint32_t storedSize;
+            uint32_t size;
+        };
+
+        /** @brief FNV-1a of the path with '\\' turned into '/' and leading "./" dropped */
+        inline uint64_t hashPath(const std::string& path){
+            size_t start = 0;
+            while (path.compare(start, 2, "./") == 0){
+                start += 2;
+            }
+            uint64_t hash = 14695981039346656037ull;
+            for (size_t i = start; i < path.size(); i++){
+                char c = path[i] == '\\' ? '/' : path[i];
+                hash ^= (uint8_t)c;
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        /**
+        * @brief Read only, memory mapped .tpak archive
+        *
+        * Stored payloads are returned as pointers into the mapping, no copy is made. Compressed payloads are
+        * split into independent chunks that read() decompresses in parallel on the job system, straight into
+        * the destination (e.g. a staging ring through VulkanUploadManager's fill overloads).
+        */
+        class AssetPack{
+            private:
+                MappedFile file;
+                const uint8_t* base = nullptr;
+                size_t mappedSize = 0;
+                const TpakHeader* header = nullptr;
+                const TpakChunk* chunks = nullptr;
+                const TpakEntry* entries = nullptr;
+                const char* paths = nullptr;
+
+                /** @brief Every table, payload, chunk and path lies within the mapping */
+                bool validate() const;
+                bool decompressChunk(const TpakEntry* entry, uint32_t chunk, uint8_t* dst) const;
+
+            public:
+                AssetPack(){}
+                ~AssetPack(){
+                    close();
+                }
+
+                /** @brief Map an archive, throws on missing or corrupt files. Every entry is bounds checked once here */
+                void open(const std::string& path);
+                void close();
+                bool isOpen() const { return base != nullptr; }
+
+                /** @return Entry of the path, nullptr if the archive does not contain it */
+                const TpakEntry* find(const std::string& path) const;
+                uint32_t getEntryCount() const { return header ? header->entryCount : 0; }
+                const TpakEntry* getEntry(uint32_t index) const { return &entries[index]; }
+                const char* getPath(const TpakEntry* entry) const { return paths + entry->pathOffset; }
+                bool isCompressed(const TpakEntry* entry) const { return entry->flags == eTpakLz4; }
+
+                /** @brief Zero copy view of a stored payload, nullptr for compressed payloads (use read()) */
+                const void* data(const TpakEntry* entry) const;
+
+                /**
+                * Copy or decompress a payload
+                *
+                * @param entry Entry to read
+                * @param dst Receives entry->size bytes
+                * @param jobs (Optional) Job system the chunks are decompressed on, nullptr decompresses on the calling thread
+                *
+                * @return false if a chunk does not decompress
+                */
+                bool read(const TpakEntry* entry, void* dst, core::JobSystem* jobs = nullptr) const;
+        };
+
+        /**
+        * @brief Writes .tpak archives, payloads are streamed to disk as they are added
+        */
+        class AssetPackBuilder{
+            private:
+                struct PendingEntry{
+                    std::string path;
+                    TpakEntry entry;
+                };
+
+                std::ofstream out;
+                std::string filename;
+                uint32_t chunkSize = TPAK_DEFAULT_CHUNK_SIZE;
+                uint64_t offset = 0;
+                std::vector<PendingEntry> pending;
+                std::vector<TpakChunk> chunks;
+                uint64_t rawBytes = 0;
+                uint64_t storedBytes = 0;
+
+                void pad();
+
+            public:
+                /** @param chunkSize (Optional) Uncompressed size of the independently compressed chunks */
+                void begin(const std::string& output, uint32_t chunkSize = TPAK_DEFAULT_CHUNK_SIZE);
+                /**
+                * Append a payload. Large payloads are compressed chunk by chunk in parallel and stored raw if that does not pay off
+                *
+                * @return false on a duplicate path or hash collision
+                */
+                bool add(const std::string& path, const void* data, size_t size, core::JobSystem* jobs = nullptr);
+                /** @brief Write the tables and header, the archive is complete afterwards */
+                void finish();
+
+                uint64_t getRawBytes() const { return rawBytes; }
+                uint64_t getStoredBytes() const { return storedBytes; }
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef TRB_ASSET_Lz4_H_
+#define TRB_ASSET_Lz4_H_
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Hash table of the compressor, 2^LZ4_HASH_LOG entries
+#define LZ4_HASH_LOG 14
+#define LZ4_MIN_MATCH 4
+// The last match has to start this many bytes before the end of the block
+#define LZ4_MF_LIMIT 12
+// The last bytes of a block are always literals
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MAX_DISTANCE 65535
+
+namespace trb{
+    namespace asset{
+
+        /**
+        * @brief LZ4 block format codec
+        *
+        * Produces and reads plain LZ4 blocks (no frame header), so packs can be inspected with the reference tools.
+        * The compressor is the greedy single hash variant, which is what the fast levels of liblz4 do too.
+        */
+        namespace lz4{
+
+            /** @brief Worst case compressed size of size bytes */
+            inline size_t compressBound(size_t size){
+                return size + size / 255 + 16;
+            }
+
+            inline uint32_t read32(const uint8_t* p){
+                uint32_t value;
+                memcpy(&value, p, sizeof(value));
+                return value;
+            }
+
+            inline uint32_t hash(uint32_t sequence){
+                return (sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+            }
+
+            inline bool writeLength(size_t length, uint8_t** op, const uint8_t* end){
+                while (length >= 255){
+                    if (*op >= end){
+                        return false;
+                    }
+                    *(*op)++ = 255;
+                    length -= 255;
+                }
+                if (*op >= end){
+                    return false;
+                }
+                *(*op)++ = (uint8_t)length;
+                return true;
+            }
+
+            /** @brief Emit literals [anchor, anchor + literals) followed by a match, or just the literals if matchLength is 0 */
+            inline bool writeSequence(const uint8_t* anchor, size_t literals, size_t offset, size_t matchLength, uint8_t** op, const uint8_t* end){
+                uint8_t* token = (*op)++;
+                if (token >= end){
+                    return false;
+                }
+                *token = (uint8_t)((literals >= 15 ? 15 : literals) << 4);
+                if (literals >= 15 && !writeLength(literals - 15, op, end)){
+                    return false;
+                }
+                if ((size_t)(end - *op) < literals){
+                    return false;
+                }
+                if (literals > 0){
+                    memcpy(*op, anchor, literals);
+                }
+                *op += literals;
+                if (matchLength == 0){
+                    return true;
+                }
+                if (end - *op < 2){
+                    return false;
+                }
+                *(*op)++ = (uint8_t)(offset & 0xff);
+                *(*op)++ = (uint8_t)(offset >> 8);
+                size_t length = matchLength - LZ4_MIN_MATCH;
+                *token |= (uint8_t)(length >= 15 ? 15 : length);
+                if (length >= 15 && !writeLength(length - 15, op, end)){
+                    return false;
+                }
+                return true;
+            }
+
+            /**
+            * Compress one independent block
+            *
+            * @return Compressed size, 0 if dst is too small (use compressBound())
+            */
+            inline size_t compress(const void* src, size_t srcSize, void* dst, size_t dstCapacity){
+                const uint8_t* in = (const uint8_t*)src;
+                uint8_t* op = (uint8_t*)dst;
+                const uint8_t* end = op + dstCapacity;
+                const uint8_t* anchor = in;
+                if (srcSize > LZ4_MF_LIMIT){
+                    // positions + 1, 0 marks an empty slot
+                    std::vector<uint32_t> table((size_t)1 << LZ4_HASH_LOG, 0);
+                    size_t limit = srcSize - LZ4_MF_LIMIT;
+                    size_t matchLimit = srcSize - LZ4_LAST_LITERALS;
+                    size_t ip = 0;
+                    while (ip < limit){
+                        uint32_t sequence = read32(in + ip);
+                        uint32_t h = hash(sequence);
+                        size_t candidate = table[h];
+                        table[h] = (uint32_t)(ip + 1);
+                        if (candidate == 0 || ip - (candidate - 1) > LZ4_MAX_DISTANCE || read32(in + candidate - 1) != sequence){
+                            ip++;
+                            continue;
+                        }
+                        size_t ref = candidate - 1;
+                        size_t length = LZ4_MIN_MATCH;
+                        while (ip + length < matchLimit && in[ref + length] == in[ip + length]){
+                            length++;
+                        }
+                        if (!writeSequence(anchor, (size_t)(in + ip - anchor), ip - ref, length, &op, end)){
+                            return 0;
+                        }
+                        ip += length;
+                        anchor = in + ip;
+                    }
+                }
+                if (!writeSequence(anchor, (size_t)(in + srcSize - anchor), 0, 0, &op, end)){
+                    return 0;
+                }
+                return (size_t)(op - (uint8_t*)dst);
+            }
+
+            /**
+            * Decompress one block, never reads or writes out of bounds on corrupt input
+            *
+            * @return Decompressed size, -1 on corrupt input or if dst is too small
+            */
+            inline int64_t decompress(const void* src, size_t srcSize, void* dst, size_t dstCapacity){
+                const uint8_t* ip = (const uint8_t*)src;
+                const uint8_t* inEnd = ip + srcSize;
+                uint8_t* op = (uint8_t*)dst;
+                uint8_t* outEnd = op + dstCapacity;
+                while (ip < inEnd){
+                    uint8_t token = *ip++;
+                    size_t literals = token >> 4;
+                    if (literals == 15){
+                        uint8_t byte;
+                        do{
+                            if (ip >= inEnd){
+                                return -1;
+                            }
+                            byte = *ip++;
+                            literals += byte;
+                        }while (byte == 255);
+                    }
+                    if ((size_t)(inEnd - ip) < literals || (size_t)(outEnd - op) < literals){
+                        return -1;
+                    }
+                    memcpy(op, ip, literals);
+                    ip += literals;
+                    op += literals;
+                    if (ip == inEnd){
+                        // the last sequence has no match
+                        break;
+                    }
+                    if (inEnd - ip < 2){
+                        return -1;
+                    }
+                    size_t offset = ip[0] | ((size_t)ip[1] << 8);
+                    ip += 2;
+                    if (offset == 0 || offset > (size_t)(op - (uint8_t*)dst)){
+                        return -1;
+                    }
+                    size_t length = token & 15;
+                    if (length == 15){
+                        uint8_t byte;
+                        do{
+                            if (ip >= inEnd){
+                                return -1;
+                            }
+                            byte = *ip++;
+                            length += byte;
+                        }while (byte == 255);
+                    }
+                    length += LZ4_MIN_MATCH;
+                    if ((size_t)(outEnd - op) < length){
+                        return -1;
+                    }
+                    const uint8_t* match = op - offset;
+                    if (offset >= length){
+                        memcpy(op, match, length);
+                        op += length;
+                    }else{
+                        // overlapping copy repeats the last offset bytes
+                        for (size_t i = 0; i < length; i++){
+                            *op++ = match[i];
+                        }
+                    }
+                }
+                return (int64_t)(op - (uint8_t*)dst);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include "MappedFile.hpp"
+
+#include <stdexcept>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+void trb::asset::MappedFile::open(const std::string& path){
+    close();
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (file == INVALID_HANDLE_VALUE){
+        throw std::runtime_error("failed to open file " + path);
+    }
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    base = mapping ? (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    fileHandle = file;
+    mappingHandle = mapping;
+    size = (size_t)fileSize.QuadPart;
+#else
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0){
+        throw std::runtime_error("failed to open file " + path);
+    }
+    struct stat st;
+    fstat(fd, &st);
+    size = (size_t)st.st_size;
+    void* mapping = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    base = mapping == MAP_FAILED ? nullptr : (const uint8_t*)mapping;
+#endif
+    if (!base){
+        close();
+        throw std::runtime_error("failed to map file " + path);
+    }
+#if !defined(_WIN32)
+    madvise((void*)base, size, MADV_WILLNEED);
+#endif
+}
+
+void trb::asset::MappedFile::close(){
+#if defined(_WIN32)
+    if (base){
+        UnmapViewOfFile(base);
+    }
+    if (mappingHandle){
+        CloseHandle((HANDLE)mappingHandle);
+    }
+    if (fileHandle){
+        CloseHandle((HANDLE)fileHandle);
+    }
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+#else
+    if (base){
+        munmap((void*)base, size);
+    }
+    if (fd >= 0){
+        ::close(fd);
+    }
+    fd = -1;
+#endif
+    base = nullptr;
+    size = 0;
+}
@@ -0,0 +1,47 @@
+#ifndef TRB_ASSET_MappedFile_H_
+#define TRB_ASSET_MappedFile_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace trb{
+    namespace asset{
+
+        /**
+        * @brief Read only memory mapping of a whole file
+        *
+        * Cooked assets are laid out the way they are consumed, so a mapping is all a loader needs: the pages are
+        * faulted in on first touch and shared with the page cache, nothing is copied into process memory.
+        */
+        class MappedFile{
+            private:
+                const uint8_t* base = nullptr;
+                size_t size = 0;
+#if defined(_WIN32)
+                void* fileHandle = nullptr;
+                void* mappingHandle = nullptr;
+#else
+                int fd = -1;
+#endif
+
+            public:
+                MappedFile(){}
+                ~MappedFile(){
+                    close();
+                }
+                MappedFile(const MappedFile&) = delete;
+                MappedFile& operator=(const MappedFile&) = delete;
+
+                /** @brief Map path, throws if it can not be opened or mapped */
+                void open(const std::string& path);
+                void close();
+                bool isOpen() const { return base != nullptr; }
+
+                const uint8_t* data() const { return base; }
+                size_t getSize() const { return size; }
+        };
+    }
+}
+
+#endif
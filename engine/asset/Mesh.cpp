@@ -0,0 +1,184 @@
+#include "Mesh.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cfloat>
+
+void trb::asset::MeshView::parse(const void* data, size_t size){
+    const uint8_t* bytes = (const uint8_t*)data;
+    const TmeshHeader* h = (const TmeshHeader*)bytes;
+    if (size < sizeof(TmeshHeader) || h->magic != TMESH_MAGIC || h->version != TMESH_VERSION){
+        throw std::runtime_error("not a .tmesh file");
+    }
+    uint64_t tables = sizeof(TmeshHeader) + (uint64_t)h->attributeCount * sizeof(TmeshAttribute)
+        + (uint64_t)h->streamCount * sizeof(TmeshStream) + (uint64_t)h->submeshCount * sizeof(TmeshSubmesh)
+        + (uint64_t)h->submeshCount * h->lodCount * sizeof(TmeshLod);
+    if (h->lodCount == 0 || (h->indexSize != 2 && h->indexSize != 4) || tables > h->dataOffset || h->dataOffset + h->dataSize > size ||
+        h->indexOffset < h->dataOffset || h->indexOffset + (uint64_t)h->indexCount * h->indexSize > h->dataOffset + h->dataSize){
+        throw std::runtime_error("corrupt .tmesh file");
+    }
+    const TmeshAttribute* a = (const TmeshAttribute*)(bytes + sizeof(TmeshHeader));
+    const TmeshStream* s = (const TmeshStream*)(a + h->attributeCount);
+    const TmeshSubmesh* m = (const TmeshSubmesh*)(s + h->streamCount);
+    const TmeshLod* l = (const TmeshLod*)(m + h->submeshCount);
+    for (uint32_t i = 0; i < h->streamCount; i++){
+        if (s[i].offset < h->dataOffset || s[i].offset + (uint64_t)s[i].stride * h->vertexCount > h->dataOffset + h->dataSize){
+            throw std::runtime_error("corrupt .tmesh stream");
+        }
+    }
+    for (uint32_t i = 0; i < h->attributeCount; i++){
+        if (a[i].stream >= h->streamCount){
+            throw std::runtime_error("corrupt .tmesh attribute");
+        }
+    }
+    for (uint32_t i = 0; i < h->submeshCount; i++){
+        if ((uint64_t)m[i].firstIndex + m[i].indexCount > h->indexCount){
+            throw std::runtime_error("corrupt .tmesh submesh");
+        }
+    }
+    for (uint64_t i = 0; i < (uint64_t)h->submeshCount * h->lodCount; i++){
+        if ((uint64_t)l[i].firstIndex + l[i].indexCount > h->indexCount){
+            throw std::runtime_error("corrupt .tmesh lod");
+        }
+    }
+    base = bytes;
+    header = h;
+    attributes = a;
+    streams = s;
+    submeshes = m;
+    lods = l;
+}
+
+const trb::asset::TmeshAttribute* trb::asset::MeshData::findAttribute(uint32_t semantic) const {
+    for (auto& attribute : attributes){
+        if (attribute.semantic == semantic){
+            return &attribute;
+        }
+    }
+    return nullptr;
+}
+
+void trb::asset::MeshData::computeBounds(){
+    const TmeshAttribute* position = findAttribute(eTmeshPosition);
+    if (!position || position->format != VK_FORMAT_R32G32B32_SFLOAT){
+        throw std::runtime_error("mesh bounds need a R32G32B32_SFLOAT position");
+    }
+    const Stream& stream = streams[position->stream];
+    auto grow = [&](float* lo, float* hi, uint32_t index){
+        float p[3];
+        memcpy(p, stream.data.data() + (size_t)index * stream.stride + position->offset, sizeof(p));
+        for (int c = 0; c < 3; c++){
+            lo[c] = std::min(lo[c], p[c]);
+            hi[c] = std::max(hi[c], p[c]);
+        }
+    };
+
+    for (int c = 0; c < 3; c++){
+        boundsMin[c] = vertexCount ? FLT_MAX : 0.0f;
+        boundsMax[c] = vertexCount ? -FLT_MAX : 0.0f;
+    }
+    for (uint32_t i = 0; i < vertexCount; i++){
+        grow(boundsMin, boundsMax, i);
+    }
+    for (auto& submesh : submeshes){
+        for (int c = 0; c < 3; c++){
+            submesh.boundsMin[c] = submesh.indexCount ? FLT_MAX : 0.0f;
+            submesh.boundsMax[c] = submesh.indexCount ? -FLT_MAX : 0.0f;
+        }
+        for (uint32_t i = 0; i < submesh.indexCount; i++){
+            grow(submesh.boundsMin, submesh.boundsMax, indices[submesh.firstIndex + i] + submesh.vertexOffset);
+        }
+    }
+}
+
+void trb::asset::MeshData::write(const std::string& path) const {
+    auto align = [](uint64_t value){
+        return (value + TMESH_DATA_ALIGNMENT - 1) / TMESH_DATA_ALIGNMENT * TMESH_DATA_ALIGNMENT;
+    };
+
+    uint32_t maxIndex = 0;
+    for (auto& submesh : submeshes){
+        for (uint32_t i = 0; i < submesh.indexCount; i++){
+            maxIndex = std::max(maxIndex, indices[submesh.firstIndex + i]);
+        }
+    }
+    if (submeshes.empty()){
+        for (uint32_t index : indices){
+            maxIndex = std::max(maxIndex, index);
+        }
+    }
+
+    std::vector<TmeshLod> lodTable = lods;
+    uint32_t levels = lodCount;
+    if (levels <= 1 || lodTable.size() != submeshes.size() * levels){
+        levels = 1;
+        lodTable.assign(submeshes.size(), TmeshLod());
+        for (size_t i = 0; i < submeshes.size(); i++){
+            lodTable[i].firstIndex = submeshes[i].firstIndex;
+            lodTable[i].indexCount = submeshes[i].indexCount;
+        }
+    }
+
+    TmeshHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TMESH_MAGIC;
+    header.version = TMESH_VERSION;
+    header.vertexCount = vertexCount;
+    header.indexCount = (uint32_t)indices.size();
+    // 0xffff is the primitive restart value, keep it free
+    header.indexSize = maxIndex < 0xffff ? 2 : 4;
+    header.attributeCount = (uint32_t)attributes.size();
+    header.streamCount = (uint32_t)streams.size();
+    header.submeshCount = (uint32_t)submeshes.size();
+    header.lodCount = levels;
+    memcpy(header.boundsMin, boundsMin, sizeof(boundsMin));
+    memcpy(header.boundsMax, boundsMax, sizeof(boundsMax));
+
+    uint64_t offset = align(sizeof(TmeshHeader) + attributes.size() * sizeof(TmeshAttribute)
+        + streams.size() * sizeof(TmeshStream) + submeshes.size() * sizeof(TmeshSubmesh) + lodTable.size() * sizeof(TmeshLod));
+    header.dataOffset = offset;
+    std::vector<TmeshStream> streamTable(streams.size());
+    for (size_t i = 0; i < streams.size(); i++){
+        if (streams[i].data.size() != (size_t)streams[i].stride * vertexCount){
+            throw std::runtime_error("mesh stream size does not match the vertex count");
+        }
+        streamTable[i].offset = offset;
+        streamTable[i].stride = streams[i].stride;
+        streamTable[i].reserved = 0;
+        offset = align(offset + streams[i].data.size());
+    }
+    header.indexOffset = offset;
+    header.dataSize = offset + (uint64_t)indices.size() * header.indexSize - header.dataOffset;
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()){
+        throw std::runtime_error("failed to create mesh " + path);
+    }
+    static const char zeros[TMESH_DATA_ALIGNMENT] = {};
+    auto pad = [&](){
+        uint64_t position = (uint64_t)out.tellp();
+        out.write(zeros, (std::streamsize)(align(position) - position));
+    };
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)attributes.data(), (std::streamsize)(attributes.size() * sizeof(TmeshAttribute)));
+    out.write((const char*)streamTable.data(), (std::streamsize)(streamTable.size() * sizeof(TmeshStream)));
+    out.write((const char*)submeshes.data(), (std::streamsize)(submeshes.size() * sizeof(TmeshSubmesh)));
+    out.write((const char*)lodTable.data(), (std::streamsize)(lodTable.size() * sizeof(TmeshLod)));
+    pad();
+    for (auto& stream : streams){
+        out.write((const char*)stream.data.data(), (std::streamsize)stream.data.size());
+        pad();
+    }
+    if (header.indexSize == 2){
+        std::vector<uint16_t> narrow(indices.begin(), indices.end());
+        out.write((const char*)narrow.data(), (std::streamsize)(narrow.size() * sizeof(uint16_t)));
+    }else{
+        out.write((const char*)indices.data(), (std::streamsize)(indices.size() * sizeof(uint32_t)));
+    }
+    out.close();
+    if (!out){
+        throw std::runtime_error("failed to write mesh " + path);
+    }
+}
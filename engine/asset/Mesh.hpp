@@ -0,0 +1,224 @@
+#ifndef TRB_ASSET_Mesh_H_
+#define TRB_ASSET_Mesh_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+#include "MappedFile.hpp"
+
+#define TMESH_MAGIC 0x48534D54u // "TMSH"
+#define TMESH_VERSION 2
+// Vertex streams and the index data start on this boundary, covers every vertex format and index type
+#define TMESH_DATA_ALIGNMENT 16
+
+namespace trb{
+    namespace asset{
+
+        /**
+        * @brief Vertex attribute semantics, the value is also the shader input location
+        */
+        enum TmeshSemantic{
+            eTmeshPosition = 0,
+            eTmeshNormal = 1,
+            eTmeshTangent = 2,
+            eTmeshUv0 = 3,
+            eTmeshUv1 = 4,
+            eTmeshColor = 5
+        };
+
+        /**
+        * .tmesh layout, little endian:
+        * header | attributes | streams | submeshes | lods | vertex streams and indices (the data block)
+        *
+        * The lod table holds lodCount entries per submesh, entry [submesh * lodCount + lod]. Level 0 is the submesh
+        * itself, coarser levels reuse its vertices and only bring their own index ranges.
+        *
+        * The data block is exactly what ends up in the GPU buffer: one copy of [dataOffset, dataOffset + dataSize)
+        * and the streams and indices are bound at their offsets relative to dataOffset.
+        */
+        struct TmeshHeader{
+            uint32_t magic;
+            uint32_t version;
+            uint32_t vertexCount;
+            uint32_t indexCount;
+            /** @brief 2 or 4 bytes */
+            uint32_t indexSize;
+            uint32_t attributeCount;
+            uint32_t streamCount;
+            uint32_t submeshCount;
+            /** @brief Levels of detail per submesh, at least 1 */
+            uint32_t lodCount;
+            uint32_t reserved;
+            float boundsMin[3];
+            float boundsMax[3];
+            uint64_t dataOffset;
+            uint64_t dataSize;
+            /** @brief Offset of the indices in the file */
+            uint64_t indexOffset;
+        };
+
+        struct TmeshAttribute{
+            /** @brief TmeshSemantic */
+            uint32_t semantic;
+            /** @brief VkFormat of the attribute */
+            uint32_t format;
+            uint32_t stream;
+            /** @brief Offset inside a vertex of the stream */
+            uint32_t offset;
+        };
+
+        struct TmeshStream{
+            /** @brief Offset of the stream in the file */
+            uint64_t offset;
+            uint32_t stride;
+            uint32_t reserved;
+        };
+
+        struct TmeshSubmesh{
+            uint32_t firstIndex;
+            uint32_t indexCount;
+            int32_t vertexOffset;
+            uint32_t material;
+            float boundsMin[3];
+            float boundsMax[3];
+        };
+
+        struct TmeshLod{
+            /** @brief Index range of the level, relative to the same vertexOffset as its submesh */
+            uint32_t firstIndex;
+            uint32_t indexCount;
+            /** @brief Largest distance in mesh units of an original vertex from the simplified surface, 0 for level 0 */
+            float error;
+            uint32_t reserved;
+        };
+
+        /** @brief Size in bytes of the vertex formats the cooker emits, 0 for anything else */
+        inline uint32_t formatSize(uint32_t format){
+            switch (format){
+                case VK_FORMAT_R8G8B8A8_UNORM:
+                case VK_FORMAT_R8G8B8A8_SNORM:
+                case VK_FORMAT_A2B10G10R10_SNORM_PACK32:
+                case VK_FORMAT_R16G16_SFLOAT:
+                case VK_FORMAT_R16G16_UNORM:
+                case VK_FORMAT_R32_SFLOAT:
+                    return 4;
+                case VK_FORMAT_R16G16B16A16_SFLOAT:
+                case VK_FORMAT_R16G16B16A16_SNORM:
+                case VK_FORMAT_R32G32_SFLOAT:
+                    return 8;
+                case VK_FORMAT_R32G32B32_SFLOAT:
+                    return 12;
+                case VK_FORMAT_R32G32B32A32_SFLOAT:
+                    return 16;
+                default:
+                    return 0;
+            }
+        }
+
+        /**
+        * @brief Validated view of a .tmesh in memory, e.g. a MappedFile or a stored AssetPack entry
+        *
+        * Nothing is copied or converted, the view only points into the memory it was parsed from.
+        */
+        class MeshView{
+            private:
+                const uint8_t* base = nullptr;
+                const TmeshHeader* header = nullptr;
+                const TmeshAttribute* attributes = nullptr;
+                const TmeshStream* streams = nullptr;
+                const TmeshSubmesh* submeshes = nullptr;
+                const TmeshLod* lods = nullptr;
+
+            public:
+                /** @brief Point the view at a .tmesh, throws if the data is not a valid mesh */
+                void parse(const void* data, size_t size);
+                bool isValid() const { return header != nullptr; }
+
+                const TmeshHeader& getHeader() const { return *header; }
+                uint32_t getVertexCount() const { return header->vertexCount; }
+                uint32_t getIndexCount() const { return header->indexCount; }
+                uint32_t getIndexSize() const { return header->indexSize; }
+
+                uint32_t getAttributeCount() const { return header->attributeCount; }
+                const TmeshAttribute& getAttribute(uint32_t index) const { return attributes[index]; }
+                uint32_t getStreamCount() const { return header->streamCount; }
+                const TmeshStream& getStream(uint32_t index) const { return streams[index]; }
+                uint32_t getSubmeshCount() const { return header->submeshCount; }
+                const TmeshSubmesh& getSubmesh(uint32_t index) const { return submeshes[index]; }
+                uint32_t getLodCount() const { return header->lodCount; }
+                const TmeshLod& getLod(uint32_t submesh, uint32_t lod) const { return lods[submesh * header->lodCount + lod]; }
+
+                /** @brief Vertex streams and indices, copy this block to the GPU as is */
+                const void* getData() const { return base + header->dataOffset; }
+                uint64_t getDataSize() const { return header->dataSize; }
+                /** @brief Offset of a stream inside the data block */
+                uint64_t getStreamOffset(uint32_t index) const { return streams[index].offset - header->dataOffset; }
+                /** @brief Offset of the indices inside the data block */
+                uint64_t getIndexOffset() const { return header->indexOffset - header->dataOffset; }
+                const void* getIndices() const { return base + header->indexOffset; }
+        };
+
+        /**
+        * @brief A .tmesh mapped from disk
+        */
+        class MeshFile{
+            private:
+                MappedFile file;
+                MeshView view;
+
+            public:
+                /** @brief Map and validate path, throws on missing or corrupt files */
+                void open(const std::string& path){
+                    file.open(path);
+                    try{
+                        view.parse(file.data(), file.getSize());
+                    }catch (...){
+                        file.close();
+                        throw;
+                    }
+                }
+                void close(){
+                    file.close();
+                    view = MeshView();
+                }
+                const MeshView& getView() const { return view; }
+        };
+
+        /**
+        * @brief Editable mesh the cooker fills and writes out as .tmesh
+        */
+        struct MeshData{
+            struct Stream{
+                uint32_t stride = 0;
+                std::vector<uint8_t> data;
+            };
+
+            uint32_t vertexCount = 0;
+            std::vector<TmeshAttribute> attributes;
+            std::vector<Stream> streams;
+            std::vector<uint32_t> indices;
+            std::vector<TmeshSubmesh> submeshes;
+            /** @brief Levels of detail per submesh, 0 or 1 means the submeshes only */
+            uint32_t lodCount = 0;
+            /** @brief lodCount entries per submesh, level 0 included. Filled by generateLods() */
+            std::vector<TmeshLod> lods;
+            float boundsMin[3] = { 0.0f, 0.0f, 0.0f };
+            float boundsMax[3] = { 0.0f, 0.0f, 0.0f };
+
+            /** @brief Attribute with the semantic, nullptr if the mesh does not have it */
+            const TmeshAttribute* findAttribute(uint32_t semantic) const;
+            /** @brief Recompute the mesh and submesh bounds, the position attribute has to be R32G32B32_SFLOAT */
+            void computeBounds();
+            /**
+            * @brief Write the mesh, indices are stored as 16 bit when every vertex can be addressed that way. Throws on IO errors
+            *
+            * Without lods a single level mirroring the submeshes is written.
+            */
+            void write(const std::string& path) const;
+        };
+    }
+}
+
+#endif
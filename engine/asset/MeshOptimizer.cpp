@@ -0,0 +1,345 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+#include <string>
+#include <cstring>
+#include <cmath>
+
+trb::asset::VertexCacheStats trb::asset::analyzeVertexCache(const uint32_t* indices, size_t count, uint32_t cacheSize){
+    VertexCacheStats stats;
+    stats.triangles = count / 3;
+    uint32_t maxIndex = 0;
+    for (size_t i = 0; i < count; i++){
+        maxIndex = std::max(maxIndex, indices[i]);
+    }
+    // miss counter after the vertex entered the cache, FIFO means it is evicted cacheSize misses later
+    std::vector<uint64_t> inserted(count ? (size_t)maxIndex + 1 : 0, 0);
+    std::vector<bool> seen(inserted.size(), false);
+    for (size_t i = 0; i < count; i++){
+        uint32_t v = indices[i];
+        if (!seen[v]){
+            seen[v] = true;
+            stats.vertices++;
+        }else if (stats.misses - inserted[v] < cacheSize){
+            continue;
+        }
+        inserted[v] = ++stats.misses;
+    }
+    return stats;
+}
+
+void trb::asset::optimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize, std::vector<uint32_t>* clusters){
+    size_t triangleCount = indices.size() / 3;
+    if (clusters){
+        clusters->clear();
+    }
+    if (triangleCount == 0){
+        return;
+    }
+
+    // triangles around every vertex, packed
+    std::vector<uint32_t> live(vertexCount, 0);
+    for (uint32_t v : indices){
+        live[v]++;
+    }
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (uint32_t v = 0; v < vertexCount; v++){
+        offsets[v + 1] = offsets[v] + live[v];
+    }
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++){
+        adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+    }
+
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnds;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    uint32_t time = cacheSize + 1;
+    uint32_t cursor = 0;
+
+    int64_t fanning = indices[0];
+    if (clusters){
+        clusters->push_back(0);
+    }
+    while (fanning >= 0){
+        // emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (uint32_t a = offsets[fanning]; a < offsets[fanning + 1]; a++){
+            uint32_t t = adjacency[a];
+            if (emitted[t]){
+                continue;
+            }
+            emitted[t] = true;
+            for (int k = 0; k < 3; k++){
+                uint32_t v = indices[t * 3 + k];
+                output.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cacheTime[v] > cacheSize){
+                    cacheTime[v] = time++;
+                }
+            }
+        }
+
+        // next fanning vertex: the one with live triangles that will still be in the cache after fanning it, oldest first
+        int64_t next = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t v : candidates){
+            if (live[v] == 0){
+                continue;
+            }
+            int64_t priority = 0;
+            if (time - cacheTime[v] + 2 * live[v] <= cacheSize){
+                priority = time - cacheTime[v];
+            }
+            if (priority > bestPriority){
+                bestPriority = priority;
+                next = v;
+            }
+        }
+        if (next < 0){
+            // dead end, back up to a recently used vertex, then scan for any vertex with work left
+            while (!deadEnds.empty() && next < 0){
+                uint32_t v = deadEnds.back();
+                deadEnds.pop_back();
+                if (live[v] > 0){
+                    next = v;
+                }
+            }
+            while (next < 0 && cursor < vertexCount){
+                if (live[cursor] > 0){
+                    next = cursor;
+                }
+                cursor++;
+            }
+            if (next >= 0 && clusters){
+                clusters->push_back((uint32_t)(output.size() / 3));
+            }
+        }
+        fanning = next;
+    }
+    indices.swap(output);
+}
+
+uint32_t trb::asset::optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<float>& positions, const std::vector<uint32_t>& clusters,
+                                      float threshold, uint32_t cacheSize){
+    uint32_t triangleCount = (uint32_t)(indices.size() / 3);
+    if (triangleCount == 0 || clusters.empty()){
+        return 0;
+    }
+
+    // soft boundaries: split a hard cluster wherever the prefix is already as cache friendly as the whole cluster
+    std::vector<uint32_t> boundaries;
+    std::vector<uint64_t> inserted(positions.size() / 3, 0);
+    uint64_t misses = 0;
+    for (size_t c = 0; c < clusters.size(); c++){
+        uint32_t start = clusters[c];
+        uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+        float limit = analyzeVertexCache(indices.data() + start * 3, (end - start) * 3, cacheSize).acmr() * threshold;
+        boundaries.push_back(start);
+        // advancing the counter past the cache size empties the simulated cache
+        misses += cacheSize + 1;
+        uint64_t clusterMisses = 0;
+        uint32_t clusterStart = start;
+        for (uint32_t t = start; t < end; t++){
+            for (int k = 0; k < 3; k++){
+                uint32_t v = indices[t * 3 + k];
+                if (misses - inserted[v] >= cacheSize){
+                    inserted[v] = ++misses;
+                    clusterMisses++;
+                }
+            }
+            if (t + 1 < end && clusterMisses <= limit * (t + 1 - clusterStart)){
+                boundaries.push_back(t + 1);
+                misses += cacheSize + 1;
+                clusterMisses = 0;
+                clusterStart = t + 1;
+            }
+        }
+    }
+    boundaries.push_back(triangleCount);
+
+    auto position = [&](uint32_t v, int axis){
+        return positions[v * 3 + axis];
+    };
+    float meshCentroid[3] = { 0.0f, 0.0f, 0.0f };
+    for (uint32_t v : indices){
+        for (int axis = 0; axis < 3; axis++){
+            meshCentroid[axis] += position(v, axis);
+        }
+    }
+    for (int axis = 0; axis < 3; axis++){
+        meshCentroid[axis] /= (float)indices.size();
+    }
+
+    struct Cluster{
+        uint32_t start;
+        uint32_t end;
+        float sortKey;
+    };
+    std::vector<Cluster> sorted;
+    for (size_t b = 0; b + 1 < boundaries.size(); b++){
+        Cluster cluster;
+        cluster.start = boundaries[b];
+        cluster.end = boundaries[b + 1];
+        float centroid[3] = { 0.0f, 0.0f, 0.0f };
+        float normal[3] = { 0.0f, 0.0f, 0.0f };
+        float area = 0.0f;
+        for (uint32_t t = cluster.start; t < cluster.end; t++){
+            uint32_t a = indices[t * 3], b1 = indices[t * 3 + 1], c = indices[t * 3 + 2];
+            float e0[3], e1[3], n[3];
+            for (int axis = 0; axis < 3; axis++){
+                e0[axis] = position(b1, axis) - position(a, axis);
+                e1[axis] = position(c, axis) - position(a, axis);
+            }
+            n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+            n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+            n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+            // |n| is twice the area, area weights both the centroid and the normal
+            float w = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int axis = 0; axis < 3; axis++){
+                centroid[axis] += w * (position(a, axis) + position(b1, axis) + position(c, axis)) / 3.0f;
+                normal[axis] += n[axis];
+            }
+            area += w;
+        }
+        float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        cluster.sortKey = 0.0f;
+        if (area > 0.0f && length > 0.0f){
+            for (int axis = 0; axis < 3; axis++){
+                cluster.sortKey += (centroid[axis] / area - meshCentroid[axis]) * normal[axis] / length;
+            }
+        }
+        sorted.push_back(cluster);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b){
+        return a.sortKey > b.sortKey;
+    });
+
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    for (auto& cluster : sorted){
+        output.insert(output.end(), indices.begin() + cluster.start * 3, indices.begin() + cluster.end * 3);
+    }
+    indices.swap(output);
+    return (uint32_t)sorted.size();
+}
+
+trb::asset::MeshOptimizerStats trb::asset::optimizeMesh(MeshData* mesh, float overdrawThreshold, uint32_t cacheSize){
+    MeshOptimizerStats stats;
+    stats.verticesBefore = mesh->vertexCount;
+
+    const TmeshAttribute* position = mesh->findAttribute(eTmeshPosition);
+    if (position && position->format != VK_FORMAT_R32G32B32_SFLOAT){
+        position = nullptr;
+    }
+    std::vector<TmeshSubmesh> submeshes = mesh->submeshes;
+    if (submeshes.empty()){
+        TmeshSubmesh whole;
+        memset(&whole, 0, sizeof(whole));
+        whole.indexCount = (uint32_t)mesh->indices.size();
+        submeshes.push_back(whole);
+    }
+
+    std::vector<MeshData::Stream> streams(mesh->streams.size());
+    uint32_t vertexStride = 0;
+    for (size_t s = 0; s < streams.size(); s++){
+        streams[s].stride = mesh->streams[s].stride;
+        vertexStride += streams[s].stride;
+    }
+    uint32_t vertexCount = 0;
+
+    for (auto& submesh : submeshes){
+        uint32_t* range = mesh->indices.data() + submesh.firstIndex;
+        if (submesh.indexCount == 0){
+            submesh.vertexOffset = (int32_t)vertexCount;
+            continue;
+        }
+        VertexCacheStats before = analyzeVertexCache(range, submesh.indexCount, cacheSize);
+        stats.before.triangles += before.triangles;
+        stats.before.vertices += before.vertices;
+        stats.before.misses += before.misses;
+
+        // work on the vertex range the submesh references
+        uint32_t base = UINT32_MAX, last = 0;
+        for (uint32_t i = 0; i < submesh.indexCount; i++){
+            base = std::min(base, range[i]);
+            last = std::max(last, range[i]);
+        }
+        uint32_t localCount = last - base + 1;
+        std::vector<uint32_t> local(range, range + submesh.indexCount);
+        for (auto& index : local){
+            index -= base;
+        }
+        base += submesh.vertexOffset;
+
+        // 1. merge bit identical vertices
+        std::vector<uint32_t> remap(localCount);
+        std::unordered_map<std::string, uint32_t> unique;
+        std::string key(vertexStride, '\0');
+        for (uint32_t v = 0; v < localCount; v++){
+            size_t offset = 0;
+            for (auto& stream : mesh->streams){
+                memcpy(&key[offset], stream.data.data() + (size_t)(base + v) * stream.stride, stream.stride);
+                offset += stream.stride;
+            }
+            remap[v] = unique.insert(std::make_pair(key, v)).first->second;
+        }
+        for (auto& index : local){
+            index = remap[index];
+        }
+
+        // 2. + 3. triangle order
+        std::vector<uint32_t> clusters;
+        optimizeVertexCache(local, localCount, cacheSize, &clusters);
+        if (position){
+            std::vector<float> positions((size_t)localCount * 3);
+            const MeshData::Stream& stream = mesh->streams[position->stream];
+            for (uint32_t v = 0; v < localCount; v++){
+                memcpy(&positions[v * 3], stream.data.data() + (size_t)(base + v) * stream.stride + position->offset, 3 * sizeof(float));
+            }
+            stats.clusters += optimizeOverdraw(local, positions, clusters, overdrawThreshold, cacheSize);
+        }else{
+            stats.clusters += (uint32_t)clusters.size();
+        }
+
+        // 4. vertices in first use order
+        std::vector<uint32_t> fetchOrder(localCount, UINT32_MAX);
+        uint32_t used = 0;
+        for (auto& index : local){
+            if (fetchOrder[index] == UINT32_MAX){
+                fetchOrder[index] = used++;
+                for (size_t s = 0; s < streams.size(); s++){
+                    const uint8_t* vertex = mesh->streams[s].data.data() + (size_t)(base + index) * streams[s].stride;
+                    streams[s].data.insert(streams[s].data.end(), vertex, vertex + streams[s].stride);
+                }
+            }
+            index = fetchOrder[index];
+        }
+        memcpy(range, local.data(), local.size() * sizeof(uint32_t));
+        submesh.vertexOffset = (int32_t)vertexCount;
+        vertexCount += used;
+
+        VertexCacheStats after = analyzeVertexCache(range, submesh.indexCount, cacheSize);
+        stats.after.triangles += after.triangles;
+        stats.after.vertices += after.vertices;
+        stats.after.misses += after.misses;
+    }
+
+    mesh->streams.swap(streams);
+    mesh->vertexCount = vertexCount;
+    if (!mesh->submeshes.empty()){
+        mesh->submeshes = submeshes;
+    }
+    // levels of detail point at the old vertex order, generate them after optimizing
+    mesh->lodCount = 0;
+    mesh->lods.clear();
+    stats.verticesAfter = vertexCount;
+    return stats;
+}
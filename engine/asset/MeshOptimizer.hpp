@@ -0,0 +1,92 @@
+#ifndef TRB_ASSET_MeshOptimizer_H_
+#define TRB_ASSET_MeshOptimizer_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "Mesh.hpp"
+
+// FIFO post transform cache the reordering targets and the statistics simulate. Mobile GPUs keep roughly
+// this many transformed vertices around, a smaller target costs little on GPUs with bigger caches
+#define MESH_VERTEX_CACHE_SIZE 16
+// Overdraw clusters may be this much worse than the cache optimal order in ACMR
+#define MESH_OVERDRAW_THRESHOLD 1.05f
+
+namespace trb{
+    namespace asset{
+
+        /**
+        * @brief Post transform cache efficiency of an index buffer
+        *
+        * ACMR (average cache miss ratio) is transformed vertices per triangle: 3 is the worst case, ~0.5 the best
+        * a regular grid can get. ATVR (average transform to vertex ratio) is transformed vertices per unique vertex,
+        * 1 means every vertex is shaded exactly once.
+        */
+        struct VertexCacheStats{
+            uint64_t triangles = 0;
+            uint64_t vertices = 0;
+            uint64_t misses = 0;
+
+            float acmr() const { return triangles ? (float)misses / triangles : 0.0f; }
+            float atvr() const { return vertices ? (float)misses / vertices : 0.0f; }
+        };
+
+        struct MeshOptimizerStats{
+            VertexCacheStats before;
+            VertexCacheStats after;
+            uint32_t verticesBefore = 0;
+            uint32_t verticesAfter = 0;
+            /** @brief Tipsify dead ends plus overdraw soft boundaries, summed over submeshes */
+            uint32_t clusters = 0;
+        };
+
+        /**
+        * Simulate a FIFO post transform cache over a triangle list
+        *
+        * @param indices Triangle list
+        * @param count Number of indices
+        * @param cacheSize (Optional) Cache entries
+        */
+        VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t count, uint32_t cacheSize = MESH_VERTEX_CACHE_SIZE);
+
+        /**
+        * Tipsify (Sander et al. 2007), reorders triangles for the post transform cache in linear time
+        *
+        * @param indices Triangle list with indices below vertexCount, reordered in place
+        * @param vertexCount Number of vertices the list references
+        * @param cacheSize Cache entries to optimize for
+        * @param clusters (Optional) Receives the first triangle of every cluster, a new one starts at each dead end
+        */
+        void optimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize = MESH_VERTEX_CACHE_SIZE,
+                                 std::vector<uint32_t>* clusters = nullptr);
+
+        /**
+        * Reorder the clusters of a cache optimized triangle list so outward facing, outer clusters draw first
+        *
+        * Clusters are split further where that keeps the ACMR within threshold of the input (soft boundaries),
+        * then sorted by the view independent occlusion potential dot(centroid - mesh centroid, cluster normal).
+        *
+        * @param indices Output of optimizeVertexCache(), reordered in place
+        * @param positions xyz per vertex
+        * @param clusters Hard cluster starts from optimizeVertexCache()
+        *
+        * @return Number of clusters after splitting
+        */
+        uint32_t optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<float>& positions, const std::vector<uint32_t>& clusters,
+                                  float threshold = MESH_OVERDRAW_THRESHOLD, uint32_t cacheSize = MESH_VERTEX_CACHE_SIZE);
+
+        /**
+        * Run the full optimization on every submesh of a mesh
+        *
+        * 1. merge vertices whose attributes are bit identical
+        * 2. reorder triangles for the post transform cache (Tipsify)
+        * 3. reorder the resulting clusters against overdraw (needs an R32G32B32_SFLOAT position, skipped otherwise)
+        * 4. reorder vertices into first use order so fetches stream through memory, unreferenced vertices are dropped
+        *
+        * Submeshes keep their index ranges, each gets its own contiguous vertex range.
+        */
+        MeshOptimizerStats optimizeMesh(MeshData* mesh, float overdrawThreshold = MESH_OVERDRAW_THRESHOLD, uint32_t cacheSize = MESH_VERTEX_CACHE_SIZE);
+    }
+}
+
+#endif
@@ -0,0 +1,367 @@
+#include "MeshSimplifier.hpp"
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+namespace{
+
+    /** @brief Sum of area weighted squared distances to a set of planes, as a symmetric 4x4 matrix */
+    struct Quadric{
+        double a00 = 0.0, a01 = 0.0, a02 = 0.0, a11 = 0.0, a12 = 0.0, a22 = 0.0;
+        double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+        double c = 0.0;
+        double weight = 0.0;
+
+        /** @brief Plane n.x + d = 0 with unit normal n */
+        void addPlane(double nx, double ny, double nz, double d, double w){
+            a00 += w * nx * nx; a01 += w * nx * ny; a02 += w * nx * nz;
+            a11 += w * ny * ny; a12 += w * ny * nz; a22 += w * nz * nz;
+            b0 += w * nx * d; b1 += w * ny * d; b2 += w * nz * d;
+            c += w * d * d;
+            weight += w;
+        }
+
+        void add(const Quadric& q){
+            a00 += q.a00; a01 += q.a01; a02 += q.a02;
+            a11 += q.a11; a12 += q.a12; a22 += q.a22;
+            b0 += q.b0; b1 += q.b1; b2 += q.b2;
+            c += q.c;
+            weight += q.weight;
+        }
+
+        double evaluate(const float* p) const {
+            double x = p[0], y = p[1], z = p[2];
+            return a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+                + 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+        }
+    };
+
+    struct Collapse{
+        uint32_t from;
+        uint32_t to;
+        /** @brief Mean squared distance to the planes of both vertices after the collapse */
+        double cost;
+    };
+
+    void triangleNormal(const float* a, const float* b, const float* c, double* n){
+        double e0[3] = { (double)b[0] - a[0], (double)b[1] - a[1], (double)b[2] - a[2] };
+        double e1[3] = { (double)c[0] - a[0], (double)c[1] - a[1], (double)c[2] - a[2] };
+        n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+        n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+        n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+    }
+
+    inline double dot(const double* a, const double* b){
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    /** @brief Distance from q to the closest point of triangle abc (Ericson, Real-Time Collision Detection 5.1.5) */
+    double pointTriangleDistance(const float* q, const float* a, const float* b, const float* c){
+        double ab[3], ac[3], ap[3];
+        for (int k = 0; k < 3; k++){
+            ab[k] = (double)b[k] - a[k];
+            ac[k] = (double)c[k] - a[k];
+            ap[k] = (double)q[k] - a[k];
+        }
+        double d1 = dot(ab, ap), d2 = dot(ac, ap);
+        double v = 0.0, w = 0.0;
+        if (d1 <= 0.0 && d2 <= 0.0){
+            // vertex a
+        } else{
+            double bp[3] = { (double)q[0] - b[0], (double)q[1] - b[1], (double)q[2] - b[2] };
+            double cp[3] = { (double)q[0] - c[0], (double)q[1] - c[1], (double)q[2] - c[2] };
+            double d3 = dot(ab, bp), d4 = dot(ac, bp), d5 = dot(ab, cp), d6 = dot(ac, cp);
+            double vc = d1 * d4 - d3 * d2, vb = d5 * d2 - d1 * d6, va = d3 * d6 - d5 * d4;
+            if (d3 >= 0.0 && d4 <= d3){
+                v = 1.0;
+            } else if (d6 >= 0.0 && d5 <= d6){
+                w = 1.0;
+            } else if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0){
+                v = d1 / (d1 - d3);
+            } else if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0){
+                w = d2 / (d2 - d6);
+            } else if (va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0){
+                w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+                v = 1.0 - w;
+            } else{
+                double denom = va + vb + vc;
+                v = denom > 0.0 ? vb / denom : 0.0;
+                w = denom > 0.0 ? vc / denom : 0.0;
+            }
+        }
+        double distance = 0.0;
+        for (int k = 0; k < 3; k++){
+            double delta = ap[k] - ab[k] * v - ac[k] * w;
+            distance += delta * delta;
+        }
+        return std::sqrt(distance);
+    }
+}
+
+float trb::asset::simplifyMesh(std::vector<uint32_t>& indices, const std::vector<float>& positions, uint32_t vertexCount,
+                               size_t targetIndexCount, float maxError){
+    const float* p = positions.data();
+    double maxCost = (double)maxError * maxError;
+
+    // one plane per triangle on each of its corners, weighted by area so slivers do not dominate
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3){
+        double n[3];
+        triangleNormal(&p[indices[i] * 3], &p[indices[i + 1] * 3], &p[indices[i + 2] * 3], n);
+        double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length == 0.0){
+            continue;
+        }
+        n[0] /= length;
+        n[1] /= length;
+        n[2] /= length;
+        const float* a = &p[indices[i] * 3];
+        double d = -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]);
+        for (int k = 0; k < 3; k++){
+            quadrics[indices[i + k]].addPlane(n[0], n[1], n[2], d, length * 0.5);
+        }
+    }
+
+    // seams: vertices sharing a position with another one (split normals or uvs)
+    std::vector<bool> locked(vertexCount, false);
+    std::vector<uint32_t> order(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; v++){
+        order[v] = v;
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){
+        return memcmp(&p[a * 3], &p[b * 3], 3 * sizeof(float)) < 0;
+    });
+    for (uint32_t i = 1; i < vertexCount; i++){
+        if (memcmp(&p[order[i] * 3], &p[order[i - 1] * 3], 3 * sizeof(float)) == 0){
+            locked[order[i]] = true;
+            locked[order[i - 1]] = true;
+        }
+    }
+    // borders and non manifold edges: any edge not shared by exactly two triangles
+    std::vector<uint64_t> edges;
+    edges.reserve(indices.size());
+    for (size_t i = 0; i + 2 < indices.size(); i += 3){
+        for (int k = 0; k < 3; k++){
+            uint64_t a = indices[i + k], b = indices[i + (k + 1) % 3];
+            edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size();){
+        size_t j = i + 1;
+        while (j < edges.size() && edges[j] == edges[i]){
+            j++;
+        }
+        if (j - i != 2){
+            locked[edges[i] >> 32] = true;
+            locked[edges[i] & 0xffffffffu] = true;
+        }
+        i = j;
+    }
+
+    std::vector<uint32_t> offsets(vertexCount + 1);
+    std::vector<uint32_t> adjacency;
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<bool> touched(vertexCount);
+    // vertex every original vertex ended up in
+    std::vector<uint32_t> collapsedInto(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; v++){
+        collapsedInto[v] = v;
+    }
+    bool limited = false;
+    while (indices.size() > targetIndexCount && !limited){
+        // triangles around every vertex of the current list
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for (uint32_t v : indices){
+            offsets[v + 1]++;
+        }
+        for (uint32_t v = 0; v < vertexCount; v++){
+            offsets[v + 1] += offsets[v];
+        }
+        adjacency.resize(indices.size());
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++){
+            adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+        }
+
+        // every edge in both directions, interior edges show up twice and the second copy is skipped below
+        collapses.clear();
+        for (size_t i = 0; i + 2 < indices.size(); i += 3){
+            for (int k = 0; k < 3; k++){
+                uint32_t a = indices[i + k], b = indices[i + (k + 1) % 3];
+                for (int direction = 0; direction < 2; direction++){
+                    uint32_t from = direction ? b : a, to = direction ? a : b;
+                    if (locked[from]){
+                        continue;
+                    }
+                    const Quadric& qf = quadrics[from];
+                    const Quadric& qt = quadrics[to];
+                    double weight = qf.weight + qt.weight;
+                    Collapse collapse;
+                    collapse.from = from;
+                    collapse.to = to;
+                    collapse.cost = weight > 0.0 ? std::max(0.0, (qf.evaluate(&p[to * 3]) + qt.evaluate(&p[to * 3])) / weight) : 0.0;
+                    collapses.push_back(collapse);
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b){
+            return a.cost < b.cost;
+        });
+
+        // cheapest first, each collapse only touches vertices no other collapse of this pass moved or looked at
+        size_t goal = (indices.size() - targetIndexCount + 2) / 3;
+        size_t removed = 0;
+        uint32_t accepted = 0;
+        for (uint32_t v = 0; v < vertexCount; v++){
+            remap[v] = v;
+        }
+        std::fill(touched.begin(), touched.end(), false);
+        for (const Collapse& collapse : collapses){
+            if (removed >= goal){
+                break;
+            }
+            if (collapse.cost > maxCost){
+                limited = true;
+                break;
+            }
+            if (touched[collapse.from] || touched[collapse.to]){
+                continue;
+            }
+            bool flips = false;
+            size_t dying = 0;
+            for (uint32_t a = offsets[collapse.from]; a < offsets[collapse.from + 1] && !flips; a++){
+                const uint32_t* t = &indices[adjacency[a] * 3];
+                if (t[0] == collapse.to || t[1] == collapse.to || t[2] == collapse.to){
+                    dying++;
+                    continue;
+                }
+                const float* corners[3];
+                for (int k = 0; k < 3; k++){
+                    corners[k] = &p[(t[k] == collapse.from ? collapse.to : t[k]) * 3];
+                }
+                double before[3], after[3];
+                triangleNormal(&p[t[0] * 3], &p[t[1] * 3], &p[t[2] * 3], before);
+                triangleNormal(corners[0], corners[1], corners[2], after);
+                flips = before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0;
+            }
+            if (flips || dying == 0){
+                continue;
+            }
+            for (uint32_t a = offsets[collapse.from]; a < offsets[collapse.from + 1]; a++){
+                const uint32_t* t = &indices[adjacency[a] * 3];
+                touched[t[0]] = touched[t[1]] = touched[t[2]] = true;
+            }
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to].add(quadrics[collapse.from]);
+            removed += dying;
+            accepted++;
+        }
+        if (accepted == 0){
+            break;
+        }
+
+        size_t write = 0;
+        for (size_t i = 0; i + 2 < indices.size(); i += 3){
+            uint32_t a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (a != b && b != c && a != c){
+                indices[write++] = a;
+                indices[write++] = b;
+                indices[write++] = c;
+            }
+        }
+        indices.resize(write);
+        // the target of a collapse is touched, so it never moves in the same pass and one step per pass suffices
+        for (uint32_t v = 0; v < vertexCount; v++){
+            collapsedInto[v] = remap[collapsedInto[v]];
+        }
+    }
+
+    // the quadric cost is a mean over planes, the error reported is the largest distance of a removed vertex from the
+    // triangles around the vertex it collapsed into
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (uint32_t v : indices){
+        offsets[v + 1]++;
+    }
+    for (uint32_t v = 0; v < vertexCount; v++){
+        offsets[v + 1] += offsets[v];
+    }
+    adjacency.resize(indices.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++){
+        adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+    }
+    double worst = 0.0;
+    for (uint32_t v = 0; v < vertexCount; v++){
+        uint32_t into = collapsedInto[v];
+        if (into == v){
+            continue;
+        }
+        // everything around the vertex collapsed away, the surface shrank onto it
+        double distance = offsets[into] == offsets[into + 1] ? pointTriangleDistance(&p[v * 3], &p[into * 3], &p[into * 3], &p[into * 3]) : DBL_MAX;
+        for (uint32_t a = offsets[into]; a < offsets[into + 1]; a++){
+            const uint32_t* t = &indices[adjacency[a] * 3];
+            distance = std::min(distance, pointTriangleDistance(&p[v * 3], &p[t[0] * 3], &p[t[1] * 3], &p[t[2] * 3]));
+        }
+        worst = std::max(worst, distance);
+    }
+    return (float)worst;
+}
+
+trb::asset::MeshLodStats trb::asset::generateLods(MeshData* mesh, uint32_t levels, float reduction){
+    const TmeshAttribute* position = mesh->findAttribute(eTmeshPosition);
+    if (!position || position->format != VK_FORMAT_R32G32B32_SFLOAT || mesh->submeshes.empty()){
+        levels = 1;
+    }
+    levels = std::max(levels, 1u);
+
+    MeshLodStats stats;
+    stats.triangles.assign(levels, 0);
+    stats.errors.assign(levels, 0.0f);
+    mesh->lodCount = levels;
+    mesh->lods.assign(mesh->submeshes.size() * levels, TmeshLod());
+
+    for (size_t s = 0; s < mesh->submeshes.size(); s++){
+        const TmeshSubmesh& submesh = mesh->submeshes[s];
+        TmeshLod* chain = &mesh->lods[s * levels];
+        chain[0].firstIndex = submesh.firstIndex;
+        chain[0].indexCount = submesh.indexCount;
+        stats.triangles[0] += submesh.indexCount / 3;
+
+        std::vector<uint32_t> source(mesh->indices.begin() + submesh.firstIndex, mesh->indices.begin() + submesh.firstIndex + submesh.indexCount);
+        uint32_t localCount = 0;
+        for (uint32_t index : source){
+            localCount = std::max(localCount, index + 1);
+        }
+        std::vector<float> positions;
+        if (levels > 1){
+            positions.resize((size_t)localCount * 3);
+            const MeshData::Stream& stream = mesh->streams[position->stream];
+            for (uint32_t v = 0; v < localCount; v++){
+                memcpy(&positions[v * 3], stream.data.data() + (size_t)(submesh.vertexOffset + v) * stream.stride + position->offset, 3 * sizeof(float));
+            }
+        }
+
+        // every level starts from the full submesh, so its error is measured against the original surface
+        double target = (double)source.size() / 3;
+        for (uint32_t l = 1; l < levels; l++){
+            chain[l] = chain[l - 1];
+            target *= reduction;
+            std::vector<uint32_t> simplified = source;
+            float error = simplifyMesh(simplified, positions, localCount, (size_t)target * 3);
+            if (!simplified.empty() && simplified.size() <= chain[l - 1].indexCount * MESH_LOD_MIN_GAIN){
+                optimizeVertexCache(simplified, localCount);
+                chain[l].firstIndex = (uint32_t)mesh->indices.size();
+                chain[l].indexCount = (uint32_t)simplified.size();
+                chain[l].error = std::max(error, chain[l - 1].error);
+                mesh->indices.insert(mesh->indices.end(), simplified.begin(), simplified.end());
+            }
+            stats.triangles[l] += chain[l].indexCount / 3;
+            stats.errors[l] = std::max(stats.errors[l], chain[l].error);
+        }
+    }
+    return stats;
+}
@@ -0,0 +1,61 @@
+#ifndef TRB_ASSET_MeshSimplifier_H_
+#define TRB_ASSET_MeshSimplifier_H_
+
+#include <cstdint>
+#include <vector>
+#include <cfloat>
+
+#include "Mesh.hpp"
+
+// Levels of detail generateLods() builds per submesh, level 0 included
+#define MESH_LOD_LEVELS 4
+// Every level targets this fraction of the triangles of the level before it
+#define MESH_LOD_REDUCTION 0.5f
+// A level that does not get below this fraction of the level before it is not worth its index data, the previous one is repeated
+#define MESH_LOD_MIN_GAIN 0.8f
+
+namespace trb{
+    namespace asset{
+
+        struct MeshLodStats{
+            /** @brief Triangles of every level summed over the submeshes, level 0 first */
+            std::vector<uint64_t> triangles;
+            /** @brief Largest distance of an original vertex from every level over the submeshes, in mesh units */
+            std::vector<float> errors;
+        };
+
+        /**
+        * Quadric error metric simplification (Garland and Heckbert 1997) of a triangle list
+        *
+        * Edges collapse onto one of their vertices, so the result indexes the same vertex buffer and only needs its own
+        * index range. Vertices on open borders and on attribute seams (several vertices at one position) never move,
+        * which keeps the silhouette and the uv layout intact at the cost of stopping early on heavily split meshes.
+        * Collapses that flip a triangle are rejected.
+        *
+        * @param indices Triangle list with indices below vertexCount, replaced by the simplified list
+        * @param positions xyz per vertex
+        * @param vertexCount Number of vertices the list references
+        * @param targetIndexCount Stop once the list has no more indices than this
+        * @param maxError (Optional) Stop before a collapse costs more than this, in mesh units. The cost is the root mean
+        *        square distance to the planes the collapse merges, a cheaper estimate than the distance returned
+        *
+        * @return Largest distance of a removed vertex from the simplified triangles around the vertex it collapsed
+        *         into, in mesh units
+        */
+        float simplifyMesh(std::vector<uint32_t>& indices, const std::vector<float>& positions, uint32_t vertexCount,
+                           size_t targetIndexCount, float maxError = FLT_MAX);
+
+        /**
+        * Build a chain of levels of detail for every submesh, run it after optimizeMesh()
+        *
+        * The index ranges of coarser levels are appended to the mesh indices and cache optimized, the vertices are shared
+        * with level 0. Needs an R32G32B32_SFLOAT position, meshes without one keep a single level.
+        *
+        * @param levels Levels per submesh, level 0 included
+        * @param reduction Triangle fraction each level targets relative to the one before
+        */
+        MeshLodStats generateLods(MeshData* mesh, uint32_t levels = MESH_LOD_LEVELS, float reduction = MESH_LOD_REDUCTION);
+    }
+}
+
+#endif
@@ -0,0 +1,660 @@
+#include "BatchMath.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#if (defined(__SSE2__) || defined(_M_X64)) && defined(__GNUC__)
+// both x86 paths are built with a target attribute and only called when the CPU reports the instruction set
+#define MATH_SSE41 1
+#define MATH_AVX2 1
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MATH_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace{
+
+    /*
+    * One function per kernel and path, the public functions forward to the table of the active path. Matrices
+    * are 16 floats column major, streams are pointers to the components. Every path uses the operation order of
+    * the scalar one: matrix products ((a0 b0 + a1 b1) + a2 b2) + a3 b3 like glm's mat4 * mat4, transforms
+    * (m0 x + m1 y) + (m2 z + m3 w) like glm's mat4 * vec4.
+    */
+    struct Kernels{
+        /** @brief aStride is 16 to walk an array of matrices or 0 to reuse one */
+        void (*multiply)(const float* a, uint32_t aStride, const float* b, float* out, uint32_t count);
+        void (*transform)(const float* m, float w, const float* const in[3], float* const out[3], uint32_t count);
+        void (*boxes)(const float* m, const float* const in[6], float* const out[6], uint32_t count);
+        void (*quaternions)(const float* const q[4], float* out, uint32_t count);
+        uint32_t (*spheres)(const float* planes, uint32_t planeCount, const float* const s[4], uint8_t* inside, uint32_t count);
+    };
+
+    void multiplyScalar(const float* a, uint32_t aStride, const float* b, float* out, uint32_t count){
+        for (uint32_t i = 0; i < count; i++){
+            const float* A = a + i * aStride;
+            const float* B = b + i * 16;
+            float r[16];
+            for (int j = 0; j < 4; j++){
+                for (int k = 0; k < 4; k++){
+                    r[j * 4 + k] = A[k] * B[j * 4] + A[4 + k] * B[j * 4 + 1] + A[8 + k] * B[j * 4 + 2] + A[12 + k] * B[j * 4 + 3];
+                }
+            }
+            memcpy(out + i * 16, r, sizeof(r));
+        }
+    }
+
+    void transformScalarRange(const float* m, float w, const float* const in[3], float* const out[3], uint32_t begin, uint32_t end){
+        float tx = m[12] * w, ty = m[13] * w, tz = m[14] * w;
+        for (uint32_t i = begin; i < end; i++){
+            float x = in[0][i], y = in[1][i], z = in[2][i];
+            out[0][i] = (m[0] * x + m[4] * y) + (m[8] * z + tx);
+            out[1][i] = (m[1] * x + m[5] * y) + (m[9] * z + ty);
+            out[2][i] = (m[2] * x + m[6] * y) + (m[10] * z + tz);
+        }
+    }
+
+    void transformScalar(const float* m, float w, const float* const in[3], float* const out[3], uint32_t count){
+        transformScalarRange(m, w, in, out, 0, count);
+    }
+
+    void boxesScalarRange(const float* m, const float* const in[6], float* const out[6], uint32_t begin, uint32_t end){
+        float a[9];
+        for (int k = 0; k < 3; k++){
+            a[k] = std::fabs(m[k]);
+            a[3 + k] = std::fabs(m[4 + k]);
+            a[6 + k] = std::fabs(m[8 + k]);
+        }
+        for (uint32_t i = begin; i < end; i++){
+            float x = in[0][i], y = in[1][i], z = in[2][i];
+            float ex = in[3][i], ey = in[4][i], ez = in[5][i];
+            for (int k = 0; k < 3; k++){
+                out[k][i] = (m[k] * x + m[4 + k] * y) + (m[8 + k] * z + m[12 + k]);
+                out[3 + k][i] = a[k] * ex + a[3 + k] * ey + a[6 + k] * ez;
+            }
+        }
+    }
+
+    void boxesScalar(const float* m, const float* const in[6], float* const out[6], uint32_t count){
+        boxesScalarRange(m, in, out, 0, count);
+    }
+
+    void quaternionsScalarRange(const float* const q[4], float* out, uint32_t begin, uint32_t end){
+        for (uint32_t i = begin; i < end; i++){
+            float x = q[0][i], y = q[1][i], z = q[2][i], w = q[3][i];
+            float xx = x * x, yy = y * y, zz = z * z;
+            float xz = x * z, xy = x * y, yz = y * z;
+            float wx = w * x, wy = w * y, wz = w * z;
+            float* m = out + i * 16;
+            m[0] = 1.0f - 2.0f * (yy + zz);
+            m[1] = 2.0f * (xy + wz);
+            m[2] = 2.0f * (xz - wy);
+            m[3] = 0.0f;
+            m[4] = 2.0f * (xy - wz);
+            m[5] = 1.0f - 2.0f * (xx + zz);
+            m[6] = 2.0f * (yz + wx);
+            m[7] = 0.0f;
+            m[8] = 2.0f * (xz + wy);
+            m[9] = 2.0f * (yz - wx);
+            m[10] = 1.0f - 2.0f * (xx + yy);
+            m[11] = 0.0f;
+            m[12] = 0.0f;
+            m[13] = 0.0f;
+            m[14] = 0.0f;
+            m[15] = 1.0f;
+        }
+    }
+
+    void quaternionsScalar(const float* const q[4], float* out, uint32_t count){
+        quaternionsScalarRange(q, out, 0, count);
+    }
+
+    uint32_t spheresScalarRange(const float* planes, uint32_t planeCount, const float* const s[4], uint8_t* inside, uint32_t begin, uint32_t end){
+        uint32_t count = 0;
+        for (uint32_t i = begin; i < end; i++){
+            bool in = true;
+            for (uint32_t p = 0; p < planeCount && in; p++){
+                const float* n = planes + p * 4;
+                float d = n[0] * s[0][i] + n[1] * s[1][i] + n[2] * s[2][i] + n[3];
+                in = d + s[3][i] >= 0.0f;
+            }
+            inside[i] = in ? 1 : 0;
+            count += in ? 1 : 0;
+        }
+        return count;
+    }
+
+    uint32_t spheresScalar(const float* planes, uint32_t planeCount, const float* const s[4], uint8_t* inside, uint32_t count){
+        return spheresScalarRange(planes, planeCount, s, inside, 0, count);
+    }
+
+    const Kernels scalarKernels = { multiplyScalar, transformScalar, boxesScalar, quaternionsScalar, spheresScalar };
+
+#ifdef MATH_SSE41
+    __attribute__((target("sse4.1")))
+    inline __m128 splat(__m128 v, int lane){
+        switch (lane){
+            case 0: return _mm_shuffle_ps(v, v, 0x00);
+            case 1: return _mm_shuffle_ps(v, v, 0x55);
+            case 2: return _mm_shuffle_ps(v, v, 0xAA);
+            default: return _mm_shuffle_ps(v, v, 0xFF);
+        }
+    }
+
+    __attribute__((target("sse4.1")))
+    void multiplySse41(const float* a, uint32_t aStride, const float* b, float* out, uint32_t count){
+        for (uint32_t i = 0; i < count; i++){
+            const float* A = a + i * aStride;
+            const float* B = b + i * 16;
+            __m128 a0 = _mm_loadu_ps(A), a1 = _mm_loadu_ps(A + 4), a2 = _mm_loadu_ps(A + 8), a3 = _mm_loadu_ps(A + 12);
+            __m128 r[4];
+            for (int j = 0; j < 4; j++){
+                __m128 c = _mm_loadu_ps(B + j * 4);
+                r[j] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, splat(c, 0)), _mm_mul_ps(a1, splat(c, 1))), _mm_mul_ps(a2, splat(c, 2))),
+                    _mm_mul_ps(a3, splat(c, 3)));
+            }
+            for (int j = 0; j < 4; j++){
+                _mm_storeu_ps(out + i * 16 + j * 4, r[j]);
+            }
+        }
+    }
+
+    __attribute__((target("sse4.1")))
+    void transformSse41(const float* m, float w, const float* const in[3], float* const out[3], uint32_t count){
+        __m128 c[12];
+        for (int k = 0; k < 12; k++){
+            c[k] = _mm_set1_ps(m[k]);
+        }
+        __m128 t[3] = { _mm_set1_ps(m[12] * w), _mm_set1_ps(m[13] * w), _mm_set1_ps(m[14] * w) };
+        uint32_t i = 0;
+        for (; i + 4 <= count; i += 4){
+            __m128 x = _mm_loadu_ps(in[0] + i), y = _mm_loadu_ps(in[1] + i), z = _mm_loadu_ps(in[2] + i);
+            __m128 r[3];
+            for (int k = 0; k < 3; k++){
+                r[k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[k], x), _mm_mul_ps(c[4 + k], y)), _mm_add_ps(_mm_mul_ps(c[8 + k], z), t[k]));
+            }
+            for (int k = 0; k < 3; k++){
+                _mm_storeu_ps(out[k] + i, r[k]);
+            }
+        }
+        transformScalarRange(m, w, in, out, i, count);
+    }
+
+    __attribute__((target("sse4.1")))
+    void boxesSse41(const float* m, const float* const in[6], float* const out[6], uint32_t count){
+        __m128 c[12], a[9];
+        for (int k = 0; k < 12; k++){
+            c[k] = _mm_set1_ps(m[k]);
+        }
+        for (int k = 0; k < 3; k++){
+            a[k] = _mm_set1_ps(std::fabs(m[k]));
+            a[3 + k] = _mm_set1_ps(std::fabs(m[4 + k]));
+            a[6 + k] = _mm_set1_ps(std::fabs(m[8 + k]));
+        }
+        __m128 t[3] = { _mm_set1_ps(m[12]), _mm_set1_ps(m[13]), _mm_set1_ps(m[14]) };
+        uint32_t i = 0;
+        for (; i + 4 <= count; i += 4){
+            __m128 v[6];
+            for (int k = 0; k < 6; k++){
+                v[k] = _mm_loadu_ps(in[k] + i);
+            }
+            __m128 r[6];
+            for (int k = 0; k < 3; k++){
+                r[k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[k], v[0]), _mm_mul_ps(c[4 + k], v[1])), _mm_add_ps(_mm_mul_ps(c[8 + k], v[2]), t[k]));
+                r[3 + k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[k], v[3]), _mm_mul_ps(a[3 + k], v[4])), _mm_mul_ps(a[6 + k], v[5]));
+            }
+            for (int k = 0; k < 6; k++){
+                _mm_storeu_ps(out[k] + i, r[k]);
+            }
+        }
+        boxesScalarRange(m, in, out, i, count);
+    }
+
+    /** @brief Columns of four rotation matrices from the nine entries of each, stored to out, out + 16, ... */
+    __attribute__((target("sse4.1")))
+    inline void storeRotations(const __m128* r, float* out){
+        __m128 zero = _mm_setzero_ps();
+        __m128 last = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+        for (int c = 0; c < 3; c++){
+            __m128 c0 = r[c * 3], c1 = r[c * 3 + 1], c2 = r[c * 3 + 2], c3 = zero;
+            _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+            _mm_storeu_ps(out + c * 4, c0);
+            _mm_storeu_ps(out + 16 + c * 4, c1);
+            _mm_storeu_ps(out + 32 + c * 4, c2);
+            _mm_storeu_ps(out + 48 + c * 4, c3);
+        }
+        for (int k = 0; k < 4; k++){
+            _mm_storeu_ps(out + k * 16 + 12, last);
+        }
+    }
+
+    __attribute__((target("sse4.1")))
+    void quaternionsSse41(const float* const q[4], float* out, uint32_t count){
+        __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+        uint32_t i = 0;
+        for (; i + 4 <= count; i += 4){
+            __m128 x = _mm_loadu_ps(q[0] + i), y = _mm_loadu_ps(q[1] + i), z = _mm_loadu_ps(q[2] + i), w = _mm_loadu_ps(q[3] + i);
+            __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+            __m128 xz = _mm_mul_ps(x, z), xy = _mm_mul_ps(x, y), yz = _mm_mul_ps(y, z);
+            __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+            __m128 r[9] = {
+                _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), _mm_mul_ps(two, _mm_add_ps(xy, wz)), _mm_mul_ps(two, _mm_sub_ps(xz, wy)),
+                _mm_mul_ps(two, _mm_sub_ps(xy, wz)), _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), _mm_mul_ps(two, _mm_add_ps(yz, wx)),
+                _mm_mul_ps(two, _mm_add_ps(xz, wy)), _mm_mul_ps(two, _mm_sub_ps(yz, wx)), _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)))
+            };
+            storeRotations(r, out + i * 16);
+        }
+        quaternionsScalarRange(q, out, i, count);
+    }
+
+    __attribute__((target("sse4.1")))
+    uint32_t spheresSse41(const float* planes, uint32_t planeCount, const float* const s[4], uint8_t* inside, uint32_t count){
+        __m128 zero = _mm_setzero_ps();
+        uint32_t visible = 0;
+        uint32_t i = 0;
+        for (; i + 4 <= count; i += 4){
+            __m128 x = _mm_loadu_ps(s[0] + i), y = _mm_loadu_ps(s[1] + i), z = _mm_loadu_ps(s[2] + i), r = _mm_loadu_ps(s[3] + i);
+            __m128 in = _mm_cmpeq_ps(zero, zero);
+            for (uint32_t p = 0; p < planeCount; p++){
+                const float* n = planes + p * 4;
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(n[0]), x), _mm_mul_ps(_mm_set1_ps(n[1]), y)),
+                    _mm_mul_ps(_mm_set1_ps(n[2]), z)), _mm_set1_ps(n[3]));
+                in = _mm_and_ps(in, _mm_cmpge_ps(_mm_add_ps(d, r), zero));
+            }
+            int mask = _mm_movemask_ps(in);
+            for (uint32_t k = 0; k < 4; k++){
+                inside[i + k] = (mask >> k) & 1;
+            }
+            visible += (uint32_t)__builtin_popcount((unsigned)mask);
+        }
+        return visible + spheresScalarRange(planes, planeCount, s, inside, i, count);
+    }
+
+    const Kernels sse41Kernels = { multiplySse41, transformSse41, boxesSse41, quaternionsSse41, spheresSse41 };
+#endif
+
+#ifdef MATH_AVX2
+    __attribute__((target("avx2")))
+    void multiplyAvx2(const float* a, uint32_t aStride, const float* b, float* out, uint32_t count){
+        for (uint32_t i = 0; i < count; i++){
+            const float* A = a + i * aStride;
+            const float* B = b + i * 16;
+            // the columns of a in both halves, two columns of b and of the result per register
+            __m256 a0 = _mm256_broadcast_ps((const __m128*)A), a1 = _mm256_broadcast_ps((const __m128*)(A + 4));
+            __m256 a2 = _mm256_broadcast_ps((const __m128*)(A + 8)), a3 = _mm256_broadcast_ps((const __m128*)(A + 12));
+            __m256 r[2];
+            for (int j = 0; j < 2; j++){
+                __m256 c = _mm256_loadu_ps(B + j * 8);
+                r[j] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a0, _mm256_shuffle_ps(c, c, 0x00)), _mm256_mul_ps(a1, _mm256_shuffle_ps(c, c, 0x55))),
+                    _mm256_mul_ps(a2, _mm256_shuffle_ps(c, c, 0xAA))), _mm256_mul_ps(a3, _mm256_shuffle_ps(c, c, 0xFF)));
+            }
+            _mm256_storeu_ps(out + i * 16, r[0]);
+            _mm256_storeu_ps(out + i * 16 + 8, r[1]);
+        }
+    }
+
+    __attribute__((target("avx2")))
+    void transformAvx2(const float* m, float w, const float* const in[3], float* const out[3], uint32_t count){
+        __m256 c[12];
+        for (int k = 0; k < 12; k++){
+            c[k] = _mm256_set1_ps(m[k]);
+        }
+        __m256 t[3] = { _mm256_set1_ps(m[12] * w), _mm256_set1_ps(m[13] * w), _mm256_set1_ps(m[14] * w) };
+        uint32_t i = 0;
+        for (; i + 8 <= count; i += 8){
+            __m256 x = _mm256_loadu_ps(in[0] + i), y = _mm256_loadu_ps(in[1] + i), z = _mm256_loadu_ps(in[2] + i);
+            __m256 r[3];
+            for (int k = 0; k < 3; k++){
+                // no fma, it would round differently from the other paths
+                r[k] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[k], x), _mm256_mul_ps(c[4 + k], y)), _mm256_add_ps(_mm256_mul_ps(c[8 + k], z), t[k]));
+            }
+            for (int k = 0; k < 3; k++){
+                _mm256_storeu_ps(out[k] + i, r[k]);
+            }
+        }
+        transformScalarRange(m, w, in, out, i, count);
+    }
+
+    __attribute__((target("avx2")))
+    void boxesAvx2(const float* m, const float* const in[6], float* const out[6], uint32_t count){
+        __m256 c[12], a[9];
+        for (int k = 0; k < 12; k++){
+            c[k] = _mm256_set1_ps(m[k]);
+        }
+        for (int k = 0; k < 3; k++){
+            a[k] = _mm256_set1_ps(std::fabs(m[k]));
+            a[3 + k] = _mm256_set1_ps(std::fabs(m[4 + k]));
+            a[6 + k] = _mm256_set1_ps(std::fabs(m[8 + k]));
+        }
+        __m256 t[3] = { _mm256_set1_ps(m[12]), _mm256_set1_ps(m[13]), _mm256_set1_ps(m[14]) };
+        uint32_t i = 0;
+        for (; i + 8 <= count; i += 8){
+            __m256 v[6];
+            for (int k = 0; k < 6; k++){
+                v[k] = _mm256_loadu_ps(in[k] + i);
+            }
+            __m256 r[6];
+            for (int k = 0; k < 3; k++){
+                r[k] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[k], v[0]), _mm256_mul_ps(c[4 + k], v[1])), _mm256_add_ps(_mm256_mul_ps(c[8 + k], v[2]), t[k]));
+                r[3 + k] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a[k], v[3]), _mm256_mul_ps(a[3 + k], v[4])), _mm256_mul_ps(a[6 + k], v[5]));
+            }
+            for (int k = 0; k < 6; k++){
+                _mm256_storeu_ps(out[k] + i, r[k]);
+            }
+        }
+        boxesScalarRange(m, in, out, i, count);
+    }
+
+    /** @brief 4x4 transposes of the rows a, b, c, d within each 128 bit half, matrix k and k + 4 of t[k] */
+    __attribute__((target("avx2")))
+    inline void transposeHalves(__m256 a, __m256 b, __m256 c, __m256 d, __m256* t){
+        __m256 ab0 = _mm256_unpacklo_ps(a, b), ab1 = _mm256_unpackhi_ps(a, b);
+        __m256 cd0 = _mm256_unpacklo_ps(c, d), cd1 = _mm256_unpackhi_ps(c, d);
+        t[0] = _mm256_shuffle_ps(ab0, cd0, 0x44);
+        t[1] = _mm256_shuffle_ps(ab0, cd0, 0xEE);
+        t[2] = _mm256_shuffle_ps(ab1, cd1, 0x44);
+        t[3] = _mm256_shuffle_ps(ab1, cd1, 0xEE);
+    }
+
+    /**
+    * Eight rotation matrices from the nine entries of each, stored to out, out + 16, ... Two columns per store,
+    * straight from the 8 wide registers
+    */
+    __attribute__((target("avx2")))
+    inline void storeRotations(const __m256* r, float* out){
+        __m256 zero = _mm256_setzero_ps();
+        __m256 last = _mm256_setr_ps(0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+        __m256 c0[4], c1[4], c2[4];
+        transposeHalves(r[0], r[1], r[2], zero, c0);
+        transposeHalves(r[3], r[4], r[5], zero, c1);
+        transposeHalves(r[6], r[7], r[8], zero, c2);
+        for (int k = 0; k < 4; k++){
+            _mm256_storeu_ps(out + k * 16, _mm256_permute2f128_ps(c0[k], c1[k], 0x20));
+            _mm256_storeu_ps(out + k * 16 + 8, _mm256_permute2f128_ps(c2[k], last, 0x20));
+            _mm256_storeu_ps(out + (k + 4) * 16, _mm256_permute2f128_ps(c0[k], c1[k], 0x31));
+            _mm256_storeu_ps(out + (k + 4) * 16 + 8, _mm256_permute2f128_ps(c2[k], last, 0x31));
+        }
+    }
+
+    __attribute__((target("avx2")))
+    void quaternionsAvx2(const float* const q[4], float* out, uint32_t count){
+        __m256 one = _mm256_set1_ps(1.0f), two = _mm256_set1_ps(2.0f);
+        uint32_t i = 0;
+        for (; i + 8 <= count; i += 8){
+            __m256 x = _mm256_loadu_ps(q[0] + i), y = _mm256_loadu_ps(q[1] + i), z = _mm256_loadu_ps(q[2] + i), w = _mm256_loadu_ps(q[3] + i);
+            __m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+            __m256 xz = _mm256_mul_ps(x, z), xy = _mm256_mul_ps(x, y), yz = _mm256_mul_ps(y, z);
+            __m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y), wz = _mm256_mul_ps(w, z);
+            __m256 r[9] = {
+                _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz))), _mm256_mul_ps(two, _mm256_add_ps(xy, wz)), _mm256_mul_ps(two, _mm256_sub_ps(xz, wy)),
+                _mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz))), _mm256_mul_ps(two, _mm256_add_ps(yz, wx)),
+                _mm256_mul_ps(two, _mm256_add_ps(xz, wy)), _mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy)))
+            };
+            storeRotations(r, out + i * 16);
+        }
+        quaternionsScalarRange(q, out, i, count);
+    }
+
+    __attribute__((target("avx2")))
+    uint32_t spheresAvx2(const float* planes, uint32_t planeCount, const float* const s[4], uint8_t* inside, uint32_t count){
+        __m256 zero = _mm256_setzero_ps();
+        uint32_t visible = 0;
+        uint32_t i = 0;
+        for (; i + 8 <= count; i += 8){
+            __m256 x = _mm256_loadu_ps(s[0] + i), y = _mm256_loadu_ps(s[1] + i), z = _mm256_loadu_ps(s[2] + i), r = _mm256_loadu_ps(s[3] + i);
+            __m256 in = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+            for (uint32_t p = 0; p < planeCount; p++){
+                const float* n = planes + p * 4;
+                __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(n[0]), x), _mm256_mul_ps(_mm256_set1_ps(n[1]), y)),
+                    _mm256_mul_ps(_mm256_set1_ps(n[2]), z)), _mm256_set1_ps(n[3]));
+                in = _mm256_and_ps(in, _mm256_cmp_ps(_mm256_add_ps(d, r), zero, _CMP_GE_OQ));
+            }
+            int mask = _mm256_movemask_ps(in);
+            for (uint32_t k = 0; k < 8; k++){
+                inside[i + k] = (mask >> k) & 1;
+            }
+            visible += (uint32_t)__builtin_popcount((unsigned)mask);
+        }
+        return visible + spheresScalarRange(planes, planeCount, s, inside, i, count);
+    }
+
+    const Kernels avx2Kernels = { multiplyAvx2, transformAvx2, boxesAvx2, quaternionsAvx2, spheresAvx2 };
+#endif
+
+#ifdef MATH_NEON
+    void multiplyNeon(const float* a, uint32_t aStride, const float* b, float* out, uint32_t count){
+        for (uint32_t i = 0; i < count; i++){
+            const float* A = a + i * aStride;
+            const float* B = b + i * 16;
+            float32x4_t a0 = vld1q_f32(A), a1 = vld1q_f32(A + 4), a2 = vld1q_f32(A + 8), a3 = vld1q_f32(A + 12);
+            float32x4_t r[4];
+            for (int j = 0; j < 4; j++){
+                const float* c = B + j * 4;
+                // separate multiplies and adds, a fused vmla would round differently from the other paths
+                r[j] = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(a0, c[0]), vmulq_n_f32(a1, c[1])), vmulq_n_f32(a2, c[2])), vmulq_n_f32(a3, c[3]));
+            }
+            for (int j = 0; j < 4; j++){
+                vst1q_f32(out + i * 16 + j * 4, r[j]);
+            }
+        }
+    }
+
+    void transformNeon(const float* m, float w, const float* const in[3], float* const out[3], uint32_t count){
+        float32x4_t t[3] = { vdupq_n_f32(m[12] * w), vdupq_n_f32(m[13] * w), vdupq_n_f32(m[14] * w) };
+        uint32_t i = 0;
+        for (; i + 4 <= count; i += 4){
+            float32x4_t x = vld1q_f32(in[0] + i), y = vld1q_f32(in[1] + i), z = vld1q_f32(in[2] + i);
+            float32x4_t r[3];
+            for (int k = 0; k < 3; k++){
+                r[k] = vaddq_f32(vaddq_f32(vmulq_n_f32(x, m[k]), vmulq_n_f32(y, m[4 + k])), vaddq_f32(vmulq_n_f32(z, m[8 + k]), t[k]));
+            }
+            for (int k = 0; k < 3; k++){
+                vst1q_f32(out[k] + i, r[k]);
+            }
+        }
+        transformScalarRange(m, w, in, out, i, count);
+    }
+
+    void boxesNeon(const float* m, const float* const in[6], float* const out[6], uint32_t count){
+        float a[9];
+        for (int k = 0; k < 3; k++){
+            a[k] = std::fabs(m[k]);
+            a[3 + k] = std::fabs(m[4 + k]);
+            a[6 + k] = std::fabs(m[8 + k]);
+        }
+        uint32_t i = 0;
+        for (; i + 4 <= count; i += 4){
+            float32x4_t v[6];
+            for (int k = 0; k < 6; k++){
+                v[k] = vld1q_f32(in[k] + i);
+            }
+            float32x4_t r[6];
+            for (int k = 0; k < 3; k++){
+                r[k] = vaddq_f32(vaddq_f32(vmulq_n_f32(v[0], m[k]), vmulq_n_f32(v[1], m[4 + k])), vaddq_f32(vmulq_n_f32(v[2], m[8 + k]), vdupq_n_f32(m[12 + k])));
+                r[3 + k] = vaddq_f32(vaddq_f32(vmulq_n_f32(v[3], a[k]), vmulq_n_f32(v[4], a[3 + k])), vmulq_n_f32(v[5], a[6 + k]));
+            }
+            for (int k = 0; k < 6; k++){
+                vst1q_f32(out[k] + i, r[k]);
+            }
+        }
+        boxesScalarRange(m, in, out, i, count);
+    }
+
+    void quaternionsNeon(const float* const q[4], float* out, uint32_t count){
+        float32x4_t one = vdupq_n_f32(1.0f), two = vdupq_n_f32(2.0f), zero = vdupq_n_f32(0.0f);
+        const float lastColumn[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        float32x4_t last = vld1q_f32(lastColumn);
+        uint32_t i = 0;
+        for (; i + 4 <= count; i += 4){
+            float32x4_t x = vld1q_f32(q[0] + i), y = vld1q_f32(q[1] + i), z = vld1q_f32(q[2] + i), w = vld1q_f32(q[3] + i);
+            float32x4_t xx = vmulq_f32(x, x), yy = vmulq_f32(y, y), zz = vmulq_f32(z, z);
+            float32x4_t xz = vmulq_f32(x, z), xy = vmulq_f32(x, y), yz = vmulq_f32(y, z);
+            float32x4_t wx = vmulq_f32(w, x), wy = vmulq_f32(w, y), wz = vmulq_f32(w, z);
+            float32x4_t r[9] = {
+                vsubq_f32(one, vmulq_f32(two, vaddq_f32(yy, zz))), vmulq_f32(two, vaddq_f32(xy, wz)), vmulq_f32(two, vsubq_f32(xz, wy)),
+                vmulq_f32(two, vsubq_f32(xy, wz)), vsubq_f32(one, vmulq_f32(two, vaddq_f32(xx, zz))), vmulq_f32(two, vaddq_f32(yz, wx)),
+                vmulq_f32(two, vaddq_f32(xz, wy)), vmulq_f32(two, vsubq_f32(yz, wx)), vsubq_f32(one, vmulq_f32(two, vaddq_f32(xx, yy)))
+            };
+            float* m = out + i * 16;
+            for (int c = 0; c < 3; c++){
+                // 4x4 transpose, lane k of the three entries becomes column c of matrix k
+                float32x4x2_t t0 = vtrnq_f32(r[c * 3], r[c * 3 + 1]);
+                float32x4x2_t t1 = vtrnq_f32(r[c * 3 + 2], zero);
+                vst1q_f32(m + c * 4, vcombine_f32(vget_low_f32(t0.val[0]), vget_low_f32(t1.val[0])));
+                vst1q_f32(m + 16 + c * 4, vcombine_f32(vget_low_f32(t0.val[1]), vget_low_f32(t1.val[1])));
+                vst1q_f32(m + 32 + c * 4, vcombine_f32(vget_high_f32(t0.val[0]), vget_high_f32(t1.val[0])));
+                vst1q_f32(m + 48 + c * 4, vcombine_f32(vget_high_f32(t0.val[1]), vget_high_f32(t1.val[1])));
+            }
+            for (int k = 0; k < 4; k++){
+                vst1q_f32(m + k * 16 + 12, last);
+            }
+        }
+        quaternionsScalarRange(q, out, i, count);
+    }
+
+    uint32_t spheresNeon(const float* planes, uint32_t planeCount, const float* const s[4], uint8_t* inside, uint32_t count){
+        float32x4_t zero = vdupq_n_f32(0.0f);
+        uint32_t visible = 0;
+        uint32_t i = 0;
+        for (; i + 4 <= count; i += 4){
+            float32x4_t x = vld1q_f32(s[0] + i), y = vld1q_f32(s[1] + i), z = vld1q_f32(s[2] + i), r = vld1q_f32(s[3] + i);
+            uint32x4_t in = vceqq_f32(zero, zero);
+            for (uint32_t p = 0; p < planeCount; p++){
+                const float* n = planes + p * 4;
+                float32x4_t d = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x, n[0]), vmulq_n_f32(y, n[1])), vmulq_n_f32(z, n[2])), vdupq_n_f32(n[3]));
+                in = vandq_u32(in, vcgeq_f32(vaddq_f32(d, r), zero));
+            }
+            uint32_t lanes[4];
+            vst1q_u32(lanes, in);
+            for (uint32_t k = 0; k < 4; k++){
+                inside[i + k] = lanes[k] & 1;
+                visible += lanes[k] & 1;
+            }
+        }
+        return visible + spheresScalarRange(planes, planeCount, s, inside, i, count);
+    }
+
+    const Kernels neonKernels = { multiplyNeon, transformNeon, boxesNeon, quaternionsNeon, spheresNeon };
+#endif
+
+    const Kernels* getKernels(trb::core::MathPath path){
+        switch (path){
+#ifdef MATH_SSE41
+            case trb::core::eMathSse41:
+                return &sse41Kernels;
+#endif
+#ifdef MATH_AVX2
+            case trb::core::eMathAvx2:
+                return &avx2Kernels;
+#endif
+#ifdef MATH_NEON
+            case trb::core::eMathNeon:
+                return &neonKernels;
+#endif
+            default:
+                return &scalarKernels;
+        }
+    }
+
+    /** @brief Path of the active kernels, the best one on first use */
+    trb::core::MathPath& activePath(){
+        static trb::core::MathPath path = trb::core::getBestMathPath();
+        return path;
+    }
+
+    const Kernels*& active(){
+        static const Kernels* kernels = getKernels(activePath());
+        return kernels;
+    }
+}
+
+bool trb::core::isMathPathSupported(MathPath path){
+    switch (path){
+        case eMathScalar:
+            return true;
+#ifdef MATH_SSE41
+        case eMathSse41:
+            return __builtin_cpu_supports("sse4.1") != 0;
+#endif
+#ifdef MATH_AVX2
+        case eMathAvx2:
+            return __builtin_cpu_supports("avx2") != 0;
+#endif
+#ifdef MATH_NEON
+        case eMathNeon:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+trb::core::MathPath trb::core::getBestMathPath(){
+    static const MathPath widestFirst[] = { eMathAvx2, eMathNeon, eMathSse41 };
+    for (MathPath path : widestFirst){
+        if (isMathPathSupported(path)){
+            return path;
+        }
+    }
+    return eMathScalar;
+}
+
+const char* trb::core::getMathPathName(MathPath path){
+    switch (path){
+        case eMathSse41:
+            return "SSE4.1";
+        case eMathAvx2:
+            return "AVX2";
+        case eMathNeon:
+            return "NEON";
+        default:
+            return "scalar";
+    }
+}
+
+void trb::core::setMathPath(MathPath path){
+    activePath() = isMathPathSupported(path) ? path : eMathScalar;
+    active() = getKernels(activePath());
+}
+
+trb::core::MathPath trb::core::getMathPath(){
+    return activePath();
+}
+
+void trb::core::multiplyMatrices(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, uint32_t count){
+    active()->multiply((const float*)a, 16, (const float*)b, (float*)out, count);
+}
+
+void trb::core::multiplyMatrices(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, uint32_t count){
+    active()->multiply(&a[0][0], 0, (const float*)b, (float*)out, count);
+}
+
+void trb::core::transformPoints(const glm::mat4& m, const float* x, const float* y, const float* z, float* outX, float* outY, float* outZ,
+                                uint32_t count){
+    const float* in[3] = { x, y, z };
+    float* out[3] = { outX, outY, outZ };
+    active()->transform(&m[0][0], 1.0f, in, out, count);
+}
+
+void trb::core::transformVectors(const glm::mat4& m, const float* x, const float* y, const float* z, float* outX, float* outY, float* outZ,
+                                 uint32_t count){
+    const float* in[3] = { x, y, z };
+    float* out[3] = { outX, outY, outZ };
+    active()->transform(&m[0][0], 0.0f, in, out, count);
+}
+
+void trb::core::transformBoxes(const glm::mat4& m, const float* const in[6], float* const out[6], uint32_t count){
+    active()->boxes(&m[0][0], in, out, count);
+}
+
+void trb::core::quaternionsToMatrices(const float* x, const float* y, const float* z, const float* w, glm::mat4* out, uint32_t count){
+    const float* q[4] = { x, y, z, w };
+    active()->quaternions(q, (float*)out, count);
+}
+
+uint32_t trb::core::testSpheres(const glm::vec4* planes, uint32_t planeCount, const float* x, const float* y, const float* z, const float* radius,
+                                uint8_t* inside, uint32_t count){
+    const float* s[4] = { x, y, z, radius };
+    return active()->spheres(&planes[0][0], planeCount, s, inside, count);
+}
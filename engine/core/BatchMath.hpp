@@ -0,0 +1,114 @@
+#ifndef TRB_CORE_BatchMath_H_
+#define TRB_CORE_BatchMath_H_
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// Alignment of FloatArray and MatrixArray, a SIMD load never splits a cache line
+#define MATH_ALIGNMENT 64
+
+namespace trb{
+    namespace core{
+
+        /** @brief std::allocator with MATH_ALIGNMENT aligned storage */
+        template <typename T>
+        struct AlignedAllocator{
+            typedef T value_type;
+
+            AlignedAllocator(){}
+            template <typename U>
+            AlignedAllocator(const AlignedAllocator<U>&){}
+
+            T* allocate(size_t count){
+                // the pointer to free is kept in front of the aligned block
+                void* memory = std::malloc(count * sizeof(T) + MATH_ALIGNMENT + sizeof(void*));
+                if (!memory){
+                    throw std::bad_alloc();
+                }
+                uintptr_t aligned = ((uintptr_t)memory + sizeof(void*) + MATH_ALIGNMENT - 1) & ~(uintptr_t)(MATH_ALIGNMENT - 1);
+                ((void**)aligned)[-1] = memory;
+                return (T*)aligned;
+            }
+            void deallocate(T* pointer, size_t){
+                std::free(((void**)pointer)[-1]);
+            }
+        };
+        template <typename T, typename U>
+        bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&){ return true; }
+        template <typename T, typename U>
+        bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&){ return false; }
+
+        typedef std::vector<float, AlignedAllocator<float>> FloatArray;
+        typedef std::vector<glm::mat4, AlignedAllocator<glm::mat4>> MatrixArray;
+
+        /** @brief Instruction sets the batched math kernels are written for */
+        enum MathPath{
+            eMathScalar = 0,
+            /** @brief 4 values per instruction, picked at runtime on x86 CPUs that have SSE4.1 */
+            eMathSse41,
+            /** @brief 8 values per instruction, picked at runtime on x86 CPUs that have AVX2 */
+            eMathAvx2,
+            /** @brief 4 values per instruction on ARM */
+            eMathNeon
+        };
+
+        bool isMathPathSupported(MathPath path);
+        /** @brief Widest path the CPU supports */
+        MathPath getBestMathPath();
+        const char* getMathPathName(MathPath path);
+        /** @brief Path every kernel below runs on, the best one unless changed. Not thread safe, set it at startup */
+        void setMathPath(MathPath path);
+        MathPath getMathPath();
+
+        /*
+        * Kernels over arrays. Vectors, boxes and quaternions are structure of arrays, one stream per component,
+        * matrices are arrays of glm::mat4. Any pointer works, MATH_ALIGNMENT aligned arrays (FloatArray,
+        * MatrixArray) are fastest. Outputs may not overlap inputs unless noted.
+        *
+        * All paths do the same operations in the same order without fused multiply-add, so they agree to the bit.
+        * Matrix products and transforms use the operation order of glm and match it to the bit as well.
+        */
+
+        /** @brief out[i] = a[i] * b[i], out may be a or b */
+        void multiplyMatrices(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, uint32_t count);
+        /** @brief out[i] = a * b[i], e.g. a parent or view projection applied to many matrices, out may be b */
+        void multiplyMatrices(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, uint32_t count);
+
+        /** @brief (outX, outY, outZ)[i] = m * vec4(x[i], y[i], z[i], 1), no perspective divide, out may be the input */
+        void transformPoints(const glm::mat4& m, const float* x, const float* y, const float* z, float* outX, float* outY, float* outZ,
+                             uint32_t count);
+        /** @brief Like transformPoints() with w = 0, directions skip the translation */
+        void transformVectors(const glm::mat4& m, const float* x, const float* y, const float* z, float* outX, float* outY, float* outZ,
+                              uint32_t count);
+
+        /**
+        * Axis aligned boxes around boxes transformed by an affine matrix (Arvo)
+        *
+        * @param in Center xyz and half extent xyz streams, e.g. the arrays of grfx::BoundingBoxes
+        * @param out Six streams in the same order, may be in
+        */
+        void transformBoxes(const glm::mat4& m, const float* const in[6], float* const out[6], uint32_t count);
+
+        /** @brief Rotation matrices of unit quaternions given as x, y, z, w streams, same as glm::mat4_cast */
+        void quaternionsToMatrices(const float* x, const float* y, const float* z, const float* w, glm::mat4* out, uint32_t count);
+
+        /**
+        * Test spheres against a set of planes, e.g. a frustum, the sides of a portal or a light volume
+        *
+        * @param planes Unit normal pointing inwards and distance, inside is dot(xyz, p) + w >= 0
+        * @param inside Receives 1 for spheres not completely behind any plane, 0 otherwise
+        *
+        * @return Number of spheres inside
+        */
+        uint32_t testSpheres(const glm::vec4* planes, uint32_t planeCount, const float* x, const float* y, const float* z, const float* radius,
+                             uint8_t* inside, uint32_t count);
+    }
+}
+
+#endif
@@ -0,0 +1,333 @@
+#include "JobSystem.hpp"
+#include "Profiler.hpp"
+
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+
+// Failed steal attempts before an idle worker goes to sleep
+#define JOB_SPIN_COUNT 64
+
+namespace{
+    thread_local uint32_t currentWorker = UINT32_MAX;
+
+    inline uint32_t xorshift(uint32_t& state){
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+}
+
+trb::core::JobSystem* trb::core::JobSystem::instance = 0;
+
+trb::core::JobSystem* trb::core::JobSystem::getInstance(){
+    if (!instance){
+        instance = new JobSystem();
+    }
+    return instance;
+}
+
+trb::core::JobSystem::JobSystem() : externalPool(MAX_JOBS_PER_WORKER){
+    running = false;
+    queuedJobs = 0;
+    sleepingWorkers = 0;
+    externalQueued = 0;
+}
+
+trb::core::JobSystem::~JobSystem(){
+    shutdown();
+}
+
+uint32_t trb::core::JobSystem::getWorkerIndex(){
+    return currentWorker;
+}
+
+void trb::core::JobSystem::init(uint32_t threadCount){
+    if (running){
+        return;
+    }
+    if (threadCount == 0){
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    for (uint32_t i = 0; i < threadCount; i++){
+        Worker* worker = new Worker();
+        worker->random = 0x9E3779B9u * (i + 1);
+        workers.push_back(worker);
+    }
+    running = true;
+    currentWorker = 0;
+    for (uint32_t i = 1; i < threadCount; i++){
+        workers[i]->thread = std::thread(&JobSystem::workerMain, this, i);
+    }
+    resetStats();
+}
+
+void trb::core::JobSystem::shutdown(){
+    if (!running){
+        return;
+    }
+    running = false;
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    sleepCondition.notify_all();
+    for (uint32_t i = 1; i < workers.size(); i++){
+        workers[i]->thread.join();
+    }
+    for (auto worker : workers){
+        delete worker;
+    }
+    workers.clear();
+    externalQueue.clear();
+    externalQueued = 0;
+    currentWorker = UINT32_MAX;
+}
+
+trb::core::Job* trb::core::JobSystem::allocate(){
+    uint32_t index = currentWorker;
+    Job* job;
+    if (index < workers.size()){
+        Worker* worker = workers[index];
+        job = &worker->jobPool[worker->allocated++ & (MAX_JOBS_PER_WORKER - 1)];
+    }else{
+        std::lock_guard<std::mutex> lock(externalMutex);
+        job = &externalPool[externalAllocated++ & (MAX_JOBS_PER_WORKER - 1)];
+    }
+    // the ring wrapped onto a job that is still alive, the frame creates too many jobs
+    if (!job->retired.load(std::memory_order_acquire)){
+        throw std::runtime_error("job pool exhausted, raise MAX_JOBS_PER_WORKER");
+    }
+    job->function = nullptr;
+    job->parent = nullptr;
+    job->unfinished = 1;
+    job->pendingDependencies = 1;
+    job->sealed = false;
+    job->dependentCount = 0;
+    job->retired.store(false, std::memory_order_relaxed);
+    return job;
+}
+
+trb::core::Job* trb::core::JobSystem::create(JobFunction function){
+    Job* job = allocate();
+    job->function = function;
+    return job;
+}
+
+trb::core::Job* trb::core::JobSystem::createChild(Job* parent, JobFunction function){
+    parent->unfinished.fetch_add(1);
+    Job* job = allocate();
+    job->function = function;
+    job->parent = parent;
+    return job;
+}
+
+void trb::core::JobSystem::addDependency(Job* job, Job* dependency){
+    while (dependency->lock.test_and_set(std::memory_order_acquire)){
+    }
+    if (!dependency->sealed){
+        if (dependency->dependentCount == MAX_JOB_DEPENDENTS){
+            dependency->lock.clear(std::memory_order_release);
+            throw std::runtime_error("too many jobs depend on a single job, raise MAX_JOB_DEPENDENTS");
+        }
+        job->pendingDependencies.fetch_add(1);
+        dependency->dependents[dependency->dependentCount++] = job;
+    }
+    dependency->lock.clear(std::memory_order_release);
+}
+
+void trb::core::JobSystem::run(Job* job){
+    // drop the submission token, queue the job if no dependency is outstanding
+    if (job->pendingDependencies.fetch_sub(1) == 1){
+        push(job);
+    }
+}
+
+void trb::core::JobSystem::push(Job* job){
+    uint32_t index = currentWorker;
+    if (index < workers.size()){
+        if (!workers[index]->queue.push(job)){
+            // deque full, run it right here instead
+            execute(job, index);
+            return;
+        }
+    }else{
+        std::lock_guard<std::mutex> lock(externalMutex);
+        externalQueue.push_back(job);
+        externalQueued.fetch_add(1);
+    }
+    queuedJobs.fetch_add(1);
+    if (sleepingWorkers.load() > 0){
+        sleepCondition.notify_one();
+    }
+}
+
+trb::core::Job* trb::core::JobSystem::getJob(uint32_t workerIndex){
+    Worker* worker = workers[workerIndex];
+    Job* job = worker->queue.pop();
+    if (job){
+        queuedJobs.fetch_sub(1);
+        return job;
+    }
+    // steal from a random victim, then walk the others
+    uint32_t count = (uint32_t)workers.size();
+    uint32_t start = xorshift(worker->random) % count;
+    for (uint32_t i = 0; i < count; i++){
+        uint32_t victim = (start + i) % count;
+        if (victim == workerIndex){
+            continue;
+        }
+        job = workers[victim]->queue.steal();
+        if (job){
+            queuedJobs.fetch_sub(1);
+            worker->jobsStolen.fetch_add(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+    if (externalQueued.load() > 0){
+        std::lock_guard<std::mutex> lock(externalMutex);
+        if (!externalQueue.empty()){
+            job = externalQueue.front();
+            externalQueue.pop_front();
+            externalQueued.fetch_sub(1);
+            queuedJobs.fetch_sub(1);
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void trb::core::JobSystem::execute(Job* job, uint32_t workerIndex){
+    Worker* worker = workers[workerIndex];
+    auto tStart = std::chrono::steady_clock::now();
+    if (job->function){
+        job->function();
+    }
+    auto tEnd = std::chrono::steady_clock::now();
+#if TRB_PROFILE
+    // same clock as Profiler::now()
+    Profiler::zone("job", (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(tStart.time_since_epoch()).count(),
+        (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(tEnd.time_since_epoch()).count());
+#endif
+    worker->busyNanoseconds.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(tEnd - tStart).count(), std::memory_order_relaxed);
+    worker->jobsExecuted.fetch_add(1, std::memory_order_relaxed);
+    finish(job);
+}
+
+void trb::core::JobSystem::finish(Job* job){
+    if (job->unfinished.fetch_sub(1) != 1){
+        return;
+    }
+    // seal the dependent list so late addDependency calls see the job as finished
+    while (job->lock.test_and_set(std::memory_order_acquire)){
+    }
+    job->sealed = true;
+    uint32_t dependentCount = job->dependentCount;
+    job->lock.clear(std::memory_order_release);
+    for (uint32_t i = 0; i < dependentCount; i++){
+        Job* dependent = job->dependents[i];
+        if (dependent->pendingDependencies.fetch_sub(1) == 1){
+            push(dependent);
+        }
+    }
+    // publish completion last, waiters return and the owner may reuse the job from here on
+    Job* parent = job->parent;
+    job->retired.store(true, std::memory_order_release);
+    if (parent){
+        finish(parent);
+    }
+}
+
+void trb::core::JobSystem::wait(const Job* job){
+    uint32_t index = currentWorker;
+    while (!isFinished(job)){
+        Job* next = index < workers.size() ? getJob(index) : nullptr;
+        if (next){
+            execute(next, index);
+        }else{
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool trb::core::JobSystem::isFinished(const Job* job) const {
+    return job->retired.load(std::memory_order_acquire);
+}
+
+trb::core::Job* trb::core::JobSystem::parallelFor(uint32_t count, uint32_t elementSize, RangeFunction function, uint32_t minChunk){
+    Job* root = create(nullptr);
+    if (count > 0){
+        uint32_t workerCount = std::max(getWorkerCount(), 1u);
+        // a few chunks per worker so stealing can even out uneven chunks
+        uint32_t chunk = std::max(minChunk, (count + workerCount * 4 - 1) / (workerCount * 4));
+        uint32_t elementsPerLine = std::max(1u, (uint32_t)CACHE_LINE_SIZE / std::max(elementSize, 1u));
+        chunk = (chunk + elementsPerLine - 1) / elementsPerLine * elementsPerLine;
+        for (uint32_t begin = 0; begin < count; begin += chunk){
+            uint32_t end = std::min(begin + chunk, count);
+            Job* child = createChild(root, [function, begin, end](){ function(begin, end); });
+            run(child);
+        }
+    }
+    run(root);
+    return root;
+}
+
+void trb::core::JobSystem::workerMain(uint32_t workerIndex){
+    currentWorker = workerIndex;
+    TRB_PROFILE_THREAD("worker " + std::to_string(workerIndex));
+    Worker* worker = workers[workerIndex];
+    uint32_t spins = 0;
+    while (running){
+        Job* job = getJob(workerIndex);
+        if (job){
+            execute(job, workerIndex);
+            spins = 0;
+            continue;
+        }
+        if (++spins < JOB_SPIN_COUNT){
+            std::this_thread::yield();
+            continue;
+        }
+        // nothing to do for a while, sleep until a job is pushed (time out to cover a missed wake up)
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepingWorkers.fetch_add(1);
+        if (running && queuedJobs.load() <= 0){
+            worker->sleeps.fetch_add(1, std::memory_order_relaxed);
+            sleepCondition.wait_for(lock, std::chrono::milliseconds(1));
+        }
+        sleepingWorkers.fetch_sub(1);
+        spins = 0;
+    }
+}
+
+std::vector<trb::core::WorkerStats> trb::core::JobSystem::getStats(){
+    std::vector<WorkerStats> stats(workers.size());
+    double wall = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - statsStart).count();
+    for (uint32_t i = 0; i < workers.size(); i++){
+        stats[i].jobsExecuted = workers[i]->jobsExecuted.load(std::memory_order_relaxed);
+        stats[i].jobsStolen = workers[i]->jobsStolen.load(std::memory_order_relaxed);
+        stats[i].busyNanoseconds = workers[i]->busyNanoseconds.load(std::memory_order_relaxed);
+        stats[i].sleeps = workers[i]->sleeps.load(std::memory_order_relaxed);
+        stats[i].utilization = wall > 0.0 ? (float)(stats[i].busyNanoseconds / wall) : 0.0f;
+    }
+    return stats;
+}
+
+void trb::core::JobSystem::resetStats(){
+    for (auto worker : workers){
+        worker->jobsExecuted = 0;
+        worker->jobsStolen = 0;
+        worker->busyNanoseconds = 0;
+        worker->sleeps = 0;
+    }
+    statsStart = std::chrono::steady_clock::now();
+}
+
+void trb::core::JobSystem::printStats(std::ostream& out){
+    std::vector<WorkerStats> stats = getStats();
+    out << "jobs: " << stats.size() << " workers" << std::endl;
+    for (uint32_t i = 0; i < stats.size(); i++){
+        out << "  worker " << i << ": " << stats[i].jobsExecuted << " jobs, " << stats[i].jobsStolen << " stolen, "
+            << (uint32_t)(stats[i].utilization * 100.0f) << "% busy" << std::endl;
+    }
+}
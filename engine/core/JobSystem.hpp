@@ -0,0 +1,244 @@
+#ifndef TRB_CORE_JobSystem_H_
+#define TRB_CORE_JobSystem_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <iostream>
+
+// Jobs each worker can have allocated before its ring wraps around, must exceed the jobs alive per frame
+#define MAX_JOBS_PER_WORKER 4096
+// Jobs that can be waiting on the completion of a single job
+#define MAX_JOB_DEPENDENTS 8
+// Capacity of each worker deque, a full deque runs new jobs inline
+#define JOB_QUEUE_SIZE 4096
+#define CACHE_LINE_SIZE 64
+
+namespace trb{
+    namespace core{
+
+        typedef std::function<void()> JobFunction;
+        /** @brief Processes the elements [begin, end) of a parallelFor range */
+        typedef std::function<void(uint32_t begin, uint32_t end)> RangeFunction;
+
+        /**
+        * @brief Unit of work. A job is finished once its function and all of its children ran
+        */
+        struct Job{
+            JobFunction function;
+            Job* parent = nullptr;
+            /** @brief This job plus its unfinished children */
+            std::atomic<int32_t> unfinished;
+            /** @brief Submission token plus unfinished dependencies, the job is queued when it drops to zero */
+            std::atomic<int32_t> pendingDependencies;
+            /** @brief Guards dependents against a concurrent finish */
+            std::atomic_flag lock;
+            /** @brief Set once finish() is done with the job, only then it counts as finished and may be reused */
+            std::atomic<bool> retired;
+            bool sealed = false;
+            uint32_t dependentCount = 0;
+            Job* dependents[MAX_JOB_DEPENDENTS];
+
+            Job(){
+                unfinished = 0;
+                pendingDependencies = 0;
+                lock.clear();
+                retired = true;
+            }
+        };
+
+        /**
+        * @brief Chase-Lev deque. The owning worker pushes and pops at the bottom, thieves steal from the top
+        */
+        class WorkStealingQueue{
+            private:
+                // top and bottom live on separate cache lines, thieves and the owner hammer them independently
+                std::atomic<int64_t> top;
+                char padTop[CACHE_LINE_SIZE - sizeof(std::atomic<int64_t>)];
+                std::atomic<int64_t> bottom;
+                char padBottom[CACHE_LINE_SIZE - sizeof(std::atomic<int64_t>)];
+                std::atomic<Job*> jobs[JOB_QUEUE_SIZE];
+
+            public:
+                WorkStealingQueue(){
+                    top = 0;
+                    bottom = 0;
+                }
+
+                /** @return false if the queue is full */
+                bool push(Job* job){
+                    int64_t b = bottom.load(std::memory_order_relaxed);
+                    int64_t t = top.load(std::memory_order_acquire);
+                    if (b - t >= JOB_QUEUE_SIZE){
+                        return false;
+                    }
+                    jobs[b & (JOB_QUEUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+                    bottom.store(b + 1, std::memory_order_release);
+                    return true;
+                }
+
+                Job* pop(){
+                    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+                    bottom.store(b, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    int64_t t = top.load(std::memory_order_relaxed);
+                    if (t > b){
+                        // empty
+                        bottom.store(b + 1, std::memory_order_relaxed);
+                        return nullptr;
+                    }
+                    Job* job = jobs[b & (JOB_QUEUE_SIZE - 1)].load(std::memory_order_relaxed);
+                    if (t == b){
+                        // last job, race against thieves for it
+                        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)){
+                            job = nullptr;
+                        }
+                        bottom.store(b + 1, std::memory_order_relaxed);
+                    }
+                    return job;
+                }
+
+                Job* steal(){
+                    int64_t t = top.load(std::memory_order_acquire);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    int64_t b = bottom.load(std::memory_order_acquire);
+                    if (t >= b){
+                        return nullptr;
+                    }
+                    Job* job = jobs[t & (JOB_QUEUE_SIZE - 1)].load(std::memory_order_relaxed);
+                    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)){
+                        return nullptr;
+                    }
+                    return job;
+                }
+        };
+
+        /**
+        * @brief Per worker utilization counters
+        */
+        struct WorkerStats{
+            uint64_t jobsExecuted = 0;
+            uint64_t jobsStolen = 0;
+            uint64_t busyNanoseconds = 0;
+            uint64_t sleeps = 0;
+            /** @brief Fraction of wall time since the last resetStats() spent running jobs */
+            float utilization = 0.0f;
+        };
+
+        /**
+        * @brief Work stealing task scheduler with one worker per core
+        *
+        * The thread that calls init() becomes worker 0 and runs jobs whenever it waits on one.
+        * Jobs have a parent/child relationship (a parent finishes after its children) and may
+        * depend on other jobs (they are only queued once all of them finished).
+        */
+        class JobSystem{
+            private:
+                struct Worker{
+                    WorkStealingQueue queue;
+                    std::vector<Job> jobPool;
+                    uint32_t allocated = 0;
+                    uint32_t random = 0;
+                    std::thread thread;
+                    // written by the owning worker only, read racily for stats
+                    std::atomic<uint64_t> jobsExecuted;
+                    std::atomic<uint64_t> jobsStolen;
+                    std::atomic<uint64_t> busyNanoseconds;
+                    std::atomic<uint64_t> sleeps;
+
+                    Worker() : jobPool(MAX_JOBS_PER_WORKER) {
+                        jobsExecuted = 0;
+                        jobsStolen = 0;
+                        busyNanoseconds = 0;
+                        sleeps = 0;
+                    }
+                };
+
+                static JobSystem* instance;
+
+                std::vector<Worker*> workers;
+                std::atomic<bool> running;
+                std::atomic<int32_t> queuedJobs;
+                std::atomic<int32_t> sleepingWorkers;
+                std::mutex sleepMutex;
+                std::condition_variable sleepCondition;
+
+                // jobs created and submitted by threads that are not workers (e.g. loader threads)
+                std::mutex externalMutex;
+                std::deque<Job*> externalQueue;
+                std::atomic<int32_t> externalQueued;
+                std::vector<Job> externalPool;
+                uint32_t externalAllocated = 0;
+
+                std::chrono::steady_clock::time_point statsStart;
+
+                JobSystem();
+                ~JobSystem();
+
+                Job* allocate();
+                void push(Job* job);
+                Job* getJob(uint32_t workerIndex);
+                void execute(Job* job, uint32_t workerIndex);
+                void finish(Job* job);
+                void workerMain(uint32_t workerIndex);
+
+            public:
+                static JobSystem* getInstance();
+                /** @brief Get the instance and start its workers on the calling thread */
+                static JobSystem* create(uint32_t threadCount = 0){
+                    JobSystem* jobSystem = getInstance();
+                    jobSystem->init(threadCount);
+                    return jobSystem;
+                }
+
+                /**
+                * Start the workers. The calling thread becomes worker 0
+                *
+                * @param threadCount (Optional) Total workers including the calling thread, 0 picks one per core
+                */
+                void init(uint32_t threadCount = 0);
+                /** @brief Join the worker threads, outstanding jobs are dropped */
+                void shutdown();
+
+                Job* create(JobFunction function);
+                /** @brief Create a job that parent waits on */
+                Job* createChild(Job* parent, JobFunction function);
+                /** @brief Job will not start before dependency finished. Call before run(job) */
+                void addDependency(Job* job, Job* dependency);
+                /** @brief Submit a job, it is queued as soon as its dependencies finished */
+                void run(Job* job);
+                /** @brief Run other jobs on the calling thread until job finished */
+                void wait(const Job* job);
+                bool isFinished(const Job* job) const;
+
+                /**
+                * Split [0, count) into jobs. Chunks cover whole cache lines of the processed array so two workers
+                * never write to the same line
+                *
+                * @param count Number of elements
+                * @param elementSize Size of one element in bytes, used to align chunks to cache lines
+                * @param function Processes a sub range
+                * @param minChunk (Optional) Smallest number of elements per job
+                *
+                * @return Submitted root job, wait on it
+                */
+                Job* parallelFor(uint32_t count, uint32_t elementSize, RangeFunction function, uint32_t minChunk = 1);
+
+                uint32_t getWorkerCount() const { return (uint32_t)workers.size(); }
+                /** @brief Index of the calling worker, UINT32_MAX for threads outside the job system */
+                static uint32_t getWorkerIndex();
+
+                std::vector<WorkerStats> getStats();
+                void resetStats();
+                void printStats(std::ostream& out);
+        };
+    }
+}
+
+#endif
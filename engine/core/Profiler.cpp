@@ -0,0 +1,141 @@
+#include "Profiler.hpp"
+
+#include <mutex>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+
+namespace{
+    /** @brief Rings of all threads that ever recorded, never freed so traces outlive their threads */
+    struct RingRegistry{
+        std::mutex mutex;
+        std::vector<trb::core::ProfileRing*> rings;
+    };
+
+    RingRegistry& registry(){
+        static RingRegistry* instance = new RingRegistry();
+        return *instance;
+    }
+
+    void writeString(std::ostream& out, const char* text){
+        out << '"';
+        for (const char* c = text; *c; c++){
+            if (*c == '"' || *c == '\\'){
+                out << '\\' << *c;
+            } else if ((unsigned char)*c < 0x20){
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned)*c);
+                out << escaped;
+            } else{
+                out << *c;
+            }
+        }
+        out << '"';
+    }
+
+    /** @brief Microseconds since the first event of the trace, the unit Chrome traces use */
+    void writeTime(std::ostream& out, uint64_t time, uint64_t origin){
+        char text[32];
+        snprintf(text, sizeof(text), "%.3f", (double)(time - origin) / 1000.0);
+        out << text;
+    }
+}
+
+std::atomic<bool> trb::core::Profiler::enabled(true);
+thread_local trb::core::ProfileRing* trb::core::Profiler::threadRing = nullptr;
+
+trb::core::ProfileRing* trb::core::Profiler::createRing(){
+    threadRing = createTrack("");
+    return threadRing;
+}
+
+trb::core::ProfileRing* trb::core::Profiler::createTrack(const std::string& name){
+    ProfileRing* ring = new ProfileRing();
+    RingRegistry& rings = registry();
+    std::lock_guard<std::mutex> lock(rings.mutex);
+    ring->threadId = (uint32_t)rings.rings.size();
+    ring->threadName = name.empty() ? "thread " + std::to_string(ring->threadId) : name;
+    rings.rings.push_back(ring);
+    return ring;
+}
+
+void trb::core::Profiler::setThreadName(const std::string& name){
+    ProfileRing* ring = Profiler::ring();
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    ring->threadName = name;
+}
+
+void trb::core::Profiler::clear(){
+    RingRegistry& rings = registry();
+    std::lock_guard<std::mutex> lock(rings.mutex);
+    for (ProfileRing* ring : rings.rings){
+        ring->cleared = ring->head.load(std::memory_order_acquire);
+    }
+}
+
+std::vector<trb::core::ProfileThread> trb::core::Profiler::collect(){
+    RingRegistry& rings = registry();
+    std::lock_guard<std::mutex> lock(rings.mutex);
+    std::vector<ProfileThread> threads(rings.rings.size());
+    for (size_t i = 0; i < rings.rings.size(); i++){
+        ProfileRing* ring = rings.rings[i];
+        ProfileThread& thread = threads[i];
+        thread.id = ring->threadId;
+        thread.name = ring->threadName;
+
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = std::max(ring->cleared.load(), head > PROFILER_RING_SIZE ? head - PROFILER_RING_SIZE : (uint64_t)0);
+        thread.events.resize(head - first);
+        for (uint64_t e = first; e < head; e++){
+            thread.events[e - first] = ring->events[e & (PROFILER_RING_SIZE - 1)];
+        }
+        // the owner kept recording while we copied, the slot it writes next and everything it wrapped onto is stale
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t newHead = ring->head.load(std::memory_order_relaxed);
+        uint64_t valid = newHead >= PROFILER_RING_SIZE ? newHead - PROFILER_RING_SIZE + 1 : 0;
+        if (valid > first){
+            thread.events.erase(thread.events.begin(), thread.events.begin() + (size_t)std::min(valid - first, head - first));
+        }
+    }
+    return threads;
+}
+
+bool trb::core::Profiler::writeChromeTrace(const std::string& path){
+    std::vector<ProfileThread> threads = collect();
+    std::ofstream out(path.c_str());
+    if (!out){
+        return false;
+    }
+    uint64_t origin = UINT64_MAX;
+    for (const ProfileThread& thread : threads){
+        for (const ProfileEvent& event : thread.events){
+            origin = std::min(origin, event.start);
+        }
+    }
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const ProfileThread& thread : threads){
+        out << (first ? "\n" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << thread.id << ",\"args\":{\"name\":";
+        writeString(out, thread.name.c_str());
+        out << "}}";
+        first = false;
+        for (const ProfileEvent& event : thread.events){
+            out << ",\n{\"name\":";
+            writeString(out, event.name);
+            if (event.type == ProfileEventType::eZone){
+                out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread.id << ",\"ts\":";
+                writeTime(out, event.start, origin);
+                out << ",\"dur\":";
+                writeTime(out, event.end, event.start);
+                out << "}";
+            } else{
+                out << ",\"ph\":\"C\",\"pid\":1,\"tid\":" << thread.id << ",\"ts\":";
+                writeTime(out, event.start, origin);
+                out << ",\"args\":{\"value\":" << event.value << "}}";
+            }
+        }
+    }
+    out << "\n]}\n";
+    return (bool)out;
+}
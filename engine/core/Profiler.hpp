@@ -0,0 +1,177 @@
+#ifndef TRB_CORE_Profiler_H_
+#define TRB_CORE_Profiler_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+
+// Zones and counters are recorded unless disabled, release builds (NDEBUG) compile them out by default
+#ifndef TRB_PROFILE
+#ifdef NDEBUG
+#define TRB_PROFILE 0
+#else
+#define TRB_PROFILE 1
+#endif
+#endif
+
+// Events each thread keeps, older ones are overwritten. Power of two
+#define PROFILER_RING_SIZE 16384
+#define DEFAULT_TRACE_PATH "trace.json"
+
+namespace trb{
+    namespace core{
+
+        enum class ProfileEventType : uint32_t{
+            eZone = 0,
+            eCounter = 1
+        };
+
+        /** @brief Zone from start to end or a counter value at start, times in ns of Profiler::now() */
+        struct ProfileEvent{
+            /** @brief Not copied, string literals or other strings that live until the trace is written */
+            const char* name;
+            uint64_t start;
+            union{
+                uint64_t end;
+                double value;
+            };
+            ProfileEventType type;
+        };
+
+        /**
+        * @brief Events of one thread. Only the owning thread writes, readers copy and drop what was overwritten meanwhile
+        */
+        struct ProfileRing{
+            ProfileEvent events[PROFILER_RING_SIZE];
+            std::atomic<uint64_t> head;
+            /** @brief Events before this index were dropped by Profiler::clear() */
+            std::atomic<uint64_t> cleared;
+            uint32_t threadId;
+            std::string threadName;
+
+            ProfileRing() : head(0), cleared(0), threadId(0) {}
+
+            void push(const ProfileEvent& event){
+                uint64_t index = head.load(std::memory_order_relaxed);
+                events[index & (PROFILER_RING_SIZE - 1)] = event;
+                head.store(index + 1, std::memory_order_release);
+            }
+        };
+
+        /** @brief Copy of the events of one thread */
+        struct ProfileThread{
+            uint32_t id;
+            std::string name;
+            std::vector<ProfileEvent> events;
+        };
+
+        /**
+        * @brief Low overhead instrumentation of scoped zones and counters, dumped as a Chrome trace
+        *
+        * Each thread records into a ring of its own, created the first time the thread records, so recording
+        * takes no lock. writeChromeTrace() writes whatever the rings hold, the last PROFILER_RING_SIZE events
+        * of every thread, as JSON that chrome://tracing and ui.perfetto.dev open. Tracks (createTrack()) show
+        * events of other timelines, such as the GPU, converted to the same clock. Use the TRB_PROFILE_ macros,
+        * they compile to nothing when TRB_PROFILE is 0.
+        */
+        class Profiler{
+            private:
+                static std::atomic<bool> enabled;
+                static thread_local ProfileRing* threadRing;
+
+                static ProfileRing* createRing();
+
+            public:
+                /** @brief Steady clock in ns */
+                static uint64_t now(){
+                    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+                }
+
+                static ProfileRing* ring(){
+                    return threadRing ? threadRing : createRing();
+                }
+
+                static void zone(ProfileRing* track, const char* name, uint64_t start, uint64_t end){
+                    if (enabled.load(std::memory_order_relaxed)){
+                        ProfileEvent event;
+                        event.name = name;
+                        event.start = start;
+                        event.end = end;
+                        event.type = ProfileEventType::eZone;
+                        track->push(event);
+                    }
+                }
+
+                static void counter(ProfileRing* track, const char* name, double value, uint64_t time){
+                    if (enabled.load(std::memory_order_relaxed)){
+                        ProfileEvent event;
+                        event.name = name;
+                        event.start = time;
+                        event.value = value;
+                        event.type = ProfileEventType::eCounter;
+                        track->push(event);
+                    }
+                }
+
+                static void zone(const char* name, uint64_t start, uint64_t end){
+                    zone(ring(), name, start, end);
+                }
+
+                static void counter(const char* name, double value){
+                    counter(ring(), name, value, now());
+                }
+
+                /**
+                * A ring of its own that is not tied to a thread, e.g. for timestamps the GPU took. Only one thread
+                * at a time may record into it
+                */
+                static ProfileRing* createTrack(const std::string& name);
+
+                /** @brief Label of the calling thread in the trace */
+                static void setThreadName(const std::string& name);
+                /** @brief Pause or resume recording, zones already open still record on exit */
+                static void setEnabled(bool enable){ enabled = enable; }
+                static bool isEnabled(){ return enabled; }
+                /** @brief Drop everything recorded so far, e.g. to start a capture */
+                static void clear();
+                /** @brief Copy the events of every thread, may run while other threads record */
+                static std::vector<ProfileThread> collect();
+
+                /** @return false if the file could not be written */
+                static bool writeChromeTrace(const std::string& path = DEFAULT_TRACE_PATH);
+        };
+
+        /** @brief Records a zone from construction to destruction */
+        class ProfileZone{
+            private:
+                const char* name;
+                uint64_t start;
+
+            public:
+                explicit ProfileZone(const char* name) : name(name), start(Profiler::now()) {}
+                ~ProfileZone(){
+                    Profiler::zone(name, start, Profiler::now());
+                }
+        };
+    }
+}
+
+#define TRB_PROFILE_CONCAT_(a, b) a##b
+#define TRB_PROFILE_CONCAT(a, b) TRB_PROFILE_CONCAT_(a, b)
+
+#if TRB_PROFILE
+/** Zone until the end of the enclosing scope, name must outlive the trace (string literal) */
+#define TRB_PROFILE_ZONE(name) trb::core::ProfileZone TRB_PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define TRB_PROFILE_FUNCTION() TRB_PROFILE_ZONE(__FUNCTION__)
+#define TRB_PROFILE_COUNTER(name, value) trb::core::Profiler::counter(name, (double)(value))
+#define TRB_PROFILE_THREAD(name) trb::core::Profiler::setThreadName(name)
+#else
+#define TRB_PROFILE_ZONE(name) do{}while(0)
+#define TRB_PROFILE_FUNCTION() do{}while(0)
+#define TRB_PROFILE_COUNTER(name, value) do{}while(0)
+#define TRB_PROFILE_THREAD(name) do{}while(0)
+#endif
+
+#endif
@@ -0,0 +1,542 @@
+#include "Bvh.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SSE 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define BVH_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace{
+
+    /** @brief Half the surface area of a box */
+    float surface(const glm::vec3& min, const glm::vec3& max){
+        glm::vec3 e = max - min;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+
+#if defined(BVH_SSE)
+    // four lane helpers with the semantics of the scalar slab test: min / max are a < b ? a : b and a > b ? a : b
+    typedef __m128 Float4;
+    inline Float4 set1(float v){ return _mm_set1_ps(v); }
+    inline Float4 set4(float a, float b, float c, float d){ return _mm_setr_ps(a, b, c, d); }
+    inline Float4 sub(Float4 a, Float4 b){ return _mm_sub_ps(a, b); }
+    inline Float4 mul(Float4 a, Float4 b){ return _mm_mul_ps(a, b); }
+    inline Float4 min4(Float4 a, Float4 b){ return _mm_min_ps(a, b); }
+    inline Float4 max4(Float4 a, Float4 b){ return _mm_max_ps(a, b); }
+    inline void store(float* out, Float4 a){ _mm_storeu_ps(out, a); }
+    /** @brief Lanes where enter <= exit (NaN exits count as hits, like the scalar test) and enter < best */
+    inline int hitMask(Float4 enter, Float4 exit, Float4 best){
+        return _mm_movemask_ps(_mm_and_ps(_mm_cmpngt_ps(enter, exit), _mm_cmplt_ps(enter, best)));
+    }
+#elif defined(BVH_NEON)
+    typedef float32x4_t Float4;
+    inline Float4 set1(float v){ return vdupq_n_f32(v); }
+    inline Float4 set4(float a, float b, float c, float d){
+        float v[4] = { a, b, c, d };
+        return vld1q_f32(v);
+    }
+    inline Float4 sub(Float4 a, Float4 b){ return vsubq_f32(a, b); }
+    inline Float4 mul(Float4 a, Float4 b){ return vmulq_f32(a, b); }
+    inline Float4 min4(Float4 a, Float4 b){ return vbslq_f32(vcltq_f32(a, b), a, b); }
+    inline Float4 max4(Float4 a, Float4 b){ return vbslq_f32(vcgtq_f32(a, b), a, b); }
+    inline void store(float* out, Float4 a){ vst1q_f32(out, a); }
+    inline int hitMask(Float4 enter, Float4 exit, Float4 best){
+        uint32_t lanes[4];
+        vst1q_u32(lanes, vandq_u32(vmvnq_u32(vcgtq_f32(enter, exit)), vcltq_f32(enter, best)));
+        return (int)((lanes[0] & 1) | (lanes[1] & 2) | (lanes[2] & 4) | (lanes[3] & 8));
+    }
+#endif
+}
+
+int32_t trb::grfx::Bvh::allocateNode(){
+    if (!freeNodes.empty()){
+        int32_t node = freeNodes.back();
+        freeNodes.pop_back();
+        return node;
+    }
+    nodes.push_back(BvhNode());
+    parents.push_back(BVH_NULL_NODE);
+    return (int32_t)nodes.size() - 1;
+}
+
+void trb::grfx::Bvh::freeNode(int32_t node){
+    nodes[node].left = BVH_NULL_NODE;
+    nodes[node].right = BVH_NULL_NODE;
+    parents[node] = BVH_NULL_NODE;
+    freeNodes.push_back(node);
+}
+
+void trb::grfx::Bvh::clear(){
+    nodes.clear();
+    parents.clear();
+    freeNodes.clear();
+    leaves.clear();
+    freeHandles.clear();
+    root = BVH_NULL_NODE;
+}
+
+int32_t trb::grfx::Bvh::buildNode(BvhHandle* handles, uint32_t count, const glm::vec3* mins, const glm::vec3* maxs, int32_t parent){
+    int32_t node = allocateNode();
+    parents[node] = parent;
+    if (count == 1){
+        BvhHandle handle = handles[0];
+        nodes[node].min = mins[handle];
+        nodes[node].max = maxs[handle];
+        nodes[node].left = BVH_NULL_NODE;
+        nodes[node].right = (int32_t)handle;
+        leaves[handle] = node;
+        return node;
+    }
+
+    // split along the longest axis of the centroids (doubled, the factor cancels out)
+    glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+    for (uint32_t i = 0; i < count; i++){
+        glm::vec3 c = mins[handles[i]] + maxs[handles[i]];
+        centroidMin = glm::min(centroidMin, c);
+        centroidMax = glm::max(centroidMax, c);
+    }
+    glm::vec3 extent = centroidMax - centroidMin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    uint32_t mid = 0;
+    if (extent[axis] > 0.0f){
+        float scale = BVH_SAH_BINS / extent[axis];
+        auto binOf = [&](BvhHandle handle){
+            float c = mins[handle][axis] + maxs[handle][axis];
+            return std::min((uint32_t)((c - centroidMin[axis]) * scale), (uint32_t)BVH_SAH_BINS - 1);
+        };
+        glm::vec3 binMin[BVH_SAH_BINS], binMax[BVH_SAH_BINS];
+        uint32_t binCount[BVH_SAH_BINS] = {};
+        for (uint32_t b = 0; b < BVH_SAH_BINS; b++){
+            binMin[b] = glm::vec3(FLT_MAX);
+            binMax[b] = glm::vec3(-FLT_MAX);
+        }
+        for (uint32_t i = 0; i < count; i++){
+            uint32_t b = binOf(handles[i]);
+            binMin[b] = glm::min(binMin[b], mins[handles[i]]);
+            binMax[b] = glm::max(binMax[b], maxs[handles[i]]);
+            binCount[b]++;
+        }
+        // cost of splitting after bin b: area left * objects left + area right * objects right
+        float rightCost[BVH_SAH_BINS];
+        glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+        uint32_t objects = 0;
+        for (uint32_t b = BVH_SAH_BINS - 1; b > 0; b--){
+            lo = glm::min(lo, binMin[b]);
+            hi = glm::max(hi, binMax[b]);
+            objects += binCount[b];
+            rightCost[b - 1] = objects ? surface(lo, hi) * objects : 0.0f;
+        }
+        lo = glm::vec3(FLT_MAX);
+        hi = glm::vec3(-FLT_MAX);
+        objects = 0;
+        float bestCost = FLT_MAX;
+        uint32_t best = 0;
+        for (uint32_t b = 0; b + 1 < BVH_SAH_BINS; b++){
+            lo = glm::min(lo, binMin[b]);
+            hi = glm::max(hi, binMax[b]);
+            objects += binCount[b];
+            float cost = (objects ? surface(lo, hi) * objects : 0.0f) + rightCost[b];
+            if (objects > 0 && objects < count && cost < bestCost){
+                bestCost = cost;
+                best = b;
+            }
+        }
+        mid = (uint32_t)(std::partition(handles, handles + count, [&](BvhHandle handle){ return binOf(handle) <= best; }) - handles);
+    }
+    if (mid == 0 || mid == count){
+        // all centroids in one bin, split by count
+        mid = count / 2;
+        std::nth_element(handles, handles + mid, handles + count, [&](BvhHandle a, BvhHandle b){
+            return mins[a][axis] + maxs[a][axis] < mins[b][axis] + maxs[b][axis];
+        });
+    }
+
+    // depth first, the left child ends up right after its parent
+    int32_t left = buildNode(handles, mid, mins, maxs, node);
+    int32_t right = buildNode(handles + mid, count - mid, mins, maxs, node);
+    nodes[node].left = left;
+    nodes[node].right = right;
+    nodes[node].min = glm::min(nodes[left].min, nodes[right].min);
+    nodes[node].max = glm::max(nodes[left].max, nodes[right].max);
+    return node;
+}
+
+void trb::grfx::Bvh::build(std::vector<BvhHandle>& handles, const glm::vec3* mins, const glm::vec3* maxs){
+    nodes.clear();
+    parents.clear();
+    freeNodes.clear();
+    root = BVH_NULL_NODE;
+    if (handles.empty()){
+        return;
+    }
+    nodes.reserve(handles.size() * 2 - 1);
+    parents.reserve(handles.size() * 2 - 1);
+    root = buildNode(handles.data(), (uint32_t)handles.size(), mins, maxs, BVH_NULL_NODE);
+}
+
+void trb::grfx::Bvh::build(const glm::vec3* mins, const glm::vec3* maxs, uint32_t count){
+    clear();
+    leaves.assign(count, BVH_NULL_NODE);
+    std::vector<BvhHandle> handles(count);
+    std::iota(handles.begin(), handles.end(), 0);
+    build(handles, mins, maxs);
+}
+
+void trb::grfx::Bvh::rebuild(){
+    std::vector<glm::vec3> mins(leaves.size()), maxs(leaves.size());
+    std::vector<BvhHandle> handles;
+    handles.reserve(leaves.size());
+    for (BvhHandle handle = 0; handle < leaves.size(); handle++){
+        if (leaves[handle] != BVH_NULL_NODE){
+            mins[handle] = nodes[leaves[handle]].min;
+            maxs[handle] = nodes[leaves[handle]].max;
+            handles.push_back(handle);
+        }
+    }
+    build(handles, mins.data(), maxs.data());
+}
+
+trb::grfx::BvhHandle trb::grfx::Bvh::insert(const glm::vec3& min, const glm::vec3& max){
+    BvhHandle handle;
+    if (!freeHandles.empty()){
+        handle = freeHandles.back();
+        freeHandles.pop_back();
+    }else{
+        handle = (BvhHandle)leaves.size();
+        leaves.push_back(BVH_NULL_NODE);
+    }
+    int32_t leaf = allocateNode();
+    nodes[leaf].min = min;
+    nodes[leaf].max = max;
+    nodes[leaf].left = BVH_NULL_NODE;
+    nodes[leaf].right = (int32_t)handle;
+    leaves[handle] = leaf;
+    if (root == BVH_NULL_NODE){
+        root = leaf;
+        parents[leaf] = BVH_NULL_NODE;
+        return handle;
+    }
+
+    // walk down while a child is cheaper than pairing the new leaf with the node itself (Box2D's greedy descent)
+    int32_t sibling = root;
+    while (!nodes[sibling].isLeaf()){
+        const BvhNode& node = nodes[sibling];
+        float area = surface(node.min, node.max);
+        float combined = surface(glm::min(node.min, min), glm::max(node.max, max));
+        float cost = 2.0f * combined;
+        // every node below grows by at least this much
+        float inheritance = 2.0f * (combined - area);
+        auto descendCost = [&](int32_t index){
+            const BvhNode& child = nodes[index];
+            float grown = surface(glm::min(child.min, min), glm::max(child.max, max));
+            return (child.isLeaf() ? grown : grown - surface(child.min, child.max)) + inheritance;
+        };
+        float leftCost = descendCost(node.left);
+        float rightCost = descendCost(node.right);
+        if (cost < leftCost && cost < rightCost){
+            break;
+        }
+        sibling = leftCost < rightCost ? node.left : node.right;
+    }
+
+    int32_t oldParent = parents[sibling];
+    int32_t newParent = allocateNode();
+    nodes[newParent].left = sibling;
+    nodes[newParent].right = leaf;
+    nodes[newParent].min = glm::min(nodes[sibling].min, min);
+    nodes[newParent].max = glm::max(nodes[sibling].max, max);
+    parents[newParent] = oldParent;
+    parents[sibling] = newParent;
+    parents[leaf] = newParent;
+    if (oldParent == BVH_NULL_NODE){
+        root = newParent;
+    }else{
+        (nodes[oldParent].left == sibling ? nodes[oldParent].left : nodes[oldParent].right) = newParent;
+        refitUp(oldParent);
+    }
+    return handle;
+}
+
+void trb::grfx::Bvh::remove(BvhHandle handle){
+    int32_t leaf = leaves[handle];
+    leaves[handle] = BVH_NULL_NODE;
+    freeHandles.push_back(handle);
+    int32_t parent = parents[leaf];
+    freeNode(leaf);
+    if (parent == BVH_NULL_NODE){
+        root = BVH_NULL_NODE;
+        return;
+    }
+    // the sibling takes the place of the parent
+    int32_t sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+    int32_t grandParent = parents[parent];
+    parents[sibling] = grandParent;
+    freeNode(parent);
+    if (grandParent == BVH_NULL_NODE){
+        root = sibling;
+    }else{
+        (nodes[grandParent].left == parent ? nodes[grandParent].left : nodes[grandParent].right) = sibling;
+        refitUp(grandParent);
+    }
+}
+
+void trb::grfx::Bvh::refitUp(int32_t node){
+    while (node != BVH_NULL_NODE){
+        BvhNode& n = nodes[node];
+        glm::vec3 min = glm::min(nodes[n.left].min, nodes[n.right].min);
+        glm::vec3 max = glm::max(nodes[n.left].max, nodes[n.right].max);
+        if (min == n.min && max == n.max){
+            break;
+        }
+        n.min = min;
+        n.max = max;
+        node = parents[node];
+    }
+}
+
+void trb::grfx::Bvh::setBounds(BvhHandle handle, const glm::vec3& min, const glm::vec3& max){
+    nodes[leaves[handle]].min = min;
+    nodes[leaves[handle]].max = max;
+}
+
+void trb::grfx::Bvh::update(BvhHandle handle, const glm::vec3& min, const glm::vec3& max){
+    setBounds(handle, min, max);
+    refitUp(parents[leaves[handle]]);
+}
+
+void trb::grfx::Bvh::refit(){
+    if (root == BVH_NULL_NODE){
+        return;
+    }
+    // pre order, walked backwards every child comes before its parent
+    std::vector<int32_t> order;
+    order.reserve(nodes.size());
+    order.push_back(root);
+    for (size_t i = 0; i < order.size(); i++){
+        const BvhNode& node = nodes[order[i]];
+        if (!node.isLeaf()){
+            order.push_back(node.left);
+            order.push_back(node.right);
+        }
+    }
+    for (size_t i = order.size(); i-- > 0;){
+        BvhNode& node = nodes[order[i]];
+        if (!node.isLeaf()){
+            node.min = glm::min(nodes[node.left].min, nodes[node.right].min);
+            node.max = glm::max(nodes[node.left].max, nodes[node.right].max);
+        }
+    }
+}
+
+void trb::grfx::Bvh::queryAabb(const glm::vec3& min, const glm::vec3& max, std::vector<BvhHandle>* results) const {
+    if (root == BVH_NULL_NODE){
+        return;
+    }
+    BvhStack stack;
+    stack.push(root);
+    while (!stack.empty()){
+        const BvhNode& node = nodes[stack.pop()];
+        if (glm::any(glm::greaterThan(node.min, max)) || glm::any(glm::lessThan(node.max, min))){
+            continue;
+        }
+        if (node.isLeaf()){
+            results->push_back((BvhHandle)node.right);
+        }else{
+            stack.push(node.right);
+            stack.push(node.left);
+        }
+    }
+}
+
+void trb::grfx::Bvh::querySphere(const glm::vec3& center, float radius, std::vector<BvhHandle>* results) const {
+    if (root == BVH_NULL_NODE){
+        return;
+    }
+    BvhStack stack;
+    stack.push(root);
+    while (!stack.empty()){
+        const BvhNode& node = nodes[stack.pop()];
+        glm::vec3 d = center - glm::clamp(center, node.min, node.max);
+        if (glm::dot(d, d) > radius * radius){
+            continue;
+        }
+        if (node.isLeaf()){
+            results->push_back((BvhHandle)node.right);
+        }else{
+            stack.push(node.right);
+            stack.push(node.left);
+        }
+    }
+}
+
+void trb::grfx::Bvh::queryFrustum(const Frustum& frustum, std::vector<BvhHandle>* results) const {
+    if (root == BVH_NULL_NODE){
+        return;
+    }
+    // planes the node is not completely inside of yet, children only test those
+    const uint32_t allPlanes = (1u << Frustum::ePlaneCount) - 1;
+    std::vector<std::pair<int32_t, uint32_t>> stack;
+    stack.push_back(std::make_pair(root, allPlanes));
+    BvhStack inside;
+    while (!stack.empty()){
+        int32_t index = stack.back().first;
+        uint32_t planes = stack.back().second;
+        stack.pop_back();
+        const BvhNode& node = nodes[index];
+        glm::vec3 center = (node.min + node.max) * 0.5f;
+        glm::vec3 extent = (node.max - node.min) * 0.5f;
+        bool outside = false;
+        for (int p = 0; p < Frustum::ePlaneCount && !outside; p++){
+            if (!(planes & (1u << p))){
+                continue;
+            }
+            const glm::vec4& plane = frustum.planes[p];
+            float d = glm::dot(glm::vec3(plane), center) + plane.w;
+            float r = glm::dot(glm::abs(glm::vec3(plane)), extent);
+            outside = d + r < 0.0f;
+            if (d - r >= 0.0f){
+                planes &= ~(1u << p);
+            }
+        }
+        if (outside){
+            continue;
+        }
+        if (planes == 0){
+            // completely inside, take the whole subtree
+            inside.push(index);
+            while (!inside.empty()){
+                const BvhNode& n = nodes[inside.pop()];
+                if (n.isLeaf()){
+                    results->push_back((BvhHandle)n.right);
+                }else{
+                    inside.push(n.right);
+                    inside.push(n.left);
+                }
+            }
+        }else if (node.isLeaf()){
+            results->push_back((BvhHandle)node.right);
+        }else{
+            stack.push_back(std::make_pair(node.right, planes));
+            stack.push_back(std::make_pair(node.left, planes));
+        }
+    }
+}
+
+void trb::grfx::Bvh::tracePacket(const BvhRay* rays, uint32_t count, BvhRayHit* hits) const {
+#if defined(BVH_SSE) || defined(BVH_NEON)
+    // unused lanes get a negative best distance, nothing is ever closer
+    float ox[4], oy[4], oz[4], ix[4], iy[4], iz[4];
+    float best[4];
+    for (uint32_t k = 0; k < 4; k++){
+        const BvhRay& ray = rays[k < count ? k : 0];
+        ox[k] = ray.origin.x;
+        oy[k] = ray.origin.y;
+        oz[k] = ray.origin.z;
+        ix[k] = 1.0f / ray.direction.x;
+        iy[k] = 1.0f / ray.direction.y;
+        iz[k] = 1.0f / ray.direction.z;
+        best[k] = k < count ? ray.maxDistance : -1.0f;
+        if (k < count){
+            hits[k] = BvhRayHit();
+            hits[k].distance = ray.maxDistance;
+        }
+    }
+    if (root == BVH_NULL_NODE){
+        return;
+    }
+    Float4 originX = set4(ox[0], ox[1], ox[2], ox[3]), originY = set4(oy[0], oy[1], oy[2], oy[3]), originZ = set4(oz[0], oz[1], oz[2], oz[3]);
+    Float4 inverseX = set4(ix[0], ix[1], ix[2], ix[3]), inverseY = set4(iy[0], iy[1], iy[2], iy[3]), inverseZ = set4(iz[0], iz[1], iz[2], iz[3]);
+    Float4 zero = set1(0.0f);
+    Float4 bestDistance = set4(best[0], best[1], best[2], best[3]);
+
+    BvhStack stack;
+    stack.push(root);
+    while (!stack.empty()){
+        const BvhNode& node = nodes[stack.pop()];
+        // the scalar slab test on four rays
+        Float4 t0 = mul(sub(set1(node.min.x), originX), inverseX), t1 = mul(sub(set1(node.max.x), originX), inverseX);
+        Float4 first = min4(t0, t1), last = max4(t0, t1);
+        t0 = mul(sub(set1(node.min.y), originY), inverseY);
+        t1 = mul(sub(set1(node.max.y), originY), inverseY);
+        first = max4(first, min4(t0, t1));
+        last = min4(last, max4(t0, t1));
+        t0 = mul(sub(set1(node.min.z), originZ), inverseZ);
+        t1 = mul(sub(set1(node.max.z), originZ), inverseZ);
+        first = max4(first, min4(t0, t1));
+        last = min4(last, max4(t0, t1));
+        Float4 enter = max4(first, zero);
+        int mask = hitMask(enter, last, bestDistance);
+        if (mask == 0){
+            continue;
+        }
+        if (node.isLeaf()){
+            float distances[4];
+            store(distances, enter);
+            for (uint32_t k = 0; k < 4; k++){
+                if (mask & (1 << k)){
+                    best[k] = distances[k];
+                    hits[k].handle = (BvhHandle)node.right;
+                    hits[k].distance = distances[k];
+                }
+            }
+            bestDistance = set4(best[0], best[1], best[2], best[3]);
+            continue;
+        }
+        // children in the order the first active ray meets them
+        uint32_t lane = 0;
+        while (!(mask & (1 << lane))){
+            lane++;
+        }
+        const BvhNode& left = nodes[node.left];
+        const BvhNode& right = nodes[node.right];
+        bool leftFirst = glm::dot(left.min + left.max - right.min - right.max, rays[lane].direction) < 0.0f;
+        stack.push(leftFirst ? node.right : node.left);
+        stack.push(leftFirst ? node.left : node.right);
+    }
+#else
+    for (uint32_t k = 0; k < count; k++){
+        raycast(rays[k], &hits[k]);
+    }
+#endif
+}
+
+void trb::grfx::Bvh::raycast(const BvhRay* rays, uint32_t count, BvhRayHit* hits, core::JobSystem* jobs) const {
+    auto trace = [&](uint32_t begin, uint32_t end){
+        for (uint32_t i = begin; i < end; i += 4){
+            tracePacket(rays + i, std::min(4u, end - i), hits + i);
+        }
+    };
+    if (!jobs || count <= BVH_RAYS_PER_JOB){
+        trace(0, count);
+        return;
+    }
+    uint32_t packets = (count + 3) / 4;
+    jobs->wait(jobs->parallelFor(packets, 4 * sizeof(BvhRayHit), [&](uint32_t begin, uint32_t end){
+        trace(begin * 4, std::min(count, end * 4));
+    }, BVH_RAYS_PER_JOB / 4));
+}
+
+float trb::grfx::Bvh::getSahCost() const {
+    if (root == BVH_NULL_NODE || nodes[root].isLeaf()){
+        return 0.0f;
+    }
+    float rootArea = surface(nodes[root].min, nodes[root].max);
+    double cost = 0.0;
+    BvhStack stack;
+    stack.push(root);
+    while (!stack.empty()){
+        const BvhNode& node = nodes[stack.pop()];
+        if (!node.isLeaf()){
+            cost += surface(node.min, node.max);
+            stack.push(node.left);
+            stack.push(node.right);
+        }
+    }
+    return rootArea > 0.0f ? (float)(cost / rootArea) : 0.0f;
+}
@@ -0,0 +1,225 @@
+#ifndef TRB_GFX_Bvh_H_
+#define TRB_GFX_Bvh_H_
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cfloat>
+#include <vector>
+
+#include "Frustum.hpp"
+#include "../core/JobSystem.hpp"
+
+// Centroid bins the SAH build evaluates per split
+#define BVH_SAH_BINS 16
+// Rays one job traces in a batched raycast, a multiple of the packet width
+#define BVH_RAYS_PER_JOB 256
+// Traversal stack entries kept on the stack, deeper trees spill to the heap
+#define BVH_STACK_SIZE 64
+#define BVH_NULL_NODE -1
+#define BVH_NULL_HANDLE UINT32_MAX
+
+namespace trb{
+    namespace grfx{
+
+        /** @brief Object in a Bvh, stays valid until the object is removed */
+        typedef uint32_t BvhHandle;
+
+        /**
+        * @brief Node of the flattened tree, two per cache line
+        *
+        * Leaves hold exactly one object so objects can be inserted and removed one at a time.
+        */
+        struct BvhNode{
+            glm::vec3 min;
+            /** @brief First child, BVH_NULL_NODE for leaves */
+            int32_t left;
+            glm::vec3 max;
+            /** @brief Second child, the BvhHandle of the object for leaves */
+            int32_t right;
+
+            bool isLeaf() const { return left == BVH_NULL_NODE; }
+        };
+
+        /** @brief Traversal stack of node indices */
+        class BvhStack{
+            private:
+                int32_t fixed[BVH_STACK_SIZE];
+                uint32_t size = 0;
+                std::vector<int32_t> spill;
+
+            public:
+                bool empty() const { return size == 0; }
+                void push(int32_t node){
+                    if (size < BVH_STACK_SIZE){
+                        fixed[size++] = node;
+                    }else{
+                        spill.push_back(node);
+                        size++;
+                    }
+                }
+                int32_t pop(){
+                    if (--size >= BVH_STACK_SIZE){
+                        int32_t node = spill.back();
+                        spill.pop_back();
+                        return node;
+                    }
+                    return fixed[size];
+                }
+        };
+
+        struct BvhRay{
+            glm::vec3 origin;
+            /** @brief Does not have to be normalized, distances are in units of its length */
+            glm::vec3 direction;
+            float maxDistance = FLT_MAX;
+        };
+
+        struct BvhRayHit{
+            BvhHandle handle = BVH_NULL_HANDLE;
+            float distance = FLT_MAX;
+        };
+
+        /**
+        * @brief Dynamic bounding volume hierarchy over axis aligned boxes
+        *
+        * build() creates the tree top down with a binned surface area heuristic and lays the nodes out depth first,
+        * the left child of a node is the node after it. Moving objects are handled with update() (refits the path
+        * to the root) or setBounds() followed by one refit(); insert() places new objects next to the sibling that
+        * grows the tree surface least and remove() takes them out again. Heavy editing degrades the tree, rebuild()
+        * restores SAH quality and the layout without changing handles.
+        *
+        * Ray queries report the closest object box along the ray, the template version takes a callback to intersect
+        * the actual geometry. Batches of rays are traced as 4 ray SIMD packets.
+        */
+        class Bvh{
+            private:
+                std::vector<BvhNode> nodes;
+                std::vector<int32_t> parents;
+                std::vector<int32_t> freeNodes;
+                /** @brief Leaf node of every handle, BVH_NULL_NODE for free handles */
+                std::vector<int32_t> leaves;
+                std::vector<BvhHandle> freeHandles;
+                int32_t root = BVH_NULL_NODE;
+
+                int32_t allocateNode();
+                void freeNode(int32_t node);
+                int32_t buildNode(BvhHandle* handles, uint32_t count, const glm::vec3* mins, const glm::vec3* maxs, int32_t parent);
+                void build(std::vector<BvhHandle>& handles, const glm::vec3* mins, const glm::vec3* maxs);
+                /** @brief Recompute the boxes from node up to the root, stops at the first node that did not change */
+                void refitUp(int32_t node);
+                void tracePacket(const BvhRay* rays, uint32_t count, BvhRayHit* hits) const;
+
+                static void slab(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inverse, float* enter, float* exit){
+                    // a < b ? a : b like _mm_min_ps, so the scalar and the packet path agree on NaNs from 0 * inf
+                    auto minf = [](float a, float b){ return a < b ? a : b; };
+                    auto maxf = [](float a, float b){ return a > b ? a : b; };
+                    float t0 = (node.min.x - origin.x) * inverse.x, t1 = (node.max.x - origin.x) * inverse.x;
+                    float first = minf(t0, t1), last = maxf(t0, t1);
+                    t0 = (node.min.y - origin.y) * inverse.y;
+                    t1 = (node.max.y - origin.y) * inverse.y;
+                    first = maxf(first, minf(t0, t1));
+                    last = minf(last, maxf(t0, t1));
+                    t0 = (node.min.z - origin.z) * inverse.z;
+                    t1 = (node.max.z - origin.z) * inverse.z;
+                    first = maxf(first, minf(t0, t1));
+                    last = minf(last, maxf(t0, t1));
+                    *enter = maxf(first, 0.0f);
+                    *exit = last;
+                }
+
+            public:
+                /** @brief Replace the content with count boxes built with the SAH, their handles are 0 to count - 1 */
+                void build(const glm::vec3* mins, const glm::vec3* maxs, uint32_t count);
+                /** @brief SAH build over the current boxes, handles stay valid */
+                void rebuild();
+                void clear();
+
+                BvhHandle insert(const glm::vec3& min, const glm::vec3& max);
+                void remove(BvhHandle handle);
+                /** @brief Move an object and refit its path to the root */
+                void update(BvhHandle handle, const glm::vec3& min, const glm::vec3& max);
+                /** @brief Move an object without refitting, call refit() once after moving many */
+                void setBounds(BvhHandle handle, const glm::vec3& min, const glm::vec3& max);
+                /** @brief Recompute every inner box bottom up */
+                void refit();
+
+                void queryAabb(const glm::vec3& min, const glm::vec3& max, std::vector<BvhHandle>* results) const;
+                void querySphere(const glm::vec3& center, float radius, std::vector<BvhHandle>* results) const;
+                /** @brief Objects intersecting the frustum, subtrees completely inside are taken without further tests */
+                void queryFrustum(const Frustum& frustum, std::vector<BvhHandle>* results) const;
+
+                /**
+                * Closest object along a ray
+                *
+                * @param intersect bool(BvhHandle handle, float enter, float* distance): called for every object box the ray
+                *        enters closer than the current hit, returns whether the object itself is hit and where
+                *
+                * @return Whether anything was hit
+                */
+                template <typename Intersect>
+                bool raycast(const BvhRay& ray, Intersect intersect, BvhRayHit* hit) const {
+                    *hit = BvhRayHit();
+                    hit->distance = ray.maxDistance;
+                    if (root == BVH_NULL_NODE){
+                        return false;
+                    }
+                    glm::vec3 inverse = 1.0f / ray.direction;
+                    BvhStack stack;
+                    stack.push(root);
+                    while (!stack.empty()){
+                        const BvhNode& node = nodes[stack.pop()];
+                        float enter, exit;
+                        slab(node, ray.origin, inverse, &enter, &exit);
+                        if (enter > exit || enter >= hit->distance){
+                            continue;
+                        }
+                        if (node.isLeaf()){
+                            float distance;
+                            if (intersect((BvhHandle)node.right, enter, &distance) && distance < hit->distance){
+                                hit->handle = (BvhHandle)node.right;
+                                hit->distance = distance;
+                            }
+                            continue;
+                        }
+                        // nearer child on top, its hit may prune the other one
+                        const BvhNode& left = nodes[node.left];
+                        const BvhNode& right = nodes[node.right];
+                        bool leftFirst = glm::dot(left.min + left.max - right.min - right.max, ray.direction) < 0.0f;
+                        stack.push(leftFirst ? node.right : node.left);
+                        stack.push(leftFirst ? node.left : node.right);
+                    }
+                    return hit->handle != BVH_NULL_HANDLE;
+                }
+
+                /** @brief Closest object box along a ray */
+                bool raycast(const BvhRay& ray, BvhRayHit* hit) const {
+                    return raycast(ray, [](BvhHandle, float enter, float* distance){
+                        *distance = enter;
+                        return true;
+                    }, hit);
+                }
+
+                /**
+                * Closest object box of many rays, traced in packets of 4 neighbouring rays
+                *
+                * Packets pay off for coherent rays (camera rays of a screen tile, shadow rays to a light), incoherent
+                * rays are traced about as fast as one by one.
+                *
+                * @param jobs (Optional) Trace BVH_RAYS_PER_JOB rays per job on the job system and wait for them
+                */
+                void raycast(const BvhRay* rays, uint32_t count, BvhRayHit* hits, core::JobSystem* jobs = nullptr) const;
+
+                bool isValid(BvhHandle handle) const { return handle < leaves.size() && leaves[handle] != BVH_NULL_NODE; }
+                const BvhNode& getLeaf(BvhHandle handle) const { return nodes[leaves[handle]]; }
+                uint32_t getObjectCount() const { return (uint32_t)(leaves.size() - freeHandles.size()); }
+                uint32_t getNodeCount() const { return (uint32_t)(nodes.size() - freeNodes.size()); }
+                /** @brief Sum of the inner node surface areas relative to the root, the SAH cost of the tree */
+                float getSahCost() const;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,276 @@
+#include "Frustum.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_SSE 1
+#include <immintrin.h>
+// built with a target attribute and only called when the CPU reports AVX2
+#if defined(__GNUC__)
+#define FRUSTUM_AVX2 1
+#endif
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FRUSTUM_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace{
+
+    /**
+    * Test the volumes [begin, end) and write the visible indices to out, returns how many were visible
+    *
+    * planes holds the six planes as xyzw. streams are x, y, z, radius for spheres and center xyz, extent xyz for boxes.
+    * All paths evaluate dot(n, center) + w + radius >= 0 with the same operation order, so they agree to the bit.
+    */
+    typedef uint32_t (*CullFunction)(const float* planes, const float* const* streams, uint32_t begin, uint32_t end, uint32_t* out);
+
+    template <bool Boxes>
+    uint32_t cullScalar(const float* planes, const float* const* s, uint32_t begin, uint32_t end, uint32_t* out){
+        uint32_t count = 0;
+        for (uint32_t i = begin; i < end; i++){
+            bool inside = true;
+            for (int p = 0; p < trb::grfx::Frustum::ePlaneCount && inside; p++){
+                const float* n = planes + p * 4;
+                float d = n[0] * s[0][i] + n[1] * s[1][i] + n[2] * s[2][i] + n[3];
+                float r = Boxes ? std::fabs(n[0]) * s[3][i] + std::fabs(n[1]) * s[4][i] + std::fabs(n[2]) * s[5][i] : s[3][i];
+                inside = d + r >= 0.0f;
+            }
+            // branchless compaction, the slot is overwritten by the next index unless this one is visible
+            out[count] = i;
+            count += inside ? 1 : 0;
+        }
+        return count;
+    }
+
+#ifdef FRUSTUM_SSE
+    template <bool Boxes>
+    uint32_t cullSse(const float* planes, const float* const* s, uint32_t begin, uint32_t end, uint32_t* out){
+        __m128 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+        for (int p = 0; p < 6; p++){
+            nx[p] = _mm_set1_ps(planes[p * 4]);
+            ny[p] = _mm_set1_ps(planes[p * 4 + 1]);
+            nz[p] = _mm_set1_ps(planes[p * 4 + 2]);
+            nw[p] = _mm_set1_ps(planes[p * 4 + 3]);
+            ax[p] = _mm_set1_ps(std::fabs(planes[p * 4]));
+            ay[p] = _mm_set1_ps(std::fabs(planes[p * 4 + 1]));
+            az[p] = _mm_set1_ps(std::fabs(planes[p * 4 + 2]));
+        }
+        __m128 zero = _mm_setzero_ps();
+        uint32_t count = 0;
+        uint32_t i = begin;
+        for (; i + 4 <= end; i += 4){
+            __m128 x = _mm_loadu_ps(s[0] + i);
+            __m128 y = _mm_loadu_ps(s[1] + i);
+            __m128 z = _mm_loadu_ps(s[2] + i);
+            __m128 e0 = _mm_loadu_ps(s[3] + i);
+            __m128 e1 = Boxes ? _mm_loadu_ps(s[4] + i) : zero;
+            __m128 e2 = Boxes ? _mm_loadu_ps(s[5] + i) : zero;
+            __m128 inside = _mm_cmpeq_ps(zero, zero);
+            for (int p = 0; p < 6; p++){
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], x), _mm_mul_ps(ny[p], y)), _mm_mul_ps(nz[p], z)), nw[p]);
+                __m128 r = Boxes ? _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], e0), _mm_mul_ps(ay[p], e1)), _mm_mul_ps(az[p], e2)) : e0;
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), zero));
+            }
+            int mask = _mm_movemask_ps(inside);
+            for (uint32_t k = 0; k < 4; k++){
+                out[count] = i + k;
+                count += (mask >> k) & 1;
+            }
+        }
+        return count + cullScalar<Boxes>(planes, s, i, end, out + count);
+    }
+#endif
+
+#ifdef FRUSTUM_AVX2
+    template <bool Boxes>
+    __attribute__((target("avx2")))
+    uint32_t cullAvx2(const float* planes, const float* const* s, uint32_t begin, uint32_t end, uint32_t* out){
+        __m256 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+        for (int p = 0; p < 6; p++){
+            nx[p] = _mm256_set1_ps(planes[p * 4]);
+            ny[p] = _mm256_set1_ps(planes[p * 4 + 1]);
+            nz[p] = _mm256_set1_ps(planes[p * 4 + 2]);
+            nw[p] = _mm256_set1_ps(planes[p * 4 + 3]);
+            ax[p] = _mm256_set1_ps(std::fabs(planes[p * 4]));
+            ay[p] = _mm256_set1_ps(std::fabs(planes[p * 4 + 1]));
+            az[p] = _mm256_set1_ps(std::fabs(planes[p * 4 + 2]));
+        }
+        __m256 zero = _mm256_setzero_ps();
+        uint32_t count = 0;
+        uint32_t i = begin;
+        for (; i + 8 <= end; i += 8){
+            __m256 x = _mm256_loadu_ps(s[0] + i);
+            __m256 y = _mm256_loadu_ps(s[1] + i);
+            __m256 z = _mm256_loadu_ps(s[2] + i);
+            __m256 e0 = _mm256_loadu_ps(s[3] + i);
+            __m256 e1 = Boxes ? _mm256_loadu_ps(s[4] + i) : zero;
+            __m256 e2 = Boxes ? _mm256_loadu_ps(s[5] + i) : zero;
+            __m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+            for (int p = 0; p < 6; p++){
+                // no fma, it would round differently from the other paths
+                __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx[p], x), _mm256_mul_ps(ny[p], y)), _mm256_mul_ps(nz[p], z)), nw[p]);
+                __m256 r = Boxes ? _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax[p], e0), _mm256_mul_ps(ay[p], e1)), _mm256_mul_ps(az[p], e2)) : e0;
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r), zero, _CMP_GE_OQ));
+            }
+            int mask = _mm256_movemask_ps(inside);
+            for (uint32_t k = 0; k < 8; k++){
+                out[count] = i + k;
+                count += (mask >> k) & 1;
+            }
+        }
+        return count + cullScalar<Boxes>(planes, s, i, end, out + count);
+    }
+#endif
+
+#ifdef FRUSTUM_NEON
+    template <bool Boxes>
+    uint32_t cullNeon(const float* planes, const float* const* s, uint32_t begin, uint32_t end, uint32_t* out){
+        float32x4_t nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+        for (int p = 0; p < 6; p++){
+            nx[p] = vdupq_n_f32(planes[p * 4]);
+            ny[p] = vdupq_n_f32(planes[p * 4 + 1]);
+            nz[p] = vdupq_n_f32(planes[p * 4 + 2]);
+            nw[p] = vdupq_n_f32(planes[p * 4 + 3]);
+            ax[p] = vdupq_n_f32(std::fabs(planes[p * 4]));
+            ay[p] = vdupq_n_f32(std::fabs(planes[p * 4 + 1]));
+            az[p] = vdupq_n_f32(std::fabs(planes[p * 4 + 2]));
+        }
+        float32x4_t zero = vdupq_n_f32(0.0f);
+        uint32_t count = 0;
+        uint32_t i = begin;
+        for (; i + 4 <= end; i += 4){
+            float32x4_t x = vld1q_f32(s[0] + i);
+            float32x4_t y = vld1q_f32(s[1] + i);
+            float32x4_t z = vld1q_f32(s[2] + i);
+            float32x4_t e0 = vld1q_f32(s[3] + i);
+            float32x4_t e1 = Boxes ? vld1q_f32(s[4] + i) : zero;
+            float32x4_t e2 = Boxes ? vld1q_f32(s[5] + i) : zero;
+            uint32x4_t inside = vdupq_n_u32(0xffffffffu);
+            for (int p = 0; p < 6; p++){
+                // separate multiply and add (no vmlaq/vfmaq) to round like the other paths
+                float32x4_t d = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(nx[p], x), vmulq_f32(ny[p], y)), vmulq_f32(nz[p], z)), nw[p]);
+                float32x4_t r = Boxes ? vaddq_f32(vaddq_f32(vmulq_f32(ax[p], e0), vmulq_f32(ay[p], e1)), vmulq_f32(az[p], e2)) : e0;
+                inside = vandq_u32(inside, vcgeq_f32(vaddq_f32(d, r), zero));
+            }
+            uint32_t lanes[4];
+            vst1q_u32(lanes, inside);
+            for (uint32_t k = 0; k < 4; k++){
+                out[count] = i + k;
+                count += lanes[k] & 1;
+            }
+        }
+        return count + cullScalar<Boxes>(planes, s, i, end, out + count);
+    }
+#endif
+
+    CullFunction getCullFunction(trb::grfx::CullPath path, bool boxes){
+        switch (path){
+#ifdef FRUSTUM_SSE
+            case trb::grfx::eCullSse:
+                return boxes ? cullSse<true> : cullSse<false>;
+#endif
+#ifdef FRUSTUM_AVX2
+            case trb::grfx::eCullAvx2:
+                return boxes ? cullAvx2<true> : cullAvx2<false>;
+#endif
+#ifdef FRUSTUM_NEON
+            case trb::grfx::eCullNeon:
+                return boxes ? cullNeon<true> : cullNeon<false>;
+#endif
+            default:
+                return boxes ? cullScalar<true> : cullScalar<false>;
+        }
+    }
+}
+
+bool trb::grfx::isCullPathSupported(CullPath path){
+    switch (path){
+        case eCullScalar:
+            return true;
+#ifdef FRUSTUM_SSE
+        case eCullSse:
+            return true;
+#endif
+#ifdef FRUSTUM_AVX2
+        case eCullAvx2:
+            return __builtin_cpu_supports("avx2") != 0;
+#endif
+#ifdef FRUSTUM_NEON
+        case eCullNeon:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+trb::grfx::CullPath trb::grfx::getBestCullPath(){
+    static const CullPath widestFirst[] = { eCullAvx2, eCullNeon, eCullSse };
+    for (CullPath path : widestFirst){
+        if (isCullPathSupported(path)){
+            return path;
+        }
+    }
+    return eCullScalar;
+}
+
+const char* trb::grfx::getCullPathName(CullPath path){
+    switch (path){
+        case eCullSse:
+            return "SSE";
+        case eCullAvx2:
+            return "AVX2";
+        case eCullNeon:
+            return "NEON";
+        default:
+            return "scalar";
+    }
+}
+
+void trb::grfx::FrustumCuller::setPath(CullPath path){
+    this->path = isCullPathSupported(path) ? path : eCullScalar;
+}
+
+template <typename Kernel>
+uint32_t trb::grfx::FrustumCuller::run(uint32_t count, uint32_t* visible, core::JobSystem* jobs, Kernel kernel){
+    if (!jobs || count <= FRUSTUM_CULL_CHUNK){
+        return kernel(0, count, visible);
+    }
+    // every chunk compacts into its own slice of visible, the slices are closed up afterwards
+    uint32_t chunks = (count + FRUSTUM_CULL_CHUNK - 1) / FRUSTUM_CULL_CHUNK;
+    chunkCounts.assign(chunks, 0);
+    jobs->wait(jobs->parallelFor(chunks, CACHE_LINE_SIZE, [&](uint32_t begin, uint32_t end){
+        for (uint32_t c = begin; c < end; c++){
+            uint32_t first = c * FRUSTUM_CULL_CHUNK;
+            chunkCounts[c] = kernel(first, std::min(count, first + FRUSTUM_CULL_CHUNK), visible + first);
+        }
+    }));
+    uint32_t total = chunkCounts[0];
+    for (uint32_t c = 1; c < chunks; c++){
+        memmove(visible + total, visible + c * FRUSTUM_CULL_CHUNK, chunkCounts[c] * sizeof(uint32_t));
+        total += chunkCounts[c];
+    }
+    return total;
+}
+
+uint32_t trb::grfx::FrustumCuller::cull(const Frustum& frustum, const BoundingSpheres& spheres, uint32_t* visible, core::JobSystem* jobs){
+    const float* planes = &frustum.planes[0].x;
+    const float* streams[] = { spheres.x.data(), spheres.y.data(), spheres.z.data(), spheres.radius.data() };
+    CullFunction function = getCullFunction(path, false);
+    return run(spheres.size(), visible, jobs, [&](uint32_t begin, uint32_t end, uint32_t* out){
+        return function(planes, streams, begin, end, out);
+    });
+}
+
+uint32_t trb::grfx::FrustumCuller::cull(const Frustum& frustum, const BoundingBoxes& boxes, uint32_t* visible, core::JobSystem* jobs){
+    const float* planes = &frustum.planes[0].x;
+    const float* streams[] = { boxes.centerX.data(), boxes.centerY.data(), boxes.centerZ.data(),
+                               boxes.extentX.data(), boxes.extentY.data(), boxes.extentZ.data() };
+    CullFunction function = getCullFunction(path, true);
+    return run(boxes.size(), visible, jobs, [&](uint32_t begin, uint32_t end, uint32_t* out){
+        return function(planes, streams, begin, end, out);
+    });
+}
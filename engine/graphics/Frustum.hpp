@@ -0,0 +1,186 @@
+#ifndef TRB_GFX_Frustum_H_
+#define TRB_GFX_Frustum_H_
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "../core/JobSystem.hpp"
+
+// Objects one culling job tests, a multiple of the widest SIMD path
+#define FRUSTUM_CULL_CHUNK 4096
+
+namespace trb{
+    namespace grfx{
+
+        /**
+        * @brief The six planes of a camera frustum
+        *
+        * Planes are xyz unit normal pointing into the frustum and w distance, a point p is inside a plane when
+        * dot(xyz, p) + w >= 0.
+        */
+        struct Frustum{
+            enum Plane{
+                eLeft = 0,
+                eRight,
+                eBottom,
+                eTop,
+                eNear,
+                eFar,
+                ePlaneCount
+            };
+            glm::vec4 planes[ePlaneCount];
+
+            /**
+            * Extract the world space planes from the camera matrices (Gribb and Hartmann), clip depth is zero to one
+            *
+            * @param view E.g. Camera::matrices.view
+            * @param projection E.g. Camera::matrices.perspective
+            */
+            void update(const glm::mat4& view, const glm::mat4& projection){
+                glm::mat4 m = projection * view;
+                glm::vec4 rows[4];
+                for (int i = 0; i < 4; i++){
+                    rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+                }
+                planes[eLeft] = rows[3] + rows[0];
+                planes[eRight] = rows[3] - rows[0];
+                planes[eBottom] = rows[3] + rows[1];
+                planes[eTop] = rows[3] - rows[1];
+                planes[eNear] = rows[2];
+                planes[eFar] = rows[3] - rows[2];
+                for (auto& plane : planes){
+                    plane /= glm::length(glm::vec3(plane));
+                }
+            }
+
+            bool intersectsSphere(const glm::vec3& center, float radius) const {
+                for (auto& plane : planes){
+                    if (glm::dot(glm::vec3(plane), center) + plane.w < -radius){
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            bool intersectsBox(const glm::vec3& center, const glm::vec3& extent) const {
+                for (auto& plane : planes){
+                    if (glm::dot(glm::vec3(plane), center) + plane.w < -glm::dot(glm::abs(glm::vec3(plane)), extent)){
+                        return false;
+                    }
+                }
+                return true;
+            }
+        };
+
+        /** @brief Bounding spheres as structure of arrays, one SIMD load fetches the same component of 4-8 objects */
+        struct BoundingSpheres{
+            std::vector<float> x;
+            std::vector<float> y;
+            std::vector<float> z;
+            std::vector<float> radius;
+
+            uint32_t size() const { return (uint32_t)x.size(); }
+            void resize(uint32_t count){
+                x.resize(count);
+                y.resize(count);
+                z.resize(count);
+                radius.resize(count);
+            }
+            void set(uint32_t index, const glm::vec3& center, float r){
+                x[index] = center.x;
+                y[index] = center.y;
+                z[index] = center.z;
+                radius[index] = r;
+            }
+        };
+
+        /** @brief Axis aligned boxes as center and half extent, structure of arrays */
+        struct BoundingBoxes{
+            std::vector<float> centerX;
+            std::vector<float> centerY;
+            std::vector<float> centerZ;
+            std::vector<float> extentX;
+            std::vector<float> extentY;
+            std::vector<float> extentZ;
+
+            uint32_t size() const { return (uint32_t)centerX.size(); }
+            void resize(uint32_t count){
+                centerX.resize(count);
+                centerY.resize(count);
+                centerZ.resize(count);
+                extentX.resize(count);
+                extentY.resize(count);
+                extentZ.resize(count);
+            }
+            void set(uint32_t index, const glm::vec3& min, const glm::vec3& max){
+                glm::vec3 center = (min + max) * 0.5f;
+                glm::vec3 extent = (max - min) * 0.5f;
+                centerX[index] = center.x;
+                centerY[index] = center.y;
+                centerZ[index] = center.z;
+                extentX[index] = extent.x;
+                extentY[index] = extent.y;
+                extentZ[index] = extent.z;
+            }
+        };
+
+        /** @brief Instruction sets the culling kernels are written for */
+        enum CullPath{
+            eCullScalar = 0,
+            /** @brief 4 objects per instruction */
+            eCullSse,
+            /** @brief 8 objects per instruction, picked at runtime on x86 CPUs that have it */
+            eCullAvx2,
+            /** @brief 4 objects per instruction on ARM */
+            eCullNeon
+        };
+
+        /** @brief Whether the build contains the path and the CPU runs it */
+        bool isCullPathSupported(CullPath path);
+        /** @brief Widest supported path */
+        CullPath getBestCullPath();
+        const char* getCullPathName(CullPath path);
+
+        /**
+        * @brief Tests bounding volumes against a frustum and writes the indices of the visible ones
+        *
+        * The visible list is compact and in index order. With a job system the volumes are tested in chunks of
+        * FRUSTUM_CULL_CHUNK on the workers, each chunk writes into its own part of the output which is then closed up.
+        */
+        class FrustumCuller{
+            private:
+                CullPath path;
+                std::vector<uint32_t> chunkCounts;
+
+                template <typename Kernel>
+                uint32_t run(uint32_t count, uint32_t* visible, core::JobSystem* jobs, Kernel kernel);
+
+            public:
+                FrustumCuller(CullPath path = getBestCullPath()){
+                    setPath(path);
+                }
+
+                /** @brief Falls back to the scalar path if path is not supported */
+                void setPath(CullPath path);
+                CullPath getPath() const { return path; }
+
+                /**
+                * Cull spheres
+                *
+                * @param visible Receives the visible indices, room for spheres.size() entries
+                * @param jobs (Optional) Spread the work over the job system workers and wait for it
+                *
+                * @return Number of visible spheres
+                */
+                uint32_t cull(const Frustum& frustum, const BoundingSpheres& spheres, uint32_t* visible, core::JobSystem* jobs = nullptr);
+                /** @brief Cull boxes, see the sphere version */
+                uint32_t cull(const Frustum& frustum, const BoundingBoxes& boxes, uint32_t* visible, core::JobSystem* jobs = nullptr);
+        };
+    }
+}
+
+#endif
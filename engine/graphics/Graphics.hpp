@@ -25,8 +25,19 @@ namespace trb{
                 return graphics;
             }
 
-            void render(){
+            void buildRenderGraph(VulkanRenderGraph& graph){
+                // Clear the back buffer and draw the scene into it from the workers. The graph transitions it for presentation
+                graph.addRecordedPass("scene", [this](VulkanRenderGraph::PassBuilder& builder){
+                    builder.writeColor(backBuffer, true, vk::ClearColorValue(std::array<float, 4>{ { 0.0f, 0.0f, 0.0f, 1.0f } }));
+                }, [this](const VulkanRenderGraph&){
+                    return getDrawCount();
+                }, [this](vk::CommandBuffer commandBuffer, uint32_t first, uint32_t count){
+                    recordDraws(commandBuffer, first, count);
+                });
+            }
 
+            void render(){
+                executeRenderGraph();
             }
         };
     }
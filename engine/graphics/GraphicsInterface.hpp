@@ -4,6 +4,11 @@
 #include <string>
 
 namespace trb{
+    namespace core{
+        struct Job;
+        class JobSystem;
+    }
+
     namespace grfx{
 
         class GraphicInterface{
@@ -11,9 +16,19 @@ namespace trb{
                 virtual const std::string getWindowTitle() const = 0;
                 virtual ~GraphicInterface(){};
 
-                virtual void renderLoop() = 0;
+                /** @brief Handle the pending window events on the main thread, false once the window was closed */
+                virtual bool pollEvents() = 0;
+                /**
+                * Add the stages of one frame as children of frame. They run on the job system workers, the main
+                * thread helps while it waits on frame
+                */
+                virtual void scheduleFrame(core::JobSystem* jobs, core::Job* frame) = 0;
+                /** @brief Submit and present what the frame's jobs recorded, on the main thread after frame finished */
+                virtual void endFrame() = 0;
+                /** @brief Wait until the device finished every submitted frame */
+                virtual void waitIdle() = 0;
         };
     }
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -17,10 +17,20 @@ namespace trb{
                     return handle->getWindowTitle();
                 }
 
-                void renderLoop(){
-                    std::cout<<"GraphicsManager::renderLoop" << std::endl;
-                    std::cout << "handle: " << handle << std::endl;
-                    handle->renderLoop();
+                bool pollEvents(){
+                    return handle->pollEvents();
+                }
+
+                void scheduleFrame(core::JobSystem* jobs, core::Job* frame){
+                    handle->scheduleFrame(jobs, frame);
+                }
+
+                void endFrame(){
+                    handle->endFrame();
+                }
+
+                void waitIdle(){
+                    handle->waitIdle();
                 }
         };
     }
@@ -0,0 +1,133 @@
+#ifndef TRB_GFX_LodSelector_H_
+#define TRB_GFX_LodSelector_H_
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+// Screen space error in pixels a level of detail may show before a finer one is drawn
+#define DEFAULT_LOD_PIXEL_ERROR 1.0f
+// A level has to be this fraction below the error threshold before the selector steps down to it,
+// objects hovering around a switch distance would pop back and forth every frame otherwise
+#define DEFAULT_LOD_HYSTERESIS 0.25f
+#define INVALID_LOD UINT32_MAX
+
+namespace trb{
+    namespace grfx{
+
+        struct LodSelectorStats{
+            uint32_t objects = 0;
+            uint64_t trianglesDrawn = 0;
+            /** @brief Triangles level 0 would have drawn on top of trianglesDrawn */
+            uint64_t trianglesSaved = 0;
+        };
+
+        /**
+        * @brief Picks the level of detail of mesh instances from their projected error on screen
+        *
+        * The error of a level (the largest distance of an original vertex from its surface, stored by the cooker) is
+        * projected at the distance of the object's bounding sphere from the camera. The coarsest level whose error
+        * stays below the pixel threshold is drawn. The level last chosen for an object is remembered, a coarser
+        * level is only taken once it is comfortably below the threshold so small camera moves do not pop.
+        */
+        class LodSelector{
+            private:
+                glm::vec3 eye;
+                /** @brief Pixels covered by one unit at distance one */
+                float pixelScale = 0.0f;
+                float pixelError;
+                float hysteresis;
+                /** @brief Level chosen last for every object id */
+                std::vector<uint32_t> current;
+                LodSelectorStats stats;
+                LodSelectorStats lastStats;
+
+            public:
+                LodSelector(float pixelError = DEFAULT_LOD_PIXEL_ERROR, float hysteresis = DEFAULT_LOD_HYSTERESIS)
+                    : pixelError(pixelError), hysteresis(hysteresis) {}
+
+                /**
+                * Start selecting for a frame
+                *
+                * @param view Camera view matrix, the eye position is taken from its inverse
+                * @param projection Camera projection, only the vertical focal length is used
+                * @param viewportHeight Height of the render target in pixels
+                */
+                void beginFrame(const glm::mat4& view, const glm::mat4& projection, float viewportHeight){
+                    eye = glm::vec3(glm::inverse(view)[3]);
+                    pixelScale = projection[1][1] * viewportHeight * 0.5f;
+                    lastStats = stats;
+                    stats = LodSelectorStats();
+                }
+
+                /**
+                * Level to draw an object at this frame
+                *
+                * @param object Stable id of the object, the hysteresis is tracked per id
+                * @param mesh Mesh the object draws, anything with lodErrors, lodTriangles and boundsMin/Max (grfx::Mesh)
+                * @param transform Model matrix of the object, its largest axis scale scales the error
+                */
+                template <typename LodMesh>
+                uint32_t select(uint32_t object, const LodMesh& mesh, const glm::mat4& transform){
+                    if (object >= current.size()){
+                        current.resize(object + 1, INVALID_LOD);
+                    }
+                    uint32_t levels = (uint32_t)mesh.lodErrors.size();
+                    uint32_t lod = 0;
+                    if (levels > 1){
+                        float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+                        glm::vec3 center = glm::vec3(transform * glm::vec4((mesh.boundsMin + mesh.boundsMax) * 0.5f, 1.0f));
+                        float radius = glm::length(mesh.boundsMax - mesh.boundsMin) * 0.5f * scale;
+                        // distance to the nearest point of the bounding sphere, inside it everything is drawn at full detail
+                        float distance = glm::length(center - eye) - radius;
+                        float projected = distance > 0.0f ? scale * pixelScale / distance : 0.0f;
+                        auto fits = [&](uint32_t level, float threshold){
+                            return projected > 0.0f && mesh.lodErrors[level] * projected <= threshold;
+                        };
+
+                        // finer while the remembered level shows too much error, coarser only with some headroom
+                        uint32_t previous = current[object];
+                        float coarsen = pixelError;
+                        if (previous != INVALID_LOD){
+                            lod = std::min(previous, levels - 1);
+                            coarsen *= 1.0f - hysteresis;
+                        }
+                        while (lod > 0 && !fits(lod, pixelError)){
+                            lod--;
+                        }
+                        while (lod + 1 < levels && fits(lod + 1, coarsen)){
+                            lod++;
+                        }
+                    }
+                    current[object] = lod;
+
+                    stats.objects++;
+                    if (!mesh.lodTriangles.empty()){
+                        stats.trianglesDrawn += mesh.lodTriangles[lod];
+                        stats.trianglesSaved += mesh.lodTriangles[0] - mesh.lodTriangles[lod];
+                    }
+                    return lod;
+                }
+
+                /** @brief Forget the level of an object, e.g. when its id is reused */
+                void reset(uint32_t object){
+                    if (object < current.size()){
+                        current[object] = INVALID_LOD;
+                    }
+                }
+
+                void setPixelError(float pixels){
+                    pixelError = pixels;
+                }
+
+                /** @brief Totals of the last completed frame */
+                const LodSelectorStats& getStats() const { return lastStats; }
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,447 @@
+#include "OcclusionCuller.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_SSE 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define OCCLUSION_NEON 1
+#include <arm_neon.h>
+#endif
+
+static_assert((1 << (OCCLUSION_HIZ_LEVELS - 1)) == OCCLUSION_TILE_SIZE, "the last HiZ level has one texel per tile");
+static_assert(OCCLUSION_TILE_SIZE % 4 == 0, "tiles are rasterized four pixels at a time");
+
+namespace{
+
+#if defined(OCCLUSION_SSE)
+    // four pixels of a row
+    typedef __m128 Float4;
+    inline Float4 set1(float v){ return _mm_set1_ps(v); }
+    inline Float4 set4(float a, float b, float c, float d){ return _mm_setr_ps(a, b, c, d); }
+    inline Float4 add(Float4 a, Float4 b){ return _mm_add_ps(a, b); }
+    inline Float4 mul(Float4 a, Float4 b){ return _mm_mul_ps(a, b); }
+    inline Float4 load(const float* p){ return _mm_loadu_ps(p); }
+    inline void store(float* p, Float4 a){ _mm_storeu_ps(p, a); }
+    /** @brief All ones in lanes where a, b and c are not negative */
+    inline Float4 inside(Float4 a, Float4 b, Float4 c){
+        Float4 zero = _mm_setzero_ps();
+        return _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(a, zero), _mm_cmpge_ps(b, zero)), _mm_cmpge_ps(c, zero));
+    }
+    inline bool any(Float4 mask){ return _mm_movemask_ps(mask) != 0; }
+    /** @brief min(depth, z) in the masked lanes */
+    inline Float4 depthMin(Float4 mask, Float4 depth, Float4 z){
+        return _mm_min_ps(depth, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, depth)));
+    }
+#elif defined(OCCLUSION_NEON)
+    typedef float32x4_t Float4;
+    inline Float4 set1(float v){ return vdupq_n_f32(v); }
+    inline Float4 set4(float a, float b, float c, float d){
+        float v[4] = { a, b, c, d };
+        return vld1q_f32(v);
+    }
+    inline Float4 add(Float4 a, Float4 b){ return vaddq_f32(a, b); }
+    inline Float4 mul(Float4 a, Float4 b){ return vmulq_f32(a, b); }
+    inline Float4 load(const float* p){ return vld1q_f32(p); }
+    inline void store(float* p, Float4 a){ vst1q_f32(p, a); }
+    inline Float4 inside(Float4 a, Float4 b, Float4 c){
+        Float4 zero = vdupq_n_f32(0.0f);
+        return vreinterpretq_f32_u32(vandq_u32(vandq_u32(vcgeq_f32(a, zero), vcgeq_f32(b, zero)), vcgeq_f32(c, zero)));
+    }
+    inline bool any(Float4 mask){
+        uint32x2_t lanes = vorr_u32(vget_low_u32(vreinterpretq_u32_f32(mask)), vget_high_u32(vreinterpretq_u32_f32(mask)));
+        return (vget_lane_u32(lanes, 0) | vget_lane_u32(lanes, 1)) != 0;
+    }
+    inline Float4 depthMin(Float4 mask, Float4 depth, Float4 z){
+        return vminq_f32(depth, vbslq_f32(vreinterpretq_u32_f32(mask), z, depth));
+    }
+#else
+    struct Float4{
+        float v[4];
+    };
+    inline Float4 set1(float v){ return Float4{{ v, v, v, v }}; }
+    inline Float4 set4(float a, float b, float c, float d){ return Float4{{ a, b, c, d }}; }
+    inline Float4 add(Float4 a, Float4 b){ return Float4{{ a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] }}; }
+    inline Float4 mul(Float4 a, Float4 b){ return Float4{{ a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3] }}; }
+    inline Float4 load(const float* p){ return Float4{{ p[0], p[1], p[2], p[3] }}; }
+    inline void store(float* p, Float4 a){ memcpy(p, a.v, sizeof(a.v)); }
+    // lanes of a mask are 1.0f (inside) or 0.0f
+    inline Float4 inside(Float4 a, Float4 b, Float4 c){
+        Float4 mask;
+        for (int i = 0; i < 4; i++){
+            mask.v[i] = a.v[i] >= 0.0f && b.v[i] >= 0.0f && c.v[i] >= 0.0f ? 1.0f : 0.0f;
+        }
+        return mask;
+    }
+    inline bool any(Float4 mask){ return mask.v[0] + mask.v[1] + mask.v[2] + mask.v[3] > 0.0f; }
+    inline Float4 depthMin(Float4 mask, Float4 depth, Float4 z){
+        for (int i = 0; i < 4; i++){
+            depth.v[i] = mask.v[i] != 0.0f ? std::min(depth.v[i], z.v[i]) : depth.v[i];
+        }
+        return depth;
+    }
+#endif
+
+    /** @brief Edge function a * x + b * y + c, positive on the inner side of the edge from p to q */
+    struct Edge{
+        float a, b, c;
+
+        Edge(float px, float py, float qx, float qy) : a(py - qy), b(qx - px), c(-(a * px + b * py)) {}
+    };
+
+    // planes the clipper keeps triangles in front of, dot(plane, clip position) >= 0
+    const glm::vec4 clipPlanes[] = {
+        glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
+        glm::vec4(1.0f, 0.0f, 0.0f, OCCLUSION_GUARD_BAND),
+        glm::vec4(-1.0f, 0.0f, 0.0f, OCCLUSION_GUARD_BAND),
+        glm::vec4(0.0f, 1.0f, 0.0f, OCCLUSION_GUARD_BAND),
+        glm::vec4(0.0f, -1.0f, 0.0f, OCCLUSION_GUARD_BAND)
+    };
+    const uint32_t clipPlaneCount = sizeof(clipPlanes) / sizeof(clipPlanes[0]);
+    // a triangle with every vertex outside one of the view planes is dropped before clipping
+    const glm::vec4 viewPlanes[] = {
+        glm::vec4(1.0f, 0.0f, 0.0f, 1.0f),
+        glm::vec4(-1.0f, 0.0f, 0.0f, 1.0f),
+        glm::vec4(0.0f, 1.0f, 0.0f, 1.0f),
+        glm::vec4(0.0f, -1.0f, 0.0f, 1.0f),
+        glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
+        glm::vec4(0.0f, 0.0f, -1.0f, 1.0f)
+    };
+
+    /** @brief Sutherland-Hodgman against the clip planes, a triangle grows to at most 3 + clipPlaneCount vertices */
+    uint32_t clipPolygon(glm::vec4* polygon, uint32_t count){
+        glm::vec4 clipped[3 + clipPlaneCount];
+        for (auto& plane : clipPlanes){
+            uint32_t out = 0;
+            for (uint32_t i = 0; i < count; i++){
+                const glm::vec4& a = polygon[i];
+                const glm::vec4& b = polygon[(i + 1) % count];
+                float da = glm::dot(plane, a);
+                float db = glm::dot(plane, b);
+                if (da >= 0.0f){
+                    clipped[out++] = a;
+                }
+                if ((da >= 0.0f) != (db >= 0.0f)){
+                    clipped[out++] = a + (b - a) * (da / (da - db));
+                }
+            }
+            count = out;
+            std::copy(clipped, clipped + count, polygon);
+            if (count < 3){
+                return 0;
+            }
+        }
+        return count;
+    }
+}
+
+void trb::grfx::OcclusionCuller::resize(uint32_t width, uint32_t height){
+    tilesX = std::max(1u, (width + OCCLUSION_TILE_SIZE - 1) / OCCLUSION_TILE_SIZE);
+    tilesY = std::max(1u, (height + OCCLUSION_TILE_SIZE - 1) / OCCLUSION_TILE_SIZE);
+    this->width = tilesX * OCCLUSION_TILE_SIZE;
+    this->height = tilesY * OCCLUSION_TILE_SIZE;
+    for (uint32_t l = 0; l < OCCLUSION_HIZ_LEVELS; l++){
+        levels[l].assign((this->width >> l) * (this->height >> l), 1.0f);
+    }
+    bins.resize(tilesX * tilesY);
+}
+
+void trb::grfx::OcclusionCuller::beginFrame(const glm::mat4& view, const glm::mat4& projection){
+    viewProjection = projection * view;
+    occluders.clear();
+    lastStats = stats;
+    stats = OcclusionStats();
+}
+
+void trb::grfx::OcclusionCuller::addOccluder(const float* positions, uint32_t stride, uint32_t vertexCount, const void* indices, uint32_t indexCount,
+                                             uint32_t indexSize, const glm::mat4& transform){
+    Occluder occluder;
+    occluder.positions = positions;
+    occluder.stride = stride;
+    occluder.vertexCount = vertexCount;
+    occluder.indices = indices;
+    occluder.indexCount = indexCount;
+    occluder.indexSize = indexSize;
+    occluder.transform = transform;
+    occluders.push_back(occluder);
+}
+
+void trb::grfx::OcclusionCuller::setup(const Occluder& occluder, std::vector<Triangle>* out) const {
+    out->clear();
+    glm::mat4 m = viewProjection * occluder.transform;
+    std::vector<glm::vec4> clip(occluder.vertexCount);
+    for (uint32_t i = 0; i < occluder.vertexCount; i++){
+        const float* p = (const float*)((const char*)occluder.positions + (size_t)i * occluder.stride);
+        clip[i] = m * glm::vec4(p[0], p[1], p[2], 1.0f);
+    }
+
+    glm::vec4 polygon[3 + clipPlaneCount];
+    for (uint32_t t = 0; t + 3 <= occluder.indexCount; t += 3){
+        for (uint32_t k = 0; k < 3; k++){
+            uint32_t index = occluder.indexSize == 2 ? ((const uint16_t*)occluder.indices)[t + k] : ((const uint32_t*)occluder.indices)[t + k];
+            polygon[k] = clip[index];
+        }
+        bool outside = false;
+        for (auto& plane : viewPlanes){
+            outside = outside || (glm::dot(plane, polygon[0]) < 0.0f && glm::dot(plane, polygon[1]) < 0.0f && glm::dot(plane, polygon[2]) < 0.0f);
+        }
+        if (outside){
+            continue;
+        }
+        bool clipped = false;
+        for (auto& plane : clipPlanes){
+            clipped = clipped || glm::dot(plane, polygon[0]) < 0.0f || glm::dot(plane, polygon[1]) < 0.0f || glm::dot(plane, polygon[2]) < 0.0f;
+        }
+        uint32_t count = clipped ? clipPolygon(polygon, 3) : 3;
+
+        // project to pixels, y grows downwards like the viewport
+        float sx[3 + clipPlaneCount], sy[3 + clipPlaneCount], sz[3 + clipPlaneCount];
+        for (uint32_t i = 0; i < count; i++){
+            float w = 1.0f / polygon[i].w;
+            sx[i] = (polygon[i].x * w * 0.5f + 0.5f) * width;
+            sy[i] = (polygon[i].y * w * 0.5f + 0.5f) * height;
+            sz[i] = polygon[i].z * w;
+        }
+        for (uint32_t i = 1; i + 1 < count; i++){
+            uint32_t v[3] = { 0, i, i + 1 };
+            float area = (sx[v[1]] - sx[v[0]]) * (sy[v[2]] - sy[v[0]]) - (sx[v[2]] - sx[v[0]]) * (sy[v[1]] - sy[v[0]]);
+            if (area == 0.0f){
+                continue;
+            }
+            if (area < 0.0f){
+                std::swap(v[1], v[2]);
+            }
+            Triangle triangle;
+            float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+            for (uint32_t k = 0; k < 3; k++){
+                triangle.x[k] = sx[v[k]];
+                triangle.y[k] = sy[v[k]];
+                triangle.z[k] = sz[v[k]];
+                minX = std::min(minX, sx[v[k]]);
+                minY = std::min(minY, sy[v[k]]);
+                maxX = std::max(maxX, sx[v[k]]);
+                maxY = std::max(maxY, sy[v[k]]);
+            }
+            // pixels whose centers can be inside
+            triangle.minX = std::max(0, (int32_t)std::ceil(minX - 0.5f));
+            triangle.minY = std::max(0, (int32_t)std::ceil(minY - 0.5f));
+            triangle.maxX = std::min((int32_t)width - 1, (int32_t)std::floor(maxX - 0.5f));
+            triangle.maxY = std::min((int32_t)height - 1, (int32_t)std::floor(maxY - 0.5f));
+            if (triangle.minX <= triangle.maxX && triangle.minY <= triangle.maxY){
+                out->push_back(triangle);
+            }
+        }
+    }
+}
+
+void trb::grfx::OcclusionCuller::rasterizeTile(uint32_t tile){
+    int32_t tileX = (int32_t)(tile % tilesX) * OCCLUSION_TILE_SIZE;
+    int32_t tileY = (int32_t)(tile / tilesX) * OCCLUSION_TILE_SIZE;
+    float* depth = levels[0].data();
+    for (int32_t y = tileY; y < tileY + OCCLUSION_TILE_SIZE; y++){
+        std::fill(depth + y * width + tileX, depth + y * width + tileX + OCCLUSION_TILE_SIZE, 1.0f);
+    }
+
+    const Float4 offsets = set4(0.5f, 1.5f, 2.5f, 3.5f);
+    for (uint32_t index : bins[tile]){
+        const Triangle& t = triangles[index];
+        // edge 12 weighs vertex 0, edge 20 vertex 1 and edge 01 vertex 2
+        Edge e0(t.x[1], t.y[1], t.x[2], t.y[2]);
+        Edge e1(t.x[2], t.y[2], t.x[0], t.y[0]);
+        Edge e2(t.x[0], t.y[0], t.x[1], t.y[1]);
+        float area = e2.a * t.x[2] + e2.b * t.y[2] + e2.c;
+        // depth is linear in screen space after the perspective divide
+        float zx = (e0.a * t.z[0] + e1.a * t.z[1] + e2.a * t.z[2]) / area;
+        float zy = (e0.b * t.z[0] + e1.b * t.z[1] + e2.b * t.z[2]) / area;
+        float zc = (e0.c * t.z[0] + e1.c * t.z[1] + e2.c * t.z[2]) / area;
+
+        // tiles are four pixel aligned, so are the row starts
+        int32_t startX = std::max(t.minX, tileX) & ~3;
+        int32_t endX = std::min(t.maxX, tileX + OCCLUSION_TILE_SIZE - 1);
+        int32_t startY = std::max(t.minY, tileY);
+        int32_t endY = std::min(t.maxY, tileY + OCCLUSION_TILE_SIZE - 1);
+        Float4 step0 = set1(e0.a * 4.0f), step1 = set1(e1.a * 4.0f), step2 = set1(e2.a * 4.0f), stepZ = set1(zx * 4.0f);
+        for (int32_t y = startY; y <= endY; y++){
+            float py = y + 0.5f;
+            Float4 px = add(set1((float)startX), offsets);
+            Float4 w0 = add(mul(set1(e0.a), px), set1(e0.b * py + e0.c));
+            Float4 w1 = add(mul(set1(e1.a), px), set1(e1.b * py + e1.c));
+            Float4 w2 = add(mul(set1(e2.a), px), set1(e2.b * py + e2.c));
+            Float4 z = add(mul(set1(zx), px), set1(zy * py + zc));
+            float* row = depth + y * width;
+            for (int32_t x = startX; x <= endX; x += 4){
+                Float4 mask = inside(w0, w1, w2);
+                if (any(mask)){
+                    store(row + x, depthMin(mask, load(row + x), z));
+                }
+                w0 = add(w0, step0);
+                w1 = add(w1, step1);
+                w2 = add(w2, step2);
+                z = add(z, stepZ);
+            }
+        }
+    }
+
+    // the part of the max depth pyramid above this tile
+    for (uint32_t l = 1; l < OCCLUSION_HIZ_LEVELS; l++){
+        uint32_t size = OCCLUSION_TILE_SIZE >> l;
+        uint32_t levelWidth = width >> l;
+        uint32_t sourceWidth = width >> (l - 1);
+        const float* source = levels[l - 1].data();
+        float* target = levels[l].data();
+        uint32_t baseX = (uint32_t)tileX >> l, baseY = (uint32_t)tileY >> l;
+        for (uint32_t y = baseY; y < baseY + size; y++){
+            const float* row0 = source + 2 * y * sourceWidth;
+            const float* row1 = row0 + sourceWidth;
+            for (uint32_t x = baseX; x < baseX + size; x++){
+                target[y * levelWidth + x] = std::max(std::max(row0[2 * x], row0[2 * x + 1]), std::max(row1[2 * x], row1[2 * x + 1]));
+            }
+        }
+    }
+}
+
+void trb::grfx::OcclusionCuller::render(core::JobSystem* jobs){
+    uint32_t occluderCount = (uint32_t)occluders.size();
+    if (occluderTriangles.size() < occluderCount){
+        occluderTriangles.resize(occluderCount);
+    }
+    auto setupRange = [&](uint32_t begin, uint32_t end){
+        for (uint32_t i = begin; i < end; i++){
+            setup(occluders[i], &occluderTriangles[i]);
+        }
+    };
+    if (jobs && occluderCount > 1){
+        jobs->wait(jobs->parallelFor(occluderCount, sizeof(std::vector<Triangle>), setupRange, 1));
+    }else{
+        setupRange(0, occluderCount);
+    }
+
+    // bin in occluder order, tiles then rasterize independently
+    triangles.clear();
+    for (uint32_t i = 0; i < occluderCount; i++){
+        triangles.insert(triangles.end(), occluderTriangles[i].begin(), occluderTriangles[i].end());
+    }
+    for (auto& bin : bins){
+        bin.clear();
+    }
+    for (uint32_t i = 0; i < triangles.size(); i++){
+        const Triangle& t = triangles[i];
+        for (int32_t y = t.minY / OCCLUSION_TILE_SIZE; y <= t.maxY / OCCLUSION_TILE_SIZE; y++){
+            for (int32_t x = t.minX / OCCLUSION_TILE_SIZE; x <= t.maxX / OCCLUSION_TILE_SIZE; x++){
+                bins[y * tilesX + x].push_back(i);
+            }
+        }
+    }
+    stats.occluders += occluderCount;
+    stats.triangles += (uint32_t)triangles.size();
+
+    uint32_t tiles = tilesX * tilesY;
+    auto rasterizeRange = [&](uint32_t begin, uint32_t end){
+        for (uint32_t tile = begin; tile < end; tile++){
+            rasterizeTile(tile);
+        }
+    };
+    if (jobs){
+        jobs->wait(jobs->parallelFor(tiles, OCCLUSION_TILE_SIZE * OCCLUSION_TILE_SIZE * sizeof(float), rasterizeRange, 1));
+    }else{
+        rasterizeRange(0, tiles);
+    }
+}
+
+bool trb::grfx::OcclusionCuller::isVisible(const glm::vec3& min, const glm::vec3& max) const {
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = FLT_MAX;
+    // corners as the clip position of min plus the clip space edges of the box
+    glm::vec4 base = viewProjection * glm::vec4(min, 1.0f);
+    glm::vec4 edgeX = viewProjection[0] * (max.x - min.x);
+    glm::vec4 edgeY = viewProjection[1] * (max.y - min.y);
+    glm::vec4 edgeZ = viewProjection[2] * (max.z - min.z);
+    for (uint32_t i = 0; i < 8; i++){
+        glm::vec4 p = base;
+        if (i & 1){
+            p += edgeX;
+        }
+        if (i & 2){
+            p += edgeY;
+        }
+        if (i & 4){
+            p += edgeZ;
+        }
+        if (p.z < 0.0f){
+            // reaches past the near plane, the camera may be inside
+            return true;
+        }
+        float w = 1.0f / p.w;
+        float x = (p.x * w * 0.5f + 0.5f) * width;
+        float y = (p.y * w * 0.5f + 0.5f) * height;
+        minX = std::min(minX, x);
+        minY = std::min(minY, y);
+        maxX = std::max(maxX, x);
+        maxY = std::max(maxY, y);
+        nearest = std::min(nearest, p.z * w);
+    }
+    if (maxX < 0.0f || maxY < 0.0f || minX >= (float)width || minY >= (float)height){
+        return false;
+    }
+    int32_t x0 = std::max(0, (int32_t)std::floor(minX));
+    int32_t y0 = std::max(0, (int32_t)std::floor(minY));
+    int32_t x1 = std::min((int32_t)width - 1, (int32_t)std::floor(maxX));
+    int32_t y1 = std::min((int32_t)height - 1, (int32_t)std::floor(maxY));
+
+    uint32_t level = 0;
+    while (level + 1 < OCCLUSION_HIZ_LEVELS &&
+           ((x1 >> level) - (x0 >> level) >= OCCLUSION_TEST_TEXELS || (y1 >> level) - (y0 >> level) >= OCCLUSION_TEST_TEXELS)){
+        level++;
+    }
+    const float* depth = levels[level].data();
+    uint32_t levelWidth = width >> level;
+    for (int32_t y = y0 >> level; y <= y1 >> level; y++){
+        for (int32_t x = x0 >> level; x <= x1 >> level; x++){
+            if (depth[y * levelWidth + x] >= nearest){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+uint32_t trb::grfx::OcclusionCuller::cull(const BoundingBoxes& boxes, const uint32_t* candidates, uint32_t count, uint32_t* visible, core::JobSystem* jobs){
+    // writes never overtake reads within a chunk, so visible may alias candidates
+    auto test = [&](uint32_t begin, uint32_t end, uint32_t* out){
+        uint32_t n = 0;
+        for (uint32_t i = begin; i < end; i++){
+            uint32_t object = candidates ? candidates[i] : i;
+            glm::vec3 center(boxes.centerX[object], boxes.centerY[object], boxes.centerZ[object]);
+            glm::vec3 extent(boxes.extentX[object], boxes.extentY[object], boxes.extentZ[object]);
+            if (isVisible(center - extent, center + extent)){
+                out[n++] = object;
+            }
+        }
+        return n;
+    };
+    uint32_t total;
+    if (!jobs || count <= OCCLUSION_TEST_CHUNK){
+        total = test(0, count, visible);
+    }else{
+        // every chunk compacts into its own slice of visible, the slices are closed up afterwards
+        uint32_t chunks = (count + OCCLUSION_TEST_CHUNK - 1) / OCCLUSION_TEST_CHUNK;
+        chunkCounts.assign(chunks, 0);
+        jobs->wait(jobs->parallelFor(chunks, CACHE_LINE_SIZE, [&](uint32_t begin, uint32_t end){
+            for (uint32_t c = begin; c < end; c++){
+                uint32_t first = c * OCCLUSION_TEST_CHUNK;
+                chunkCounts[c] = test(first, std::min(count, first + OCCLUSION_TEST_CHUNK), visible + first);
+            }
+        }));
+        total = chunkCounts[0];
+        for (uint32_t c = 1; c < chunks; c++){
+            memmove(visible + total, visible + c * OCCLUSION_TEST_CHUNK, chunkCounts[c] * sizeof(uint32_t));
+            total += chunkCounts[c];
+        }
+    }
+    stats.tested += count;
+    stats.culled += count - total;
+    return total;
+}
@@ -0,0 +1,151 @@
+#ifndef TRB_GFX_OcclusionCuller_H_
+#define TRB_GFX_OcclusionCuller_H_
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "Frustum.hpp"
+#include "../core/JobSystem.hpp"
+
+// Default depth buffer size, occlusion needs a fraction of the screen resolution
+#define OCCLUSION_WIDTH 320
+#define OCCLUSION_HEIGHT 192
+// Pixels across a tile, one job clears, rasterizes and reduces a tile
+#define OCCLUSION_TILE_SIZE 32
+// Max depth levels down to one texel per tile, level 0 is the depth buffer itself
+#define OCCLUSION_HIZ_LEVELS 6
+// Texels across an object rectangle at the HiZ level it is tested against
+#define OCCLUSION_TEST_TEXELS 4
+// Objects one test job handles
+#define OCCLUSION_TEST_CHUNK 1024
+// Occluder triangles are clipped to this many screens around the view so edge functions stay precise
+#define OCCLUSION_GUARD_BAND 4.0f
+
+namespace trb{
+    namespace grfx{
+
+        struct OcclusionStats{
+            uint32_t occluders = 0;
+            /** @brief Occluder triangles left after clipping */
+            uint32_t triangles = 0;
+            uint32_t tested = 0;
+            /** @brief Tested objects hidden behind the occluders */
+            uint32_t culled = 0;
+        };
+
+        /**
+        * @brief Software depth rasterizer for occlusion culling, no GPU involved
+        *
+        * A few large occluder meshes (walls, buildings, terrain) are rendered into a small depth buffer split into
+        * tiles. Triangles are transformed and clipped per occluder, binned to the tiles they touch and every tile is
+        * rasterized four pixels at a time by one job, which then reduces its part of the max depth pyramid. Objects
+        * are hidden when the nearest point of their box lies behind the farthest occluder depth of every texel their
+        * screen rectangle covers, on the pyramid level where the rectangle spans a few texels.
+        *
+        * Per frame: beginFrame(), addOccluder() for every occluder, render(), then isVisible() or cull() the objects
+        * that survived frustum culling. Depth is 0 at the near plane and 1 at the far plane like the Vulkan viewport.
+        */
+        class OcclusionCuller{
+            private:
+                struct Occluder{
+                    const float* positions;
+                    uint32_t stride;
+                    uint32_t vertexCount;
+                    const void* indices;
+                    uint32_t indexCount;
+                    uint32_t indexSize;
+                    glm::mat4 transform;
+                };
+
+                /** @brief Screen space triangle, counter clockwise in pixel coordinates after setup */
+                struct Triangle{
+                    float x[3];
+                    float y[3];
+                    float z[3];
+                    int32_t minX, minY, maxX, maxY;
+                };
+
+                uint32_t width = 0;
+                uint32_t height = 0;
+                uint32_t tilesX = 0;
+                uint32_t tilesY = 0;
+                glm::mat4 viewProjection;
+
+                std::vector<Occluder> occluders;
+                /** @brief Triangles of every occluder, set up in parallel */
+                std::vector<std::vector<Triangle>> occluderTriangles;
+                std::vector<Triangle> triangles;
+                std::vector<std::vector<uint32_t>> bins;
+                /** @brief Max depth of every level, levels[0] is the depth buffer */
+                std::vector<float> levels[OCCLUSION_HIZ_LEVELS];
+
+                std::vector<uint32_t> chunkCounts;
+                OcclusionStats stats;
+                OcclusionStats lastStats;
+
+                void setup(const Occluder& occluder, std::vector<Triangle>* out) const;
+                void rasterizeTile(uint32_t tile);
+
+            public:
+                OcclusionCuller(uint32_t width = OCCLUSION_WIDTH, uint32_t height = OCCLUSION_HEIGHT){
+                    resize(width, height);
+                }
+
+                /** @brief Size of the depth buffer, rounded up to whole tiles */
+                void resize(uint32_t width, uint32_t height);
+
+                /**
+                * Start a frame, forgets the occluders of the last one
+                *
+                * @param view E.g. Camera::matrices.view
+                * @param projection E.g. Camera::matrices.perspective
+                */
+                void beginFrame(const glm::mat4& view, const glm::mat4& projection);
+
+                /**
+                * Queue an occluder mesh for render(), the data has to stay valid until then
+                *
+                * @param positions Object space positions, three floats every stride bytes (e.g. a MeshView stream)
+                * @param indices Triangle list of indexSize (2 or 4) byte indices
+                * @param transform Object to world matrix
+                */
+                void addOccluder(const float* positions, uint32_t stride, uint32_t vertexCount, const void* indices, uint32_t indexCount,
+                                 uint32_t indexSize, const glm::mat4& transform);
+
+                /**
+                * Rasterize the occluders and build the max depth pyramid
+                *
+                * @param jobs (Optional) Set up occluders and rasterize tiles on the job system and wait for them
+                */
+                void render(core::JobSystem* jobs = nullptr);
+
+                /** @brief Whether any part of a world space box may be visible past the occluders */
+                bool isVisible(const glm::vec3& min, const glm::vec3& max) const;
+
+                /**
+                * Occlusion test of many boxes, typically the survivors of FrustumCuller
+                *
+                * @param candidates (Optional) Indices into boxes to test, all boxes when nullptr
+                * @param count Number of candidates (or boxes)
+                * @param visible Receives the indices of the visible boxes in order, may be candidates itself
+                * @param jobs (Optional) Test OCCLUSION_TEST_CHUNK boxes per job and wait for them
+                *
+                * @return Number of visible boxes
+                */
+                uint32_t cull(const BoundingBoxes& boxes, const uint32_t* candidates, uint32_t count, uint32_t* visible, core::JobSystem* jobs = nullptr);
+
+                uint32_t getWidth() const { return width; }
+                uint32_t getHeight() const { return height; }
+                /** @brief Max depth of a pyramid level, (width >> level) * (height >> level) texels, row 0 at the top */
+                const float* getDepth(uint32_t level = 0) const { return levels[level].data(); }
+                /** @brief Counters of the last frame */
+                const OcclusionStats& getStats() const { return lastStats; }
+        };
+    }
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define TRB_GFX_VulkanBuffer_H_
 
 #include "vulkan/vulkan.hpp"
+#include "VulkanMemoryAllocator.hpp"
 
 namespace trb{
     namespace grfx{
@@ -15,6 +16,10 @@ namespace trb{
             vk::Device device;
             vk::Buffer buffer;
             vk::DeviceMemory memory;
+            /** @brief Sub range of a shared memory block backing this buffer (memory == allocation.memory) */
+            MemoryAllocation allocation;
+            /** @brief Allocator the sub range is returned to on destroy, nullptr if the buffer owns memory */
+            VulkanMemoryAllocator* allocator = nullptr;
             vk::DescriptorBufferInfo descriptor;
             vk::DeviceSize size = 0;
             vk::DeviceSize alignment = 0;
@@ -34,6 +39,14 @@ namespace trb{
             * @return VkResult of the buffer mapping call
             */
             vk::Result map(vk::DeviceSize size = VK_WHOLE_SIZE, vk::DeviceSize offset = 0){
+                if (allocation){
+                    // sub allocated blocks stay persistently mapped, hand out a pointer into the block
+                    if (!allocation.mapped()){
+                        return vk::Result::eErrorMemoryMapFailed;
+                    }
+                    mapped = (char*)allocation.mapped() + offset;
+                    return vk::Result::eSuccess;
+                }
                 return device.mapMemory(memory, offset, size, (vk::MemoryMapFlagBits)0, &mapped);
             }
 
@@ -44,7 +57,9 @@ namespace trb{
             */
             void unmap(){
                 if (mapped){
-                    device.unmapMemory(memory);
+                    if (!allocation){
+                        device.unmapMemory(memory);
+                    }
                     mapped = nullptr;
                 }
             }
@@ -57,7 +72,7 @@ namespace trb{
             * @return VkResult of the bindBufferMemory call
             */
             void bind(vk::DeviceSize offset = 0){
-                device.bindBufferMemory(buffer, memory, offset);
+                device.bindBufferMemory(buffer, memory, allocation.offset + offset);
             }
 
             /**
@@ -86,6 +101,21 @@ namespace trb{
                 memcpy(mapped, data, size);
             }
 
+            /**
+            * Translate a range of this buffer into a range of the backing memory block
+            */
+            vk::MappedMemoryRange memoryRange(vk::DeviceSize size, vk::DeviceSize offset){
+                vk::MappedMemoryRange mappedRange;
+                mappedRange.memory = memory;
+                mappedRange.offset = allocation.offset + offset;
+                mappedRange.size = size;
+                if (allocation && size == VK_WHOLE_SIZE){
+                    // the whole buffer, not the rest of the shared block (range is atom aligned by the allocator)
+                    mappedRange.size = allocation.size - offset;
+                }
+                return mappedRange;
+            }
+
             /** 
             * Flush a memory range of the buffer to make it visible to the device
             *
@@ -98,10 +128,7 @@ namespace trb{
             */
             vk::Result flush(vk::DeviceSize size = VK_WHOLE_SIZE, vk::DeviceSize offset = 0)
             {
-                vk::MappedMemoryRange mappedRange;
-                mappedRange.memory = memory;
-                mappedRange.offset = offset;
-                mappedRange.size = size;
+                vk::MappedMemoryRange mappedRange = memoryRange(size, offset);
                 return device.flushMappedMemoryRanges(1, &mappedRange);
             }
 
@@ -117,10 +144,7 @@ namespace trb{
             */
             vk::Result invalidate(vk::DeviceSize size = VK_WHOLE_SIZE, vk::DeviceSize offset = 0)
             {
-                vk::MappedMemoryRange mappedRange;
-                mappedRange.memory = memory;
-                mappedRange.offset = offset;
-                mappedRange.size = size;
+                vk::MappedMemoryRange mappedRange = memoryRange(size, offset);
                 return device.invalidateMappedMemoryRanges(1, &mappedRange);
             }
 
@@ -131,9 +155,14 @@ namespace trb{
                 if (buffer){
                     device.destroyBuffer(buffer, nullptr);                
                 }
-                if (memory){
+                if (allocation){
+                    mapped = nullptr;
+                    allocator->free(allocation);
+                }else if (memory){
                     device.freeMemory(memory, nullptr);                    
                 }
+                buffer = vk::Buffer();
+                memory = vk::DeviceMemory();
             }
 
         };
@@ -0,0 +1,191 @@
+#ifndef TRB_GFX_VulkanCommandRecorder_H_
+#define TRB_GFX_VulkanCommandRecorder_H_
+
+#include "vulkan/vulkan.hpp"
+
+#include <stdexcept>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <cassert>
+
+#include "VulkanDevice.hpp"
+#include "../../core/JobSystem.hpp"
+
+// Smallest number of draws recorded into one secondary command buffer
+#define DEFAULT_DRAWS_PER_CHUNK 64
+
+namespace trb{
+    namespace grfx{
+
+        /** @brief Records the draws [first, first + count) into a secondary command buffer that has already begun */
+        typedef std::function<void(vk::CommandBuffer commandBuffer, uint32_t first, uint32_t count)> RecordChunkFunc;
+
+        struct RecorderStats{
+            uint32_t chunks = 0;
+            uint32_t secondaryBuffersAllocated = 0;
+            /** @brief Wall time of the last record() call in ms */
+            float recordTime = 0.0f;
+        };
+
+        /**
+        * @brief Records a draw list into secondary command buffers on the job system workers
+        *
+        * Every worker owns one transient command pool per frame slot, so no pool is ever touched by two threads.
+        * Chunk i of the draw list always ends up at position i of the executeCommands call, independent of
+        * which thread recorded it. Pools of a slot are reset as a whole in beginFrame() and their command
+        * buffers are reused instead of being freed one at a time.
+        */
+        class VulkanCommandRecorder{
+            private:
+                struct ThreadPool{
+                    vk::CommandPool pool;
+                    std::vector<vk::CommandBuffer> buffers;
+                    uint32_t used = 0;
+                };
+
+                vk::Device device;
+                core::JobSystem* jobs = nullptr;
+                uint32_t threadCount = 1;
+                uint32_t frameSlot = 0;
+                // pools[frameSlot][worker]
+                std::vector<std::vector<ThreadPool> > pools;
+
+                // state of the record() call in progress
+                const vk::CommandBufferInheritanceInfo* inheritance = nullptr;
+                const RecordChunkFunc* recordChunk = nullptr;
+                uint32_t drawCount = 0;
+                uint32_t chunkSize = 0;
+                uint32_t chunkCount = 0;
+                std::vector<vk::CommandBuffer> secondaries;
+
+                RecorderStats stats;
+
+                vk::CommandBuffer acquire(uint32_t thread){
+                    ThreadPool& threadPool = pools[frameSlot][thread];
+                    if (threadPool.used == threadPool.buffers.size()){
+                        vk::CommandBufferAllocateInfo allocInfo;
+                        allocInfo.commandPool = threadPool.pool;
+                        allocInfo.level = vk::CommandBufferLevel::eSecondary;
+                        allocInfo.commandBufferCount = 1;
+                        vk::CommandBuffer commandBuffer;
+                        if (device.allocateCommandBuffers(&allocInfo, &commandBuffer) != vk::Result::eSuccess){
+                            throw std::runtime_error("failed to allocate secondary command buffer!");
+                        }
+                        threadPool.buffers.push_back(commandBuffer);
+                    }
+                    return threadPool.buffers[threadPool.used++];
+                }
+
+                /** @brief Record one chunk into a secondary buffer from the calling worker's own pool */
+                void recordChunkOn(uint32_t thread, uint32_t chunk){
+                    vk::CommandBuffer commandBuffer = acquire(thread);
+                    vk::CommandBufferBeginInfo beginInfo;
+                    beginInfo.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue | vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+                    beginInfo.pInheritanceInfo = inheritance;
+                    commandBuffer.begin(&beginInfo);
+                    uint32_t first = chunk * chunkSize;
+                    (*recordChunk)(commandBuffer, first, std::min(chunkSize, drawCount - first));
+                    commandBuffer.end();
+                    secondaries[chunk] = commandBuffer;
+                }
+
+            public:
+                VulkanCommandRecorder(){}
+                ~VulkanCommandRecorder(){
+                    destroy();
+                }
+
+                /**
+                * Create the per worker, per frame slot command pools
+                *
+                * @param vulkanDevice Device to allocate the pools from (graphics queue family)
+                * @param framesInFlight Number of frame slots
+                * @param jobSystem Job system whose workers record, must be initialized
+                */
+                void init(VulkanDevice* vulkanDevice, uint32_t framesInFlight, core::JobSystem* jobSystem){
+                    device = vulkanDevice->device;
+                    jobs = jobSystem;
+                    assert(jobs->getWorkerCount() > 0);
+                    threadCount = jobs->getWorkerCount();
+                    pools.resize(framesInFlight);
+                    for (auto& slot : pools){
+                        slot.resize(threadCount);
+                        for (auto& threadPool : slot){
+                            threadPool.pool = vulkanDevice->createCommandPool(vulkanDevice->queueFamilyIndices.graphicsFamily, vk::CommandPoolCreateFlagBits::eTransient);
+                        }
+                    }
+                }
+
+                void destroy(){
+                    for (auto& slot : pools){
+                        for (auto& threadPool : slot){
+                            device.destroyCommandPool(threadPool.pool, nullptr);
+                        }
+                    }
+                    pools.clear();
+                }
+
+                /**
+                * Reset every pool of a frame slot at once. Only call after the slot's fence signaled
+                */
+                void beginFrame(uint32_t slot){
+                    frameSlot = slot;
+                    for (auto& threadPool : pools[frameSlot]){
+                        device.resetCommandPool(threadPool.pool, vk::CommandPoolResetFlags());
+                        threadPool.used = 0;
+                    }
+                }
+
+                /**
+                * Record a draw list in parallel and execute the secondary command buffers from the primary one
+                *
+                * @param primary Primary command buffer inside a render pass begun with eSecondaryCommandBuffers
+                * @param inheritanceInfo Render pass, subpass and framebuffer the secondaries are recorded for
+                * @param draws Number of draws in the list
+                * @param func Records a chunk of draws, called concurrently from several workers
+                * @param minDrawsPerChunk (Optional) Lower bound for the chunk size
+                */
+                void record(vk::CommandBuffer primary, const vk::CommandBufferInheritanceInfo& inheritanceInfo, uint32_t draws,
+                            const RecordChunkFunc& func, uint32_t minDrawsPerChunk = DEFAULT_DRAWS_PER_CHUNK){
+                    if (draws == 0){
+                        return;
+                    }
+                    auto tStart = std::chrono::high_resolution_clock::now();
+                    inheritance = &inheritanceInfo;
+                    recordChunk = &func;
+                    drawCount = draws;
+                    // a few chunks per thread so uneven chunks still balance out
+                    chunkSize = std::max(minDrawsPerChunk, (draws + threadCount * 4 - 1) / (threadCount * 4));
+                    chunkCount = (draws + chunkSize - 1) / chunkSize;
+                    secondaries.assign(chunkCount, vk::CommandBuffer());
+
+                    // one job per chunk, the calling thread helps while it waits
+                    core::Job* root = jobs->parallelFor(chunkCount, CACHE_LINE_SIZE, [this](uint32_t begin, uint32_t end){
+                        uint32_t thread = core::JobSystem::getWorkerIndex();
+                        for (uint32_t chunk = begin; chunk < end; chunk++){
+                            recordChunkOn(thread, chunk);
+                        }
+                    });
+                    jobs->wait(root);
+
+                    // deterministic submission order: chunk order, not completion order
+                    primary.executeCommands((uint32_t)secondaries.size(), secondaries.data());
+
+                    stats.chunks = chunkCount;
+                    stats.secondaryBuffersAllocated = 0;
+                    for (auto& threadPool : pools[frameSlot]){
+                        stats.secondaryBuffersAllocated += (uint32_t)threadPool.buffers.size();
+                    }
+                    auto tEnd = std::chrono::high_resolution_clock::now();
+                    stats.recordTime = (float)std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+                }
+
+                uint32_t getThreadCount() const { return threadCount; }
+                const RecorderStats& getStats() const { return stats; }
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,477 @@
+#ifndef TRB_GFX_VulkanDescriptorAllocator_H_
+#define TRB_GFX_VulkanDescriptorAllocator_H_
+
+#include "vulkan/vulkan.hpp"
+
+#include <stdexcept>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include "VulkanDevice.hpp"
+
+// Sets of the first pool of a frame slot, every further pool doubles up to DESCRIPTOR_POOL_MAX_SETS
+#define DESCRIPTOR_POOL_SETS 128
+#define DESCRIPTOR_POOL_MAX_SETS 4096
+// Frames a cached set may go unused before it is freed, at least the frames in flight
+#define DESCRIPTOR_CACHE_FRAMES 120
+// Size of the bindless texture table unless the device allows fewer
+#define DEFAULT_BINDLESS_TEXTURES 4096
+
+namespace trb{
+    namespace grfx{
+
+        struct DescriptorStats{
+            /** @brief Sets allocated this frame, transient ones and cache misses */
+            uint32_t allocations = 0;
+            /** @brief Descriptors written this frame, bindless table updates included */
+            uint32_t writes = 0;
+            uint32_t cacheHits = 0;
+            uint32_t cacheMisses = 0;
+            /** @brief Pools created so far, transient and cache */
+            uint32_t pools = 0;
+            uint32_t cachedSets = 0;
+        };
+
+        /** @brief Content of one binding of a set: a buffer range or an image with its sampler. Texel buffers are not supported */
+        struct DescriptorBinding{
+            uint32_t binding = 0;
+            vk::DescriptorType type = vk::DescriptorType::eUniformBuffer;
+            vk::DescriptorBufferInfo buffer;
+            vk::DescriptorImageInfo image;
+
+            static DescriptorBinding ofBuffer(uint32_t binding, vk::DescriptorType type, vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE){
+                DescriptorBinding result;
+                result.binding = binding;
+                result.type = type;
+                result.buffer = vk::DescriptorBufferInfo(buffer, offset, range);
+                return result;
+            }
+
+            static DescriptorBinding ofImage(uint32_t binding, vk::DescriptorType type, vk::ImageView view, vk::Sampler sampler,
+                vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal){
+                DescriptorBinding result;
+                result.binding = binding;
+                result.type = type;
+                result.image = vk::DescriptorImageInfo(sampler, view, layout);
+                return result;
+            }
+
+            bool isBuffer() const {
+                return type == vk::DescriptorType::eUniformBuffer || type == vk::DescriptorType::eUniformBufferDynamic ||
+                    type == vk::DescriptorType::eStorageBuffer || type == vk::DescriptorType::eStorageBufferDynamic;
+            }
+
+            bool operator==(const DescriptorBinding& other) const {
+                return binding == other.binding && type == other.type && buffer == other.buffer && image == other.image;
+            }
+        };
+
+        /**
+        * @brief Descriptor pools and sets of the frame
+        *
+        * Transient sets come out of per frame slot pools that are reset as a whole in beginFrame(), nothing is
+        * freed one at a time. A pool that runs out is followed by one twice its size, the pools are kept across
+        * frames so a steady frame allocates no pools at all. getSet() hands out the same set for the same
+        * layout and binding contents, those sets live in their own pools until they have not been asked for in
+        * DESCRIPTOR_CACHE_FRAMES frames. With descriptor indexing the allocator also owns one bindless table of
+        * combined image samplers, shaders index it with the number addTexture() returned. An index is only
+        * written while no frame in flight can sample it, a texture that changes moves to a new index instead.
+        *
+        * Not thread safe, sets are allocated on the thread that records the frame.
+        */
+        class VulkanDescriptorAllocator{
+            private:
+                struct FramePools{
+                    std::vector<vk::DescriptorPool> pools;
+                    /** @brief Pool allocated from, the ones before it are full */
+                    uint32_t current = 0;
+                };
+
+                struct CachedSet{
+                    vk::DescriptorSetLayout layout;
+                    std::vector<DescriptorBinding> bindings;
+                    vk::DescriptorSet set;
+                    vk::DescriptorPool pool;
+                    uint64_t lastUsed;
+                };
+
+                VulkanDevice* vulkanDevice = nullptr;
+                vk::Device device;
+                std::vector<FramePools> frames;
+                uint32_t currentSlot = 0;
+                uint64_t frameNumber = 0;
+
+                std::unordered_multimap<uint64_t, CachedSet> cache;
+                /** @brief Pools of cached sets, created with eFreeDescriptorSet so evicted sets go back */
+                std::vector<vk::DescriptorPool> cachePools;
+
+                vk::DescriptorSetLayout bindlessLayout;
+                vk::DescriptorPool bindlessPool;
+                vk::DescriptorSet bindlessSet;
+                uint32_t bindlessCapacity = 0;
+                uint32_t bindlessUsed = 0;
+                std::vector<uint32_t> freeTextures;
+                /** @brief Removed indices and the frame they were removed in, reused once no frame in flight can read them */
+                std::vector<std::pair<uint32_t, uint64_t>> retiredTextures;
+                std::vector<uint32_t> pendingIndices;
+                std::vector<vk::DescriptorImageInfo> pendingImages;
+
+                DescriptorStats stats;
+                DescriptorStats lastStats;
+
+                vk::DescriptorPool createPool(uint32_t maxSets, vk::DescriptorPoolCreateFlags flags){
+                    // descriptors per set of every type, generous for the uniform and sampler heavy sets of materials
+                    static const struct { vk::DescriptorType type; uint32_t perSet; } ratios[] = {
+                        { vk::DescriptorType::eUniformBuffer, 2 },
+                        { vk::DescriptorType::eUniformBufferDynamic, 1 },
+                        { vk::DescriptorType::eStorageBuffer, 2 },
+                        { vk::DescriptorType::eStorageBufferDynamic, 1 },
+                        { vk::DescriptorType::eCombinedImageSampler, 4 },
+                        { vk::DescriptorType::eSampledImage, 1 },
+                        { vk::DescriptorType::eSampler, 1 },
+                        { vk::DescriptorType::eStorageImage, 1 },
+                        { vk::DescriptorType::eInputAttachment, 1 }
+                    };
+                    std::vector<vk::DescriptorPoolSize> sizes;
+                    for (const auto& ratio : ratios){
+                        sizes.push_back(vk::DescriptorPoolSize(ratio.type, ratio.perSet * maxSets));
+                    }
+                    vk::DescriptorPoolCreateInfo poolInfo;
+                    poolInfo.flags = flags;
+                    poolInfo.maxSets = maxSets;
+                    poolInfo.poolSizeCount = (uint32_t)sizes.size();
+                    poolInfo.pPoolSizes = sizes.data();
+                    vk::DescriptorPool pool;
+                    if (device.createDescriptorPool(&poolInfo, nullptr, &pool) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to create descriptor pool!");
+                    }
+                    stats.pools++;
+                    return pool;
+                }
+
+                /** @return eSuccess, or eErrorOutOfPoolMemory / eErrorFragmentedPool when the pool is full */
+                vk::Result tryAllocate(vk::DescriptorPool pool, vk::DescriptorSetLayout layout, vk::DescriptorSet* set){
+                    vk::DescriptorSetAllocateInfo allocInfo;
+                    allocInfo.descriptorPool = pool;
+                    allocInfo.descriptorSetCount = 1;
+                    allocInfo.pSetLayouts = &layout;
+                    vk::Result result = device.allocateDescriptorSets(&allocInfo, set);
+                    if (result != vk::Result::eSuccess && result != vk::Result::eErrorOutOfPoolMemory && result != vk::Result::eErrorFragmentedPool){
+                        throw std::runtime_error("failed to allocate descriptor set!");
+                    }
+                    return result;
+                }
+
+                /** @brief Allocate from the newest cache pool, a new pool is started once it is full */
+                vk::DescriptorSet allocateCached(vk::DescriptorSetLayout layout, vk::DescriptorPool* pool){
+                    vk::DescriptorSet set;
+                    if (cachePools.empty() || tryAllocate(cachePools.back(), layout, &set) != vk::Result::eSuccess){
+                        cachePools.push_back(createPool(DESCRIPTOR_POOL_SETS, vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet));
+                        if (tryAllocate(cachePools.back(), layout, &set) != vk::Result::eSuccess){
+                            throw std::runtime_error("descriptor set layout does not fit into a descriptor pool!");
+                        }
+                    }
+                    *pool = cachePools.back();
+                    stats.allocations++;
+                    return set;
+                }
+
+                /** @brief FNV-1a over the layout handle and the binding contents */
+                static uint64_t hashSet(vk::DescriptorSetLayout layout, const DescriptorBinding* bindings, uint32_t count){
+                    uint64_t hash = 14695981039346656037ull;
+                    auto mix = [&hash](uint64_t value){
+                        for (uint32_t i = 0; i < 8; i++){
+                            hash ^= (value >> (i * 8)) & 0xff;
+                            hash *= 1099511628211ull;
+                        }
+                    };
+                    mix((uint64_t)(VkDescriptorSetLayout)layout);
+                    for (uint32_t i = 0; i < count; i++){
+                        const DescriptorBinding& binding = bindings[i];
+                        mix(((uint64_t)binding.binding << 32) | (uint32_t)binding.type);
+                        if (binding.isBuffer()){
+                            mix((uint64_t)(VkBuffer)binding.buffer.buffer);
+                            mix(binding.buffer.offset);
+                            mix(binding.buffer.range);
+                        } else{
+                            mix((uint64_t)(VkImageView)binding.image.imageView);
+                            mix((uint64_t)(VkSampler)binding.image.sampler);
+                            mix((uint64_t)binding.image.imageLayout);
+                        }
+                    }
+                    return hash;
+                }
+
+                void createBindlessTable(uint32_t textures){
+                    const vk::PhysicalDeviceDescriptorIndexingPropertiesEXT& limits = vulkanDevice->descriptorIndexingProperties;
+                    bindlessCapacity = std::min(textures, std::min(limits.maxDescriptorSetUpdateAfterBindSampledImages,
+                        std::min(limits.maxPerStageDescriptorUpdateAfterBindSampledImages, limits.maxPerStageDescriptorUpdateAfterBindSamplers)));
+                    if (bindlessCapacity == 0){
+                        return;
+                    }
+
+                    vk::DescriptorSetLayoutBinding binding(0, vk::DescriptorType::eCombinedImageSampler, bindlessCapacity, vk::ShaderStageFlagBits::eAll);
+                    // unused entries stay unwritten, entries the pending frames do not read may be written while they are in flight
+                    vk::DescriptorBindingFlagsEXT bindingFlags = vk::DescriptorBindingFlagBitsEXT::ePartiallyBound | vk::DescriptorBindingFlagBitsEXT::eUpdateAfterBind |
+                        vk::DescriptorBindingFlagBitsEXT::eUpdateUnusedWhilePending;
+                    vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT flagsInfo;
+                    flagsInfo.bindingCount = 1;
+                    flagsInfo.pBindingFlags = &bindingFlags;
+                    vk::DescriptorSetLayoutCreateInfo layoutInfo;
+                    layoutInfo.pNext = &flagsInfo;
+                    layoutInfo.flags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT;
+                    layoutInfo.bindingCount = 1;
+                    layoutInfo.pBindings = &binding;
+                    if (device.createDescriptorSetLayout(&layoutInfo, nullptr, &bindlessLayout) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to create bindless descriptor set layout!");
+                    }
+
+                    vk::DescriptorPoolSize poolSize(vk::DescriptorType::eCombinedImageSampler, bindlessCapacity);
+                    vk::DescriptorPoolCreateInfo poolInfo;
+                    poolInfo.flags = vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT;
+                    poolInfo.maxSets = 1;
+                    poolInfo.poolSizeCount = 1;
+                    poolInfo.pPoolSizes = &poolSize;
+                    if (device.createDescriptorPool(&poolInfo, nullptr, &bindlessPool) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to create bindless descriptor pool!");
+                    }
+                    stats.pools++;
+                    if (tryAllocate(bindlessPool, bindlessLayout, &bindlessSet) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to allocate bindless descriptor set!");
+                    }
+                }
+
+            public:
+                /**
+                * @param frameCount Frame slots of the frames in flight pipeline
+                * @param bindlessTextures Entries of the bindless table, clamped to the device limits. Ignored without descriptor indexing
+                */
+                void init(VulkanDevice* vulkanDevice, uint32_t frameCount, uint32_t bindlessTextures = DEFAULT_BINDLESS_TEXTURES){
+                    this->vulkanDevice = vulkanDevice;
+                    device = vulkanDevice->device;
+                    frames.resize(frameCount);
+                    for (auto& frame : frames){
+                        frame.pools.push_back(createPool(DESCRIPTOR_POOL_SETS, vk::DescriptorPoolCreateFlags()));
+                    }
+                    if (vulkanDevice->descriptorIndexingEnabled()){
+                        createBindlessTable(bindlessTextures);
+                    }
+                }
+
+                /** @brief The device must be idle */
+                void destroy(){
+                    if (!device){
+                        return;
+                    }
+                    for (auto& frame : frames){
+                        for (auto pool : frame.pools){
+                            device.destroyDescriptorPool(pool);
+                        }
+                    }
+                    frames.clear();
+                    for (auto pool : cachePools){
+                        device.destroyDescriptorPool(pool);
+                    }
+                    cachePools.clear();
+                    cache.clear();
+                    if (bindlessPool){
+                        device.destroyDescriptorPool(bindlessPool);
+                        device.destroyDescriptorSetLayout(bindlessLayout);
+                        bindlessPool = vk::DescriptorPool();
+                        bindlessLayout = vk::DescriptorSetLayout();
+                        bindlessSet = vk::DescriptorSet();
+                    }
+                    device = vk::Device();
+                }
+
+                /**
+                * Reset the transient pools of a frame slot whose fence has signaled, free cached sets that went
+                * unused and release removed bindless indices no frame in flight can still read
+                */
+                void beginFrame(uint32_t slot){
+                    uint32_t pools = stats.pools;
+                    lastStats = stats;
+                    stats = DescriptorStats();
+                    stats.pools = pools;
+                    currentSlot = slot;
+                    frameNumber++;
+
+                    FramePools& frame = frames[slot];
+                    for (uint32_t i = 0; i <= frame.current && i < frame.pools.size(); i++){
+                        device.resetDescriptorPool(frame.pools[i], vk::DescriptorPoolResetFlags());
+                    }
+                    frame.current = 0;
+
+                    uint64_t keepFrames = std::max<uint64_t>(DESCRIPTOR_CACHE_FRAMES, frames.size());
+                    for (auto it = cache.begin(); it != cache.end();){
+                        if (it->second.lastUsed + keepFrames < frameNumber){
+                            device.freeDescriptorSets(it->second.pool, 1, &it->second.set);
+                            it = cache.erase(it);
+                        } else{
+                            ++it;
+                        }
+                    }
+                    stats.cachedSets = (uint32_t)cache.size();
+
+                    size_t kept = 0;
+                    for (size_t i = 0; i < retiredTextures.size(); i++){
+                        if (retiredTextures[i].second + frames.size() <= frameNumber){
+                            freeTextures.push_back(retiredTextures[i].first);
+                        } else{
+                            retiredTextures[kept++] = retiredTextures[i];
+                        }
+                    }
+                    retiredTextures.resize(kept);
+                    flush();
+                }
+
+                /** @brief A set valid until the current frame slot comes around again, the caller writes it */
+                vk::DescriptorSet allocate(vk::DescriptorSetLayout layout){
+                    FramePools& frame = frames[currentSlot];
+                    vk::DescriptorSet set;
+                    bool created = false;
+                    while (tryAllocate(frame.pools[frame.current], layout, &set) != vk::Result::eSuccess){
+                        if (created){
+                            throw std::runtime_error("descriptor set layout does not fit into a descriptor pool!");
+                        }
+                        frame.current++;
+                        if (frame.current == frame.pools.size()){
+                            uint32_t sets = std::min<uint32_t>(DESCRIPTOR_POOL_SETS << std::min<uint32_t>(frame.current, 16), DESCRIPTOR_POOL_MAX_SETS);
+                            frame.pools.push_back(createPool(sets, vk::DescriptorPoolCreateFlags()));
+                            created = true;
+                        }
+                    }
+                    stats.allocations++;
+                    return set;
+                }
+
+                /** @brief A transient set with the bindings written */
+                vk::DescriptorSet allocate(vk::DescriptorSetLayout layout, const DescriptorBinding* bindings, uint32_t count){
+                    vk::DescriptorSet set = allocate(layout);
+                    write(set, bindings, count);
+                    return set;
+                }
+
+                /**
+                * The set of layout with exactly these binding contents, allocated and written only the first time
+                * it is asked for. Handles in bindings must outlive the set, destroyed resources can leave a cached
+                * set behind until it is evicted.
+                */
+                vk::DescriptorSet getSet(vk::DescriptorSetLayout layout, const DescriptorBinding* bindings, uint32_t count){
+                    uint64_t hash = hashSet(layout, bindings, count);
+                    auto range = cache.equal_range(hash);
+                    for (auto it = range.first; it != range.second; ++it){
+                        CachedSet& cached = it->second;
+                        if (cached.layout == layout && cached.bindings.size() == count && std::equal(bindings, bindings + count, cached.bindings.begin())){
+                            cached.lastUsed = frameNumber;
+                            stats.cacheHits++;
+                            return cached.set;
+                        }
+                    }
+                    stats.cacheMisses++;
+                    CachedSet cached;
+                    cached.layout = layout;
+                    cached.bindings.assign(bindings, bindings + count);
+                    cached.set = allocateCached(layout, &cached.pool);
+                    cached.lastUsed = frameNumber;
+                    write(cached.set, bindings, count);
+                    cache.insert(std::make_pair(hash, cached));
+                    stats.cachedSets = (uint32_t)cache.size();
+                    return cached.set;
+                }
+
+                /** @brief Write the bindings of a set in one update */
+                void write(vk::DescriptorSet set, const DescriptorBinding* bindings, uint32_t count){
+                    std::vector<vk::WriteDescriptorSet> writes(count);
+                    for (uint32_t i = 0; i < count; i++){
+                        writes[i].dstSet = set;
+                        writes[i].dstBinding = bindings[i].binding;
+                        writes[i].descriptorCount = 1;
+                        writes[i].descriptorType = bindings[i].type;
+                        if (bindings[i].isBuffer()){
+                            writes[i].pBufferInfo = &bindings[i].buffer;
+                        } else{
+                            writes[i].pImageInfo = &bindings[i].image;
+                        }
+                    }
+                    device.updateDescriptorSets(count, writes.data(), 0, nullptr);
+                    stats.writes += count;
+                }
+
+                /** @brief Whether the bindless table exists, the device supports descriptor indexing */
+                bool isBindless() const { return bindlessSet ? true : false; }
+
+                /**
+                * Put a texture into the bindless table, the write happens with the next flush()
+                *
+                * @return Index of the texture in the table
+                */
+                uint32_t addTexture(vk::ImageView view, vk::Sampler sampler, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal){
+                    uint32_t index;
+                    if (!freeTextures.empty()){
+                        index = freeTextures.back();
+                        freeTextures.pop_back();
+                    } else if (bindlessUsed < bindlessCapacity){
+                        index = bindlessUsed++;
+                    } else{
+                        throw std::runtime_error("bindless texture table is full!");
+                    }
+                    pendingIndices.push_back(index);
+                    pendingImages.push_back(vk::DescriptorImageInfo(sampler, view, layout));
+                    return index;
+                }
+
+                /**
+                * Move a texture to a new index, e.g. after the streamer changed the resident mips. Frames in flight
+                * may still sample the old index, so it is never rewritten, it is removed like any other
+                *
+                * @return Index draws recorded from now on use
+                */
+                uint32_t replaceTexture(uint32_t index, vk::ImageView view, vk::Sampler sampler, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal){
+                    uint32_t replacement = addTexture(view, sampler, layout);
+                    removeTexture(index);
+                    return replacement;
+                }
+
+                /** @brief The index is handed out again once the frames in flight that may sample it have finished */
+                void removeTexture(uint32_t index){
+                    retiredTextures.push_back(std::make_pair(index, frameNumber));
+                }
+
+                /** @brief Write the queued bindless table changes in one update */
+                void flush(){
+                    if (pendingIndices.empty()){
+                        return;
+                    }
+                    std::vector<vk::WriteDescriptorSet> writes(pendingIndices.size());
+                    for (size_t i = 0; i < writes.size(); i++){
+                        writes[i].dstSet = bindlessSet;
+                        writes[i].dstBinding = 0;
+                        writes[i].dstArrayElement = pendingIndices[i];
+                        writes[i].descriptorCount = 1;
+                        writes[i].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+                        writes[i].pImageInfo = &pendingImages[i];
+                    }
+                    device.updateDescriptorSets((uint32_t)writes.size(), writes.data(), 0, nullptr);
+                    stats.writes += (uint32_t)writes.size();
+                    pendingIndices.clear();
+                    pendingImages.clear();
+                }
+
+                /** @brief Layout of the bindless table for pipeline layouts, null without descriptor indexing */
+                vk::DescriptorSetLayout getBindlessLayout() const { return bindlessLayout; }
+                /** @brief The bindless table with all queued changes written, bind it once per command buffer */
+                vk::DescriptorSet getBindlessSet(){
+                    flush();
+                    return bindlessSet;
+                }
+                uint32_t getBindlessCapacity() const { return bindlessCapacity; }
+
+                /** @brief Counters of the last completed frame */
+                const DescriptorStats& getStats() const { return lastStats; }
+        };
+    }
+}
+
+#endif
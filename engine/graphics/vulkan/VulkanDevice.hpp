@@ -9,7 +9,9 @@
 #include <algorithm>
 #include <map>
 
+#include "VulkanMemoryAllocator.hpp"
 #include "VulkanBuffer.hpp"
+#include "../../core/Profiler.hpp"
 
 // Default fence timeout in nanoseconds
 #define DEFAULT_FENCE_TIMEOUT 100000000000
@@ -20,6 +22,7 @@ namespace trb{
         struct QueueFamilyIndices {
             int graphicsFamily = -1;
             int computeFamily = -1;
+            int transferFamily = -1;
             int presentFamily = -1;
 
             bool isComplete() {
@@ -37,11 +40,18 @@ namespace trb{
             std::vector<vk::QueueFamilyProperties> queueFamilyProperties; 
             QueueFamilyIndices queueFamilyIndices;
             std::vector<std::string> supportedExtensions;
+            std::vector<std::string> enabledExtensions;
+            /** @brief Descriptor indexing features the device was created with, all off without VK_EXT_descriptor_indexing */
+            vk::PhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures;
+            vk::PhysicalDeviceDescriptorIndexingPropertiesEXT descriptorIndexingProperties;
 
             vk::CommandPool commandPool;      
+            /** @brief Sub allocates buffer memory out of large per memory type blocks */
+            VulkanMemoryAllocator allocator;
             
             VulkanDevice(){};
             ~VulkanDevice(){
+                allocator.destroy();
                 if (commandPool) {
                     device.destroyCommandPool(commandPool, nullptr);
                 }
@@ -51,6 +61,7 @@ namespace trb{
             }
 
             void init(vk::Instance instance){
+                TRB_PROFILE_ZONE("VulkanDevice::init");
                 uint32_t deviceCount = 0;
                 instance.enumeratePhysicalDevices(&deviceCount, nullptr);
                 if (deviceCount == 0) {
@@ -79,6 +90,7 @@ namespace trb{
 
                 physicalDevice.getFeatures(&features);
                 physicalDevice.getProperties(&properties);
+                physicalDevice.getMemoryProperties(&memoryProperties);
 
                 // Get list of supported extensions
                 uint32_t extCount = 0;
@@ -107,8 +119,69 @@ namespace trb{
                 if (features.geometryShader) {
                     enabledFeatures.geometryShader = VK_TRUE;
                 }
+                // GPU driven draws (VulkanGpuCuller), emulated with single draws where missing
+                if (features.multiDrawIndirect) {
+                    enabledFeatures.multiDrawIndirect = VK_TRUE;
+                }
+                if (features.drawIndirectFirstInstance) {
+                    enabledFeatures.drawIndirectFirstInstance = VK_TRUE;
+                }
+                // vertex and shader invocation counts of GPU profiler scopes (VulkanGpuProfiler)
+                if (features.pipelineStatisticsQuery) {
+                    enabledFeatures.pipelineStatisticsQuery = VK_TRUE;
+                }
                 std::vector<const char*> enabledExtensions{};
-                createLogicalDevice(enabledFeatures, enabledExtensions);
+                if (extensionSupported(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+                    enabledExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+                }
+                // Bindless texture tables (VulkanDescriptorAllocator), features come from the properties2 instance extension
+                vk::PhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures;
+                if (queryDescriptorIndexing(instance, &indexingFeatures)) {
+                    enabledExtensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+                    enabledExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+                }
+                createLogicalDevice(enabledFeatures, enabledExtensions, indexingFeatures.runtimeDescriptorArray ? &indexingFeatures : nullptr);
+                if (indexingFeatures.runtimeDescriptorArray) {
+                    descriptorIndexingFeatures = indexingFeatures;
+                    descriptorIndexingFeatures.pNext = nullptr;
+                }
+            }
+
+            /**
+            * Whether the device can index a partially bound, update after bind array of sampled images in shaders
+            * and rewrite its unused entries while a frame using it is pending
+            *
+            * @param enable Receives just the features to enable, left zero when unsupported
+            */
+            bool queryDescriptorIndexing(vk::Instance instance, vk::PhysicalDeviceDescriptorIndexingFeaturesEXT* enable) {
+                if (!extensionSupported(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) || !extensionSupported(VK_KHR_MAINTENANCE3_EXTENSION_NAME)) {
+                    return false;
+                }
+                // null unless the instance enabled VK_KHR_get_physical_device_properties2
+                PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)instance.getProcAddr("vkGetPhysicalDeviceFeatures2KHR");
+                PFN_vkGetPhysicalDeviceProperties2KHR getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)instance.getProcAddr("vkGetPhysicalDeviceProperties2KHR");
+                if (!getFeatures2 || !getProperties2) {
+                    return false;
+                }
+                vk::PhysicalDeviceDescriptorIndexingFeaturesEXT supported;
+                vk::PhysicalDeviceFeatures2 features2;
+                features2.pNext = &supported;
+                getFeatures2(physicalDevice, reinterpret_cast<VkPhysicalDeviceFeatures2*>(&features2));
+                if (!supported.runtimeDescriptorArray || !supported.descriptorBindingPartiallyBound ||
+                    !supported.descriptorBindingSampledImageUpdateAfterBind || !supported.descriptorBindingUpdateUnusedWhilePending ||
+                    !supported.shaderSampledImageArrayNonUniformIndexing) {
+                    return false;
+                }
+                vk::PhysicalDeviceProperties2 properties2;
+                properties2.pNext = &descriptorIndexingProperties;
+                getProperties2(physicalDevice, reinterpret_cast<VkPhysicalDeviceProperties2*>(&properties2));
+                descriptorIndexingProperties.pNext = nullptr;
+                enable->runtimeDescriptorArray = VK_TRUE;
+                enable->descriptorBindingPartiallyBound = VK_TRUE;
+                enable->descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+                enable->descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+                enable->shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+                return true;
             }
 
             int rateDeviceSuitability(vk::PhysicalDevice device) {
@@ -195,6 +268,17 @@ namespace trb{
                         }
                     }
                 }
+                // Dedicated queue for transfer
+                // Try to find a queue family index that supports transfer but not graphics and compute (DMA engine)
+                if (queueFlags & vk::QueueFlagBits::eTransfer){
+                    for (uint32_t i = 0; i < static_cast<uint32_t>(queueFamilyProperties.size()); i++) {
+                        if ( (queueFamilyProperties[i].queueFlags & queueFlags) && 
+                             ( !(queueFamilyProperties[i].queueFlags & vk::QueueFlagBits::eGraphics) ) &&
+                             ( !(queueFamilyProperties[i].queueFlags & vk::QueueFlagBits::eCompute) ) ) {
+                            return i;
+                        }
+                    }
+                }
                 // For other queue types or if no separate compute queue is present, return the first one to support the requested flags
                 for (uint32_t i = 0; i < static_cast<uint32_t>(queueFamilyProperties.size()); i++) {
                     if (queueFamilyProperties[i].queueFlags & queueFlags) {
@@ -203,12 +287,17 @@ namespace trb{
                     }
                 }
 
+                // Graphics and compute queues implicitly support transfer operations without having to report it
+                if (queueFlags == vk::QueueFlags(vk::QueueFlagBits::eTransfer)){
+                    return getQueueFamilyIndex(vk::QueueFlagBits::eGraphics);
+                }
+
                 throw std::runtime_error("Could not find a matching queue family index");
             }
 
 
 
-            vk::Result createLogicalDevice(vk::PhysicalDeviceFeatures enabledFeatures, std::vector<const char*> enabledExtensions, vk::QueueFlags requestedQueueTypes = vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)
+            vk::Result createLogicalDevice(vk::PhysicalDeviceFeatures enabledFeatures, std::vector<const char*> enabledExtensions, const void* next = nullptr, vk::QueueFlags requestedQueueTypes = vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eTransfer)
             {			
                 // Desired queues need to be requested upon logical device creation
                 // Due to differing queue family configurations of Vulkan implementations this can be a bit tricky, especially if the application
@@ -249,11 +338,30 @@ namespace trb{
                     queueFamilyIndices.computeFamily = queueFamilyIndices.graphicsFamily;
                 }
 
+                // Dedicated transfer queue
+                if (requestedQueueTypes & vk::QueueFlagBits::eTransfer) {
+                    queueFamilyIndices.transferFamily = getQueueFamilyIndex(vk::QueueFlagBits::eTransfer);
+                    if (queueFamilyIndices.transferFamily != queueFamilyIndices.graphicsFamily &&
+                        queueFamilyIndices.transferFamily != queueFamilyIndices.computeFamily) {
+                        // If transfer family index differs, we need an additional queue create info for the transfer queue
+                        vk::DeviceQueueCreateInfo queueInfo;
+                        queueInfo.queueFamilyIndex = queueFamilyIndices.transferFamily;
+                        queueInfo.queueCount = 1;
+                        queueInfo.pQueuePriorities = &defaultQueuePriority;
+                        queueCreateInfos.push_back(queueInfo);
+                    }
+                } else {
+                    // Else we use the same queue
+                    queueFamilyIndices.transferFamily = queueFamilyIndices.graphicsFamily;
+                }
+
                 // Create the logical device representation
                 std::vector<const char*> deviceExtensions(enabledExtensions);
                 deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 
                 vk::DeviceCreateInfo deviceCreateInfo;
+                // feature structs of extensions, e.g. descriptor indexing
+                deviceCreateInfo.pNext = next;
                 deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());;
                 deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
                 deviceCreateInfo.pEnabledFeatures = &enabledFeatures;
@@ -266,10 +374,12 @@ namespace trb{
                 vk::Result result = physicalDevice.createDevice(&deviceCreateInfo, nullptr, &device);
                 if (result == vk::Result::eSuccess ) {
                     commandPool = createCommandPool(queueFamilyIndices.graphicsFamily);
+                    allocator.init(device, memoryProperties, properties.limits);
                 }else{
                     throw std::runtime_error("failed to create logical device!");
                 }
                 this->enabledFeatures = enabledFeatures;
+                this->enabledExtensions.assign(deviceExtensions.begin(), deviceExtensions.end());
 
                 return result;
             }
@@ -287,7 +397,19 @@ namespace trb{
             }
 
 
-            vk::Result createBuffer(vk::BufferUsageFlags usageFlags, vk::MemoryPropertyFlags memoryPropertyFlags, vk::DeviceSize size, vk::Buffer *buffer, vk::DeviceMemory *memory, void *data = nullptr){
+            /**
+            * Create a raw buffer handle backed by a sub range of a shared memory block
+            *
+            * @param usageFlags Usage flag bitmask for the buffer (i.e. index, vertex, uniform buffer)
+            * @param memoryPropertyFlags Memory properties for this buffer (i.e. device local, host visible, coherent)
+            * @param size Size of the buffer in bytes
+            * @param buffer Pointer to the buffer handle acquired by the function
+            * @param allocation Pointer to the memory range acquired by the function, release with allocator.free()
+            * @param data Pointer to the data that should be copied to the buffer after creation (optional, if not set, no data is copied over)
+            *
+            * @return VK_SUCCESS if buffer handle and memory have been created and (optionally passed) data has been copied
+            */
+            vk::Result createBuffer(vk::BufferUsageFlags usageFlags, vk::MemoryPropertyFlags memoryPropertyFlags, vk::DeviceSize size, vk::Buffer *buffer, MemoryAllocation *allocation, void *data = nullptr){
                 // Create the buffer handle
                 vk::BufferCreateInfo bufferCreateInfo;
                 bufferCreateInfo.usage = usageFlags;
@@ -296,38 +418,32 @@ namespace trb{
                 if( device.createBuffer(&bufferCreateInfo, nullptr, buffer) != vk::Result::eSuccess ){
                     throw std::runtime_error("could not create buffer");
                 }
-                // Create the memory backing up the buffer handle
+                // Carve the memory backing up the buffer handle out of a shared block
                 vk::MemoryRequirements memReqs;
-                vk::MemoryAllocateInfo memAlloc;
                 device.getBufferMemoryRequirements(*buffer, &memReqs);
-                memAlloc.allocationSize = memReqs.size;
                 // Find a memory type index that fits the properties of the buffer
-                memAlloc.memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
-                if( device.allocateMemory(&memAlloc, nullptr, memory) != vk::Result::eSuccess ){
-                    throw std::runtime_error("failed to allocate memory on device");
-                }
+                uint32_t memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
+                *allocation = allocator.allocate(memReqs, memoryTypeIndex, memoryUsageFor(usageFlags));
                 
-                // If a pointer to the buffer data has been passed, map the buffer and copy over the data
+                // If a pointer to the buffer data has been passed, copy it over through the persistent mapping of the block
                 if (data != nullptr){
-                    void *mapped;
-                    //mapMemory( DeviceMemory memory, DeviceSize offset, DeviceSize size, MemoryMapFlags flags, void** ppData )
-                    if( device.mapMemory(*memory, (vk::DeviceSize)0, size, (vk::MemoryMapFlags)0, &mapped) != vk::Result::eSuccess ){
+                    void *mapped = allocation->mapped();
+                    if (!mapped){
                         throw std::runtime_error("failed to map memory to device");
                     }
                     memcpy(mapped, data, size);
                     // If host coherency hasn't been requested, do a manual flush to make writes visible
                     if ( !(memoryPropertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent) ){
                         vk::MappedMemoryRange mappedRange;
-                        mappedRange.memory = *memory;
-                        mappedRange.offset = 0;
-                        mappedRange.size = size;
+                        mappedRange.memory = allocation->memory;
+                        mappedRange.offset = allocation->offset;
+                        mappedRange.size = allocation->size;
                         device.flushMappedMemoryRanges(1, &mappedRange);                        
                     }
-                    device.unmapMemory(*memory);                    
                 }
 
-                // Attach the memory to the buffer object
-                device.bindBufferMemory(*buffer, *memory, 0);
+                // Attach the memory range to the buffer object
+                device.bindBufferMemory(*buffer, allocation->memory, allocation->offset);
                 return vk::Result::eSuccess;
             }
 
@@ -339,32 +455,40 @@ namespace trb{
             * @param buffer Pointer to a vk::Vulkan buffer object
             * @param size Size of the buffer in byes
             * @param data Pointer to the data that should be copied to the buffer after creation (optional, if not set, no data is copied over)
+            * @param queueFamilies (Optional) Queue families sharing the buffer without ownership transfers, concurrent sharing
+            *        is used when they differ
             *
             * @return VK_SUCCESS if buffer handle and memory have been created and (optionally passed) data has been copied
             */
-            vk::Result createBuffer(vk::BufferUsageFlags usageFlags, vk::MemoryPropertyFlags memoryPropertyFlags, Buffer *buffer, vk::DeviceSize size, void *data = nullptr){
+            vk::Result createBuffer(vk::BufferUsageFlags usageFlags, vk::MemoryPropertyFlags memoryPropertyFlags, Buffer *buffer, vk::DeviceSize size, void *data = nullptr,
+                                    std::vector<uint32_t> queueFamilies = std::vector<uint32_t>()){
                 buffer->device = device;
 
                 // Create the buffer handle
                 vk::BufferCreateInfo bufferCreateInfo;
                 bufferCreateInfo.usage = usageFlags;
                 bufferCreateInfo.size = size;
+                std::sort(queueFamilies.begin(), queueFamilies.end());
+                queueFamilies.erase(std::unique(queueFamilies.begin(), queueFamilies.end()), queueFamilies.end());
+                if (queueFamilies.size() > 1){
+                    bufferCreateInfo.sharingMode = vk::SharingMode::eConcurrent;
+                    bufferCreateInfo.queueFamilyIndexCount = (uint32_t)queueFamilies.size();
+                    bufferCreateInfo.pQueueFamilyIndices = queueFamilies.data();
+                }
                 if(device.createBuffer(&bufferCreateInfo, nullptr, &buffer->buffer) != vk::Result::eSuccess ){
                     throw std::runtime_error("could not create buffer");
                 }
 
-                // Create the memory backing up the buffer handle
+                // Carve the memory backing up the buffer handle out of a shared block
                 vk::MemoryRequirements memReqs;
-                vk::MemoryAllocateInfo memAlloc;
                 device.getBufferMemoryRequirements(buffer->buffer, &memReqs);
-                memAlloc.allocationSize = memReqs.size;
                 // Find a memory type index that fits the properties of the buffer
-                memAlloc.memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
-                if( device.allocateMemory(&memAlloc, nullptr, &buffer->memory) != vk::Result::eSuccess ){
-                    throw std::runtime_error("failed to allocate memory on device");
-                }
+                uint32_t memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
+                buffer->allocation = allocator.allocate(memReqs, memoryTypeIndex, memoryUsageFor(usageFlags));
+                buffer->allocator = &allocator;
+                buffer->memory = buffer->allocation.memory;
                 buffer->alignment = memReqs.alignment;
-                buffer->size = memAlloc.allocationSize;
+                buffer->size = memReqs.size;
                 buffer->usageFlags = usageFlags;
                 buffer->memoryPropertyFlags = memoryPropertyFlags;
 
@@ -374,6 +498,9 @@ namespace trb{
                         throw std::runtime_error("could not map memory");
                     }
                     memcpy(buffer->mapped, data, size);
+                    if ( !(memoryPropertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent) ){
+                        buffer->flush();
+                    }
                     buffer->unmap();
                 }
                 // Initialize a default descriptor that covers the whole buffer size
@@ -450,6 +577,15 @@ namespace trb{
 			    return (std::find(supportedExtensions.begin(), supportedExtensions.end(), extension) != supportedExtensions.end());
 		    }
 
+            bool extensionEnabled(std::string extension){
+                return (std::find(enabledExtensions.begin(), enabledExtensions.end(), extension) != enabledExtensions.end());
+            }
+
+            /** @brief Whether bindless descriptor tables can be used, see queryDescriptorIndexing() */
+            bool descriptorIndexingEnabled() const {
+                return descriptorIndexingFeatures.runtimeDescriptorArray != VK_FALSE;
+            }
+
         };
     }
 }
@@ -0,0 +1,100 @@
+#ifndef TRB_GFX_VulkanFrame_H_
+#define TRB_GFX_VulkanFrame_H_
+
+#include "vulkan/vulkan.hpp"
+
+#include <stdexcept>
+#include <vector>
+#include <functional>
+
+#include "VulkanDevice.hpp"
+
+// Default number of frames the CPU may record ahead of the GPU
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+
+namespace trb{
+    namespace grfx{
+
+        /**
+        * @brief Everything one frame slot of the N buffered frame pipeline owns
+        *
+        * The CPU only touches a slot again once its fence signaled, so command buffers and
+        * per frame resources of a slot can be reused while the GPU still works on the other slots
+        */
+        struct VulkanFrame{
+            /** @brief Reset as a whole once per frame instead of resetting individual command buffers */
+            vk::CommandPool commandPool;
+            vk::CommandBuffer commandBuffer;
+            /** @brief Signaled when the GPU finished the submission of this slot */
+            vk::Fence fence;
+            /** @brief Signaled by the presentation engine when the acquired swap chain image can be rendered to */
+            vk::Semaphore imageAvailable;
+            /** @brief Signaled when rendering finished, waited on by the present */
+            vk::Semaphore renderFinished;
+            /** @brief Swap chain image acquired for this slot */
+            uint32_t imageIndex = 0;
+            /** @brief Global frame number last recorded into this slot */
+            uint64_t frameNumber = 0;
+            /** @brief Destruction of resources last used by this slot, run once its fence signaled */
+            std::vector<std::function<void()> > deletionQueue;
+
+            void create(VulkanDevice& vulkanDevice){
+                vk::Device device = vulkanDevice.device;
+                commandPool = vulkanDevice.createCommandPool(vulkanDevice.queueFamilyIndices.graphicsFamily, vk::CommandPoolCreateFlagBits::eTransient);
+
+                vk::CommandBufferAllocateInfo cmdBufAllocateInfo;
+                cmdBufAllocateInfo.commandPool = commandPool;
+                cmdBufAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
+                cmdBufAllocateInfo.commandBufferCount = 1;
+                if (device.allocateCommandBuffers(&cmdBufAllocateInfo, &commandBuffer) != vk::Result::eSuccess){
+                    throw std::runtime_error("failed to allocate frame command buffer!");
+                }
+
+                // Created signaled so the first wait on a fresh slot returns right away
+                vk::FenceCreateInfo fenceInfo;
+                fenceInfo.flags = vk::FenceCreateFlagBits::eSignaled;
+                if (device.createFence(&fenceInfo, nullptr, &fence) != vk::Result::eSuccess){
+                    throw std::runtime_error("failed to create frame fence");
+                }
+                vk::SemaphoreCreateInfo semaphoreInfo;
+                if (device.createSemaphore(&semaphoreInfo, nullptr, &imageAvailable) != vk::Result::eSuccess ||
+                    device.createSemaphore(&semaphoreInfo, nullptr, &renderFinished) != vk::Result::eSuccess){
+                    throw std::runtime_error("failed to create frame semaphores");
+                }
+            }
+
+            /**
+            * Defer destruction of a resource until the GPU is done with this frame
+            */
+            void deferDelete(std::function<void()> deleter){
+                deletionQueue.push_back(deleter);
+            }
+
+            void flushDeletionQueue(){
+                for (auto it = deletionQueue.rbegin(); it != deletionQueue.rend(); ++it){
+                    (*it)();
+                }
+                deletionQueue.clear();
+            }
+
+            void destroy(vk::Device device){
+                flushDeletionQueue();
+                if (fence){
+                    device.destroyFence(fence, nullptr);
+                }
+                if (imageAvailable){
+                    device.destroySemaphore(imageAvailable, nullptr);
+                }
+                if (renderFinished){
+                    device.destroySemaphore(renderFinished, nullptr);
+                }
+                if (commandPool){
+                    device.destroyCommandPool(commandPool, nullptr);
+                }
+                *this = VulkanFrame();
+            }
+        };
+    }
+}
+
+#endif
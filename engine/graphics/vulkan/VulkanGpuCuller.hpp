@@ -0,0 +1,561 @@
+#ifndef TRB_GFX_VulkanGpuCuller_H_
+#define TRB_GFX_VulkanGpuCuller_H_
+
+#include "vulkan/vulkan.hpp"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <stdexcept>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstring>
+
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+#include "VulkanMesh.hpp"
+#include "../Frustum.hpp"
+
+// SPIR-V of shaders/gpu_cull.comp
+#define GPU_CULL_SHADER_PATH "shaders/gpu_cull.comp.spv"
+// Invocations per workgroup, passed to the shader as specialization constant 0
+#define GPU_CULL_GROUP_SIZE 64
+// Default size of the draw table
+#define GPU_CULL_DEFAULT_DRAWS 256
+// Push constant flags, must match shaders/gpu_cull.comp
+#define GPU_CULL_COMPACT 1
+#define GPU_CULL_FIRST_INSTANCE 2
+// Bytes in front of the commands, the draw count and padding
+#define GPU_CULL_COMMAND_OFFSET 16
+// Storage buffers of the cull shader: instances, draws, commands, visible instances
+#define GPU_CULL_BINDINGS 4
+
+namespace trb{
+    namespace grfx{
+
+        /** @brief Instance as the cull shader reads it */
+        struct GpuCullInstance{
+            /** @brief World space bounding sphere, center xyz and radius w */
+            glm::vec4 sphere;
+            /** @brief Entry of the draw table the instance is drawn with */
+            uint32_t draw;
+            uint32_t reserved[3];
+        };
+
+        /** @brief Index range an instance is drawn with, relative to the geometry bound for draw() */
+        struct GpuCullDraw{
+            uint32_t indexCount;
+            uint32_t firstIndex;
+            int32_t vertexOffset;
+            uint32_t reserved;
+        };
+
+        struct GpuCullStats{
+            /** @brief Instances of the last frame the GPU finished */
+            uint32_t instances = 0;
+            uint32_t visible = 0;
+        };
+
+        /**
+        * @brief Frustum culling on the GPU into indexed indirect draws
+        *
+        * A compute shader tests the bounding sphere of every instance against the frustum planes and writes one
+        * VkDrawIndexedIndirectCommand per visible instance plus the draw count, the draws are issued without the
+        * CPU ever seeing the visibility. firstInstance is the instance index, vertex shaders fetch per instance data
+        * with gl_InstanceIndex. Devices without drawIndirectFirstInstance get 0 there, the instance index of every
+        * command is also written to getVisibleInstances() at the command's position.
+        *
+        * With VK_KHR_draw_indirect_count the visible commands are packed to the front and drawn with the GPU written
+        * count. Without it every instance keeps its command and culled ones get instanceCount 0, which the draw skips.
+        * Devices without multiDrawIndirect issue one indirect draw per instance.
+        *
+        * Each frame slot has its own instances and commands so the CPU can fill the next frame while the GPU draws
+        * the last. Culling is recorded into the frame command buffer with cull() or runs on the compute queue family
+        * with submit(), which returns a semaphore the graphics submit waits on at eDrawIndirect.
+        */
+        class VulkanGpuCuller{
+            private:
+                struct Slot{
+                    Buffer instances;
+                    GpuCullInstance* mapped = nullptr;
+                    /** @brief Draw count followed by the commands */
+                    Buffer commands;
+                    /** @brief Instance index of each command, in the same order */
+                    Buffer visible;
+                    /** @brief Host readable copy of the draw count, read back when the slot comes around again */
+                    Buffer counter;
+                    vk::DescriptorSet descriptorSet;
+                    vk::CommandBuffer computeCommands;
+                    vk::Semaphore culled;
+                    uint32_t instanceCount = 0;
+                    bool pending = false;
+                };
+
+                struct Constants{
+                    glm::vec4 planes[Frustum::ePlaneCount];
+                    uint32_t instanceCount;
+                    uint32_t flags;
+                };
+
+                VulkanDevice* vulkanDevice = nullptr;
+                vk::Device device;
+                uint32_t graphicsFamily = 0;
+                uint32_t computeFamily = 0;
+                vk::Queue graphicsQueue;
+                vk::Queue computeQueue;
+                vk::CommandPool computePool;
+
+                vk::DescriptorSetLayout setLayout;
+                vk::DescriptorPool descriptorPool;
+                vk::PipelineLayout pipelineLayout;
+                vk::Pipeline pipeline;
+
+                std::vector<Slot> slots;
+                Buffer draws;
+                GpuCullDraw* mappedDraws = nullptr;
+                uint32_t capacity = 0;
+                uint32_t drawCapacity = 0;
+                uint32_t drawCount = 0;
+
+                PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount = nullptr;
+                bool multiDraw = false;
+                uint32_t flags = 0;
+                GpuCullStats stats;
+
+                vk::ShaderModule loadShader(const std::string& filename){
+                    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+                    if (!file.is_open()){
+                        throw std::runtime_error("failed to load shader " + filename);
+                    }
+                    std::vector<char> code((size_t)file.tellg());
+                    file.seekg(0);
+                    file.read(code.data(), code.size());
+                    if (!file || code.empty() || code.size() % 4 != 0){
+                        throw std::runtime_error("failed to load shader " + filename);
+                    }
+                    vk::ShaderModuleCreateInfo createInfo;
+                    createInfo.codeSize = code.size();
+                    createInfo.pCode = (const uint32_t*)code.data();
+                    vk::ShaderModule module;
+                    if (device.createShaderModule(&createInfo, nullptr, &module) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to create shader module " + filename);
+                    }
+                    return module;
+                }
+
+                void createPipeline(const std::string& shaderPath, vk::PipelineCache cache){
+                    vk::DescriptorSetLayoutBinding bindings[GPU_CULL_BINDINGS];
+                    for (uint32_t i = 0; i < GPU_CULL_BINDINGS; i++){
+                        bindings[i] = vk::DescriptorSetLayoutBinding(i, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute);
+                    }
+                    vk::DescriptorSetLayoutCreateInfo setLayoutInfo;
+                    setLayoutInfo.bindingCount = GPU_CULL_BINDINGS;
+                    setLayoutInfo.pBindings = bindings;
+                    if (device.createDescriptorSetLayout(&setLayoutInfo, nullptr, &setLayout) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to create cull descriptor set layout");
+                    }
+                    vk::PushConstantRange pushConstants(vk::ShaderStageFlagBits::eCompute, 0, sizeof(Constants));
+                    vk::PipelineLayoutCreateInfo layoutInfo;
+                    layoutInfo.setLayoutCount = 1;
+                    layoutInfo.pSetLayouts = &setLayout;
+                    layoutInfo.pushConstantRangeCount = 1;
+                    layoutInfo.pPushConstantRanges = &pushConstants;
+                    if (device.createPipelineLayout(&layoutInfo, nullptr, &pipelineLayout) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to create cull pipeline layout");
+                    }
+
+                    uint32_t groupSize = GPU_CULL_GROUP_SIZE;
+                    vk::SpecializationMapEntry entry(0, 0, sizeof(groupSize));
+                    vk::SpecializationInfo specialization(1, &entry, sizeof(groupSize), &groupSize);
+                    vk::ShaderModule module = loadShader(shaderPath);
+                    vk::ComputePipelineCreateInfo pipelineInfo;
+                    pipelineInfo.stage = vk::PipelineShaderStageCreateInfo(vk::PipelineShaderStageCreateFlags(), vk::ShaderStageFlagBits::eCompute, module, "main", &specialization);
+                    pipelineInfo.layout = pipelineLayout;
+                    vk::Result result = device.createComputePipelines(cache, 1, &pipelineInfo, nullptr, &pipeline);
+                    device.destroyShaderModule(module, nullptr);
+                    if (result != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to create cull pipeline");
+                    }
+                }
+
+                /** @brief Pick up the draw count the GPU wrote the last time the slot was used */
+                void retire(Slot& slot){
+                    if (slot.pending){
+                        stats.instances = slot.instanceCount;
+                        stats.visible = *(const uint32_t*)slot.counter.mapped;
+                        slot.pending = false;
+                    }
+                }
+
+                /** @brief Copy the start of a device buffer to the host and wait for it */
+                void readBuffer(const Buffer& buffer, vk::DeviceSize size, void* dst){
+                    Buffer staging;
+                    vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eTransferDst,
+                        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, &staging, size);
+                    vk::CommandBuffer copyCmd = vulkanDevice->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
+                    vk::BufferCopy region(0, 0, size);
+                    copyCmd.copyBuffer(buffer.buffer, staging.buffer, 1, &region);
+                    vk::BufferMemoryBarrier readback;
+                    readback.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+                    readback.dstAccessMask = vk::AccessFlagBits::eHostRead;
+                    readback.buffer = staging.buffer;
+                    readback.size = VK_WHOLE_SIZE;
+                    copyCmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost,
+                        vk::DependencyFlags(), 0, nullptr, 1, &readback, 0, nullptr);
+                    vulkanDevice->flushCommandBuffer(copyCmd, graphicsQueue);
+
+                    if (staging.map() != vk::Result::eSuccess){
+                        throw std::runtime_error("could not map cull readback");
+                    }
+                    memcpy(dst, staging.mapped, (size_t)size);
+                    staging.unmap();
+                    staging.destroy();
+                }
+
+                void record(vk::CommandBuffer cmd, uint32_t frame, const Frustum& frustum, uint32_t instanceCount){
+                    Slot& slot = slots[frame];
+                    if (instanceCount > capacity){
+                        throw std::runtime_error("more instances than the culler was created for");
+                    }
+                    retire(slot);
+                    slot.instanceCount = instanceCount;
+                    slot.pending = true;
+
+                    cmd.fillBuffer(slot.commands.buffer, 0, sizeof(uint32_t), 0);
+                    vk::BufferMemoryBarrier clear;
+                    clear.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+                    clear.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+                    clear.buffer = slot.commands.buffer;
+                    clear.size = VK_WHOLE_SIZE;
+                    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader,
+                        vk::DependencyFlags(), 0, nullptr, 1, &clear, 0, nullptr);
+
+                    if (instanceCount > 0){
+                        Constants constants;
+                        memcpy(constants.planes, frustum.planes, sizeof(constants.planes));
+                        constants.instanceCount = instanceCount;
+                        constants.flags = flags;
+                        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+                        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, 1, &slot.descriptorSet, 0, nullptr);
+                        cmd.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants), &constants);
+                        cmd.dispatch((instanceCount + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, 1, 1);
+                    }
+
+                    vk::BufferMemoryBarrier written[2];
+                    written[0].srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+                    written[0].dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eTransferRead;
+                    written[0].buffer = slot.commands.buffer;
+                    written[0].size = VK_WHOLE_SIZE;
+                    written[1].srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+                    written[1].dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead;
+                    written[1].buffer = slot.visible.buffer;
+                    written[1].size = VK_WHOLE_SIZE;
+                    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                        vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eTransfer,
+                        vk::DependencyFlags(), 0, nullptr, 2, written, 0, nullptr);
+
+                    vk::BufferCopy region(0, 0, sizeof(uint32_t));
+                    cmd.copyBuffer(slot.commands.buffer, slot.counter.buffer, 1, &region);
+                    vk::BufferMemoryBarrier readback;
+                    readback.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+                    readback.dstAccessMask = vk::AccessFlagBits::eHostRead;
+                    readback.buffer = slot.counter.buffer;
+                    readback.size = VK_WHOLE_SIZE;
+                    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost,
+                        vk::DependencyFlags(), 0, nullptr, 1, &readback, 0, nullptr);
+                }
+
+            public:
+                VulkanGpuCuller(){}
+                ~VulkanGpuCuller(){
+                    destroy();
+                }
+
+                /**
+                * Create the cull pipeline and the per frame buffers
+                *
+                * @param vulkanDevice Device created with a compute queue (see VulkanDevice::createLogicalDevice)
+                * @param frameCount Frame slots, e.g. VulkanGraphics::settings.framesInFlight
+                * @param capacity Instances culled per frame at most
+                * @param drawCapacity (Optional) Entries of the draw table
+                * @param shaderPath (Optional) SPIR-V of shaders/gpu_cull.comp
+                * @param cache (Optional) Pipeline cache, e.g. VulkanPipelineCache::getHandle()
+                */
+                void init(VulkanDevice* vulkanDevice, uint32_t frameCount, uint32_t capacity, uint32_t drawCapacity = GPU_CULL_DEFAULT_DRAWS,
+                          const std::string& shaderPath = GPU_CULL_SHADER_PATH, vk::PipelineCache cache = vk::PipelineCache()){
+                    this->vulkanDevice = vulkanDevice;
+                    device = vulkanDevice->device;
+                    this->capacity = capacity;
+                    this->drawCapacity = drawCapacity;
+                    drawCount = 0;
+                    graphicsFamily = (uint32_t)vulkanDevice->queueFamilyIndices.graphicsFamily;
+                    computeFamily = vulkanDevice->queueFamilyIndices.computeFamily >= 0 ? (uint32_t)vulkanDevice->queueFamilyIndices.computeFamily : graphicsFamily;
+                    device.getQueue(graphicsFamily, 0, &graphicsQueue);
+                    device.getQueue(computeFamily, 0, &computeQueue);
+                    computePool = vulkanDevice->createCommandPool(computeFamily);
+
+                    flags = 0;
+                    drawIndexedIndirectCount = nullptr;
+                    if (vulkanDevice->extensionEnabled(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)){
+                        drawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)device.getProcAddr("vkCmdDrawIndexedIndirectCountKHR");
+                    }
+                    if (drawIndexedIndirectCount){
+                        flags |= GPU_CULL_COMPACT;
+                    }
+                    if (vulkanDevice->enabledFeatures.drawIndirectFirstInstance){
+                        flags |= GPU_CULL_FIRST_INSTANCE;
+                    }
+                    multiDraw = vulkanDevice->enabledFeatures.multiDrawIndirect == VK_TRUE;
+
+                    createPipeline(shaderPath, cache);
+
+                    // shared between the compute and graphics family without ownership transfers
+                    std::vector<uint32_t> families{ graphicsFamily, computeFamily };
+                    vk::MemoryPropertyFlags hostMemory = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+                    vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, hostMemory, &draws, drawCapacity * sizeof(GpuCullDraw), nullptr, families);
+                    if (draws.map() != vk::Result::eSuccess){
+                        throw std::runtime_error("could not map cull draws");
+                    }
+                    mappedDraws = (GpuCullDraw*)draws.mapped;
+
+                    vk::DescriptorPoolSize poolSize(vk::DescriptorType::eStorageBuffer, GPU_CULL_BINDINGS * frameCount);
+                    vk::DescriptorPoolCreateInfo poolInfo;
+                    poolInfo.maxSets = frameCount;
+                    poolInfo.poolSizeCount = 1;
+                    poolInfo.pPoolSizes = &poolSize;
+                    if (device.createDescriptorPool(&poolInfo, nullptr, &descriptorPool) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to create cull descriptor pool");
+                    }
+
+                    slots.resize(frameCount);
+                    for (auto& slot : slots){
+                        vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, hostMemory, &slot.instances,
+                            capacity * sizeof(GpuCullInstance), nullptr, families);
+                        if (slot.instances.map() != vk::Result::eSuccess){
+                            throw std::runtime_error("could not map cull instances");
+                        }
+                        slot.mapped = (GpuCullInstance*)slot.instances.mapped;
+                        vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer |
+                            vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eDeviceLocal,
+                            &slot.commands, GPU_CULL_COMMAND_OFFSET + capacity * sizeof(vk::DrawIndexedIndirectCommand), nullptr, families);
+                        vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eDeviceLocal,
+                            &slot.visible, capacity * sizeof(uint32_t), nullptr, families);
+                        vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eTransferDst, hostMemory, &slot.counter, sizeof(uint32_t), nullptr, families);
+                        if (slot.counter.map() != vk::Result::eSuccess){
+                            throw std::runtime_error("could not map cull counter");
+                        }
+
+                        vk::DescriptorSetAllocateInfo allocInfo;
+                        allocInfo.descriptorPool = descriptorPool;
+                        allocInfo.descriptorSetCount = 1;
+                        allocInfo.pSetLayouts = &setLayout;
+                        if (device.allocateDescriptorSets(&allocInfo, &slot.descriptorSet) != vk::Result::eSuccess){
+                            throw std::runtime_error("failed to allocate cull descriptor set");
+                        }
+                        vk::DescriptorBufferInfo infos[GPU_CULL_BINDINGS] = {
+                            vk::DescriptorBufferInfo(slot.instances.buffer, 0, VK_WHOLE_SIZE),
+                            vk::DescriptorBufferInfo(draws.buffer, 0, VK_WHOLE_SIZE),
+                            vk::DescriptorBufferInfo(slot.commands.buffer, 0, VK_WHOLE_SIZE),
+                            vk::DescriptorBufferInfo(slot.visible.buffer, 0, VK_WHOLE_SIZE)
+                        };
+                        vk::WriteDescriptorSet writes[GPU_CULL_BINDINGS];
+                        for (uint32_t i = 0; i < GPU_CULL_BINDINGS; i++){
+                            writes[i].dstSet = slot.descriptorSet;
+                            writes[i].dstBinding = i;
+                            writes[i].descriptorCount = 1;
+                            writes[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+                            writes[i].pBufferInfo = &infos[i];
+                        }
+                        device.updateDescriptorSets(GPU_CULL_BINDINGS, writes, 0, nullptr);
+
+                        vk::CommandBufferAllocateInfo cmdInfo;
+                        cmdInfo.commandPool = computePool;
+                        cmdInfo.level = vk::CommandBufferLevel::ePrimary;
+                        cmdInfo.commandBufferCount = 1;
+                        if (device.allocateCommandBuffers(&cmdInfo, &slot.computeCommands) != vk::Result::eSuccess){
+                            throw std::runtime_error("failed to allocate cull command buffer");
+                        }
+                        vk::SemaphoreCreateInfo semaphoreInfo;
+                        if (device.createSemaphore(&semaphoreInfo, nullptr, &slot.culled) != vk::Result::eSuccess){
+                            throw std::runtime_error("failed to create cull semaphore");
+                        }
+                    }
+                }
+
+                /** @brief Release everything, the device must be idle */
+                void destroy(){
+                    if (!device){
+                        return;
+                    }
+                    for (auto& slot : slots){
+                        slot.instances.destroy();
+                        slot.commands.destroy();
+                        slot.visible.destroy();
+                        slot.counter.destroy();
+                        device.destroySemaphore(slot.culled, nullptr);
+                    }
+                    slots.clear();
+                    draws.destroy();
+                    mappedDraws = nullptr;
+                    device.destroyCommandPool(computePool, nullptr);
+                    device.destroyDescriptorPool(descriptorPool, nullptr);
+                    device.destroyPipeline(pipeline, nullptr);
+                    device.destroyPipelineLayout(pipelineLayout, nullptr);
+                    device.destroyDescriptorSetLayout(setLayout, nullptr);
+                    device = vk::Device();
+                }
+
+                /**
+                * Append an entry to the draw table, entries are never changed so this is safe while frames are in flight
+                *
+                * @return Index for GpuCullInstance::draw
+                */
+                uint32_t addDraw(uint32_t indexCount, uint32_t firstIndex, int32_t vertexOffset){
+                    if (drawCount == drawCapacity){
+                        throw std::runtime_error("cull draw table is full");
+                    }
+                    GpuCullDraw& draw = mappedDraws[drawCount];
+                    draw.indexCount = indexCount;
+                    draw.firstIndex = firstIndex;
+                    draw.vertexOffset = vertexOffset;
+                    draw.reserved = 0;
+                    return drawCount++;
+                }
+
+                /** @brief Append a submesh at a level of detail, every draw of one culler has to use the same bound geometry */
+                uint32_t addDraw(const Mesh& mesh, uint32_t submesh, uint32_t lod = 0){
+                    const asset::TmeshLod& l = mesh.lods[submesh * mesh.lodCount + std::min(lod, mesh.lodCount - 1)];
+                    return addDraw(l.indexCount, l.firstIndex, mesh.submeshes[submesh].vertexOffset);
+                }
+
+                /**
+                * Instances of a frame slot, write up to capacity of them before cull() or submit()
+                *
+                * @note The slot must not be in use by the GPU, i.e. its frame fence has been waited on
+                */
+                GpuCullInstance* getInstances(uint32_t frame){
+                    return slots[frame].mapped;
+                }
+
+                /**
+                * Record the culling of a frame slot into a command buffer of the graphics family, followed by a barrier
+                * to draw()
+                *
+                * @note Outside of a render pass, e.g. a compute stage of the render graph
+                */
+                void cull(vk::CommandBuffer cmd, uint32_t frame, const Frustum& frustum, uint32_t instanceCount){
+                    record(cmd, frame, frustum, instanceCount);
+                }
+
+                /**
+                * Cull a frame slot on the compute queue family so it overlaps with graphics work of the previous frame
+                *
+                * @param waitSemaphore (Optional) Signaled when the instances may be read, e.g. after a GPU upload
+                *
+                * @return Semaphore to wait on at vk::PipelineStageFlagBits::eDrawIndirect in the submit that draws the slot
+                */
+                vk::Semaphore submit(uint32_t frame, const Frustum& frustum, uint32_t instanceCount, vk::Semaphore waitSemaphore = vk::Semaphore()){
+                    Slot& slot = slots[frame];
+                    vk::CommandBufferBeginInfo beginInfo;
+                    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+                    slot.computeCommands.begin(&beginInfo);
+                    record(slot.computeCommands, frame, frustum, instanceCount);
+                    slot.computeCommands.end();
+
+                    vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eComputeShader;
+                    vk::SubmitInfo submitInfo;
+                    submitInfo.waitSemaphoreCount = waitSemaphore ? 1 : 0;
+                    submitInfo.pWaitSemaphores = &waitSemaphore;
+                    submitInfo.pWaitDstStageMask = &waitStage;
+                    submitInfo.commandBufferCount = 1;
+                    submitInfo.pCommandBuffers = &slot.computeCommands;
+                    submitInfo.signalSemaphoreCount = 1;
+                    submitInfo.pSignalSemaphores = &slot.culled;
+                    if (computeQueue.submit(1, &submitInfo, vk::Fence()) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to submit cull commands");
+                    }
+                    return slot.culled;
+                }
+
+                /**
+                * Draw the visible instances of a frame slot, bind the graphics pipeline and geometry first
+                */
+                void draw(vk::CommandBuffer cmd, uint32_t frame) const {
+                    const Slot& slot = slots[frame];
+                    uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand);
+                    if (slot.instanceCount == 0){
+                        return;
+                    }
+                    if (drawIndexedIndirectCount){
+                        drawIndexedIndirectCount((VkCommandBuffer)cmd, (VkBuffer)slot.commands.buffer, GPU_CULL_COMMAND_OFFSET,
+                            (VkBuffer)slot.commands.buffer, 0, slot.instanceCount, stride);
+                    }else if (multiDraw){
+                        cmd.drawIndexedIndirect(slot.commands.buffer, GPU_CULL_COMMAND_OFFSET, slot.instanceCount, stride);
+                    }else{
+                        for (uint32_t i = 0; i < slot.instanceCount; i++){
+                            cmd.drawIndexedIndirect(slot.commands.buffer, GPU_CULL_COMMAND_OFFSET + i * stride, 1, stride);
+                        }
+                    }
+                }
+
+                /**
+                * Copy the commands of a frame slot back to the host, for tests and debugging
+                *
+                * @note Waits for the copy, the culling of the slot must have been submitted
+                *
+                * @return Draw count the shader wrote, commands holds that many entries when isCompact() and one per
+                *         instance otherwise
+                */
+                uint32_t readCommands(uint32_t frame, std::vector<vk::DrawIndexedIndirectCommand>* commands){
+                    Slot& slot = slots[frame];
+                    std::vector<char> data(GPU_CULL_COMMAND_OFFSET + slot.instanceCount * sizeof(vk::DrawIndexedIndirectCommand));
+                    readBuffer(slot.commands, data.size(), data.data());
+                    uint32_t count;
+                    memcpy(&count, data.data(), sizeof(count));
+                    commands->resize(isCompact() ? std::min(count, slot.instanceCount) : slot.instanceCount);
+                    memcpy(commands->data(), data.data() + GPU_CULL_COMMAND_OFFSET, commands->size() * sizeof(vk::DrawIndexedIndirectCommand));
+                    return count;
+                }
+
+                /**
+                * Indices of the instances that survived culling in a frame slot, read from getVisibleInstances(), for
+                * tests and debugging
+                *
+                * @note Waits for the copy, the culling of the slot must have been submitted
+                *
+                * @return Draw count the shader wrote
+                */
+                uint32_t readVisibleInstances(uint32_t frame, std::vector<uint32_t>* instances){
+                    std::vector<vk::DrawIndexedIndirectCommand> commands;
+                    uint32_t count = readCommands(frame, &commands);
+                    std::vector<uint32_t> indices(commands.size());
+                    if (!indices.empty()){
+                        readBuffer(slots[frame].visible, indices.size() * sizeof(uint32_t), indices.data());
+                    }
+                    instances->clear();
+                    for (size_t i = 0; i < commands.size(); i++){
+                        if (commands[i].instanceCount > 0){
+                            instances->push_back(indices[i]);
+                        }
+                    }
+                    return count;
+                }
+
+                /**
+                * Instance index of every command of a frame slot as a storage buffer of uints, for vertex shaders of
+                * devices without drawIndirectFirstInstance
+                */
+                vk::Buffer getVisibleInstances(uint32_t frame) const { return slots[frame].visible.buffer; }
+
+                /** @brief Whether visible commands are packed and drawn with the GPU written count */
+                bool isCompact() const { return (flags & GPU_CULL_COMPACT) != 0; }
+                uint32_t getCapacity() const { return capacity; }
+                uint32_t getDrawCount() const { return drawCount; }
+                const GpuCullStats& getStats() const { return stats; }
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,386 @@
+#ifndef TRB_GFX_VulkanGpuProfiler_H_
+#define TRB_GFX_VulkanGpuProfiler_H_
+
+#include "vulkan/vulkan.hpp"
+
+#include <stdexcept>
+#include <vector>
+#include <string>
+#include <set>
+#include <algorithm>
+
+#include "VulkanDevice.hpp"
+#include "../../core/Profiler.hpp"
+
+// Scopes one frame can time, further scopes are dropped
+#define GPU_PROFILER_MAX_SCOPES 256
+// Scopes of one frame that can collect pipeline statistics
+#define GPU_PROFILER_MAX_STATISTICS 32
+#define GPU_SCOPE_NONE UINT32_MAX
+
+namespace trb{
+    namespace grfx{
+
+        /** @brief Counters of a scope, in the order of the query's pipelineStatistics bits */
+        struct GpuPipelineStatistics{
+            uint64_t inputVertices = 0;
+            uint64_t inputPrimitives = 0;
+            uint64_t vertexInvocations = 0;
+            uint64_t clippingPrimitives = 0;
+            uint64_t fragmentInvocations = 0;
+            uint64_t computeInvocations = 0;
+        };
+
+        struct GpuScopeResult{
+            /** @brief Interned, valid as long as the profiler */
+            const char* name;
+            /** @brief Scopes open around this one, the frame scope has depth 0 */
+            uint32_t depth;
+            /** @brief Times in ms relative to the start of the frame */
+            double start;
+            double duration;
+            bool hasStatistics;
+            GpuPipelineStatistics statistics;
+        };
+
+        struct GpuProfilerStats{
+            /** @brief GPU time of the whole frame command buffer in ms */
+            float frameTime = 0.0f;
+            uint32_t scopes = 0;
+            /** @brief Scopes that did not fit into GPU_PROFILER_MAX_SCOPES */
+            uint32_t droppedScopes = 0;
+            /** @brief Frame the results are from, a frame in flight count behind the current one */
+            uint64_t frameNumber = 0;
+        };
+
+        /**
+        * @brief Times named scopes of the frame command buffer with timestamp queries
+        *
+        * Every frame slot has its own query pools. The results of a slot are read in beginFrame(), after the
+        * slot's fence has signaled, so reading never waits on the GPU and the numbers are as old as the frames in
+        * flight. Ticks are scaled by timestampPeriod and moved onto the clock of core::Profiler, which gets a
+        * "GPU" track with the scopes next to the CPU zones in the trace. The offset between the clocks is
+        * measured once in init() and only ever moved forward, when a frame would otherwise appear to start on the
+        * GPU before the CPU began recording it.
+        *
+        * Scopes that ask for pipeline statistics also count vertices, primitives and shader invocations when the
+        * device has pipelineStatisticsQuery. Vulkan allows one such query at a time, a statistics scope nested in
+        * another only records its time. Scopes are recorded into primary command buffers on the recording thread.
+        */
+        class VulkanGpuProfiler{
+            private:
+                struct Scope{
+                    const char* name;
+                    uint32_t depth;
+                    uint32_t statisticsQuery;
+                };
+
+                struct FrameQueries{
+                    vk::QueryPool timestamps;
+                    vk::QueryPool statistics;
+                    std::vector<Scope> scopes;
+                    uint32_t statisticsCount = 0;
+                    uint32_t droppedScopes = 0;
+                    /** @brief Profiler::now() when recording began, the GPU can not have started earlier */
+                    uint64_t cpuBegin = 0;
+                    uint64_t frameNumber = 0;
+                    bool recorded = false;
+                };
+
+                vk::Device device;
+                std::vector<FrameQueries> frames;
+                uint32_t currentSlot = 0;
+                uint64_t frameNumber = 0;
+                bool supported = false;
+                bool statisticsSupported = false;
+                /** @brief Nanoseconds per tick */
+                double period = 1.0;
+                uint64_t timestampMask = ~0ull;
+                /** @brief Profiler::now() of GPU tick zero */
+                double clockOffset = 0.0;
+                std::vector<uint32_t> openScopes;
+                /** @brief Scope whose statistics query is active, GPU_SCOPE_NONE if none */
+                uint32_t statisticsScope = GPU_SCOPE_NONE;
+                std::set<std::string> names;
+                std::vector<GpuScopeResult> results;
+                GpuProfilerStats lastStats;
+                core::ProfileRing* track = nullptr;
+
+                /** @brief Match tick zero to the CPU clock with one timestamp and a round trip through the queue */
+                void calibrate(VulkanDevice* vulkanDevice, vk::Queue queue){
+                    vk::CommandBuffer commandBuffer = vulkanDevice->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
+                    commandBuffer.resetQueryPool(frames[0].timestamps, 0, 1);
+                    commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, frames[0].timestamps, 0);
+                    uint64_t before = core::Profiler::now();
+                    vulkanDevice->flushCommandBuffer(commandBuffer, queue);
+                    uint64_t after = core::Profiler::now();
+                    uint64_t ticks = 0;
+                    if (device.getQueryPoolResults(frames[0].timestamps, 0, 1, sizeof(ticks), &ticks, sizeof(ticks),
+                        vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to read calibration timestamp!");
+                    }
+                    // the timestamp was taken somewhere in the round trip, the middle is the best guess
+                    clockOffset = (double)(before + after) * 0.5 - (double)(ticks & timestampMask) * period;
+                }
+
+                /** @brief Turn the queries of a finished frame into results and trace events */
+                void resolve(FrameQueries& frame){
+                    uint32_t count = (uint32_t)frame.scopes.size();
+                    if (count == 0){
+                        return;
+                    }
+                    // value and availability of every query, unfinished scopes are skipped
+                    std::vector<uint64_t> ticks(count * 2 * 2);
+                    vk::Result result = device.getQueryPoolResults(frame.timestamps, 0, count * 2, ticks.size() * sizeof(uint64_t), ticks.data(),
+                        2 * sizeof(uint64_t), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability);
+                    if (result != vk::Result::eSuccess && result != vk::Result::eNotReady){
+                        return;
+                    }
+                    std::vector<uint64_t> statistics;
+                    if (frame.statisticsCount > 0){
+                        statistics.resize(frame.statisticsCount * 7);
+                        result = device.getQueryPoolResults(frame.statistics, 0, frame.statisticsCount, statistics.size() * sizeof(uint64_t), statistics.data(),
+                            7 * sizeof(uint64_t), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability);
+                        if (result != vk::Result::eSuccess && result != vk::Result::eNotReady){
+                            statistics.clear();
+                        }
+                    }
+                    if (!ticks[1]){
+                        return;
+                    }
+
+                    // scope 0 is the frame, its start is the base the other scopes are measured from
+                    uint64_t base = ticks[0] & timestampMask;
+                    double frameStart = (double)base * period + clockOffset;
+                    if (frameStart < (double)frame.cpuBegin){
+                        clockOffset += (double)frame.cpuBegin - frameStart;
+                        frameStart = (double)frame.cpuBegin;
+                    }
+
+                    results.clear();
+                    for (uint32_t i = 0; i < count; i++){
+                        const Scope& scope = frame.scopes[i];
+                        if (!ticks[i * 4 + 1] || !ticks[i * 4 + 3]){
+                            continue;
+                        }
+                        double start = (double)(((ticks[i * 4] & timestampMask) - base) & timestampMask) * period;
+                        double end = (double)(((ticks[i * 4 + 2] & timestampMask) - base) & timestampMask) * period;
+                        GpuScopeResult scopeResult;
+                        scopeResult.name = scope.name;
+                        scopeResult.depth = scope.depth;
+                        scopeResult.start = start / 1e6;
+                        scopeResult.duration = std::max(end - start, 0.0) / 1e6;
+                        scopeResult.hasStatistics = false;
+                        if (scope.statisticsQuery != GPU_SCOPE_NONE && !statistics.empty() && statistics[scope.statisticsQuery * 7 + 6]){
+                            const uint64_t* values = &statistics[scope.statisticsQuery * 7];
+                            scopeResult.hasStatistics = true;
+                            scopeResult.statistics.inputVertices = values[0];
+                            scopeResult.statistics.inputPrimitives = values[1];
+                            scopeResult.statistics.vertexInvocations = values[2];
+                            scopeResult.statistics.clippingPrimitives = values[3];
+                            scopeResult.statistics.fragmentInvocations = values[4];
+                            scopeResult.statistics.computeInvocations = values[5];
+                        }
+                        results.push_back(scopeResult);
+#if TRB_PROFILE
+                        core::Profiler::zone(track, scope.name, (uint64_t)(frameStart + start), (uint64_t)(frameStart + std::max(start, end)));
+                        if (scopeResult.hasStatistics){
+                            const GpuPipelineStatistics& counts = scopeResult.statistics;
+                            static const char* suffixes[6] = { " input vertices", " input primitives", " vertex invocations",
+                                " clipped primitives", " fragment invocations", " compute invocations" };
+                            uint64_t values[6] = { counts.inputVertices, counts.inputPrimitives, counts.vertexInvocations,
+                                counts.clippingPrimitives, counts.fragmentInvocations, counts.computeInvocations };
+                            for (uint32_t v = 0; v < 6; v++){
+                                core::Profiler::counter(track, intern(std::string(scope.name) + suffixes[v]), (double)values[v], (uint64_t)(frameStart + start));
+                            }
+                        }
+#endif
+                    }
+
+                    lastStats.frameTime = results.empty() || results[0].depth != 0 ? 0.0f : (float)results[0].duration;
+                    lastStats.scopes = (uint32_t)results.size();
+                    lastStats.droppedScopes = frame.droppedScopes;
+                    lastStats.frameNumber = frame.frameNumber;
+                }
+
+            public:
+                /**
+                * Create the query pools and calibrate the GPU clock against the CPU clock, waits for the queue once
+                *
+                * @param queue Queue the frames are submitted to
+                * @param frameCount Frame slots of the frames in flight pipeline
+                */
+                void init(VulkanDevice* vulkanDevice, vk::Queue queue, uint32_t frameCount){
+                    device = vulkanDevice->device;
+                    const vk::PhysicalDeviceLimits& limits = vulkanDevice->properties.limits;
+                    uint32_t validBits = vulkanDevice->queueFamilyProperties[vulkanDevice->queueFamilyIndices.graphicsFamily].timestampValidBits;
+                    supported = validBits > 0 && limits.timestampPeriod > 0.0f;
+                    if (!supported){
+                        return;
+                    }
+                    period = (double)limits.timestampPeriod;
+                    timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+                    statisticsSupported = vulkanDevice->enabledFeatures.pipelineStatisticsQuery == VK_TRUE;
+
+                    frames.resize(frameCount);
+                    for (auto& frame : frames){
+                        vk::QueryPoolCreateInfo poolInfo;
+                        poolInfo.queryType = vk::QueryType::eTimestamp;
+                        poolInfo.queryCount = GPU_PROFILER_MAX_SCOPES * 2;
+                        if (device.createQueryPool(&poolInfo, nullptr, &frame.timestamps) != vk::Result::eSuccess){
+                            throw std::runtime_error("failed to create timestamp query pool!");
+                        }
+                        if (statisticsSupported){
+                            vk::QueryPoolCreateInfo statisticsInfo;
+                            statisticsInfo.queryType = vk::QueryType::ePipelineStatistics;
+                            statisticsInfo.queryCount = GPU_PROFILER_MAX_STATISTICS;
+                            statisticsInfo.pipelineStatistics = vk::QueryPipelineStatisticFlagBits::eInputAssemblyVertices |
+                                vk::QueryPipelineStatisticFlagBits::eInputAssemblyPrimitives | vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations |
+                                vk::QueryPipelineStatisticFlagBits::eClippingPrimitives | vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations |
+                                vk::QueryPipelineStatisticFlagBits::eComputeShaderInvocations;
+                            if (device.createQueryPool(&statisticsInfo, nullptr, &frame.statistics) != vk::Result::eSuccess){
+                                throw std::runtime_error("failed to create pipeline statistics query pool!");
+                            }
+                        }
+                    }
+
+                    track = core::Profiler::createTrack("GPU");
+                    calibrate(vulkanDevice, queue);
+                }
+
+                /** @brief The device must be idle */
+                void destroy(){
+                    for (auto& frame : frames){
+                        device.destroyQueryPool(frame.timestamps, nullptr);
+                        if (frame.statistics){
+                            device.destroyQueryPool(frame.statistics, nullptr);
+                        }
+                    }
+                    frames.clear();
+                    supported = false;
+                }
+
+                /**
+                * Read the results the slot's previous frame left behind and start timing this frame
+                *
+                * @param slot Frame slot whose fence has signaled
+                * @param commandBuffer The slot's command buffer, just begun and outside of a render pass
+                */
+                void beginFrame(uint32_t slot, vk::CommandBuffer commandBuffer){
+                    if (!supported){
+                        return;
+                    }
+                    currentSlot = slot;
+                    frameNumber++;
+                    FrameQueries& frame = frames[slot];
+                    if (frame.recorded){
+                        resolve(frame);
+                    }
+                    frame.scopes.clear();
+                    frame.statisticsCount = 0;
+                    frame.droppedScopes = 0;
+                    frame.cpuBegin = core::Profiler::now();
+                    frame.frameNumber = frameNumber;
+                    frame.recorded = true;
+                    commandBuffer.resetQueryPool(frame.timestamps, 0, GPU_PROFILER_MAX_SCOPES * 2);
+                    if (frame.statistics){
+                        commandBuffer.resetQueryPool(frame.statistics, 0, GPU_PROFILER_MAX_STATISTICS);
+                    }
+                    openScopes.clear();
+                    statisticsScope = GPU_SCOPE_NONE;
+                    beginScope(commandBuffer, "gpu frame");
+                }
+
+                /** @brief Close the frame scope, before the command buffer ends */
+                void endFrame(vk::CommandBuffer commandBuffer){
+                    if (!supported){
+                        return;
+                    }
+                    // scopes left open would never become available
+                    while (!openScopes.empty()){
+                        endScope(commandBuffer, openScopes.back());
+                    }
+                }
+
+                /**
+                * Start a named scope, scopes nest and must be closed in reverse order. Pipeline statistics can not
+                * cross a render pass boundary: begin and end such a scope in the same subpass or both outside
+                *
+                * @param name Must live as long as the profiler, use the std::string overload otherwise
+                *
+                * @return Scope to pass to endScope(), GPU_SCOPE_NONE if the frame has no room left
+                */
+                uint32_t beginScope(vk::CommandBuffer commandBuffer, const char* name, bool statistics = false){
+                    if (!supported){
+                        return GPU_SCOPE_NONE;
+                    }
+                    FrameQueries& frame = frames[currentSlot];
+                    if (frame.scopes.size() == GPU_PROFILER_MAX_SCOPES){
+                        frame.droppedScopes++;
+                        return GPU_SCOPE_NONE;
+                    }
+                    Scope scope;
+                    scope.name = name;
+                    scope.depth = (uint32_t)openScopes.size();
+                    scope.statisticsQuery = GPU_SCOPE_NONE;
+                    uint32_t index = (uint32_t)frame.scopes.size();
+                    commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, frame.timestamps, index * 2);
+                    if (statistics && frame.statistics && statisticsScope == GPU_SCOPE_NONE && frame.statisticsCount < GPU_PROFILER_MAX_STATISTICS){
+                        statisticsScope = index;
+                        scope.statisticsQuery = frame.statisticsCount++;
+                        commandBuffer.beginQuery(frame.statistics, scope.statisticsQuery, vk::QueryControlFlags());
+                    }
+                    frame.scopes.push_back(scope);
+                    openScopes.push_back(index);
+                    return index;
+                }
+
+                uint32_t beginScope(vk::CommandBuffer commandBuffer, const std::string& name, bool statistics = false){
+                    return supported ? beginScope(commandBuffer, intern(name), statistics) : GPU_SCOPE_NONE;
+                }
+
+                void endScope(vk::CommandBuffer commandBuffer, uint32_t scope){
+                    if (scope == GPU_SCOPE_NONE || !supported){
+                        return;
+                    }
+                    FrameQueries& frame = frames[currentSlot];
+                    if (frame.scopes[scope].statisticsQuery != GPU_SCOPE_NONE){
+                        commandBuffer.endQuery(frame.statistics, frame.scopes[scope].statisticsQuery);
+                        statisticsScope = GPU_SCOPE_NONE;
+                    }
+                    commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, frame.timestamps, scope * 2 + 1);
+                    openScopes.erase(std::remove(openScopes.begin(), openScopes.end(), scope), openScopes.end());
+                }
+
+                /** @brief Copy of name that lives as long as the profiler, look names up once and keep the pointer */
+                const char* intern(const std::string& name){
+                    return names.insert(name).first->c_str();
+                }
+
+                bool isSupported() const { return supported; }
+                bool hasStatistics() const { return statisticsSupported; }
+                /** @brief Scopes of the last resolved frame, the frame scope first */
+                const std::vector<GpuScopeResult>& getResults() const { return results; }
+                const GpuProfilerStats& getStats() const { return lastStats; }
+        };
+
+        /** @brief Times the enclosing C++ scope on the GPU */
+        class GpuScope{
+            private:
+                VulkanGpuProfiler* profiler;
+                vk::CommandBuffer commandBuffer;
+                uint32_t scope;
+
+            public:
+                GpuScope(VulkanGpuProfiler* profiler, vk::CommandBuffer commandBuffer, const char* name, bool statistics = false)
+                    : profiler(profiler), commandBuffer(commandBuffer), scope(profiler->beginScope(commandBuffer, name, statistics)) {}
+                ~GpuScope(){
+                    profiler->endScope(commandBuffer, scope);
+                }
+                GpuScope(const GpuScope&) = delete;
+                GpuScope& operator=(const GpuScope&) = delete;
+        };
+    }
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include <chrono>
 
 #include "../../LogManager.hpp"
+#include "../../core/Profiler.hpp"
 
 //////
 // Validation Layer Callbacks
@@ -29,12 +30,179 @@ void DestroyDebugReportCallbackEXT(VkInstance instance, VkDebugReportCallbackEXT
 
 
 void trb::grfx::VulkanGraphics::initVulkan(){
+    TRB_PROFILE_ZONE("VulkanGraphics::initVulkan");
+    auto tStart = std::chrono::high_resolution_clock::now();
     createInstance();
     setupDebugCallback();
     vulkanDevice.init(instance);
+    pipelineCache.init(&vulkanDevice);
+    pipelineCompiler.init(&pipelineCache);
+    uploadManager.init(&vulkanDevice);
+    vulkanDevice.device.getQueue(vulkanDevice.queueFamilyIndices.graphicsFamily, 0, &queue);
+    initSwapchain();
+    createFrames();
+    textureStreamer.init(&vulkanDevice, &uploadManager, (uint32_t)frames.size(), settings.textureBudget);
+    descriptorAllocator.init(&vulkanDevice, (uint32_t)frames.size());
+    uniformAllocator.init(&vulkanDevice, (uint32_t)frames.size());
+    gpuProfiler.init(&vulkanDevice, queue, (uint32_t)frames.size());
+    renderGraph.init(&vulkanDevice, &gpuProfiler, &commandRecorder);
+    createRenderGraph();
+    // Pipelines of previous sessions are built now instead of hitching on first use
+    pipelineCache.warmup();
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    std::cout << "startup: " << std::chrono::duration<double, std::milli>(tEnd - tStart).count() << " ms" << std::endl;
+    pipelineCache.printStats(std::cout);
+    prepared = true;
+}
+
+void trb::grfx::VulkanGraphics::initSwapchain(){
+    swapChain.connect(instance, &vulkanDevice);
+#if defined(VK_USE_PLATFORM_XCB_KHR)
+    swapChain.initSurface(instance, connection, window);
+#endif
+    swapChain.create(&width, &height, settings.vsync);
+}
+
+void trb::grfx::VulkanGraphics::createFrames(){
+    frames.resize(std::max(settings.framesInFlight, 1u));
+    for (auto& frame : frames) {
+        frame.create(vulkanDevice);
+    }
+    imagesInFlight.assign(swapChain.imageCount, vk::Fence());
+    currentFrame = 0;
+    commandRecorder.init(&vulkanDevice, (uint32_t)frames.size(), core::JobSystem::getInstance());
+}
+
+void trb::grfx::VulkanGraphics::destroyFrames(){
+    if (!vulkanDevice.device) {
+        return;
+    }
+    vulkanDevice.device.waitIdle();
+    renderGraph.reset();
+    commandRecorder.destroy();
+    for (auto& frame : frames) {
+        frame.destroy(vulkanDevice.device);
+    }
+    frames.clear();
+    imagesInFlight.clear();
+}
+
+void trb::grfx::VulkanGraphics::windowResize(){
+    if (!prepared) {
+        return;
+    }
+    prepared = false;
+    // Every slot has to be idle before the swap chain images go away
+    vulkanDevice.device.waitIdle();
+    width = destWidth;
+    height = destHeight;
+    swapChain.create(&width, &height, settings.vsync);
+    imagesInFlight.assign(swapChain.imageCount, vk::Fence());
+    camera.updateAspectRatio((float)width / (float)height);
+    createRenderGraph();
+    windowResized();
+    viewChanged();
+    prepared = true;
+}
+
+void trb::grfx::VulkanGraphics::createRenderGraph(){
+    renderGraph.reset();
+    backBuffer = renderGraph.importImage("backbuffer", swapChain.colorFormat, vk::Extent2D(width, height),
+        vk::ImageLayout::eUndefined, vk::ImageLayout::ePresentSrcKHR);
+    buildRenderGraph(renderGraph);
+    renderGraph.compile();
+    renderGraph.printStats(std::cout);
+}
+
+void trb::grfx::VulkanGraphics::executeRenderGraph(){
+    uint32_t imageIndex = frame().imageIndex;
+    renderGraph.setImportedImage(backBuffer, swapChain.images[imageIndex], swapChain.buffers[imageIndex].view);
+    renderGraph.execute(frame().commandBuffer);
+}
+
+bool trb::grfx::VulkanGraphics::prepareFrame(){
+    TRB_PROFILE_ZONE("prepareFrame");
+    VulkanFrame& slot = frame();
+
+    // Only block when the GPU is still working on the frame that last used this slot
+    auto tWaitStart = std::chrono::high_resolution_clock::now();
+    if (vulkanDevice.device.waitForFences(1, &slot.fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT) != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to wait for frame fence");
+    }
+    auto tWaitEnd = std::chrono::high_resolution_clock::now();
+    gpuWaitTimer = (float)std::chrono::duration<double, std::milli>(tWaitEnd - tWaitStart).count();
+    TRB_PROFILE_COUNTER("gpu wait ms", gpuWaitTimer);
+
+    // Resources retired by this slot are no longer referenced by the GPU
+    slot.flushDeletionQueue();
+
+    VkResult result = swapChain.acquireNextImage(slot.imageAvailable, &slot.imageIndex);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        windowResize();
+        return false;
+    }
+    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+        throw std::runtime_error("failed to acquire swap chain image");
+    }
+
+    // A swap chain image may come back before the slot that rendered to it finished (more images than slots)
+    vk::Fence& imageFence = imagesInFlight[slot.imageIndex];
+    if (imageFence && imageFence != slot.fence) {
+        vulkanDevice.device.waitForFences(1, &imageFence, VK_TRUE, DEFAULT_FENCE_TIMEOUT);
+    }
+    imageFence = slot.fence;
+
+    vulkanDevice.device.resetFences(1, &slot.fence);
+    vulkanDevice.device.resetCommandPool(slot.commandPool, vk::CommandPoolResetFlags());
+    commandRecorder.beginFrame(currentFrame);
+    descriptorAllocator.beginFrame(currentFrame);
+    uniformAllocator.beginFrame(currentFrame);
+    pipelineCompiler.beginFrame();
+    slot.frameNumber = frameNumber;
+
+    vk::CommandBufferBeginInfo beginInfo;
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    slot.commandBuffer.begin(&beginInfo);
+    gpuProfiler.beginFrame(currentFrame, slot.commandBuffer);
+    uploadManager.recordAcquireBarriers(slot.commandBuffer);
+    return true;
+}
+
+void trb::grfx::VulkanGraphics::submitFrame(){
+    TRB_PROFILE_ZONE("submitFrame");
+    VulkanFrame& slot = frame();
+    gpuProfiler.endFrame(slot.commandBuffer);
+    slot.commandBuffer.end();
+    // one flush for all uniform data of the frame
+    uniformAllocator.flush();
+
+    vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+    vk::SubmitInfo submitInfo;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &slot.imageAvailable;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &slot.commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &slot.renderFinished;
+    if (queue.submit(1, &submitInfo, slot.fence) != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to submit frame command buffer");
+    }
+
+    VkResult result = swapChain.queuePresent(queue, slot.imageIndex, slot.renderFinished);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+        windowResize();
+    } else if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to present swap chain image");
+    }
+
+    // The CPU moves on to the next slot while the GPU works on this one
+    currentFrame = (currentFrame + 1) % (uint32_t)frames.size();
+    frameNumber++;
 }
 
 void trb::grfx::VulkanGraphics::createInstance(){
+        TRB_PROFILE_ZONE("VulkanGraphics::createInstance");
 		LogManager::getInstance()->log( "VulkanGraphics::createInstance", LogManager::Level::eDebug);
         if (enableValidationLayers && !checkValidationLayerSupport()) {
             throw std::runtime_error("validation layers requested, but not available!");
@@ -65,7 +233,14 @@ void trb::grfx::VulkanGraphics::createInstance(){
 	    instanceExtensions.push_back(VK_MVK_IOS_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_MACOS_MVK)
 	    instanceExtensions.push_back(VK_MVK_MACOS_SURFACE_EXTENSION_NAME);
-#endif        
+#endif
+        // Extension feature queries of the device, e.g. descriptor indexing for bindless textures
+        std::vector<vk::ExtensionProperties> availableExtensions = vk::enumerateInstanceExtensionProperties();
+        for (const auto& extension : availableExtensions) {
+            if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+                instanceExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+            }
+        }
 
         vk::InstanceCreateInfo createInfo;
         createInfo.pApplicationInfo = &appInfo;
@@ -138,6 +313,7 @@ static inline xcb_intern_atom_reply_t* intern_atom_helper(xcb_connection_t *conn
 
 // Set up a window using XCB and request event types
 xcb_window_t trb::grfx::VulkanGraphics::setupWindow(){
+    TRB_PROFILE_ZONE("VulkanGraphics::setupWindow");
     std::cout<<"setupWindow xcb" << std::endl;
 	LogManager::getInstance()->log( "setupWindow xcb", LogManager::Level::eDebug);
 
@@ -226,6 +402,120 @@ void trb::grfx::VulkanGraphics::initxcbConnection()
 
 
 
+bool trb::grfx::VulkanGraphics::pollEvents()
+{
+	TRB_PROFILE_ZONE("events");
+	frameStart = std::chrono::high_resolution_clock::now();
+#if defined(VK_USE_PLATFORM_XCB_KHR)
+	xcb_flush(connection);
+	xcb_generic_event_t *event;
+	while ((event = xcb_poll_for_event(connection)))
+	{
+		handleEvent(event);
+		free(event);
+	}
+	return !quit;
+#else
+	return true;
+#endif
+}
+
+void trb::grfx::VulkanGraphics::scheduleFrame(core::JobSystem* jobs, core::Job* frame)
+{
+	gpuWaitTimer = 0.0f;
+	frameAcquired = false;
+	core::Job* update = jobs->createChild(frame, [this]() {
+		TRB_PROFILE_ZONE("update");
+		camera.update(frameTimer);
+		if (camera.moving())
+		{
+			viewUpdated = true;
+		}
+		if (viewUpdated)
+		{
+			viewUpdated = false;
+			viewChanged();
+		}
+	});
+	// streaming sizes mips by the camera of this frame
+	core::Job* streaming = jobs->createChild(frame, [this]() {
+		TRB_PROFILE_ZONE("streaming");
+		uploadManager.poll();
+		textureStreamer.update(camera.matrices.view, camera.matrices.perspective, vk::Extent2D(width, height));
+	});
+	core::Job* pipelines = jobs->createChild(frame, [this]() {
+		TRB_PROFILE_ZONE("pipelines");
+		pipelineCache.update();
+	});
+	// acquiring may recreate the swap chain, nothing else of the frame may run meanwhile
+	core::Job* acquire = jobs->createChild(frame, [this]() {
+		frameAcquired = prepared && prepareFrame();
+	});
+	core::Job* record = jobs->createChild(frame, [this]() {
+		if (frameAcquired)
+		{
+			TRB_PROFILE_ZONE("render");
+			render();
+		}
+	});
+	jobs->addDependency(streaming, update);
+	jobs->addDependency(acquire, streaming);
+	jobs->addDependency(acquire, pipelines);
+	jobs->addDependency(record, acquire);
+	jobs->run(update);
+	jobs->run(streaming);
+	jobs->run(pipelines);
+	jobs->run(acquire);
+	jobs->run(record);
+}
+
+void trb::grfx::VulkanGraphics::endFrame()
+{
+	if (frameAcquired)
+	{
+		submitFrame();
+	}
+	frameCounter++;
+	auto tEnd = std::chrono::high_resolution_clock::now();
+	auto tDiff = std::chrono::duration<double, std::milli>(tEnd - frameStart).count();
+	TRB_PROFILE_COUNTER("frame ms", tDiff);
+	frameTimer = tDiff / 1000.0f;
+	gpuWaitAccumulator += gpuWaitTimer;
+	// Convert to clamped timer value
+	if (!paused)
+	{
+		timer += timerSpeed * frameTimer;
+		if (timer > 1.0)
+		{
+			timer -= 1.0f;
+		}
+	}
+	fpsTimer += (float)tDiff;
+	if (fpsTimer > 1000.0f)
+	{
+		lastFPS = (float)frameCounter * (1000.0f / fpsTimer);
+		lastGpuWait = gpuWaitAccumulator / (float)frameCounter;
+		gpuWaitAccumulator = 0.0f;
+#if defined(VK_USE_PLATFORM_XCB_KHR)
+		if (!settings.overlay)
+		{
+			std::string windowTitle = getWindowTitle();
+			xcb_change_property(connection, XCB_PROP_MODE_REPLACE,
+				window, XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8,
+				windowTitle.size(), windowTitle.c_str());
+		}
+#endif
+		fpsTimer = 0.0f;
+		frameCounter = 0;
+	}
+}
+
+void trb::grfx::VulkanGraphics::waitIdle()
+{
+	// Flush device to make sure all resources can be freed
+	vulkanDevice.device.waitIdle();
+}
+
 void trb::grfx::VulkanGraphics::renderLoop()
 {
 	std::cout<< "VulkanGraphics::renderLoop" << std::endl;
@@ -453,56 +743,7 @@ void trb::grfx::VulkanGraphics::renderLoop()
 		updateOverlay();
 	}
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
-	xcb_flush(connection);
-	while (!quit)
-	{
-		auto tStart = std::chrono::high_resolution_clock::now();
-		if (viewUpdated)
-		{
-			viewUpdated = false;
-			viewChanged();
-		}
-		xcb_generic_event_t *event;
-		while ((event = xcb_poll_for_event(connection)))
-		{
-			handleEvent(event);
-			free(event);
-		}
-		render();
-		frameCounter++;
-		auto tEnd = std::chrono::high_resolution_clock::now();
-		auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
-		frameTimer = tDiff / 1000.0f;
-		camera.update(frameTimer);
-		if (camera.moving())
-		{
-			viewUpdated = true;
-		}
-		// Convert to clamped timer value
-		if (!paused)
-		{
-			timer += timerSpeed * frameTimer;
-			if (timer > 1.0)
-			{
-				timer -= 1.0f;
-			}
-		}
-		fpsTimer += (float)tDiff;
-		if (fpsTimer > 1000.0f)
-		{
-			if (!settings.overlay)
-			{
-				std::string windowTitle = getWindowTitle();
-				xcb_change_property(connection, XCB_PROP_MODE_REPLACE,
-					window, XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8,
-					windowTitle.size(), windowTitle.c_str());
-			}
-			lastFPS = (float)frameCounter * (1000.0f / fpsTimer);
-			fpsTimer = 0.0f;
-			frameCounter = 0;
-		}
-		//updateOverlay();
-	}
+	// Engine::gameLoop drives the frames through pollEvents(), scheduleFrame() and endFrame()
 #endif
 	// Flush device to make sure all resources can be freed 
 	vulkanDevice.device.waitIdle();	
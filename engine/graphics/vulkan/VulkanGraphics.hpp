@@ -30,11 +30,24 @@
 #include <stdexcept>
 #include <vector>
 #include <cstring>
+#include <cstdio>
 #include <cstdlib>
 #include <algorithm>
 #include <fstream>
+#include <chrono>
 #include "VulkanDevice.hpp"
 #include "VulkanSwapChain.hpp"
+#include "VulkanUploadManager.hpp"
+#include "VulkanFrame.hpp"
+#include "VulkanCommandRecorder.hpp"
+#include "VulkanRenderGraph.hpp"
+#include "VulkanPipelineCache.hpp"
+#include "VulkanPipelineCompiler.hpp"
+#include "VulkanTextureStreamer.hpp"
+#include "VulkanDescriptorAllocator.hpp"
+#include "VulkanUniformAllocator.hpp"
+#include "VulkanGpuProfiler.hpp"
+#include "VulkanMesh.hpp"
 #include "../GraphicsInterface.hpp"
 #include "../Camera.hpp"
 
@@ -64,6 +77,10 @@ namespace trb{
                     bool vsync = false;
                     /** @brief Enable UI overlay */
                     bool overlay = false;
+                    /** @brief Number of frames the CPU may record ahead of the GPU */
+                    uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+                    /** @brief GPU memory streamed textures may occupy */
+                    vk::DeviceSize textureBudget = DEFAULT_TEXTURE_BUDGET;
                 } settings;
 
                 void init(){
@@ -72,15 +89,52 @@ namespace trb{
                 }
 
                 const std::string getWindowTitle() const {
-                    // TODO ..
-                    return std::string("Engine Turbulence");
+                    std::string windowTitle = title;
+                    if (lastFPS > 0){
+                        char stats[64];
+                        snprintf(stats, sizeof(stats), " - %u fps, %.2f ms gpu wait", lastFPS, lastGpuWait);
+                        windowTitle += stats;
+                    }
+                    if (lastFPS > 0 && gpuProfiler.getStats().frameTime > 0.0f){
+                        char stats[64];
+                        snprintf(stats, sizeof(stats), ", %.2f ms gpu", gpuProfiler.getStats().frameTime);
+                        windowTitle += stats;
+                    }
+                    if (lastFPS > 0 && descriptorAllocator.getStats().writes > 0){
+                        char stats[64];
+                        snprintf(stats, sizeof(stats), ", %u descriptor writes", descriptorAllocator.getStats().writes);
+                        windowTitle += stats;
+                    }
+                    if (pipelineCompiler.getPendingCount() > 0){
+                        char stats[64];
+                        snprintf(stats, sizeof(stats), ", %u pipelines compiling", pipelineCompiler.getPendingCount());
+                        windowTitle += stats;
+                    }
+                    return windowTitle;
                 } 
-                void renderLoop();               
+                /** @brief Frame loop of the platforms Engine::gameLoop does not drive yet, returns at once on XCB */
+                void renderLoop();
+
+                bool pollEvents();
+                /**
+                * Frame stages as jobs: update (camera and view dependent state) before streaming (uploads and
+                * texture mips), the pipeline cache save next to them, then acquiring the frame slot and recording
+                * the render graph, whose recorded passes fan out to the workers. Scene update and culling have no
+                * scene to work on yet, they belong into the update job
+                */
+                void scheduleFrame(core::JobSystem* jobs, core::Job* frame);
+                void endFrame();
+                void waitIdle();
 
             protected:
                   // Frame counter to display fps
 	            uint32_t frameCounter = 0;
 	            uint32_t lastFPS = 0;
+                /** @brief Time in ms the CPU waited for the GPU to release the current frame slot */
+                float gpuWaitTimer = 0.0f;
+                /** @brief Average gpu wait per frame over the last fps interval */
+                float lastGpuWait = 0.0f;
+                float gpuWaitAccumulator = 0.0f;
                 Camera camera;
 
                 // Destination dimensions for resizing the window
@@ -88,6 +142,9 @@ namespace trb{
                 uint32_t destWidth;
                 uint32_t destHeight;
                 bool viewUpdated = false;
+                /** @brief Set by the acquire job, the frame is recorded and submitted only if a slot was acquired */
+                bool frameAcquired = false;
+                std::chrono::high_resolution_clock::time_point frameStart;
                 bool resizing = false;
                 bool paused = false;
                 std::string title = "Engine Turbulence";
@@ -96,6 +153,36 @@ namespace trb{
                 vk::Instance instance;    
                 VulkanDevice vulkanDevice;
                 VulkanSwapChain swapChain;
+                /** @brief Asynchronous asset uploads on the transfer queue, polled once per frame */
+                VulkanUploadManager uploadManager;
+                /** @brief Graphics (and present) queue the frames are submitted to */
+                vk::Queue queue;
+                /** @brief Frame slots of the frames in flight pipeline */
+                std::vector<VulkanFrame> frames;
+                /** @brief Slot recorded by the CPU this frame */
+                uint32_t currentFrame = 0;
+                /** @brief Monotonic frame number */
+                uint64_t frameNumber = 0;
+                /** @brief Fence of the frame slot that last rendered to each swap chain image */
+                std::vector<vk::Fence> imagesInFlight;
+                /** @brief Parallel recording of secondary command buffers, one pool per thread and frame slot */
+                VulkanCommandRecorder commandRecorder;
+                /** @brief Frame graph rebuilt whenever the swap chain changes */
+                VulkanRenderGraph renderGraph;
+                /** @brief Swap chain image of the current frame, imported into the render graph */
+                RenderGraphResource backBuffer = RENDER_GRAPH_INVALID;
+                /** @brief Pipelines and the on disk pipeline cache they are built through */
+                VulkanPipelineCache pipelineCache;
+                /** @brief Background pipeline builds, draws use fallbacks until their pipeline is published */
+                VulkanPipelineCompiler pipelineCompiler;
+                /** @brief Mip streaming of textures by screen size inside settings.textureBudget */
+                VulkanTextureStreamer textureStreamer;
+                /** @brief Per frame descriptor pools, the set cache and the bindless texture table */
+                VulkanDescriptorAllocator descriptorAllocator;
+                /** @brief Per frame uniform data, bound through dynamic offsets */
+                VulkanUniformAllocator uniformAllocator;
+                /** @brief GPU timestamps of the frame and of every render graph pass, read back a frame slot later */
+                VulkanGpuProfiler gpuProfiler;
 
                 VkDebugReportCallbackEXT callback;          // NOTE: could not get c++ syntax to work here.. so using C  
 
@@ -129,9 +216,37 @@ namespace trb{
                     }
 #endif
                 }
-                virtual ~VulkanGraphics(){}
+                virtual ~VulkanGraphics(){
+                    destroyFrames();
+                    textureStreamer.destroy();
+                    descriptorAllocator.destroy();
+                    uniformAllocator.destroy();
+                    gpuProfiler.destroy();
+                    pipelineCompiler.shutdown();
+                    pipelineCache.destroy();
+                }
 
                 void initVulkan();
+                void initSwapchain();
+                void createFrames();
+                void destroyFrames();
+                void windowResize();
+                /** @brief Declare the frame through buildRenderGraph() and compile it for the current swap chain */
+                void createRenderGraph();
+                /** @brief Record the compiled render graph targeting the acquired swap chain image */
+                void executeRenderGraph();
+
+                /** @brief Frame slot the CPU is currently recording */
+                VulkanFrame& frame() { return frames[currentFrame]; }
+                /**
+                * Wait for the current frame slot to be released by the GPU, acquire the next swap chain image
+                * and begin the slot's command buffer
+                *
+                * @return false if the swap chain had to be recreated and the frame should be skipped
+                */
+                bool prepareFrame();
+                /** @brief End the slot's command buffer, submit it and present, then advance to the next slot */
+                void submitFrame();
 
                 // vulkan init functions
                 void createInstance();
@@ -153,10 +268,14 @@ namespace trb{
                 // Called when the window has been resized
                 // Can be overriden in derived class to recreate or rebuild resources attached to the frame buffer / swapchain
                 virtual void windowResized() {};
-                // Pure virtual function to be overriden by the dervice class
-                // Called in case of an event where e.g. the framebuffer has to be rebuild and thus
-                // all command buffers that may reference this
-                virtual void buildCommandBuffers() {};
+                // Declare the passes of a frame, override in derived class
+                // Called in case of an event where e.g. the framebuffer has to be rebuild, the
+                // back buffer is already imported into the graph
+                virtual void buildRenderGraph(VulkanRenderGraph& graph) {};
+                /** @brief (Virtual) Draws of the scene pass this frame, 0 until a scene provides them */
+                virtual uint32_t getDrawCount() { return 0; }
+                /** @brief (Virtual) Record the draws [first, first + count), called concurrently from the job system workers */
+                virtual void recordDraws(vk::CommandBuffer commandBuffer, uint32_t first, uint32_t count) {}
 
 
 #if defined(VK_USE_PLATFORM_XCB_KHR)
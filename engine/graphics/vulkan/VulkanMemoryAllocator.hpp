@@ -0,0 +1,590 @@
+#ifndef TRB_GFX_VulkanMemoryAllocator_H_
+#define TRB_GFX_VulkanMemoryAllocator_H_
+
+#include "vulkan/vulkan.hpp"
+
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <algorithm>
+#include <iterator>
+#include <cassert>
+
+// Default size of a device local memory block carved up by the allocator (64 MiB)
+#define DEFAULT_DEVICE_BLOCK_SIZE (64ull * 1024 * 1024)
+// Default size of a host visible memory block carved up by the allocator (16 MiB)
+#define DEFAULT_HOST_BLOCK_SIZE (16ull * 1024 * 1024)
+// Smallest sub range handed out by the buddy allocator
+#define MIN_BUDDY_SIZE 256ull
+
+namespace trb{
+    namespace grfx{
+
+        /**
+        * @brief How an allocation is going to be used, selects the sub allocation strategy of the block it lands in
+        */
+        enum class MemoryUsage{
+            /** @brief Long lived resources (vertex, index, storage buffers), free-list with coalescing */
+            eStatic = 0,
+            /** @brief Small, frequently recycled ranges (uniform buffers), buddy allocator */
+            eUniform = 1,
+            /** @brief Short lived upload data, linear bump allocator that resets once empty */
+            eStaging = 2,
+            /** @brief Optimal tiling images, free-list kept in separate blocks from buffers (bufferImageGranularity) */
+            eImage = 3,
+            eCount = 4
+        };
+
+        inline const char* toString(MemoryUsage usage){
+            switch(usage){
+                case MemoryUsage::eStatic: return "static";
+                case MemoryUsage::eUniform: return "uniform";
+                case MemoryUsage::eStaging: return "staging";
+                case MemoryUsage::eImage: return "image";
+                default: return "unknown";
+            }
+        }
+
+        /**
+        * @brief Pick the memory usage class for a buffer from its usage flags
+        */
+        inline MemoryUsage memoryUsageFor(vk::BufferUsageFlags usageFlags){
+            if (usageFlags & vk::BufferUsageFlagBits::eUniformBuffer){
+                return MemoryUsage::eUniform;
+            }
+            if (usageFlags == vk::BufferUsageFlags(vk::BufferUsageFlagBits::eTransferSrc)){
+                return MemoryUsage::eStaging;
+            }
+            return MemoryUsage::eStatic;
+        }
+
+        inline vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment){
+            return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+        }
+
+        /**
+        * @brief Fragmentation / occupancy snapshot of a single memory block
+        */
+        struct MemoryBlockStats{
+            uint32_t memoryTypeIndex = 0;
+            MemoryUsage usage = MemoryUsage::eStatic;
+            bool dedicated = false;
+            vk::DeviceSize size = 0;
+            vk::DeviceSize used = 0;
+            uint32_t allocationCount = 0;
+            uint32_t freeRangeCount = 0;
+            vk::DeviceSize largestFreeRange = 0;
+
+            /** @brief 0.0 when all free space is one contiguous range, approaching 1.0 as it gets scattered */
+            float fragmentation() const {
+                vk::DeviceSize freeBytes = size - used;
+                if (freeBytes == 0){
+                    return 0.0f;
+                }
+                return 1.0f - (float)largestFreeRange / (float)freeBytes;
+            }
+        };
+
+        struct MemoryStats{
+            std::vector<MemoryBlockStats> blocks;
+            vk::DeviceSize reserved = 0;
+            vk::DeviceSize used = 0;
+            uint32_t allocationCount = 0;
+            uint32_t deviceMemoryCount = 0;
+        };
+
+        /**
+        * @brief Sub allocation strategy over the address range [0, size) of one memory block
+        */
+        class BlockAllocator{
+            public:
+                virtual ~BlockAllocator(){}
+                /** @return true and the aligned offset in *offset if a range of size bytes fits */
+                virtual bool allocate(vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize *offset) = 0;
+                virtual void free(vk::DeviceSize offset) = 0;
+                virtual vk::DeviceSize used() const = 0;
+                virtual uint32_t freeRangeCount() const = 0;
+                virtual vk::DeviceSize largestFreeRange() const = 0;
+        };
+
+        /**
+        * @brief Bump allocator. Ranges can't be reused individually, the block rewinds once every range was freed
+        */
+        class LinearBlockAllocator : public BlockAllocator{
+            private:
+                vk::DeviceSize size;
+                vk::DeviceSize head = 0;
+                vk::DeviceSize usedBytes = 0;
+                std::map<vk::DeviceSize, vk::DeviceSize> live;
+
+            public:
+                LinearBlockAllocator(vk::DeviceSize size) : size(size) {}
+
+                bool allocate(vk::DeviceSize bytes, vk::DeviceSize alignment, vk::DeviceSize *offset){
+                    vk::DeviceSize start = alignUp(head, alignment);
+                    if (start + bytes > size){
+                        return false;
+                    }
+                    *offset = start;
+                    head = start + bytes;
+                    usedBytes += bytes;
+                    live[start] = bytes;
+                    return true;
+                }
+
+                void free(vk::DeviceSize offset){
+                    auto it = live.find(offset);
+                    assert(it != live.end());
+                    usedBytes -= it->second;
+                    live.erase(it);
+                    if (live.empty()){
+                        head = 0;
+                    }
+                }
+
+                vk::DeviceSize used() const { return usedBytes; }
+                uint32_t freeRangeCount() const { return head < size ? 1 : 0; }
+                vk::DeviceSize largestFreeRange() const { return size - head; }
+        };
+
+        /**
+        * @brief Binary buddy allocator over a power of two block. Ranges are naturally aligned to their size
+        */
+        class BuddyBlockAllocator : public BlockAllocator{
+            private:
+                uint32_t levels;
+                vk::DeviceSize size;
+                vk::DeviceSize usedBytes = 0;
+                // free offsets per level, level 0 is the whole block
+                std::vector<std::set<vk::DeviceSize> > freeLists;
+                // level of every handed out range
+                std::map<vk::DeviceSize, uint32_t> live;
+
+                vk::DeviceSize levelSize(uint32_t level) const { return size >> level; }
+
+            public:
+                BuddyBlockAllocator(vk::DeviceSize blockSize){
+                    size = MIN_BUDDY_SIZE;
+                    levels = 1;
+                    while (size < blockSize){
+                        size <<= 1;
+                        levels++;
+                    }
+                    freeLists.resize(levels);
+                    freeLists[0].insert(0);
+                }
+
+                vk::DeviceSize capacity() const { return size; }
+
+                bool allocate(vk::DeviceSize bytes, vk::DeviceSize alignment, vk::DeviceSize *offset){
+                    vk::DeviceSize needed = std::max(std::max(bytes, alignment), (vk::DeviceSize)MIN_BUDDY_SIZE);
+                    if (needed > size){
+                        return false;
+                    }
+                    // deepest level whose ranges still fit the request
+                    uint32_t level = 0;
+                    while (level + 1 < levels && levelSize(level + 1) >= needed){
+                        level++;
+                    }
+                    // find a free range at this level or split a bigger one
+                    int32_t from = (int32_t)level;
+                    while (from >= 0 && freeLists[from].empty()){
+                        from--;
+                    }
+                    if (from < 0){
+                        return false;
+                    }
+                    vk::DeviceSize start = *freeLists[from].begin();
+                    freeLists[from].erase(freeLists[from].begin());
+                    for (uint32_t l = (uint32_t)from; l < level; l++){
+                        freeLists[l + 1].insert(start + levelSize(l + 1));
+                    }
+                    live[start] = level;
+                    usedBytes += levelSize(level);
+                    *offset = start;
+                    return true;
+                }
+
+                void free(vk::DeviceSize offset){
+                    auto it = live.find(offset);
+                    assert(it != live.end());
+                    uint32_t level = it->second;
+                    live.erase(it);
+                    usedBytes -= levelSize(level);
+                    // merge with the buddy as long as it is free too
+                    while (level > 0){
+                        vk::DeviceSize buddy = offset ^ levelSize(level);
+                        auto b = freeLists[level].find(buddy);
+                        if (b == freeLists[level].end()){
+                            break;
+                        }
+                        freeLists[level].erase(b);
+                        offset = std::min(offset, buddy);
+                        level--;
+                    }
+                    freeLists[level].insert(offset);
+                }
+
+                vk::DeviceSize used() const { return usedBytes; }
+
+                uint32_t freeRangeCount() const {
+                    uint32_t count = 0;
+                    for (auto& list : freeLists){
+                        count += (uint32_t)list.size();
+                    }
+                    return count;
+                }
+
+                vk::DeviceSize largestFreeRange() const {
+                    for (uint32_t l = 0; l < levels; l++){
+                        if (!freeLists[l].empty()){
+                            return levelSize(l);
+                        }
+                    }
+                    return 0;
+                }
+        };
+
+        /**
+        * @brief First fit free-list allocator, neighbouring free ranges are coalesced on free
+        */
+        class FreeListBlockAllocator : public BlockAllocator{
+            private:
+                vk::DeviceSize usedBytes = 0;
+                // offset -> size of every free range
+                std::map<vk::DeviceSize, vk::DeviceSize> freeRanges;
+                // aligned offset -> (range start, range size) of every handed out range
+                std::map<vk::DeviceSize, std::pair<vk::DeviceSize, vk::DeviceSize> > live;
+
+            public:
+                FreeListBlockAllocator(vk::DeviceSize size){
+                    freeRanges[0] = size;
+                }
+
+                bool allocate(vk::DeviceSize bytes, vk::DeviceSize alignment, vk::DeviceSize *offset){
+                    for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it){
+                        vk::DeviceSize start = it->first;
+                        vk::DeviceSize rangeSize = it->second;
+                        vk::DeviceSize aligned = alignUp(start, alignment);
+                        if (aligned + bytes > start + rangeSize){
+                            continue;
+                        }
+                        freeRanges.erase(it);
+                        // padding in front of the aligned offset is returned to the free list
+                        if (aligned > start){
+                            freeRanges[start] = aligned - start;
+                        }
+                        vk::DeviceSize end = aligned + bytes;
+                        if (end < start + rangeSize){
+                            freeRanges[end] = start + rangeSize - end;
+                        }
+                        live[aligned] = std::make_pair(aligned, bytes);
+                        usedBytes += bytes;
+                        *offset = aligned;
+                        return true;
+                    }
+                    return false;
+                }
+
+                void free(vk::DeviceSize offset){
+                    auto it = live.find(offset);
+                    assert(it != live.end());
+                    vk::DeviceSize start = it->second.first;
+                    vk::DeviceSize rangeSize = it->second.second;
+                    live.erase(it);
+                    usedBytes -= rangeSize;
+
+                    auto next = freeRanges.lower_bound(start);
+                    // merge with the following free range
+                    if (next != freeRanges.end() && next->first == start + rangeSize){
+                        rangeSize += next->second;
+                        next = freeRanges.erase(next);
+                    }
+                    // merge with the preceding free range
+                    if (next != freeRanges.begin()){
+                        auto prev = std::prev(next);
+                        if (prev->first + prev->second == start){
+                            prev->second += rangeSize;
+                            return;
+                        }
+                    }
+                    freeRanges[start] = rangeSize;
+                }
+
+                vk::DeviceSize used() const { return usedBytes; }
+                uint32_t freeRangeCount() const { return (uint32_t)freeRanges.size(); }
+
+                vk::DeviceSize largestFreeRange() const {
+                    vk::DeviceSize largest = 0;
+                    for (auto& range : freeRanges){
+                        largest = std::max(largest, range.second);
+                    }
+                    return largest;
+                }
+        };
+
+        /**
+        * @brief One vk::DeviceMemory allocation carved into sub ranges
+        */
+        struct MemoryBlock{
+            vk::DeviceMemory memory;
+            vk::DeviceSize size = 0;
+            uint32_t memoryTypeIndex = 0;
+            MemoryUsage usage = MemoryUsage::eStatic;
+            /** @brief Block holds exactly one resource that was too big to share a block */
+            bool dedicated = false;
+            /** @brief Persistent mapping of the whole block for host visible memory, nullptr otherwise */
+            void* mapped = nullptr;
+            uint32_t allocationCount = 0;
+            BlockAllocator* allocator = nullptr;
+
+            ~MemoryBlock(){
+                delete allocator;
+            }
+        };
+
+        /**
+        * @brief A sub range of a memory block as handed out by the VulkanMemoryAllocator
+        */
+        struct MemoryAllocation{
+            MemoryBlock* block = nullptr;
+            vk::DeviceMemory memory;
+            vk::DeviceSize offset = 0;
+            vk::DeviceSize size = 0;
+
+            /** @brief Host pointer to the start of this range if the block is host visible */
+            void* mapped() const {
+                return (block && block->mapped) ? (char*)block->mapped + offset : nullptr;
+            }
+            operator bool() const { return block != nullptr; }
+        };
+
+        /**
+        * @brief Carves large per memory type blocks into aligned sub ranges so that thousands of
+        * resources only need a handful of vk::DeviceMemory objects (see maxMemoryAllocationCount)
+        */
+        class VulkanMemoryAllocator{
+            private:
+                vk::Device device;
+                vk::PhysicalDeviceMemoryProperties memoryProperties;
+                vk::DeviceSize nonCoherentAtomSize = 1;
+                vk::DeviceSize bufferImageGranularity = 1;
+                std::vector<MemoryBlock*> blocks;
+                std::mutex mutex;
+
+                vk::DeviceSize preferredBlockSize(uint32_t memoryTypeIndex) const {
+                    const vk::MemoryType& type = memoryProperties.memoryTypes[memoryTypeIndex];
+                    vk::DeviceSize heapSize = memoryProperties.memoryHeaps[type.heapIndex].size;
+                    vk::DeviceSize blockSize = (type.propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) ? DEFAULT_HOST_BLOCK_SIZE : DEFAULT_DEVICE_BLOCK_SIZE;
+                    // small heaps (mobile) should not be swallowed by a handful of blocks
+                    while (blockSize > (1ull << 20) && blockSize > heapSize / 8){
+                        blockSize >>= 1;
+                    }
+                    return blockSize;
+                }
+
+                MemoryBlock* createBlock(uint32_t memoryTypeIndex, MemoryUsage usage, vk::DeviceSize size, bool dedicated){
+                    MemoryBlock* block = new MemoryBlock();
+                    block->memoryTypeIndex = memoryTypeIndex;
+                    block->usage = usage;
+                    block->dedicated = dedicated;
+                    if (dedicated){
+                        block->allocator = new LinearBlockAllocator(size);
+                    }else if (usage == MemoryUsage::eUniform){
+                        BuddyBlockAllocator* buddy = new BuddyBlockAllocator(size);
+                        size = buddy->capacity();
+                        block->allocator = buddy;
+                    }else if (usage == MemoryUsage::eStaging){
+                        block->allocator = new LinearBlockAllocator(size);
+                    }else{
+                        block->allocator = new FreeListBlockAllocator(size);
+                    }
+                    block->size = size;
+
+                    vk::MemoryAllocateInfo memAlloc;
+                    memAlloc.allocationSize = size;
+                    memAlloc.memoryTypeIndex = memoryTypeIndex;
+                    if (device.allocateMemory(&memAlloc, nullptr, &block->memory) != vk::Result::eSuccess){
+                        delete block;
+                        return nullptr;
+                    }
+                    // keep host visible blocks mapped for their whole lifetime, a vk::DeviceMemory can only be mapped once
+                    if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible){
+                        if (device.mapMemory(block->memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags(), &block->mapped) != vk::Result::eSuccess){
+                            device.freeMemory(block->memory, nullptr);
+                            delete block;
+                            throw std::runtime_error("failed to map memory block");
+                        }
+                    }
+                    blocks.push_back(block);
+                    return block;
+                }
+
+                void destroyBlock(MemoryBlock* block){
+                    if (block->mapped){
+                        device.unmapMemory(block->memory);
+                    }
+                    device.freeMemory(block->memory, nullptr);
+                    blocks.erase(std::find(blocks.begin(), blocks.end(), block));
+                    delete block;
+                }
+
+            public:
+                VulkanMemoryAllocator(){}
+                ~VulkanMemoryAllocator(){
+                    destroy();
+                }
+
+                void init(vk::Device device, const vk::PhysicalDeviceMemoryProperties& memoryProperties, const vk::PhysicalDeviceLimits& limits){
+                    this->device = device;
+                    this->memoryProperties = memoryProperties;
+                    this->nonCoherentAtomSize = std::max(limits.nonCoherentAtomSize, (vk::DeviceSize)1);
+                    this->bufferImageGranularity = std::max(limits.bufferImageGranularity, (vk::DeviceSize)1);
+                }
+
+                /**
+                * Release every memory block. Any allocation still referencing a block becomes invalid
+                */
+                void destroy(){
+                    std::lock_guard<std::mutex> lock(mutex);
+                    while (!blocks.empty()){
+                        destroyBlock(blocks.back());
+                    }
+                }
+
+                /**
+                * Allocate a sub range for a resource
+                *
+                * @param memReqs Memory requirements of the buffer or image
+                * @param memoryTypeIndex Memory type the range has to come from
+                * @param usage Usage class, selects the pool and sub allocation strategy
+                *
+                * @return MemoryAllocation describing the block and the aligned offset inside it
+                */
+                MemoryAllocation allocate(const vk::MemoryRequirements& memReqs, uint32_t memoryTypeIndex, MemoryUsage usage){
+                    vk::DeviceSize alignment = std::max(memReqs.alignment, (vk::DeviceSize)1);
+                    vk::DeviceSize size = memReqs.size;
+                    bool hostVisible = (bool)(memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible);
+                    bool hostCoherent = (bool)(memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent);
+                    if (hostVisible && !hostCoherent){
+                        // flushes of one range must not touch atoms owned by a neighbour
+                        alignment = std::max(alignment, nonCoherentAtomSize);
+                        size = alignUp(size, nonCoherentAtomSize);
+                    }
+                    if (usage == MemoryUsage::eImage){
+                        alignment = std::max(alignment, bufferImageGranularity);
+                    }
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    MemoryAllocation allocation;
+                    vk::DeviceSize blockSize = preferredBlockSize(memoryTypeIndex);
+                    if (size > blockSize / 2){
+                        // too big to share, give it a block of its own
+                        MemoryBlock* block = createBlock(memoryTypeIndex, usage, size, true);
+                        if (!block){
+                            throw std::runtime_error("failed to allocate memory on device");
+                        }
+                        block->allocator->allocate(size, 1, &allocation.offset);
+                        block->allocationCount++;
+                        allocation.block = block;
+                        allocation.memory = block->memory;
+                        allocation.size = size;
+                        return allocation;
+                    }
+
+                    for (auto block : blocks){
+                        if (block->dedicated || block->memoryTypeIndex != memoryTypeIndex || block->usage != usage){
+                            continue;
+                        }
+                        if (block->allocator->allocate(size, alignment, &allocation.offset)){
+                            block->allocationCount++;
+                            allocation.block = block;
+                            allocation.memory = block->memory;
+                            allocation.size = size;
+                            return allocation;
+                        }
+                    }
+
+                    MemoryBlock* block = createBlock(memoryTypeIndex, usage, blockSize, false);
+                    if (!block || !block->allocator->allocate(size, alignment, &allocation.offset)){
+                        throw std::runtime_error("failed to allocate memory on device");
+                    }
+                    block->allocationCount++;
+                    allocation.block = block;
+                    allocation.memory = block->memory;
+                    allocation.size = size;
+                    return allocation;
+                }
+
+                /**
+                * Return a sub range to its block. Dedicated blocks are released right away, shared blocks are kept for reuse
+                */
+                void free(MemoryAllocation& allocation){
+                    if (!allocation.block){
+                        return;
+                    }
+                    std::lock_guard<std::mutex> lock(mutex);
+                    MemoryBlock* block = allocation.block;
+                    block->allocator->free(allocation.offset);
+                    block->allocationCount--;
+                    if (block->dedicated && block->allocationCount == 0){
+                        destroyBlock(block);
+                    }
+                    allocation = MemoryAllocation();
+                }
+
+                /**
+                * Release shared blocks that no longer hold any allocation
+                */
+                void trim(){
+                    std::lock_guard<std::mutex> lock(mutex);
+                    for (size_t i = blocks.size(); i-- > 0;){
+                        if (blocks[i]->allocationCount == 0){
+                            destroyBlock(blocks[i]);
+                        }
+                    }
+                }
+
+                vk::DeviceSize getNonCoherentAtomSize() const { return nonCoherentAtomSize; }
+
+                MemoryStats getStats(){
+                    std::lock_guard<std::mutex> lock(mutex);
+                    MemoryStats stats;
+                    for (auto block : blocks){
+                        MemoryBlockStats blockStats;
+                        blockStats.memoryTypeIndex = block->memoryTypeIndex;
+                        blockStats.usage = block->usage;
+                        blockStats.dedicated = block->dedicated;
+                        blockStats.size = block->size;
+                        blockStats.used = block->allocator->used();
+                        blockStats.allocationCount = block->allocationCount;
+                        blockStats.freeRangeCount = block->allocator->freeRangeCount();
+                        blockStats.largestFreeRange = block->allocator->largestFreeRange();
+                        stats.blocks.push_back(blockStats);
+                        stats.reserved += blockStats.size;
+                        stats.used += blockStats.used;
+                        stats.allocationCount += blockStats.allocationCount;
+                    }
+                    stats.deviceMemoryCount = (uint32_t)blocks.size();
+                    return stats;
+                }
+
+                void printStats(std::ostream& out){
+                    MemoryStats stats = getStats();
+                    out << "memory: " << stats.allocationCount << " allocations in " << stats.deviceMemoryCount << " blocks, "
+                        << (stats.used >> 10) << " / " << (stats.reserved >> 10) << " KiB used" << std::endl;
+                    for (auto& block : stats.blocks){
+                        out << "  type " << block.memoryTypeIndex << " " << toString(block.usage) << (block.dedicated ? " (dedicated)" : "")
+                            << ": " << (block.used >> 10) << " / " << (block.size >> 10) << " KiB, "
+                            << block.allocationCount << " allocations, " << block.freeRangeCount << " free ranges, "
+                            << "fragmentation " << block.fragmentation() << std::endl;
+                    }
+                }
+        };
+    }
+}
+
+#endif
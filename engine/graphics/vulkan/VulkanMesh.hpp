@@ -0,0 +1,139 @@
+#ifndef TRB_GFX_VulkanMesh_H_
+#define TRB_GFX_VulkanMesh_H_
+
+#include "vulkan/vulkan.hpp"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+#include "VulkanUploadManager.hpp"
+#include "../../asset/Mesh.hpp"
+
+namespace trb{
+    namespace grfx{
+
+        /**
+        * @brief A cooked .tmesh living in a single vertex + index buffer
+        *
+        * The data block of the file is copied into the buffer unchanged, streams and indices are bound at their
+        * offsets in it. Shader input locations are the TmeshSemantic values.
+        */
+        struct Mesh{
+            Buffer buffer;
+            /** @brief One entry per vertex stream, all pointing at buffer */
+            std::vector<vk::Buffer> streamBuffers;
+            std::vector<vk::DeviceSize> streamOffsets;
+            std::vector<vk::VertexInputBindingDescription> bindings;
+            std::vector<vk::VertexInputAttributeDescription> attributes;
+            vk::DeviceSize indexOffset = 0;
+            vk::IndexType indexType = vk::IndexType::eUint16;
+            uint32_t vertexCount = 0;
+            uint32_t indexCount = 0;
+            std::vector<asset::TmeshSubmesh> submeshes;
+            uint32_t lodCount = 1;
+            /** @brief lodCount entries per submesh, level 0 is the submesh itself */
+            std::vector<asset::TmeshLod> lods;
+            /** @brief Largest error of every level over all submeshes, in mesh units */
+            std::vector<float> lodErrors;
+            /** @brief Triangles of every level summed over all submeshes */
+            std::vector<uint32_t> lodTriangles;
+            glm::vec3 boundsMin;
+            glm::vec3 boundsMax;
+
+            /**
+            * Create the buffer and fill it with the data block of the mesh
+            *
+            * @param device Device the buffer is created on
+            * @param mesh Parsed mesh, usually a MeshFile mapping so the only copy is the one into GPU memory
+            * @param uploads (Optional) Upload into device local memory through the staging ring. Without it the block
+            *        is copied straight into a host visible buffer by VulkanDevice::createBuffer, which is device local
+            *        memory as well on unified memory (mobile) GPUs
+            *
+            * @return Ticket of the upload, poll it before drawing. 0 when the data was copied directly
+            */
+            UploadTicket create(VulkanDevice* device, const asset::MeshView& mesh, VulkanUploadManager* uploads = nullptr){
+                const asset::TmeshHeader& header = mesh.getHeader();
+                vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer;
+                UploadTicket ticket = 0;
+                if (uploads){
+                    device->createBuffer(usage | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal, &buffer, mesh.getDataSize());
+                    ticket = uploads->uploadBuffer(&buffer, mesh.getData(), mesh.getDataSize());
+                }else{
+                    device->createBuffer(usage, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                        &buffer, mesh.getDataSize(), (void*)mesh.getData());
+                }
+
+                streamBuffers.assign(mesh.getStreamCount(), buffer.buffer);
+                streamOffsets.clear();
+                bindings.clear();
+                for (uint32_t i = 0; i < mesh.getStreamCount(); i++){
+                    streamOffsets.push_back(mesh.getStreamOffset(i));
+                    bindings.push_back(vk::VertexInputBindingDescription(i, mesh.getStream(i).stride, vk::VertexInputRate::eVertex));
+                }
+                attributes.clear();
+                for (uint32_t i = 0; i < mesh.getAttributeCount(); i++){
+                    const asset::TmeshAttribute& attribute = mesh.getAttribute(i);
+                    attributes.push_back(vk::VertexInputAttributeDescription(attribute.semantic, attribute.stream, (vk::Format)attribute.format, attribute.offset));
+                }
+                indexOffset = mesh.getIndexOffset();
+                indexType = mesh.getIndexSize() == 2 ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+                vertexCount = mesh.getVertexCount();
+                indexCount = mesh.getIndexCount();
+                submeshes.clear();
+                for (uint32_t i = 0; i < mesh.getSubmeshCount(); i++){
+                    submeshes.push_back(mesh.getSubmesh(i));
+                }
+                lodCount = mesh.getLodCount();
+                lods.clear();
+                lodErrors.assign(lodCount, 0.0f);
+                lodTriangles.assign(lodCount, 0);
+                for (uint32_t i = 0; i < mesh.getSubmeshCount(); i++){
+                    for (uint32_t l = 0; l < lodCount; l++){
+                        const asset::TmeshLod& lod = mesh.getLod(i, l);
+                        lods.push_back(lod);
+                        lodErrors[l] = std::max(lodErrors[l], lod.error);
+                        lodTriangles[l] += lod.indexCount / 3;
+                    }
+                }
+                boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+                boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+                return ticket;
+            }
+
+            void destroy(){
+                buffer.destroy();
+                streamBuffers.clear();
+                submeshes.clear();
+                lods.clear();
+                lodErrors.clear();
+                lodTriangles.clear();
+            }
+
+            void bind(vk::CommandBuffer cmd) const {
+                cmd.bindVertexBuffers(0, (uint32_t)streamBuffers.size(), streamBuffers.data(), streamOffsets.data());
+                cmd.bindIndexBuffer(buffer.buffer, indexOffset, indexType);
+            }
+
+            /** @brief Draw one submesh at a level of detail (see LodSelector), bind() first */
+            void draw(vk::CommandBuffer cmd, uint32_t submesh, uint32_t lod = 0, uint32_t instanceCount = 1) const {
+                const asset::TmeshLod& l = lods[submesh * lodCount + std::min(lod, lodCount - 1)];
+                cmd.drawIndexed(l.indexCount, instanceCount, l.firstIndex, submeshes[submesh].vertexOffset, 0);
+            }
+
+            /** @brief Draw every submesh at a level of detail, bind() first */
+            void drawAll(vk::CommandBuffer cmd, uint32_t lod = 0) const {
+                for (uint32_t i = 0; i < submeshes.size(); i++){
+                    draw(cmd, i, lod);
+                }
+            }
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,669 @@
+#ifndef TRB_GFX_VulkanPipelineCache_H_
+#define TRB_GFX_VulkanPipelineCache_H_
+
+#include "vulkan/vulkan.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#include "VulkanDevice.hpp"
+
+// Pipeline cache blob, the manifest is stored next to it with a .manifest suffix
+#define DEFAULT_PIPELINE_CACHE_PATH "pipeline_cache.bin"
+// Seconds between periodic saves of a changed cache
+#define DEFAULT_PIPELINE_CACHE_SAVE_INTERVAL 30.0
+#define PIPELINE_MANIFEST_VERSION 1
+
+namespace trb{
+    namespace grfx{
+
+        /**
+        * @brief Everything needed to rebuild a graphics pipeline in a later session
+        *
+        * Shader paths point to SPIR-V files and may not contain whitespace. The pipeline is built against a render
+        * pass derived from the attachment formats, so it can be used with every compatible render pass.
+        */
+        struct PipelineDesc{
+            std::string vertexShader;
+            std::string fragmentShader;
+            std::vector<vk::VertexInputBindingDescription> bindings;
+            std::vector<vk::VertexInputAttributeDescription> attributes;
+            /** @brief Bindings of descriptor set 0 */
+            std::vector<vk::DescriptorSetLayoutBinding> descriptorBindings;
+            uint32_t pushConstantSize = 0;
+            vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+            vk::PolygonMode polygonMode = vk::PolygonMode::eFill;
+            vk::CullModeFlags cullMode = vk::CullModeFlagBits::eBack;
+            vk::FrontFace frontFace = vk::FrontFace::eCounterClockwise;
+            bool depthTest = true;
+            bool depthWrite = true;
+            vk::CompareOp depthCompare = vk::CompareOp::eLessOrEqual;
+            bool blend = false;
+            std::vector<vk::Format> colorFormats;
+            vk::Format depthFormat = vk::Format::eUndefined;
+            vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+
+            /** @brief One line serialization, identifies the pipeline in the cache and the manifest */
+            std::string key() const {
+                std::ostringstream out;
+                out << vertexShader << " " << fragmentShader << " " << (uint32_t)topology << " " << (uint32_t)polygonMode << " "
+                    << (uint32_t)cullMode << " " << (uint32_t)frontFace << " " << depthTest << " " << depthWrite << " "
+                    << (uint32_t)depthCompare << " " << blend << " " << (uint32_t)depthFormat << " " << (uint32_t)samples << " " << pushConstantSize;
+                out << " " << colorFormats.size();
+                for (auto format : colorFormats){
+                    out << " " << (uint32_t)format;
+                }
+                out << " " << bindings.size();
+                for (auto& binding : bindings){
+                    out << " " << binding.binding << " " << binding.stride << " " << (uint32_t)binding.inputRate;
+                }
+                out << " " << attributes.size();
+                for (auto& attribute : attributes){
+                    out << " " << attribute.location << " " << attribute.binding << " " << (uint32_t)attribute.format << " " << attribute.offset;
+                }
+                out << " " << descriptorBindings.size();
+                for (auto& binding : descriptorBindings){
+                    out << " " << binding.binding << " " << (uint32_t)binding.descriptorType << " " << binding.descriptorCount << " " << (uint32_t)binding.stageFlags;
+                }
+                return out.str();
+            }
+
+            /** @return false if the line is not a valid serialization */
+            static bool parse(const std::string& line, PipelineDesc* desc){
+                std::istringstream in(line);
+                uint32_t topology, polygonMode, cullMode, frontFace, depthCompare, depthFormat, samples;
+                size_t count;
+                PipelineDesc d;
+                if (!(in >> d.vertexShader >> d.fragmentShader >> topology >> polygonMode >> cullMode >> frontFace >> d.depthTest >> d.depthWrite
+                         >> depthCompare >> d.blend >> depthFormat >> samples >> d.pushConstantSize)){
+                    return false;
+                }
+                d.topology = (vk::PrimitiveTopology)topology;
+                d.polygonMode = (vk::PolygonMode)polygonMode;
+                d.cullMode = (vk::CullModeFlags)(vk::CullModeFlagBits)cullMode;
+                d.frontFace = (vk::FrontFace)frontFace;
+                d.depthCompare = (vk::CompareOp)depthCompare;
+                d.depthFormat = (vk::Format)depthFormat;
+                d.samples = (vk::SampleCountFlagBits)samples;
+                if (!(in >> count)){
+                    return false;
+                }
+                for (size_t i = 0; i < count; i++){
+                    uint32_t format;
+                    if (!(in >> format)){
+                        return false;
+                    }
+                    d.colorFormats.push_back((vk::Format)format);
+                }
+                if (!(in >> count)){
+                    return false;
+                }
+                for (size_t i = 0; i < count; i++){
+                    uint32_t binding, stride, inputRate;
+                    if (!(in >> binding >> stride >> inputRate)){
+                        return false;
+                    }
+                    d.bindings.push_back(vk::VertexInputBindingDescription(binding, stride, (vk::VertexInputRate)inputRate));
+                }
+                if (!(in >> count)){
+                    return false;
+                }
+                for (size_t i = 0; i < count; i++){
+                    uint32_t location, binding, format, offset;
+                    if (!(in >> location >> binding >> format >> offset)){
+                        return false;
+                    }
+                    d.attributes.push_back(vk::VertexInputAttributeDescription(location, binding, (vk::Format)format, offset));
+                }
+                if (!(in >> count)){
+                    return false;
+                }
+                for (size_t i = 0; i < count; i++){
+                    uint32_t binding, type, descriptorCount, stages;
+                    if (!(in >> binding >> type >> descriptorCount >> stages)){
+                        return false;
+                    }
+                    d.descriptorBindings.push_back(vk::DescriptorSetLayoutBinding(binding, (vk::DescriptorType)type, descriptorCount,
+                        (vk::ShaderStageFlags)(vk::ShaderStageFlagBits)stages, nullptr));
+                }
+                *desc = d;
+                return true;
+            }
+        };
+
+        struct PipelineCacheStats{
+            /** @brief Size of the blob read from disk, 0 on a cold start */
+            size_t loadedBytes = 0;
+            /** @brief The blob on disk was produced by this driver and device */
+            bool headerValid = false;
+            size_t savedBytes = 0;
+            uint32_t saves = 0;
+            uint32_t pipelinesCreated = 0;
+            /** @brief Pipelines of previous sessions rebuilt by warmup() */
+            uint32_t warmedUp = 0;
+            /** @brief Time spent in vkCreateGraphicsPipelines in ms */
+            float compileTime = 0.0f;
+            float loadTime = 0.0f;
+            float warmupTime = 0.0f;
+        };
+
+        /**
+        * @brief Persistent VkPipelineCache plus the pipelines created through it
+        *
+        * The blob is only handed to the driver if its header matches the vendor, device and pipeline cache UUID
+        * of the current device, a stale blob from a driver update is dropped. Saving writes to a temporary file
+        * and renames it over the old one, so a crash mid save never leaves a truncated cache behind.
+        * The manifest lists the pipelines of previous sessions so warmup() can build them while loading.
+        */
+        class VulkanPipelineCache{
+            private:
+                struct Pipeline{
+                    PipelineDesc desc;
+                    vk::Pipeline pipeline;
+                    vk::PipelineLayout layout;
+                };
+
+                VulkanDevice* vulkanDevice = nullptr;
+                vk::PipelineCache cache;
+                std::string path;
+
+                std::mutex mutex;
+                std::map<std::string, Pipeline> pipelines;
+                std::map<std::string, vk::ShaderModule> shaderModules;
+                std::map<std::string, vk::DescriptorSetLayout> setLayouts;
+                std::map<std::string, vk::PipelineLayout> pipelineLayouts;
+                std::map<std::string, vk::RenderPass> renderPasses;
+
+                /** @brief Pipelines of this and previous sessions in first use order */
+                std::vector<std::string> manifest;
+                std::set<std::string> manifestKeys;
+
+                /** @brief Pipelines were built since the last save, set by the compiler thread */
+                std::atomic<bool> dirty;
+                std::chrono::steady_clock::time_point lastSave;
+                PipelineCacheStats stats;
+
+                static bool readFile(const std::string& filename, std::vector<char>* data){
+                    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+                    if (!file.is_open()){
+                        return false;
+                    }
+                    size_t fileSize = (size_t)file.tellg();
+                    data->resize(fileSize);
+                    file.seekg(0);
+                    file.read(data->data(), fileSize);
+                    return (bool)file;
+                }
+
+                /** @brief Write to a temporary file and rename it over the target */
+                static bool writeFileAtomic(const std::string& filename, const void* data, size_t size){
+                    std::string tmp = filename + ".tmp";
+                    FILE* file = fopen(tmp.c_str(), "wb");
+                    if (!file){
+                        return false;
+                    }
+                    bool ok = fwrite(data, 1, size, file) == size && fflush(file) == 0;
+#if !defined(_WIN32)
+                    ok = ok && fsync(fileno(file)) == 0;
+#endif
+                    ok = fclose(file) == 0 && ok;
+                    if (!ok){
+                        std::remove(tmp.c_str());
+                        return false;
+                    }
+#if defined(_WIN32)
+                    std::remove(filename.c_str());
+#endif
+                    return std::rename(tmp.c_str(), filename.c_str()) == 0;
+                }
+
+                /** @brief Check the VkPipelineCacheHeaderVersionOne at the start of a blob against the device */
+                bool validateHeader(const std::vector<char>& data){
+                    const size_t headerSize = 16 + VK_UUID_SIZE;
+                    if (data.size() < headerSize){
+                        return false;
+                    }
+                    uint32_t header[4];
+                    memcpy(header, data.data(), sizeof(header));
+                    const vk::PhysicalDeviceProperties& properties = vulkanDevice->properties;
+                    return header[0] >= headerSize &&
+                           header[1] == (uint32_t)VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+                           header[2] == properties.vendorID &&
+                           header[3] == properties.deviceID &&
+                           memcmp(data.data() + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+                }
+
+                void loadManifest(){
+                    std::ifstream file(path + ".manifest");
+                    std::string line;
+                    if (!file.is_open() || !std::getline(file, line) || line != "TRBPIPELINES " + std::to_string(PIPELINE_MANIFEST_VERSION)){
+                        return;
+                    }
+                    while (std::getline(file, line)){
+                        PipelineDesc desc;
+                        if (PipelineDesc::parse(line, &desc) && manifestKeys.insert(line).second){
+                            manifest.push_back(line);
+                        }
+                    }
+                }
+
+                bool saveManifest(){
+                    std::ostringstream out;
+                    out << "TRBPIPELINES " << PIPELINE_MANIFEST_VERSION << "\n";
+                    for (auto& key : manifest){
+                        out << key << "\n";
+                    }
+                    std::string data = out.str();
+                    return writeFileAtomic(path + ".manifest", data.data(), data.size());
+                }
+
+                vk::ShaderModule getShaderModule(const std::string& filename){
+                    auto it = shaderModules.find(filename);
+                    if (it != shaderModules.end()){
+                        return it->second;
+                    }
+                    std::vector<char> code;
+                    if (!readFile(filename, &code) || code.empty() || code.size() % 4 != 0){
+                        throw std::runtime_error("failed to load shader " + filename);
+                    }
+                    vk::ShaderModuleCreateInfo createInfo;
+                    createInfo.codeSize = code.size();
+                    createInfo.pCode = (const uint32_t*)code.data();
+                    vk::ShaderModule module;
+                    if (vulkanDevice->device.createShaderModule(&createInfo, nullptr, &module) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to create shader module " + filename);
+                    }
+                    shaderModules[filename] = module;
+                    return module;
+                }
+
+                vk::PipelineLayout getPipelineLayout(const PipelineDesc& desc){
+                    std::ostringstream setKey;
+                    for (auto& binding : desc.descriptorBindings){
+                        setKey << binding.binding << " " << (uint32_t)binding.descriptorType << " " << binding.descriptorCount << " " << (uint32_t)binding.stageFlags << " ";
+                    }
+                    vk::DescriptorSetLayout& setLayout = setLayouts[setKey.str()];
+                    if (!setLayout){
+                        vk::DescriptorSetLayoutCreateInfo layoutInfo;
+                        layoutInfo.bindingCount = (uint32_t)desc.descriptorBindings.size();
+                        layoutInfo.pBindings = desc.descriptorBindings.data();
+                        if (vulkanDevice->device.createDescriptorSetLayout(&layoutInfo, nullptr, &setLayout) != vk::Result::eSuccess){
+                            throw std::runtime_error("failed to create descriptor set layout");
+                        }
+                    }
+                    std::string layoutKey = setKey.str() + "/" + std::to_string(desc.pushConstantSize);
+                    vk::PipelineLayout& layout = pipelineLayouts[layoutKey];
+                    if (!layout){
+                        vk::PushConstantRange pushConstants(vk::ShaderStageFlagBits::eAllGraphics, 0, desc.pushConstantSize);
+                        vk::PipelineLayoutCreateInfo layoutInfo;
+                        layoutInfo.setLayoutCount = 1;
+                        layoutInfo.pSetLayouts = &setLayout;
+                        layoutInfo.pushConstantRangeCount = desc.pushConstantSize > 0 ? 1 : 0;
+                        layoutInfo.pPushConstantRanges = &pushConstants;
+                        if (vulkanDevice->device.createPipelineLayout(&layoutInfo, nullptr, &layout) != vk::Result::eSuccess){
+                            throw std::runtime_error("failed to create pipeline layout");
+                        }
+                    }
+                    return layout;
+                }
+
+                /** @brief Single subpass render pass compatible with every render pass using the same attachment formats */
+                vk::RenderPass getCompatibleRenderPass(const PipelineDesc& desc){
+                    std::ostringstream key;
+                    for (auto format : desc.colorFormats){
+                        key << (uint32_t)format << " ";
+                    }
+                    key << "/" << (uint32_t)desc.depthFormat << "/" << (uint32_t)desc.samples;
+                    vk::RenderPass& renderPass = renderPasses[key.str()];
+                    if (renderPass){
+                        return renderPass;
+                    }
+                    std::vector<vk::AttachmentDescription> attachments;
+                    std::vector<vk::AttachmentReference> colorRefs;
+                    for (auto format : desc.colorFormats){
+                        vk::AttachmentDescription attachment;
+                        attachment.format = format;
+                        attachment.samples = desc.samples;
+                        attachment.initialLayout = vk::ImageLayout::eColorAttachmentOptimal;
+                        attachment.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
+                        colorRefs.push_back(vk::AttachmentReference((uint32_t)attachments.size(), vk::ImageLayout::eColorAttachmentOptimal));
+                        attachments.push_back(attachment);
+                    }
+                    vk::AttachmentReference depthRef((uint32_t)attachments.size(), vk::ImageLayout::eDepthStencilAttachmentOptimal);
+                    if (desc.depthFormat != vk::Format::eUndefined){
+                        vk::AttachmentDescription attachment;
+                        attachment.format = desc.depthFormat;
+                        attachment.samples = desc.samples;
+                        attachment.initialLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+                        attachment.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+                        attachments.push_back(attachment);
+                    }
+                    vk::SubpassDescription subpass;
+                    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+                    subpass.colorAttachmentCount = (uint32_t)colorRefs.size();
+                    subpass.pColorAttachments = colorRefs.data();
+                    subpass.pDepthStencilAttachment = desc.depthFormat != vk::Format::eUndefined ? &depthRef : nullptr;
+
+                    vk::RenderPassCreateInfo renderPassInfo;
+                    renderPassInfo.attachmentCount = (uint32_t)attachments.size();
+                    renderPassInfo.pAttachments = attachments.data();
+                    renderPassInfo.subpassCount = 1;
+                    renderPassInfo.pSubpasses = &subpass;
+                    if (vulkanDevice->device.createRenderPass(&renderPassInfo, nullptr, &renderPass) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to create compatible render pass");
+                    }
+                    return renderPass;
+                }
+
+                /** @brief Build a pipeline through the cache, shader modules and layouts are created on first use */
+                Pipeline build(const PipelineDesc& desc){
+                    Pipeline result;
+                    result.desc = desc;
+                    vk::PipelineShaderStageCreateInfo stages[2];
+                    vk::RenderPass renderPass;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        stages[0] = vk::PipelineShaderStageCreateInfo(vk::PipelineShaderStageCreateFlags(), vk::ShaderStageFlagBits::eVertex, getShaderModule(desc.vertexShader), "main");
+                        stages[1] = vk::PipelineShaderStageCreateInfo(vk::PipelineShaderStageCreateFlags(), vk::ShaderStageFlagBits::eFragment, getShaderModule(desc.fragmentShader), "main");
+                        result.layout = getPipelineLayout(desc);
+                        renderPass = getCompatibleRenderPass(desc);
+                    }
+
+                    vk::PipelineVertexInputStateCreateInfo vertexInput;
+                    vertexInput.vertexBindingDescriptionCount = (uint32_t)desc.bindings.size();
+                    vertexInput.pVertexBindingDescriptions = desc.bindings.data();
+                    vertexInput.vertexAttributeDescriptionCount = (uint32_t)desc.attributes.size();
+                    vertexInput.pVertexAttributeDescriptions = desc.attributes.data();
+
+                    vk::PipelineInputAssemblyStateCreateInfo inputAssembly;
+                    inputAssembly.topology = desc.topology;
+
+                    // viewport and scissor are dynamic, one pipeline serves every target size
+                    vk::PipelineViewportStateCreateInfo viewportState;
+                    viewportState.viewportCount = 1;
+                    viewportState.scissorCount = 1;
+
+                    vk::PipelineRasterizationStateCreateInfo rasterizer;
+                    rasterizer.polygonMode = desc.polygonMode;
+                    rasterizer.cullMode = desc.cullMode;
+                    rasterizer.frontFace = desc.frontFace;
+                    rasterizer.lineWidth = 1.0f;
+
+                    vk::PipelineMultisampleStateCreateInfo multisampling;
+                    multisampling.rasterizationSamples = desc.samples;
+
+                    vk::PipelineDepthStencilStateCreateInfo depthStencil;
+                    depthStencil.depthTestEnable = desc.depthTest;
+                    depthStencil.depthWriteEnable = desc.depthWrite;
+                    depthStencil.depthCompareOp = desc.depthCompare;
+
+                    std::vector<vk::PipelineColorBlendAttachmentState> blendAttachments(desc.colorFormats.size());
+                    for (auto& attachment : blendAttachments){
+                        attachment.blendEnable = desc.blend;
+                        attachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+                        attachment.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+                        attachment.colorBlendOp = vk::BlendOp::eAdd;
+                        attachment.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+                        attachment.dstAlphaBlendFactor = vk::BlendFactor::eZero;
+                        attachment.alphaBlendOp = vk::BlendOp::eAdd;
+                        attachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+                                                    vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+                    }
+                    vk::PipelineColorBlendStateCreateInfo colorBlending;
+                    colorBlending.attachmentCount = (uint32_t)blendAttachments.size();
+                    colorBlending.pAttachments = blendAttachments.data();
+
+                    vk::DynamicState dynamicStates[] = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+                    vk::PipelineDynamicStateCreateInfo dynamicState;
+                    dynamicState.dynamicStateCount = 2;
+                    dynamicState.pDynamicStates = dynamicStates;
+
+                    vk::GraphicsPipelineCreateInfo pipelineInfo;
+                    pipelineInfo.stageCount = 2;
+                    pipelineInfo.pStages = stages;
+                    pipelineInfo.pVertexInputState = &vertexInput;
+                    pipelineInfo.pInputAssemblyState = &inputAssembly;
+                    pipelineInfo.pViewportState = &viewportState;
+                    pipelineInfo.pRasterizationState = &rasterizer;
+                    pipelineInfo.pMultisampleState = &multisampling;
+                    pipelineInfo.pDepthStencilState = &depthStencil;
+                    pipelineInfo.pColorBlendState = &colorBlending;
+                    pipelineInfo.pDynamicState = &dynamicState;
+                    pipelineInfo.layout = result.layout;
+                    pipelineInfo.renderPass = renderPass;
+                    pipelineInfo.subpass = 0;
+
+                    // the pipeline cache is internally synchronized, creation runs outside the lock
+                    auto tStart = std::chrono::high_resolution_clock::now();
+                    if (vulkanDevice->device.createGraphicsPipelines(cache, 1, &pipelineInfo, nullptr, &result.pipeline) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to create graphics pipeline " + desc.vertexShader + " / " + desc.fragmentShader);
+                    }
+                    auto tEnd = std::chrono::high_resolution_clock::now();
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stats.compileTime += (float)std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+                    stats.pipelinesCreated++;
+                    dirty = true;
+                    return result;
+                }
+
+            public:
+                VulkanPipelineCache() : dirty(false) {}
+                ~VulkanPipelineCache(){
+                    destroy();
+                }
+
+                /**
+                * Create the pipeline cache, seeded with the blob of the previous session if it belongs to this device
+                *
+                * @param vulkanDevice Initialized device
+                * @param cachePath (Optional) File the blob is stored in, the manifest goes next to it
+                */
+                void init(VulkanDevice* vulkanDevice, const std::string& cachePath = DEFAULT_PIPELINE_CACHE_PATH){
+                    this->vulkanDevice = vulkanDevice;
+                    path = cachePath;
+                    auto tStart = std::chrono::high_resolution_clock::now();
+
+                    std::vector<char> data;
+                    vk::PipelineCacheCreateInfo cacheInfo;
+                    if (readFile(path, &data)){
+                        stats.headerValid = validateHeader(data);
+                        if (stats.headerValid){
+                            stats.loadedBytes = data.size();
+                            cacheInfo.initialDataSize = data.size();
+                            cacheInfo.pInitialData = data.data();
+                        }else{
+                            std::cout << "pipeline cache: " << path << " belongs to another device or driver, starting cold" << std::endl;
+                        }
+                    }
+                    if (vulkanDevice->device.createPipelineCache(&cacheInfo, nullptr, &cache) != vk::Result::eSuccess){
+                        // some drivers reject blobs that pass the header check, retry empty
+                        cacheInfo.initialDataSize = 0;
+                        cacheInfo.pInitialData = nullptr;
+                        stats.loadedBytes = 0;
+                        stats.headerValid = false;
+                        if (vulkanDevice->device.createPipelineCache(&cacheInfo, nullptr, &cache) != vk::Result::eSuccess){
+                            throw std::runtime_error("failed to create pipeline cache");
+                        }
+                    }
+                    loadManifest();
+                    lastSave = std::chrono::steady_clock::now();
+                    auto tEnd = std::chrono::high_resolution_clock::now();
+                    stats.loadTime = (float)std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+                }
+
+                /** @brief Save and destroy everything created through the cache */
+                void destroy(){
+                    if (!cache){
+                        return;
+                    }
+                    save();
+                    vk::Device device = vulkanDevice->device;
+                    for (auto& pipeline : pipelines){
+                        device.destroyPipeline(pipeline.second.pipeline, nullptr);
+                    }
+                    for (auto& layout : pipelineLayouts){
+                        device.destroyPipelineLayout(layout.second, nullptr);
+                    }
+                    for (auto& setLayout : setLayouts){
+                        device.destroyDescriptorSetLayout(setLayout.second, nullptr);
+                    }
+                    for (auto& module : shaderModules){
+                        device.destroyShaderModule(module.second, nullptr);
+                    }
+                    for (auto& renderPass : renderPasses){
+                        device.destroyRenderPass(renderPass.second, nullptr);
+                    }
+                    pipelines.clear();
+                    pipelineLayouts.clear();
+                    setLayouts.clear();
+                    shaderModules.clear();
+                    renderPasses.clear();
+                    device.destroyPipelineCache(cache, nullptr);
+                    cache = vk::PipelineCache();
+                }
+
+                /**
+                * Get a pipeline, building it (and adding it to the manifest) on first use
+                */
+                vk::Pipeline getPipeline(const PipelineDesc& desc, vk::PipelineLayout* layout = nullptr){
+                    std::string key = desc.key();
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        auto it = pipelines.find(key);
+                        if (it != pipelines.end()){
+                            if (layout){
+                                *layout = it->second.layout;
+                            }
+                            return it->second.pipeline;
+                        }
+                    }
+                    Pipeline pipeline = build(desc);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    auto inserted = pipelines.insert(std::make_pair(key, pipeline));
+                    if (!inserted.second){
+                        // built concurrently by another thread
+                        vulkanDevice->device.destroyPipeline(pipeline.pipeline, nullptr);
+                    }
+                    if (manifestKeys.insert(key).second){
+                        manifest.push_back(key);
+                    }
+                    if (layout){
+                        *layout = inserted.first->second.layout;
+                    }
+                    return inserted.first->second.pipeline;
+                }
+
+                /**
+                * Build every pipeline of previous sessions that does not exist yet, call while loading
+                *
+                * @return Number of pipelines built
+                */
+                uint32_t warmup(){
+                    auto tStart = std::chrono::high_resolution_clock::now();
+                    std::vector<std::string> keys;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        keys = manifest;
+                    }
+                    uint32_t built = 0;
+                    for (auto& key : keys){
+                        PipelineDesc desc;
+                        if (!PipelineDesc::parse(key, &desc)){
+                            continue;
+                        }
+                        try{
+                            getPipeline(desc);
+                            built++;
+                        }catch (const std::runtime_error& e){
+                            // shaders may have been removed since the manifest was written
+                            std::cerr << "pipeline warmup: " << e.what() << std::endl;
+                        }
+                    }
+                    auto tEnd = std::chrono::high_resolution_clock::now();
+                    stats.warmedUp += built;
+                    stats.warmupTime += (float)std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+                    return built;
+                }
+
+                /**
+                * Write the cache blob and the manifest to disk
+                *
+                * @return false if either file could not be written
+                */
+                bool save(){
+                    if (!cache){
+                        return false;
+                    }
+                    // cleared before the data is read, pipelines built meanwhile mark the cache dirty again
+                    bool wasDirty = dirty.exchange(false);
+                    size_t size = 0;
+                    vk::Device device = vulkanDevice->device;
+                    std::vector<char> data;
+                    bool read = device.getPipelineCacheData(cache, &size, nullptr) == vk::Result::eSuccess;
+                    if (read){
+                        data.resize(size);
+                        read = device.getPipelineCacheData(cache, &size, data.data()) == vk::Result::eSuccess;
+                    }
+                    if (!read){
+                        if (wasDirty){
+                            dirty = true;
+                        }
+                        return false;
+                    }
+                    std::lock_guard<std::mutex> lock(mutex);
+                    bool ok = writeFileAtomic(path, data.data(), size) && saveManifest();
+                    if (ok){
+                        stats.savedBytes = size;
+                        stats.saves++;
+                    }else{
+                        if (wasDirty){
+                            dirty = true;
+                        }
+                        std::cerr << "pipeline cache: failed to write " << path << std::endl;
+                    }
+                    lastSave = std::chrono::steady_clock::now();
+                    return ok;
+                }
+
+                /**
+                * Save the cache if pipelines were built since the last save and the interval passed, call once per frame
+                */
+                void update(double interval = DEFAULT_PIPELINE_CACHE_SAVE_INTERVAL){
+                    if (!dirty){
+                        return;
+                    }
+                    if (std::chrono::duration<double>(std::chrono::steady_clock::now() - lastSave).count() >= interval){
+                        save();
+                    }
+                }
+
+                vk::PipelineCache getHandle() const { return cache; }
+                size_t getManifestSize() const { return manifest.size(); }
+                const PipelineCacheStats& getStats() const { return stats; }
+
+                void printStats(std::ostream& out) const {
+                    out << "pipeline cache: " << (stats.headerValid ? "warm" : "cold") << " start, " << (stats.loadedBytes >> 10) << " KiB loaded in "
+                        << stats.loadTime << " ms, " << stats.warmedUp << " pipelines warmed up in " << stats.warmupTime << " ms, "
+                        << stats.pipelinesCreated << " created in " << stats.compileTime << " ms total" << std::endl;
+                }
+        };
+    }
+}
+
+#endif
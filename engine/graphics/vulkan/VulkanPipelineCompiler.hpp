@@ -0,0 +1,320 @@
+#ifndef TRB_GFX_VulkanPipelineCompiler_H_
+#define TRB_GFX_VulkanPipelineCompiler_H_
+
+#include "vulkan/vulkan.hpp"
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "VulkanPipelineCache.hpp"
+
+// Pipelines that can be requested over the lifetime of the compiler, handles index a fixed array
+#define MAX_ASYNC_PIPELINES 4096
+#define INVALID_PIPELINE UINT32_MAX
+
+namespace trb{
+    namespace grfx{
+
+        /** @brief Index of a pipeline requested from the compiler */
+        typedef uint32_t PipelineHandle;
+
+        struct PipelineCompilerStats{
+            /** @brief Compiles queued or running at the start of the frame */
+            uint32_t pending = 0;
+            /** @brief Draws of the frame that used a fallback because their pipeline was not ready */
+            uint32_t fallbackDraws = 0;
+            /** @brief Draws of the frame that were skipped, neither pipeline nor fallback were ready */
+            uint32_t skippedDraws = 0;
+            /** @brief Pipelines that were needed before they finished compiling, each one a frame hitch avoided */
+            uint32_t hitchesAvoided = 0;
+            /** @brief Compile time of those pipelines in ms, the stall the render thread did not take */
+            float hitchTimeAvoided = 0.0f;
+            uint32_t compiled = 0;
+            uint32_t failed = 0;
+        };
+
+        /**
+        * @brief Builds pipelines on background threads
+        *
+        * request() hands out a handle right away and queues the compile. acquire() is called per draw, also from
+        * recording workers, and never blocks: it returns the pipeline once it was published, otherwise the
+        * registered fallback, otherwise false and the draw is skipped. Handles index a fixed array and a compile
+        * thread publishes its result with a single release store, so the render side takes no locks.
+        */
+        class VulkanPipelineCompiler{
+            private:
+                enum SlotState{ ePending = 0, eReady = 1, eFailed = 2 };
+
+                struct Slot{
+                    PipelineDesc desc;
+                    PipelineHandle fallback = INVALID_PIPELINE;
+                    // written by the compile thread before state is released
+                    vk::Pipeline pipeline;
+                    vk::PipelineLayout layout;
+                    float compileTime = 0.0f;
+                    std::atomic<uint32_t> state;
+                    /** @brief A draw needed this pipeline while it was still pending */
+                    std::atomic<bool> missed;
+
+                    Slot(){
+                        state = ePending;
+                        missed = false;
+                    }
+                };
+
+                VulkanPipelineCache* cache = nullptr;
+                Slot* slots = nullptr;
+                std::atomic<uint32_t> slotCount;
+
+                // request side, rare compared to acquire
+                std::mutex requestMutex;
+                std::map<std::string, PipelineHandle> handles;
+
+                std::mutex queueMutex;
+                std::condition_variable queueCondition;
+                std::deque<PipelineHandle> queue;
+                std::vector<std::thread> threads;
+                bool running = false;
+
+                std::atomic<uint32_t> pending;
+                std::atomic<uint32_t> compiled;
+                std::atomic<uint32_t> failed;
+                std::atomic<uint32_t> fallbackDraws;
+                std::atomic<uint32_t> skippedDraws;
+                std::atomic<uint32_t> hitchesAvoided;
+                std::atomic<uint64_t> hitchMicrosecondsAvoided;
+                PipelineCompilerStats lastFrame;
+
+                void publish(Slot& slot, bool ok){
+                    if (ok){
+                        compiled.fetch_add(1);
+                    }else{
+                        failed.fetch_add(1);
+                    }
+                    slot.state.store(ok ? eReady : eFailed, std::memory_order_release);
+                    pending.fetch_sub(1);
+                    if (ok && slot.missed.load()){
+                        hitchMicrosecondsAvoided.fetch_add((uint64_t)(slot.compileTime * 1000.0f));
+                    }
+                }
+
+                void compile(Slot& slot){
+                    auto tStart = std::chrono::high_resolution_clock::now();
+                    bool ok = true;
+                    try{
+                        slot.pipeline = cache->getPipeline(slot.desc, &slot.layout);
+                    }catch (const std::runtime_error& e){
+                        std::cerr << "pipeline compiler: " << e.what() << std::endl;
+                        ok = false;
+                    }
+                    auto tEnd = std::chrono::high_resolution_clock::now();
+                    slot.compileTime = (float)std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+                    publish(slot, ok);
+                }
+
+                void threadMain(){
+                    while (true){
+                        PipelineHandle handle;
+                        {
+                            std::unique_lock<std::mutex> lock(queueMutex);
+                            queueCondition.wait(lock, [this](){ return !running || !queue.empty(); });
+                            if (!running){
+                                return;
+                            }
+                            handle = queue.front();
+                            queue.pop_front();
+                        }
+                        compile(slots[handle]);
+                    }
+                }
+
+                PipelineHandle allocate(const PipelineDesc& desc, PipelineHandle fallback, bool* created){
+                    std::string key = desc.key();
+                    std::lock_guard<std::mutex> lock(requestMutex);
+                    auto it = handles.find(key);
+                    if (it != handles.end()){
+                        *created = false;
+                        return it->second;
+                    }
+                    uint32_t handle = slotCount.load();
+                    if (handle == MAX_ASYNC_PIPELINES){
+                        throw std::runtime_error("too many pipelines requested, raise MAX_ASYNC_PIPELINES");
+                    }
+                    slots[handle].desc = desc;
+                    slots[handle].fallback = fallback;
+                    slotCount.store(handle + 1);
+                    handles[key] = handle;
+                    pending.fetch_add(1);
+                    *created = true;
+                    return handle;
+                }
+
+            public:
+                VulkanPipelineCompiler(){
+                    slotCount = 0;
+                    pending = 0;
+                    compiled = 0;
+                    failed = 0;
+                    fallbackDraws = 0;
+                    skippedDraws = 0;
+                    hitchesAvoided = 0;
+                    hitchMicrosecondsAvoided = 0;
+                }
+                ~VulkanPipelineCompiler(){
+                    shutdown();
+                }
+
+                /**
+                * Start the compile threads
+                *
+                * @param pipelineCache Cache the pipelines are built through, owns the pipelines
+                * @param threadCount (Optional) Compile threads, 0 leaves a core for the render thread (at most 2)
+                */
+                void init(VulkanPipelineCache* pipelineCache, uint32_t threadCount = 0){
+                    cache = pipelineCache;
+                    if (threadCount == 0){
+                        uint32_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+                        threadCount = std::max(1u, std::min(2u, cores - 1));
+                    }
+                    slots = new Slot[MAX_ASYNC_PIPELINES];
+                    running = true;
+                    for (uint32_t i = 0; i < threadCount; i++){
+                        threads.push_back(std::thread(&VulkanPipelineCompiler::threadMain, this));
+                    }
+                }
+
+                /**
+                * Join the compile threads, queued compiles are dropped and count as failed. Pipelines stay owned by
+                * the cache
+                */
+                void shutdown(){
+                    {
+                        std::lock_guard<std::mutex> lock(queueMutex);
+                        running = false;
+                        queue.clear();
+                    }
+                    queueCondition.notify_all();
+                    for (auto& thread : threads){
+                        thread.join();
+                    }
+                    threads.clear();
+
+                    std::lock_guard<std::mutex> lock(requestMutex);
+                    uint32_t count = slotCount.load();
+                    for (uint32_t i = 0; i < count; i++){
+                        if (slots[i].state.load(std::memory_order_acquire) == ePending){
+                            publish(slots[i], false);
+                        }
+                    }
+                    slotCount = 0;
+                    handles.clear();
+                    delete[] slots;
+                    slots = nullptr;
+                }
+
+                /**
+                * Queue a pipeline for compilation. Requesting the same description again returns the same handle
+                *
+                * @param desc State description of the pipeline
+                * @param fallback (Optional) Pipeline drawn with while this one compiles, should share its layout
+                */
+                PipelineHandle request(const PipelineDesc& desc, PipelineHandle fallback = INVALID_PIPELINE){
+                    bool created;
+                    PipelineHandle handle = allocate(desc, fallback, &created);
+                    if (created){
+                        {
+                            std::lock_guard<std::mutex> lock(queueMutex);
+                            queue.push_back(handle);
+                        }
+                        queueCondition.notify_one();
+                    }
+                    return handle;
+                }
+
+                /**
+                * Build a pipeline on the calling thread, meant for the fallbacks themselves at load time
+                */
+                PipelineHandle requestNow(const PipelineDesc& desc){
+                    bool created;
+                    PipelineHandle handle = allocate(desc, INVALID_PIPELINE, &created);
+                    if (created){
+                        compile(slots[handle]);
+                    }
+                    return handle;
+                }
+
+                /**
+                * Get the pipeline to draw with, never blocks
+                *
+                * @param handle Requested pipeline
+                * @param pipeline Pipeline to bind, the fallback if the requested one is still compiling
+                * @param layout (Optional) Layout of the returned pipeline
+                *
+                * @return false if the draw has to be skipped
+                */
+                bool acquire(PipelineHandle handle, vk::Pipeline* pipeline, vk::PipelineLayout* layout = nullptr){
+                    if (handle >= slotCount.load(std::memory_order_acquire)){
+                        return false;
+                    }
+                    Slot& slot = slots[handle];
+                    if (slot.state.load(std::memory_order_acquire) == eReady){
+                        *pipeline = slot.pipeline;
+                        if (layout){
+                            *layout = slot.layout;
+                        }
+                        return true;
+                    }
+                    if (slot.state.load(std::memory_order_relaxed) == ePending && !slot.missed.exchange(true)){
+                        // synchronous creation would have stalled this frame
+                        hitchesAvoided.fetch_add(1);
+                    }
+                    if (slot.fallback != INVALID_PIPELINE && slots[slot.fallback].state.load(std::memory_order_acquire) == eReady){
+                        *pipeline = slots[slot.fallback].pipeline;
+                        if (layout){
+                            *layout = slots[slot.fallback].layout;
+                        }
+                        fallbackDraws.fetch_add(1, std::memory_order_relaxed);
+                        return true;
+                    }
+                    skippedDraws.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+
+                bool isReady(PipelineHandle handle) const {
+                    return handle < slotCount.load(std::memory_order_acquire) && slots[handle].state.load(std::memory_order_acquire) == eReady;
+                }
+
+                /** @brief Close the statistics of the previous frame, call once per frame before recording */
+                void beginFrame(){
+                    lastFrame.pending = pending.load();
+                    lastFrame.fallbackDraws = fallbackDraws.exchange(0);
+                    lastFrame.skippedDraws = skippedDraws.exchange(0);
+                    lastFrame.hitchesAvoided = hitchesAvoided.load();
+                    lastFrame.hitchTimeAvoided = (float)hitchMicrosecondsAvoided.load() / 1000.0f;
+                    lastFrame.compiled = compiled.load();
+                    lastFrame.failed = failed.load();
+                }
+
+                uint32_t getPendingCount() const { return pending.load(); }
+                /** @brief Per frame counters of the last finished frame, hitches and compiles are totals */
+                const PipelineCompilerStats& getStats() const { return lastFrame; }
+
+                void printStats(std::ostream& out) const {
+                    out << "pipeline compiler: " << lastFrame.compiled << " compiled, " << lastFrame.failed << " failed, "
+                        << lastFrame.hitchesAvoided << " hitches avoided (" << lastFrame.hitchTimeAvoided << " ms)" << std::endl;
+                }
+        };
+    }
+}
+
+#endif
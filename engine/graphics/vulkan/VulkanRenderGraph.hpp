@@ -0,0 +1,1006 @@
+#ifndef TRB_GFX_VulkanRenderGraph_H_
+#define TRB_GFX_VulkanRenderGraph_H_
+
+#include "vulkan/vulkan.hpp"
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <algorithm>
+
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+#include "VulkanGpuProfiler.hpp"
+#include "VulkanCommandRecorder.hpp"
+
+#define RENDER_GRAPH_INVALID UINT32_MAX
+
+namespace trb{
+    namespace grfx{
+
+        /** @brief Handle of an image or buffer declared on the render graph */
+        typedef uint32_t RenderGraphResource;
+
+        class VulkanRenderGraph;
+
+        /** @brief How a pass accesses a resource, maps to a layout, access mask and pipeline stages */
+        enum class RenderGraphUsage{
+            eColorAttachment,
+            eDepthAttachment,
+            eDepthRead,
+            eSampled,
+            eStorageRead,
+            eStorageWrite,
+            eTransferSrc,
+            eTransferDst,
+            eUniformBuffer,
+            eVertexBuffer,
+            eIndexBuffer,
+            eIndirectBuffer
+        };
+
+        /** @brief Records the commands of a pass. Render passes are already begun for passes with attachments */
+        typedef std::function<void(vk::CommandBuffer commandBuffer, const VulkanRenderGraph& graph)> RenderGraphExecuteFunc;
+
+        /** @brief Number of draws a recorded pass has this frame */
+        typedef std::function<uint32_t(const VulkanRenderGraph& graph)> RenderGraphDrawCountFunc;
+
+        struct RenderGraphStats{
+            uint32_t passes = 0;
+            uint32_t culledPasses = 0;
+            /** @brief vkCmdPipelineBarrier calls per execute, at most one per pass plus the final transitions */
+            uint32_t barrierBatches = 0;
+            uint32_t imageBarriers = 0;
+            uint32_t bufferBarriers = 0;
+            uint32_t layoutTransitions = 0;
+            /** @brief Read after read accesses in the same layout that needed no barrier */
+            uint32_t skippedBarriers = 0;
+            uint32_t transientImages = 0;
+            /** @brief Memory the transient images would need without aliasing */
+            vk::DeviceSize transientBytes = 0;
+            /** @brief Memory actually allocated for the transient images */
+            vk::DeviceSize aliasedBytes = 0;
+        };
+
+        /**
+        * @brief Declarative frame graph
+        *
+        * Passes declare the resources they read and write. compile() culls passes that contribute nothing to an
+        * output, derives load/store ops from the actual usage, batches all barriers a pass needs into one
+        * pipelineBarrier and places transient images with disjoint lifetimes into the same memory. All frames in
+        * flight share the transients, the first barrier of each transient in a frame waits for the previous frame.
+        */
+        class VulkanRenderGraph{
+            public:
+                struct ResourceUse{
+                    RenderGraphResource resource = RENDER_GRAPH_INVALID;
+                    RenderGraphUsage usage = RenderGraphUsage::eSampled;
+                    vk::PipelineStageFlags stages;
+                    bool clear = false;
+                    vk::ClearValue clearValue;
+                };
+
+                /**
+                * @brief Handed to the setup function of a pass to declare its resource usage
+                */
+                class PassBuilder{
+                    private:
+                        VulkanRenderGraph& graph;
+                        uint32_t pass;
+
+                        PassBuilder& use(RenderGraphResource resource, RenderGraphUsage usage, vk::PipelineStageFlags stages, bool clear = false, vk::ClearValue clearValue = vk::ClearValue()){
+                            ResourceUse resourceUse;
+                            resourceUse.resource = resource;
+                            resourceUse.usage = usage;
+                            resourceUse.stages = stages;
+                            resourceUse.clear = clear;
+                            resourceUse.clearValue = clearValue;
+                            graph.passes[pass].uses.push_back(resourceUse);
+                            return *this;
+                        }
+
+                    public:
+                        PassBuilder(VulkanRenderGraph& graph, uint32_t pass) : graph(graph), pass(pass) {}
+
+                        PassBuilder& writeColor(RenderGraphResource image, bool clear = false, vk::ClearColorValue color = vk::ClearColorValue()){
+                            return use(image, RenderGraphUsage::eColorAttachment, vk::PipelineStageFlagBits::eColorAttachmentOutput, clear, vk::ClearValue(color));
+                        }
+                        PassBuilder& writeDepth(RenderGraphResource image, bool clear = false, float depth = 1.0f){
+                            return use(image, RenderGraphUsage::eDepthAttachment, vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+                                clear, vk::ClearValue(vk::ClearDepthStencilValue(depth, 0)));
+                        }
+                        PassBuilder& readDepth(RenderGraphResource image){
+                            return use(image, RenderGraphUsage::eDepthRead, vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests);
+                        }
+                        PassBuilder& readTexture(RenderGraphResource image, vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eFragmentShader){
+                            return use(image, RenderGraphUsage::eSampled, stages);
+                        }
+                        PassBuilder& readStorage(RenderGraphResource resource, vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eComputeShader){
+                            return use(resource, RenderGraphUsage::eStorageRead, stages);
+                        }
+                        PassBuilder& writeStorage(RenderGraphResource resource, vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eComputeShader){
+                            return use(resource, RenderGraphUsage::eStorageWrite, stages);
+                        }
+                        PassBuilder& readBuffer(RenderGraphResource buffer, RenderGraphUsage usage, vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eVertexShader){
+                            return use(buffer, usage, stages);
+                        }
+                        PassBuilder& copyFrom(RenderGraphResource resource){
+                            return use(resource, RenderGraphUsage::eTransferSrc, vk::PipelineStageFlagBits::eTransfer);
+                        }
+                        PassBuilder& copyTo(RenderGraphResource resource){
+                            return use(resource, RenderGraphUsage::eTransferDst, vk::PipelineStageFlagBits::eTransfer);
+                        }
+                        /** @brief Never cull this pass, e.g. it writes to something outside the graph */
+                        PassBuilder& sideEffect(){
+                            graph.passes[pass].sideEffect = true;
+                            return *this;
+                        }
+                };
+                typedef std::function<void(PassBuilder& builder)> RenderGraphSetupFunc;
+
+            private:
+                struct Resource{
+                    std::string name;
+                    bool isImage = true;
+                    bool imported = false;
+                    bool output = false;
+                    // image description
+                    vk::Format format = vk::Format::eUndefined;
+                    vk::Extent2D extent;
+                    vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+                    vk::ImageUsageFlags imageUsage;
+                    vk::ImageLayout initialLayout = vk::ImageLayout::eUndefined;
+                    vk::ImageLayout finalLayout = vk::ImageLayout::eUndefined;
+                    vk::Image image;
+                    vk::ImageView view;
+                    // buffer description
+                    vk::DeviceSize size = 0;
+                    vk::BufferUsageFlags bufferUsage;
+                    vk::Buffer buffer;
+                    Buffer transientBuffer;
+                    // compiled
+                    uint32_t firstPass = RENDER_GRAPH_INVALID;
+                    uint32_t lastPass = RENDER_GRAPH_INVALID;
+                    vk::DeviceSize memoryOffset = 0;
+                    vk::MemoryRequirements memReqs;
+                    /** @brief Transient whose memory this one reuses last, its final access has to finish first */
+                    RenderGraphResource aliasPredecessor = RENDER_GRAPH_INVALID;
+                };
+
+                struct Pass{
+                    std::string name;
+                    /** @brief name interned by the profiler, so timing a pass does no string lookup */
+                    const char* profileName = nullptr;
+                    std::vector<ResourceUse> uses;
+                    bool sideEffect = false;
+                    RenderGraphExecuteFunc execute;
+                    /** @brief Set for passes whose draws are recorded into secondary command buffers on the workers */
+                    RenderGraphDrawCountFunc drawCount;
+                    RecordChunkFunc recordChunk;
+                    // compiled
+                    bool culled = false;
+                    vk::RenderPass renderPass;
+                    vk::Extent2D extent;
+                    std::vector<RenderGraphResource> attachments;
+                    std::vector<vk::ClearValue> clearValues;
+                    vk::PipelineStageFlags srcStages;
+                    vk::PipelineStageFlags dstStages;
+                    std::vector<vk::ImageMemoryBarrier> imageBarriers;
+                    std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+                    // resource of each barrier, handles of imported resources may change every frame
+                    std::vector<RenderGraphResource> imageBarrierResources;
+                    std::vector<RenderGraphResource> bufferBarrierResources;
+                };
+
+                struct ResourceState{
+                    vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+                    vk::AccessFlags access;
+                    vk::PipelineStageFlags stages;
+                    bool written = false;
+                    bool touched = false;
+                };
+
+                VulkanDevice* vulkanDevice = nullptr;
+                /** @brief Times every pass on the GPU when set */
+                VulkanGpuProfiler* profiler = nullptr;
+                /** @brief Records the draws of recorded passes in parallel */
+                VulkanCommandRecorder* recorder = nullptr;
+                std::vector<Resource> resources;
+                std::vector<Pass> passes;
+                bool compiled = false;
+
+                MemoryAllocation transientMemory;
+                std::map<std::vector<uint64_t>, vk::Framebuffer> framebuffers;
+                // transitions of the outputs into their final layout after the last pass
+                vk::PipelineStageFlags finalSrcStages;
+                std::vector<vk::ImageMemoryBarrier> finalBarriers;
+                std::vector<RenderGraphResource> finalResources;
+
+                RenderGraphStats stats;
+
+                static bool isWrite(RenderGraphUsage usage){
+                    return usage == RenderGraphUsage::eColorAttachment || usage == RenderGraphUsage::eDepthAttachment ||
+                           usage == RenderGraphUsage::eStorageWrite || usage == RenderGraphUsage::eTransferDst;
+                }
+
+                static bool isAttachment(RenderGraphUsage usage){
+                    return usage == RenderGraphUsage::eColorAttachment || usage == RenderGraphUsage::eDepthAttachment || usage == RenderGraphUsage::eDepthRead;
+                }
+
+                static vk::ImageLayout layoutFor(RenderGraphUsage usage){
+                    switch (usage){
+                        case RenderGraphUsage::eColorAttachment: return vk::ImageLayout::eColorAttachmentOptimal;
+                        case RenderGraphUsage::eDepthAttachment: return vk::ImageLayout::eDepthStencilAttachmentOptimal;
+                        case RenderGraphUsage::eDepthRead: return vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+                        case RenderGraphUsage::eSampled: return vk::ImageLayout::eShaderReadOnlyOptimal;
+                        case RenderGraphUsage::eTransferSrc: return vk::ImageLayout::eTransferSrcOptimal;
+                        case RenderGraphUsage::eTransferDst: return vk::ImageLayout::eTransferDstOptimal;
+                        default: return vk::ImageLayout::eGeneral;
+                    }
+                }
+
+                static vk::AccessFlags accessFor(RenderGraphUsage usage){
+                    switch (usage){
+                        case RenderGraphUsage::eColorAttachment: return vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+                        case RenderGraphUsage::eDepthAttachment: return vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+                        case RenderGraphUsage::eDepthRead: return vk::AccessFlagBits::eDepthStencilAttachmentRead;
+                        case RenderGraphUsage::eSampled: return vk::AccessFlagBits::eShaderRead;
+                        case RenderGraphUsage::eStorageRead: return vk::AccessFlagBits::eShaderRead;
+                        case RenderGraphUsage::eStorageWrite: return vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+                        case RenderGraphUsage::eTransferSrc: return vk::AccessFlagBits::eTransferRead;
+                        case RenderGraphUsage::eTransferDst: return vk::AccessFlagBits::eTransferWrite;
+                        case RenderGraphUsage::eUniformBuffer: return vk::AccessFlagBits::eUniformRead;
+                        case RenderGraphUsage::eVertexBuffer: return vk::AccessFlagBits::eVertexAttributeRead;
+                        case RenderGraphUsage::eIndexBuffer: return vk::AccessFlagBits::eIndexRead;
+                        case RenderGraphUsage::eIndirectBuffer: return vk::AccessFlagBits::eIndirectCommandRead;
+                        default: return vk::AccessFlags();
+                    }
+                }
+
+                static vk::ImageUsageFlags imageUsageFor(RenderGraphUsage usage){
+                    switch (usage){
+                        case RenderGraphUsage::eColorAttachment: return vk::ImageUsageFlagBits::eColorAttachment;
+                        case RenderGraphUsage::eDepthAttachment:
+                        case RenderGraphUsage::eDepthRead: return vk::ImageUsageFlagBits::eDepthStencilAttachment;
+                        case RenderGraphUsage::eSampled: return vk::ImageUsageFlagBits::eSampled;
+                        case RenderGraphUsage::eTransferSrc: return vk::ImageUsageFlagBits::eTransferSrc;
+                        case RenderGraphUsage::eTransferDst: return vk::ImageUsageFlagBits::eTransferDst;
+                        default: return vk::ImageUsageFlagBits::eStorage;
+                    }
+                }
+
+                static vk::BufferUsageFlags bufferUsageFor(RenderGraphUsage usage){
+                    switch (usage){
+                        case RenderGraphUsage::eUniformBuffer: return vk::BufferUsageFlagBits::eUniformBuffer;
+                        case RenderGraphUsage::eVertexBuffer: return vk::BufferUsageFlagBits::eVertexBuffer;
+                        case RenderGraphUsage::eIndexBuffer: return vk::BufferUsageFlagBits::eIndexBuffer;
+                        case RenderGraphUsage::eIndirectBuffer: return vk::BufferUsageFlagBits::eIndirectBuffer;
+                        case RenderGraphUsage::eTransferSrc: return vk::BufferUsageFlagBits::eTransferSrc;
+                        case RenderGraphUsage::eTransferDst: return vk::BufferUsageFlagBits::eTransferDst;
+                        default: return vk::BufferUsageFlagBits::eStorageBuffer;
+                    }
+                }
+
+                static bool isDepthFormat(vk::Format format){
+                    return format == vk::Format::eD16Unorm || format == vk::Format::eD32Sfloat || format == vk::Format::eD16UnormS8Uint ||
+                           format == vk::Format::eD24UnormS8Uint || format == vk::Format::eD32SfloatS8Uint || format == vk::Format::eX8D24UnormPack32;
+                }
+
+                static vk::ImageAspectFlags aspectFor(vk::Format format){
+                    if (!isDepthFormat(format)){
+                        return vk::ImageAspectFlagBits::eColor;
+                    }
+                    if (format == vk::Format::eD16Unorm || format == vk::Format::eD32Sfloat || format == vk::Format::eX8D24UnormPack32){
+                        return vk::ImageAspectFlagBits::eDepth;
+                    }
+                    return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+                }
+
+                RenderGraphResource addResource(const Resource& resource){
+                    resources.push_back(resource);
+                    compiled = false;
+                    return (RenderGraphResource)(resources.size() - 1);
+                }
+
+                /** @brief Walk the passes backwards and keep only those that feed an output or have side effects */
+                void cull(){
+                    std::vector<bool> needed(resources.size(), false);
+                    for (size_t r = 0; r < resources.size(); r++){
+                        needed[r] = resources[r].output;
+                    }
+                    for (size_t p = passes.size(); p-- > 0;){
+                        Pass& pass = passes[p];
+                        bool alive = pass.sideEffect;
+                        for (auto& use : pass.uses){
+                            if (isWrite(use.usage) && needed[use.resource]){
+                                alive = true;
+                            }
+                        }
+                        pass.culled = !alive;
+                        if (!alive){
+                            continue;
+                        }
+                        for (auto& use : pass.uses){
+                            // attachments that are not cleared may load earlier contents, so they count as reads
+                            if (!isWrite(use.usage) || (isAttachment(use.usage) && !use.clear) || use.usage == RenderGraphUsage::eStorageWrite){
+                                needed[use.resource] = true;
+                            }
+                        }
+                    }
+                }
+
+                void computeLifetimes(){
+                    for (auto& resource : resources){
+                        resource.firstPass = RENDER_GRAPH_INVALID;
+                        resource.lastPass = RENDER_GRAPH_INVALID;
+                        resource.imageUsage = vk::ImageUsageFlags();
+                        resource.bufferUsage = vk::BufferUsageFlags();
+                    }
+                    for (uint32_t p = 0; p < passes.size(); p++){
+                        if (passes[p].culled){
+                            continue;
+                        }
+                        for (auto& use : passes[p].uses){
+                            Resource& resource = resources[use.resource];
+                            if (resource.firstPass == RENDER_GRAPH_INVALID){
+                                resource.firstPass = p;
+                            }
+                            resource.lastPass = p;
+                            if (resource.isImage){
+                                resource.imageUsage |= imageUsageFor(use.usage);
+                            }else{
+                                resource.bufferUsage |= bufferUsageFor(use.usage);
+                            }
+                        }
+                    }
+                }
+
+                /** @brief Create the transient images and place them in one memory range, reusing memory across disjoint lifetimes */
+                void allocateTransients(){
+                    vk::Device device = vulkanDevice->device;
+                    std::vector<RenderGraphResource> transients;
+                    for (uint32_t r = 0; r < resources.size(); r++){
+                        Resource& resource = resources[r];
+                        if (resource.imported || resource.firstPass == RENDER_GRAPH_INVALID){
+                            continue;
+                        }
+                        if (!resource.isImage){
+                            vulkanDevice->createBuffer(resource.bufferUsage, vk::MemoryPropertyFlagBits::eDeviceLocal, &resource.transientBuffer, resource.size);
+                            resource.buffer = resource.transientBuffer.buffer;
+                            continue;
+                        }
+                        vk::ImageCreateInfo imageInfo;
+                        imageInfo.imageType = vk::ImageType::e2D;
+                        imageInfo.format = resource.format;
+                        imageInfo.extent = vk::Extent3D(resource.extent.width, resource.extent.height, 1);
+                        imageInfo.mipLevels = 1;
+                        imageInfo.arrayLayers = 1;
+                        imageInfo.samples = resource.samples;
+                        imageInfo.tiling = vk::ImageTiling::eOptimal;
+                        imageInfo.usage = resource.imageUsage;
+                        imageInfo.sharingMode = vk::SharingMode::eExclusive;
+                        imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+                        if (device.createImage(&imageInfo, nullptr, &resource.image) != vk::Result::eSuccess){
+                            throw std::runtime_error("failed to create render graph image " + resource.name);
+                        }
+                        device.getImageMemoryRequirements(resource.image, &resource.memReqs);
+                        transients.push_back(r);
+                    }
+                    stats.transientImages = (uint32_t)transients.size();
+                    if (transients.empty()){
+                        return;
+                    }
+
+                    // biggest first, each one goes into the lowest gap not used by a resource alive at the same time
+                    std::sort(transients.begin(), transients.end(), [this](RenderGraphResource a, RenderGraphResource b){
+                        return resources[a].memReqs.size > resources[b].memReqs.size;
+                    });
+                    vk::MemoryRequirements heapReqs;
+                    heapReqs.memoryTypeBits = ~0u;
+                    heapReqs.alignment = 1;
+                    std::vector<RenderGraphResource> placed;
+                    for (auto r : transients){
+                        Resource& resource = resources[r];
+                        std::vector<RenderGraphResource> overlapping;
+                        for (auto other : placed){
+                            const Resource& o = resources[other];
+                            if (o.firstPass <= resource.lastPass && resource.firstPass <= o.lastPass){
+                                overlapping.push_back(other);
+                            }
+                        }
+                        std::sort(overlapping.begin(), overlapping.end(), [this](RenderGraphResource a, RenderGraphResource b){
+                            return resources[a].memoryOffset < resources[b].memoryOffset;
+                        });
+                        vk::DeviceSize offset = 0;
+                        for (auto other : overlapping){
+                            const Resource& o = resources[other];
+                            if (alignUp(offset, resource.memReqs.alignment) + resource.memReqs.size <= o.memoryOffset){
+                                break;
+                            }
+                            offset = std::max(offset, o.memoryOffset + o.memReqs.size);
+                        }
+                        resource.memoryOffset = alignUp(offset, resource.memReqs.alignment);
+
+                        // the latest earlier occupant of this memory has to be done before the first use
+                        for (auto other : placed){
+                            const Resource& o = resources[other];
+                            bool memoryOverlap = o.memoryOffset < resource.memoryOffset + resource.memReqs.size && resource.memoryOffset < o.memoryOffset + o.memReqs.size;
+                            if (memoryOverlap && o.lastPass < resource.firstPass &&
+                                (resource.aliasPredecessor == RENDER_GRAPH_INVALID || resources[resource.aliasPredecessor].lastPass < o.lastPass)){
+                                resource.aliasPredecessor = other;
+                            }
+                        }
+                        placed.push_back(r);
+
+                        heapReqs.size = std::max(heapReqs.size, resource.memoryOffset + resource.memReqs.size);
+                        heapReqs.alignment = std::max(heapReqs.alignment, resource.memReqs.alignment);
+                        heapReqs.memoryTypeBits &= resource.memReqs.memoryTypeBits;
+                        stats.transientBytes += resource.memReqs.size;
+                    }
+                    if (heapReqs.memoryTypeBits == 0){
+                        throw std::runtime_error("render graph transients have no common memory type");
+                    }
+                    stats.aliasedBytes = heapReqs.size;
+
+                    uint32_t memoryTypeIndex = vulkanDevice->getMemoryType(heapReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+                    transientMemory = vulkanDevice->allocator.allocate(heapReqs, memoryTypeIndex, MemoryUsage::eImage);
+                    for (auto r : transients){
+                        Resource& resource = resources[r];
+                        device.bindImageMemory(resource.image, transientMemory.memory, transientMemory.offset + resource.memoryOffset);
+
+                        vk::ImageViewCreateInfo viewInfo;
+                        viewInfo.image = resource.image;
+                        viewInfo.viewType = vk::ImageViewType::e2D;
+                        viewInfo.format = resource.format;
+                        viewInfo.subresourceRange = vk::ImageSubresourceRange(aspectFor(resource.format), 0, 1, 0, 1);
+                        if (device.createImageView(&viewInfo, nullptr, &resource.view) != vk::Result::eSuccess){
+                            throw std::runtime_error("failed to create render graph image view " + resource.name);
+                        }
+                    }
+                }
+
+                /**
+                * Stages and accesses of the previous frame to the memory of each transient. Frames in flight share the
+                * transients, so the previous frame may still run on the queue when the next one first uses them
+                */
+                std::vector<ResourceState> previousFrameStates() const {
+                    std::vector<ResourceState> uses(resources.size());
+                    for (auto& pass : passes){
+                        if (pass.culled){
+                            continue;
+                        }
+                        for (auto& use : pass.uses){
+                            uses[use.resource].stages |= use.stages;
+                            uses[use.resource].access |= accessFor(use.usage);
+                        }
+                    }
+                    std::vector<ResourceState> previous(resources.size());
+                    for (uint32_t r = 0; r < resources.size(); r++){
+                        const Resource& resource = resources[r];
+                        if (resource.imported || resource.firstPass == RENDER_GRAPH_INVALID){
+                            continue;
+                        }
+                        // every transient placed in overlapping memory, transient buffers have memory of their own
+                        for (uint32_t o = 0; o < resources.size(); o++){
+                            const Resource& other = resources[o];
+                            if (other.imported || other.firstPass == RENDER_GRAPH_INVALID){
+                                continue;
+                            }
+                            bool memoryOverlap = o == r || (resource.isImage && other.isImage &&
+                                other.memoryOffset < resource.memoryOffset + resource.memReqs.size && resource.memoryOffset < other.memoryOffset + other.memReqs.size);
+                            if (memoryOverlap){
+                                previous[r].stages |= uses[o].stages;
+                                previous[r].access |= uses[o].access;
+                            }
+                        }
+                    }
+                    return previous;
+                }
+
+                /** @brief Walk the surviving passes in order, tracking every resource's state to derive barriers and load/store ops */
+                void buildBarriers(){
+                    std::vector<ResourceState> previous = previousFrameStates();
+                    std::vector<ResourceState> states(resources.size());
+                    for (uint32_t r = 0; r < resources.size(); r++){
+                        const Resource& resource = resources[r];
+                        if (resource.imported){
+                            states[r].layout = resource.initialLayout;
+                            // written by earlier submissions on the queue, or handed over by a semaphore wait (swap chain images)
+                            states[r].written = !resource.isImage || resource.initialLayout != vk::ImageLayout::eUndefined;
+                            states[r].access = states[r].written ? vk::AccessFlags(vk::AccessFlagBits::eMemoryWrite) : vk::AccessFlags();
+                            states[r].stages = vk::PipelineStageFlagBits::eAllCommands;
+                        }
+                    }
+
+                    for (uint32_t p = 0; p < passes.size(); p++){
+                        Pass& pass = passes[p];
+                        if (pass.culled){
+                            continue;
+                        }
+                        for (auto& use : pass.uses){
+                            Resource& resource = resources[use.resource];
+                            ResourceState& state = states[use.resource];
+                            if (!state.touched && !resource.imported){
+                                // the previous frame's accesses to the same memory, contents do not carry over
+                                state.access = previous[use.resource].access;
+                                state.stages = previous[use.resource].stages;
+                                if (resource.aliasPredecessor != RENDER_GRAPH_INVALID){
+                                    // memory previously owned by another transient of this frame
+                                    state.access |= states[resource.aliasPredecessor].access;
+                                    state.stages |= states[resource.aliasPredecessor].stages;
+                                }
+                            }
+                            state.touched = true;
+
+                            vk::ImageLayout layout = resource.isImage ? layoutFor(use.usage) : vk::ImageLayout::eUndefined;
+                            vk::AccessFlags access = accessFor(use.usage);
+                            bool write = isWrite(use.usage);
+                            bool prevWrite = (bool)(state.access & (vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite |
+                                vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eMemoryWrite | vk::AccessFlagBits::eHostWrite));
+                            bool layoutChange = resource.isImage && layout != state.layout;
+
+                            if (!layoutChange && !write && !prevWrite){
+                                // read after read in the same layout, the earlier barrier already covers it
+                                stats.skippedBarriers++;
+                                state.stages |= use.stages;
+                                state.access |= access;
+                                continue;
+                            }
+                            bool discard = isAttachment(use.usage) && (use.clear || !state.written);
+                            if (state.stages){
+                                pass.srcStages |= state.stages;
+                            }else{
+                                pass.srcStages |= vk::PipelineStageFlagBits::eTopOfPipe;
+                            }
+                            pass.dstStages |= use.stages;
+                            if (resource.isImage){
+                                vk::ImageMemoryBarrier barrier;
+                                barrier.srcAccessMask = prevWrite ? state.access : vk::AccessFlags();
+                                barrier.dstAccessMask = access;
+                                // contents that are going to be cleared or were never written can be discarded
+                                barrier.oldLayout = discard ? vk::ImageLayout::eUndefined : state.layout;
+                                barrier.newLayout = layout;
+                                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                                barrier.subresourceRange = vk::ImageSubresourceRange(aspectFor(resource.format), 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS);
+                                pass.imageBarriers.push_back(barrier);
+                                pass.imageBarrierResources.push_back(use.resource);
+                                if (layoutChange){
+                                    stats.layoutTransitions++;
+                                }
+                            }else{
+                                vk::BufferMemoryBarrier barrier;
+                                barrier.srcAccessMask = prevWrite ? state.access : vk::AccessFlags();
+                                barrier.dstAccessMask = access;
+                                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                                barrier.offset = 0;
+                                barrier.size = VK_WHOLE_SIZE;
+                                pass.bufferBarriers.push_back(barrier);
+                                pass.bufferBarrierResources.push_back(use.resource);
+                            }
+                            state.layout = layout;
+                            state.access = access;
+                            state.stages = use.stages;
+                            state.written = state.written || write;
+                        }
+                        stats.imageBarriers += (uint32_t)pass.imageBarriers.size();
+                        stats.bufferBarriers += (uint32_t)pass.bufferBarriers.size();
+                        if (!pass.imageBarriers.empty() || !pass.bufferBarriers.empty()){
+                            stats.barrierBatches++;
+                        }
+                    }
+
+                    // hand the outputs over in the layout their consumer outside the graph expects
+                    for (uint32_t r = 0; r < resources.size(); r++){
+                        const Resource& resource = resources[r];
+                        if (!resource.isImage || !resource.imported || !states[r].touched ||
+                            resource.finalLayout == vk::ImageLayout::eUndefined || resource.finalLayout == states[r].layout){
+                            continue;
+                        }
+                        vk::ImageMemoryBarrier barrier;
+                        barrier.srcAccessMask = states[r].access;
+                        barrier.dstAccessMask = vk::AccessFlags();
+                        barrier.oldLayout = states[r].layout;
+                        barrier.newLayout = resource.finalLayout;
+                        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                        barrier.subresourceRange = vk::ImageSubresourceRange(aspectFor(resource.format), 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS);
+                        finalBarriers.push_back(barrier);
+                        finalResources.push_back(r);
+                        finalSrcStages |= states[r].stages;
+                        stats.layoutTransitions++;
+                    }
+                    if (!finalBarriers.empty()){
+                        stats.barrierBatches++;
+                        stats.imageBarriers += (uint32_t)finalBarriers.size();
+                    }
+                }
+
+                /** @brief One render pass per pass with attachments, load/store ops from the usage of the neighbouring passes */
+                void buildRenderPasses(){
+                    vk::Device device = vulkanDevice->device;
+                    std::vector<bool> hasContents(resources.size(), false);
+                    for (uint32_t r = 0; r < resources.size(); r++){
+                        hasContents[r] = resources[r].imported && (!resources[r].isImage || resources[r].initialLayout != vk::ImageLayout::eUndefined);
+                    }
+                    for (uint32_t p = 0; p < passes.size(); p++){
+                        Pass& pass = passes[p];
+                        if (pass.culled){
+                            continue;
+                        }
+                        std::vector<vk::AttachmentDescription> descriptions;
+                        std::vector<vk::AttachmentReference> colorRefs;
+                        vk::AttachmentReference depthRef;
+                        bool hasDepth = false;
+                        for (auto& use : pass.uses){
+                            if (!isAttachment(use.usage)){
+                                continue;
+                            }
+                            Resource& resource = resources[use.resource];
+                            // is the content still needed after this pass
+                            bool usedLater = resource.output;
+                            for (uint32_t q = p + 1; q < passes.size() && !usedLater; q++){
+                                if (passes[q].culled){
+                                    continue;
+                                }
+                                for (auto& later : passes[q].uses){
+                                    if (later.resource == use.resource && !(isAttachment(later.usage) && later.clear)){
+                                        usedLater = true;
+                                    }
+                                }
+                            }
+                            vk::AttachmentDescription description;
+                            description.format = resource.format;
+                            description.samples = resource.samples;
+                            if (use.clear){
+                                description.loadOp = vk::AttachmentLoadOp::eClear;
+                            }else if (hasContents[use.resource]){
+                                description.loadOp = vk::AttachmentLoadOp::eLoad;
+                            }else{
+                                description.loadOp = vk::AttachmentLoadOp::eDontCare;
+                            }
+                            description.storeOp = (usedLater && use.usage != RenderGraphUsage::eDepthRead) ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+                            description.stencilLoadOp = description.loadOp;
+                            description.stencilStoreOp = description.storeOp;
+                            // layout transitions happen in the batched barrier in front of the pass
+                            description.initialLayout = layoutFor(use.usage);
+                            description.finalLayout = layoutFor(use.usage);
+
+                            vk::AttachmentReference reference((uint32_t)descriptions.size(), layoutFor(use.usage));
+                            if (use.usage == RenderGraphUsage::eColorAttachment){
+                                colorRefs.push_back(reference);
+                            }else{
+                                depthRef = reference;
+                                hasDepth = true;
+                            }
+                            descriptions.push_back(description);
+                            pass.attachments.push_back(use.resource);
+                            pass.clearValues.push_back(use.clearValue);
+                            pass.extent = resource.extent;
+                            hasContents[use.resource] = hasContents[use.resource] || isWrite(use.usage);
+                        }
+                        for (auto& use : pass.uses){
+                            if (isWrite(use.usage)){
+                                hasContents[use.resource] = true;
+                            }
+                        }
+                        if (descriptions.empty()){
+                            continue;
+                        }
+
+                        vk::SubpassDescription subpass;
+                        subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+                        subpass.colorAttachmentCount = (uint32_t)colorRefs.size();
+                        subpass.pColorAttachments = colorRefs.data();
+                        subpass.pDepthStencilAttachment = hasDepth ? &depthRef : nullptr;
+
+                        vk::RenderPassCreateInfo renderPassInfo;
+                        renderPassInfo.attachmentCount = (uint32_t)descriptions.size();
+                        renderPassInfo.pAttachments = descriptions.data();
+                        renderPassInfo.subpassCount = 1;
+                        renderPassInfo.pSubpasses = &subpass;
+                        if (device.createRenderPass(&renderPassInfo, nullptr, &pass.renderPass) != vk::Result::eSuccess){
+                            throw std::runtime_error("failed to create render pass for " + pass.name);
+                        }
+                    }
+                }
+
+                vk::Framebuffer getFramebuffer(const Pass& pass){
+                    std::vector<uint64_t> key;
+                    key.push_back((uint64_t)(VkRenderPass)pass.renderPass);
+                    std::vector<vk::ImageView> views;
+                    for (auto r : pass.attachments){
+                        views.push_back(resources[r].view);
+                        key.push_back((uint64_t)(VkImageView)resources[r].view);
+                    }
+                    auto it = framebuffers.find(key);
+                    if (it != framebuffers.end()){
+                        return it->second;
+                    }
+                    vk::FramebufferCreateInfo framebufferInfo;
+                    framebufferInfo.renderPass = pass.renderPass;
+                    framebufferInfo.attachmentCount = (uint32_t)views.size();
+                    framebufferInfo.pAttachments = views.data();
+                    framebufferInfo.width = pass.extent.width;
+                    framebufferInfo.height = pass.extent.height;
+                    framebufferInfo.layers = 1;
+                    vk::Framebuffer framebuffer;
+                    if (vulkanDevice->device.createFramebuffer(&framebufferInfo, nullptr, &framebuffer) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to create framebuffer for " + pass.name);
+                    }
+                    framebuffers[key] = framebuffer;
+                    return framebuffer;
+                }
+
+                void releaseCompiled(){
+                    if (!vulkanDevice){
+                        return;
+                    }
+                    vk::Device device = vulkanDevice->device;
+                    for (auto& framebuffer : framebuffers){
+                        device.destroyFramebuffer(framebuffer.second, nullptr);
+                    }
+                    framebuffers.clear();
+                    for (auto& pass : passes){
+                        if (pass.renderPass){
+                            device.destroyRenderPass(pass.renderPass, nullptr);
+                        }
+                        pass.renderPass = vk::RenderPass();
+                        pass.attachments.clear();
+                        pass.clearValues.clear();
+                        pass.imageBarriers.clear();
+                        pass.bufferBarriers.clear();
+                        pass.imageBarrierResources.clear();
+                        pass.bufferBarrierResources.clear();
+                        pass.srcStages = vk::PipelineStageFlags();
+                        pass.dstStages = vk::PipelineStageFlags();
+                    }
+                    for (auto& resource : resources){
+                        if (resource.imported){
+                            continue;
+                        }
+                        if (resource.view){
+                            device.destroyImageView(resource.view, nullptr);
+                        }
+                        if (resource.image){
+                            device.destroyImage(resource.image, nullptr);
+                        }
+                        if (resource.transientBuffer.buffer){
+                            resource.transientBuffer.destroy();
+                        }
+                        resource.view = vk::ImageView();
+                        resource.image = vk::Image();
+                        resource.buffer = vk::Buffer();
+                        resource.aliasPredecessor = RENDER_GRAPH_INVALID;
+                    }
+                    if (transientMemory){
+                        vulkanDevice->allocator.free(transientMemory);
+                    }
+                    finalBarriers.clear();
+                    finalResources.clear();
+                    finalSrcStages = vk::PipelineStageFlags();
+                    compiled = false;
+                }
+
+            public:
+                VulkanRenderGraph(){}
+                ~VulkanRenderGraph(){
+                    reset();
+                }
+
+                void init(VulkanDevice* vulkanDevice, VulkanGpuProfiler* profiler = nullptr, VulkanCommandRecorder* recorder = nullptr){
+                    this->vulkanDevice = vulkanDevice;
+                    this->profiler = profiler;
+                    this->recorder = recorder;
+                }
+
+                /**
+                * Declare an image owned outside the graph (e.g. a swap chain image)
+                *
+                * @param initialLayout Layout the image is in when the graph starts, eUndefined discards the contents
+                * @param finalLayout Layout the image is transitioned to after its last use, eUndefined leaves it as is
+                * @param output Passes writing to an output are never culled
+                */
+                RenderGraphResource importImage(const std::string& name, vk::Format format, vk::Extent2D extent,
+                                                vk::ImageLayout initialLayout, vk::ImageLayout finalLayout, bool output = true){
+                    Resource resource;
+                    resource.name = name;
+                    resource.imported = true;
+                    resource.output = output;
+                    resource.format = format;
+                    resource.extent = extent;
+                    resource.initialLayout = initialLayout;
+                    resource.finalLayout = finalLayout;
+                    return addResource(resource);
+                }
+
+                /** @brief Point an imported image at its handles for this frame (swap chain image index changes every frame) */
+                void setImportedImage(RenderGraphResource resource, vk::Image image, vk::ImageView view){
+                    resources[resource].image = image;
+                    resources[resource].view = view;
+                }
+
+                RenderGraphResource importBuffer(const std::string& name, vk::Buffer buffer, vk::DeviceSize size, bool output = false){
+                    Resource resource;
+                    resource.name = name;
+                    resource.isImage = false;
+                    resource.imported = true;
+                    resource.output = output;
+                    resource.buffer = buffer;
+                    resource.size = size;
+                    return addResource(resource);
+                }
+
+                /** @brief Declare an intermediate image, created by compile() and aliased with other transients */
+                RenderGraphResource createImage(const std::string& name, vk::Format format, vk::Extent2D extent,
+                                                vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1){
+                    Resource resource;
+                    resource.name = name;
+                    resource.format = format;
+                    resource.extent = extent;
+                    resource.samples = samples;
+                    return addResource(resource);
+                }
+
+                RenderGraphResource createBuffer(const std::string& name, vk::DeviceSize size){
+                    Resource resource;
+                    resource.name = name;
+                    resource.isImage = false;
+                    resource.size = size;
+                    return addResource(resource);
+                }
+
+                /** @brief Keep the passes producing this resource even though nothing in the graph reads it */
+                void markOutput(RenderGraphResource resource){
+                    resources[resource].output = true;
+                    compiled = false;
+                }
+
+                void addPass(const std::string& name, RenderGraphSetupFunc setup, RenderGraphExecuteFunc execute){
+                    Pass pass;
+                    pass.name = name;
+                    pass.profileName = profiler ? profiler->intern(name) : nullptr;
+                    pass.execute = execute;
+                    passes.push_back(pass);
+                    PassBuilder builder(*this, (uint32_t)passes.size() - 1);
+                    setup(builder);
+                    compiled = false;
+                }
+
+                /**
+                * Add a pass whose draws the command recorder records on the job system workers. The render pass is
+                * begun with eSecondaryCommandBuffers and the chunks are executed in draw order
+                *
+                * @param drawCount Draws of the pass this frame, asked for every execute()
+                * @param recordChunk Records a chunk of the draws, called concurrently from several workers
+                */
+                void addRecordedPass(const std::string& name, RenderGraphSetupFunc setup, RenderGraphDrawCountFunc drawCount, RecordChunkFunc recordChunk){
+                    if (!recorder){
+                        throw std::runtime_error("render graph has no command recorder for " + name);
+                    }
+                    addPass(name, setup, nullptr);
+                    passes.back().drawCount = drawCount;
+                    passes.back().recordChunk = recordChunk;
+                }
+
+                /**
+                * Cull, create transient resources, barriers and render passes. Has to be called again after the graph changed
+                */
+                void compile(){
+                    releaseCompiled();
+                    stats = RenderGraphStats();
+                    cull();
+                    computeLifetimes();
+                    allocateTransients();
+                    buildBarriers();
+                    buildRenderPasses();
+                    stats.passes = (uint32_t)passes.size();
+                    for (auto& pass : passes){
+                        stats.culledPasses += pass.culled ? 1 : 0;
+                        if (!pass.culled && pass.recordChunk && !pass.renderPass){
+                            throw std::runtime_error("recorded pass " + pass.name + " has no attachments");
+                        }
+                    }
+                    compiled = true;
+                }
+
+                /**
+                * Record all surviving passes with their batched barriers into a command buffer
+                */
+                void execute(vk::CommandBuffer commandBuffer){
+                    if (!compiled){
+                        compile();
+                    }
+                    for (auto& pass : passes){
+                        if (pass.culled){
+                            continue;
+                        }
+                        uint32_t scope = profiler ? profiler->beginScope(commandBuffer, pass.profileName) : GPU_SCOPE_NONE;
+                        if (!pass.imageBarriers.empty() || !pass.bufferBarriers.empty()){
+                            // resource handles may change between frames (imported swap chain images), patch them in
+                            for (size_t i = 0; i < pass.imageBarriers.size(); i++){
+                                pass.imageBarriers[i].image = resources[pass.imageBarrierResources[i]].image;
+                            }
+                            for (size_t i = 0; i < pass.bufferBarriers.size(); i++){
+                                pass.bufferBarriers[i].buffer = resources[pass.bufferBarrierResources[i]].buffer;
+                            }
+                            commandBuffer.pipelineBarrier(pass.srcStages, pass.dstStages, vk::DependencyFlags(),
+                                0, nullptr,
+                                (uint32_t)pass.bufferBarriers.size(), pass.bufferBarriers.data(),
+                                (uint32_t)pass.imageBarriers.size(), pass.imageBarriers.data());
+                        }
+                        if (pass.renderPass){
+                            vk::RenderPassBeginInfo beginInfo;
+                            beginInfo.renderPass = pass.renderPass;
+                            beginInfo.framebuffer = getFramebuffer(pass);
+                            beginInfo.renderArea = vk::Rect2D(vk::Offset2D(0, 0), pass.extent);
+                            beginInfo.clearValueCount = (uint32_t)pass.clearValues.size();
+                            beginInfo.pClearValues = pass.clearValues.data();
+                            if (pass.recordChunk){
+                                commandBuffer.beginRenderPass(&beginInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+                                vk::CommandBufferInheritanceInfo inheritanceInfo;
+                                inheritanceInfo.renderPass = pass.renderPass;
+                                inheritanceInfo.subpass = 0;
+                                inheritanceInfo.framebuffer = beginInfo.framebuffer;
+                                recorder->record(commandBuffer, inheritanceInfo, pass.drawCount(*this), pass.recordChunk);
+                            }else{
+                                commandBuffer.beginRenderPass(&beginInfo, vk::SubpassContents::eInline);
+                                if (pass.execute){
+                                    pass.execute(commandBuffer, *this);
+                                }
+                            }
+                            commandBuffer.endRenderPass();
+                        }else if (pass.execute){
+                            pass.execute(commandBuffer, *this);
+                        }
+                        if (profiler){
+                            profiler->endScope(commandBuffer, scope);
+                        }
+                    }
+                    if (!finalBarriers.empty()){
+                        for (size_t i = 0; i < finalBarriers.size(); i++){
+                            finalBarriers[i].image = resources[finalResources[i]].image;
+                        }
+                        commandBuffer.pipelineBarrier(finalSrcStages, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(),
+                            0, nullptr, 0, nullptr, (uint32_t)finalBarriers.size(), finalBarriers.data());
+                    }
+                }
+
+                /** @brief Drop all passes and resources (e.g. before rebuilding the graph for a new swap chain size) */
+                void reset(){
+                    releaseCompiled();
+                    passes.clear();
+                    resources.clear();
+                    stats = RenderGraphStats();
+                }
+
+                vk::Image getImage(RenderGraphResource resource) const { return resources[resource].image; }
+                vk::ImageView getImageView(RenderGraphResource resource) const { return resources[resource].view; }
+                vk::Buffer getBuffer(RenderGraphResource resource) const { return resources[resource].buffer; }
+                vk::Extent2D getExtent(RenderGraphResource resource) const { return resources[resource].extent; }
+                bool isCulled(const std::string& passName) const {
+                    for (auto& pass : passes){
+                        if (pass.name == passName){
+                            return pass.culled;
+                        }
+                    }
+                    return true;
+                }
+
+                const RenderGraphStats& getStats() const { return stats; }
+
+                void printStats(std::ostream& out) const {
+                    out << "render graph: " << (stats.passes - stats.culledPasses) << "/" << stats.passes << " passes, "
+                        << stats.barrierBatches << " barrier batches (" << stats.imageBarriers << " image, " << stats.bufferBarriers << " buffer, "
+                        << stats.skippedBarriers << " skipped), " << stats.layoutTransitions << " layout transitions, "
+                        << stats.transientImages << " transients in " << (stats.aliasedBytes >> 10) << " KiB (" << (stats.transientBytes >> 10) << " KiB unaliased)" << std::endl;
+                }
+        };
+    }
+}
+
+#endif
@@ -38,7 +38,7 @@ namespace trb{
 
         class VulkanSwapChain{
         private: 
-            VulkanDevice vulkanDevice;
+            VulkanDevice* vulkanDevice = nullptr;
             vk::SurfaceKHR surface;
             // Function pointers
             PFN_vkGetPhysicalDeviceSurfaceSupportKHR fpGetPhysicalDeviceSurfaceSupportKHR;
@@ -127,11 +127,11 @@ namespace trb{
 
                 // Get available queue family properties
                 uint32_t queueCount;
-                vulkanDevice.physicalDevice.getQueueFamilyProperties(&queueCount, NULL);                            
+                vulkanDevice->physicalDevice.getQueueFamilyProperties(&queueCount, NULL);                            
                 assert(queueCount >= 1);
 
                 std::vector<vk::QueueFamilyProperties> queueProps(queueCount);
-                vulkanDevice.physicalDevice.getQueueFamilyProperties(&queueCount, queueProps.data());
+                vulkanDevice->physicalDevice.getQueueFamilyProperties(&queueCount, queueProps.data());
 
                 // Iterate over each queue to learn whether it supports presenting:
                 // Find a queue with present support
@@ -139,7 +139,7 @@ namespace trb{
                 std::vector<vk::Bool32> supportsPresent(queueCount);
 
                 for (uint32_t i = 0; i < queueCount; i++) {                    
-                    fpGetPhysicalDeviceSurfaceSupportKHR(vulkanDevice.physicalDevice, i, surface, &supportsPresent[i]);
+                    fpGetPhysicalDeviceSurfaceSupportKHR(vulkanDevice->physicalDevice, i, surface, &supportsPresent[i]);
                 }
 
                 // Search for a graphics and a present queue in the array of queue
@@ -183,13 +183,13 @@ namespace trb{
 
                 // Get list of supported surface formats
                 uint32_t formatCount;
-                if( fpGetPhysicalDeviceSurfaceFormatsKHR(vulkanDevice.physicalDevice, surface, &formatCount, NULL) != VK_SUCCESS ){
+                if( fpGetPhysicalDeviceSurfaceFormatsKHR(vulkanDevice->physicalDevice, surface, &formatCount, NULL) != VK_SUCCESS ){
                     throw std::runtime_error("fpGetPhysicalDeviceSurfaceFormatsKHR Failed");
                 }
                 assert(formatCount > 0);
 
                 std::vector<vk::SurfaceFormatKHR> surfaceFormats(formatCount);
-                if( fpGetPhysicalDeviceSurfaceFormatsKHR(vulkanDevice.physicalDevice, surface, &formatCount, (VkSurfaceFormatKHR*)surfaceFormats.data()) != VK_SUCCESS){
+                if( fpGetPhysicalDeviceSurfaceFormatsKHR(vulkanDevice->physicalDevice, surface, &formatCount, (VkSurfaceFormatKHR*)surfaceFormats.data()) != VK_SUCCESS){
                     throw std::runtime_error("fpGetPhysicalDeviceSurfaceFormatsKHR Failed");
                 }
 
@@ -230,17 +230,17 @@ namespace trb{
             * @param device Logical representation of the device to create the swapchain for
             *
             */
-            void connect(vk::Instance instance, VulkanDevice vulkanDevice){
+            void connect(vk::Instance instance, VulkanDevice* vulkanDevice){
                 this->vulkanDevice = vulkanDevice;                
                 GET_INSTANCE_PROC_ADDR(instance, GetPhysicalDeviceSurfaceSupportKHR);
                 GET_INSTANCE_PROC_ADDR(instance, GetPhysicalDeviceSurfaceCapabilitiesKHR);
                 GET_INSTANCE_PROC_ADDR(instance, GetPhysicalDeviceSurfaceFormatsKHR);
                 GET_INSTANCE_PROC_ADDR(instance, GetPhysicalDeviceSurfacePresentModesKHR);
-                GET_DEVICE_PROC_ADDR(vulkanDevice.device, CreateSwapchainKHR);
-                GET_DEVICE_PROC_ADDR(vulkanDevice.device, DestroySwapchainKHR);
-                GET_DEVICE_PROC_ADDR(vulkanDevice.device, GetSwapchainImagesKHR);
-                GET_DEVICE_PROC_ADDR(vulkanDevice.device, AcquireNextImageKHR);
-                GET_DEVICE_PROC_ADDR(vulkanDevice.device, QueuePresentKHR);
+                GET_DEVICE_PROC_ADDR(vulkanDevice->device, CreateSwapchainKHR);
+                GET_DEVICE_PROC_ADDR(vulkanDevice->device, DestroySwapchainKHR);
+                GET_DEVICE_PROC_ADDR(vulkanDevice->device, GetSwapchainImagesKHR);
+                GET_DEVICE_PROC_ADDR(vulkanDevice->device, AcquireNextImageKHR);
+                GET_DEVICE_PROC_ADDR(vulkanDevice->device, QueuePresentKHR);
             }
 
             /** 
@@ -255,19 +255,19 @@ namespace trb{
 
                 // Get physical device surface properties and formats
                 vk::SurfaceCapabilitiesKHR surfCaps;
-                if(fpGetPhysicalDeviceSurfaceCapabilitiesKHR(vulkanDevice.physicalDevice, surface, (VkSurfaceCapabilitiesKHR*)&surfCaps) != VK_SUCCESS){
+                if(fpGetPhysicalDeviceSurfaceCapabilitiesKHR(vulkanDevice->physicalDevice, surface, (VkSurfaceCapabilitiesKHR*)&surfCaps) != VK_SUCCESS){
                     throw std::runtime_error("fpGetPhysicalDeviceSurfaceCapabilitiesKHR Failed");
                 }
 
                 // Get available present modes
                 uint32_t presentModeCount;
-                if(fpGetPhysicalDeviceSurfacePresentModesKHR(vulkanDevice.physicalDevice, surface, &presentModeCount, NULL) != VK_SUCCESS){
+                if(fpGetPhysicalDeviceSurfacePresentModesKHR(vulkanDevice->physicalDevice, surface, &presentModeCount, NULL) != VK_SUCCESS){
                      throw std::runtime_error("fpGetPhysicalDeviceSurfacePresentModesKHR Failed");
                 }
                 assert(presentModeCount > 0);
 
                 std::vector<vk::PresentModeKHR> presentModes(presentModeCount);
-                if(fpGetPhysicalDeviceSurfacePresentModesKHR(vulkanDevice.physicalDevice, surface, &presentModeCount, (VkPresentModeKHR*)presentModes.data()) != VK_SUCCESS){
+                if(fpGetPhysicalDeviceSurfacePresentModesKHR(vulkanDevice->physicalDevice, surface, &presentModeCount, (VkPresentModeKHR*)presentModes.data()) != VK_SUCCESS){
                      throw std::runtime_error("fpGetPhysicalDeviceSurfacePresentModesKHR Failed");
                 }
 
@@ -367,7 +367,7 @@ namespace trb{
                     swapchainCI.imageUsage |= vk::ImageUsageFlagBits::eTransferDst;
                 }
 
-                if(fpCreateSwapchainKHR(vulkanDevice.device, (VkSwapchainCreateInfoKHR*)&swapchainCI, nullptr, (VkSwapchainKHR_T**)&swapChain )  != VK_SUCCESS){
+                if(fpCreateSwapchainKHR(vulkanDevice->device, (VkSwapchainCreateInfoKHR*)&swapchainCI, nullptr, (VkSwapchainKHR_T**)&swapChain )  != VK_SUCCESS){
                      throw std::runtime_error("fpCreateSwapchainKHR Failed");
                 }
 
@@ -375,17 +375,17 @@ namespace trb{
                 // This also cleans up all the presentable images
                 if (oldSwapchain) { 
                     for (uint32_t i = 0; i < imageCount; i++){
-                        vkDestroyImageView(vulkanDevice.device, buffers[i].view, nullptr);
+                        vkDestroyImageView(vulkanDevice->device, buffers[i].view, nullptr);
                     }
-                    fpDestroySwapchainKHR(vulkanDevice.device, oldSwapchain, nullptr);
+                    fpDestroySwapchainKHR(vulkanDevice->device, oldSwapchain, nullptr);
                 }
-                if(fpGetSwapchainImagesKHR(vulkanDevice.device, swapChain, &imageCount, NULL) != VK_SUCCESS){
+                if(fpGetSwapchainImagesKHR(vulkanDevice->device, swapChain, &imageCount, NULL) != VK_SUCCESS){
                      throw std::runtime_error("fpGetSwapchainImagesKHR Failed");
                 }
 
                 // Get the swap chain images
                 images.resize(imageCount);
-                if(fpGetSwapchainImagesKHR(vulkanDevice.device, swapChain, &imageCount, (VkImage_T**)images.data()  ) != VK_SUCCESS){
+                if(fpGetSwapchainImagesKHR(vulkanDevice->device, swapChain, &imageCount, (VkImage_T**)images.data()  ) != VK_SUCCESS){
                      throw std::runtime_error("fpGetSwapchainImagesKHR Failed");
                 }
 
@@ -412,7 +412,7 @@ namespace trb{
 
                     colorAttachmentView.image = buffers[i].image;
 
-                    if( vulkanDevice.device.createImageView(&colorAttachmentView, nullptr, &buffers[i].view) != vk::Result::eSuccess ){                    
+                    if( vulkanDevice->device.createImageView(&colorAttachmentView, nullptr, &buffers[i].view) != vk::Result::eSuccess ){                    
                         throw std::runtime_error("fpGetSwapchainImagesKHR Failed");
                     }
                 }
@@ -423,16 +423,18 @@ namespace trb{
             *
             * @param presentCompleteSemaphore (Optional) Semaphore that is signaled when the image is ready for use
             * @param imageIndex Pointer to the image index that will be increased if the next image could be acquired
+            * @param fence (Optional) Fence that is signaled when the image is ready for use
+            * @param timeout (Optional) Nanoseconds to wait for an image, VK_TIMEOUT / VK_NOT_READY is returned when none became available
             *
-            * @note The function will always wait until the next image has been acquired by setting timeout to UINT64_MAX
+            * @note By default the function will wait until the next image has been acquired by setting timeout to UINT64_MAX
             *
             * @return VkResult of the image acquisition
             */
-            VkResult acquireNextImage(vk::Semaphore presentCompleteSemaphore, uint32_t *imageIndex)
+            VkResult acquireNextImage(vk::Semaphore presentCompleteSemaphore, uint32_t *imageIndex, vk::Fence fence = vk::Fence(), uint64_t timeout = UINT64_MAX)
             {
                 // By setting timeout to UINT64_MAX we will always wait until the next image has been acquired or an actual error is thrown
                 // With that we don't have to handle VK_NOT_READY
-                return fpAcquireNextImageKHR(vulkanDevice.device, swapChain, UINT64_MAX, presentCompleteSemaphore, (VkFence)nullptr, imageIndex);
+                return fpAcquireNextImageKHR(vulkanDevice->device, swapChain, timeout, presentCompleteSemaphore, fence, imageIndex);
             }
 
             /**
@@ -466,11 +468,11 @@ namespace trb{
             void cleanup(vk::Instance instance){
                 if (swapChain){
                     for (uint32_t i = 0; i < imageCount; i++){
-                        vulkanDevice.device.destroyImageView(buffers[i].view, nullptr);                        
+                        vulkanDevice->device.destroyImageView(buffers[i].view, nullptr);                        
                     }
                 }
                 if (surface){
-                    vulkanDevice.device.destroySwapchainKHR(swapChain, nullptr);
+                    vulkanDevice->device.destroySwapchainKHR(swapChain, nullptr);
                     instance.destroySurfaceKHR(surface, nullptr);
                 }
                 surface = nullptr;
@@ -0,0 +1,568 @@
+#ifndef TRB_GFX_VulkanTextureStreamer_H_
+#define TRB_GFX_VulkanTextureStreamer_H_
+
+#include "vulkan/vulkan.hpp"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <gli/gli.hpp>
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "VulkanDevice.hpp"
+#include "VulkanUploadManager.hpp"
+
+// GPU memory all streamed textures together may occupy
+#define DEFAULT_TEXTURE_BUDGET (256ull * 1024 * 1024)
+// Mips up to this size are loaded with the texture and never evicted
+#define DEFAULT_MIP_TAIL_SIZE 64
+// Textures being streamed in at the same time
+#define MAX_TEXTURE_STREAM_REQUESTS 4
+#define INVALID_TEXTURE UINT32_MAX
+
+namespace trb{
+    namespace grfx{
+
+        /** @brief Index of a streamed texture */
+        typedef uint32_t TextureHandle;
+
+        struct TextureStreamerStats{
+            vk::DeviceSize budget = 0;
+            /** @brief Memory of all texture images, including images still uploading or waiting to be destroyed */
+            vk::DeviceSize residentBytes = 0;
+            vk::DeviceSize bytesStreamed = 0;
+            uint32_t textures = 0;
+            uint32_t streaming = 0;
+            uint32_t mipsStreamed = 0;
+            /** @brief Textures dropped back to their mip tail to stay inside the budget */
+            uint32_t evictions = 0;
+            /** @brief Stream requests that were clamped to a lower mip because the budget was exhausted */
+            uint32_t budgetClamps = 0;
+        };
+
+        /**
+        * @brief Streams the mips of KTX / DDS textures by their size on screen inside a memory budget
+        *
+        * load() only uploads the mip tail. Every frame the caller reports where textures are used, the next
+        * update() derives the mip each texture needs from the camera matrices and a loader thread builds a new
+        * image holding the levels from that mip down, which replaces the old image once its upload finished.
+        * When the budget is exhausted the least recently used textures are dropped back to their mip tail.
+        */
+        class VulkanTextureStreamer{
+            private:
+                /** @brief Image holding the levels [baseMip, levelCount) of a texture */
+                struct StreamImage{
+                    vk::Image image;
+                    vk::ImageView view;
+                    MemoryAllocation memory;
+                    vk::DeviceSize size = 0;
+                    uint32_t baseMip = 0;
+                };
+
+                struct StreamedTexture{
+                    std::string path;
+                    vk::Format format = vk::Format::eUndefined;
+                    vk::Extent2D extent;
+                    uint32_t levelCount = 0;
+                    uint32_t tailMip = 0;
+                    /** @brief Levels [tailMip, levelCount) kept in system memory to rebuild the tail image after an eviction */
+                    std::vector<char> tailData;
+                    std::vector<vk::BufferImageCopy> tailRegions;
+                    vk::DeviceSize tailSize = 0;
+
+                    StreamImage active;
+                    /** @brief Bumped whenever the active view changes, descriptors referencing the texture have to be rewritten */
+                    uint32_t generation = 0;
+                    bool streaming = false;
+                    bool failed = false;
+                    /** @brief Finest mip a draw needed this frame */
+                    uint32_t desiredMip = UINT32_MAX;
+                    uint64_t lastUsedFrame = 0;
+                };
+
+                struct StreamRequest{
+                    TextureHandle handle;
+                    std::string path;
+                    uint32_t mip;
+                };
+
+                struct StreamResult{
+                    TextureHandle handle;
+                    StreamImage image;
+                    UploadTicket ticket;
+                    bool ok;
+                };
+
+                struct Retired{
+                    StreamImage image;
+                    uint64_t frame;
+                };
+
+                VulkanDevice* vulkanDevice = nullptr;
+                VulkanUploadManager* uploadManager = nullptr;
+                vk::DeviceSize budget = DEFAULT_TEXTURE_BUDGET;
+                uint32_t mipTailSize = DEFAULT_MIP_TAIL_SIZE;
+                uint32_t framesInFlight = 1;
+                uint64_t frame = 0;
+
+                std::vector<StreamedTexture> textures;
+                std::vector<Retired> retired;
+                /** @brief Uploads that finished on the loader thread and wait for their transfer to complete */
+                std::vector<StreamResult> uploading;
+
+                // camera of the frame the use() calls belong to
+                glm::mat4 view;
+                glm::mat4 projection;
+                float viewportHeight = 1.0f;
+
+                std::mutex requestMutex;
+                std::condition_variable requestCondition;
+                std::deque<StreamRequest> requests;
+                std::mutex resultMutex;
+                std::vector<StreamResult> results;
+                std::thread loader;
+                bool running = false;
+
+                TextureStreamerStats stats;
+
+                static vk::DeviceSize levelSize(const gli::texture2d& texture, uint32_t first){
+                    vk::DeviceSize size = 0;
+                    for (size_t level = first; level < texture.levels(); level++){
+                        size += texture[level].size();
+                    }
+                    return size;
+                }
+
+                /** @brief Copy levels [first, levelCount) into one blob with a copy region per level, mips are renumbered from 0 */
+                static void packLevels(const gli::texture2d& texture, uint32_t first, std::vector<char>* data, std::vector<vk::BufferImageCopy>* regions){
+                    data->resize((size_t)levelSize(texture, first));
+                    regions->clear();
+                    vk::DeviceSize offset = 0;
+                    for (size_t level = first; level < texture.levels(); level++){
+                        memcpy(data->data() + offset, texture[level].data(), texture[level].size());
+                        vk::BufferImageCopy region;
+                        region.bufferOffset = offset;
+                        region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, (uint32_t)(level - first), 0, 1);
+                        region.imageExtent = vk::Extent3D((uint32_t)texture[level].extent().x, (uint32_t)texture[level].extent().y, 1);
+                        regions->push_back(region);
+                        offset += texture[level].size();
+                    }
+                }
+
+                StreamImage createImage(vk::Format format, vk::Extent2D extent, uint32_t baseMip, uint32_t levels){
+                    vk::Device device = vulkanDevice->device;
+                    StreamImage result;
+                    result.baseMip = baseMip;
+                    vk::ImageCreateInfo imageInfo;
+                    imageInfo.imageType = vk::ImageType::e2D;
+                    imageInfo.format = format;
+                    imageInfo.extent = vk::Extent3D(std::max(extent.width >> baseMip, 1u), std::max(extent.height >> baseMip, 1u), 1);
+                    imageInfo.mipLevels = levels;
+                    imageInfo.arrayLayers = 1;
+                    imageInfo.samples = vk::SampleCountFlagBits::e1;
+                    imageInfo.tiling = vk::ImageTiling::eOptimal;
+                    imageInfo.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+                    imageInfo.sharingMode = vk::SharingMode::eExclusive;
+                    imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+                    if (device.createImage(&imageInfo, nullptr, &result.image) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to create streamed texture image");
+                    }
+                    try{
+                        vk::MemoryRequirements memReqs;
+                        device.getImageMemoryRequirements(result.image, &memReqs);
+                        uint32_t memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+                        result.memory = vulkanDevice->allocator.allocate(memReqs, memoryTypeIndex, MemoryUsage::eImage);
+                        result.size = memReqs.size;
+                        device.bindImageMemory(result.image, result.memory.memory, result.memory.offset);
+
+                        vk::ImageViewCreateInfo viewInfo;
+                        viewInfo.image = result.image;
+                        viewInfo.viewType = vk::ImageViewType::e2D;
+                        viewInfo.format = format;
+                        viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, levels, 0, 1);
+                        if (device.createImageView(&viewInfo, nullptr, &result.view) != vk::Result::eSuccess){
+                            throw std::runtime_error("failed to create streamed texture view");
+                        }
+                    }catch (...){
+                        destroyImage(result);
+                        throw;
+                    }
+                    return result;
+                }
+
+                void destroyImage(StreamImage& image){
+                    vk::Device device = vulkanDevice->device;
+                    if (image.view){
+                        device.destroyImageView(image.view, nullptr);
+                    }
+                    if (image.image){
+                        device.destroyImage(image.image, nullptr);
+                    }
+                    if (image.memory){
+                        vulkanDevice->allocator.free(image.memory);
+                    }
+                    image = StreamImage();
+                }
+
+                /** @brief Create an image for levels [mip, levelCount) and queue its upload */
+                StreamResult upload(TextureHandle handle, vk::Format format, vk::Extent2D extent, uint32_t mip, uint32_t levelCount,
+                                    const std::vector<char>& data, const std::vector<vk::BufferImageCopy>& regions){
+                    StreamResult result;
+                    result.handle = handle;
+                    result.image = createImage(format, extent, mip, levelCount - mip);
+                    try{
+                        vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, levelCount - mip, 0, 1);
+                        uploadManager->uploadImage(result.image.image, data.data(), data.size(), regions, range);
+                        result.ticket = uploadManager->submit();
+                    }catch (...){
+                        // uploadImage throws before it records anything, nothing refers to the image yet
+                        destroyImage(result.image);
+                        throw;
+                    }
+                    result.ok = true;
+                    return result;
+                }
+
+                void loaderMain(){
+                    while (true){
+                        StreamRequest request;
+                        {
+                            std::unique_lock<std::mutex> lock(requestMutex);
+                            requestCondition.wait(lock, [this](){ return !running || !requests.empty(); });
+                            if (!running){
+                                return;
+                            }
+                            request = requests.front();
+                            requests.pop_front();
+                        }
+                        // gli reads the whole file, only the requested levels are uploaded
+                        StreamResult result;
+                        result.handle = request.handle;
+                        result.ok = false;
+                        try{
+                            gli::texture2d texture(gli::load(request.path));
+                            if (!texture.empty() && request.mip < texture.levels()){
+                                std::vector<char> data;
+                                std::vector<vk::BufferImageCopy> regions;
+                                packLevels(texture, request.mip, &data, &regions);
+                                vk::Extent2D extent((uint32_t)texture.extent().x, (uint32_t)texture.extent().y);
+                                result = upload(request.handle, (vk::Format)texture.format(), extent, request.mip, (uint32_t)texture.levels(), data, regions);
+                            }
+                        }catch (const std::runtime_error& e){
+                            std::cerr << "texture streamer: " << request.path << ": " << e.what() << std::endl;
+                        }
+                        std::lock_guard<std::mutex> lock(resultMutex);
+                        results.push_back(result);
+                    }
+                }
+
+                /** @brief Memory the texture would occupy with levels [mip, levelCount) resident */
+                vk::DeviceSize estimateSize(const StreamedTexture& texture, uint32_t mip) const {
+                    // block compressed formats are within rounding of this, the real size is known once the image exists
+                    vk::DeviceSize size = texture.tailSize;
+                    for (uint32_t level = mip; level < texture.tailMip; level++){
+                        size += texture.tailSize * ((vk::DeviceSize)1 << (2 * (texture.tailMip - level)));
+                    }
+                    return size;
+                }
+
+                /** @brief Drop the least recently used texture not needed this frame back to its mip tail */
+                bool evictOne(){
+                    TextureHandle victim = INVALID_TEXTURE;
+                    for (TextureHandle handle = 0; handle < textures.size(); handle++){
+                        StreamedTexture& texture = textures[handle];
+                        if (texture.streaming || !texture.active.image || texture.active.baseMip >= texture.tailMip || texture.lastUsedFrame + 1 >= frame){
+                            continue;
+                        }
+                        if (victim == INVALID_TEXTURE || texture.lastUsedFrame < textures[victim].lastUsedFrame){
+                            victim = handle;
+                        }
+                    }
+                    if (victim == INVALID_TEXTURE){
+                        return false;
+                    }
+                    StreamedTexture& texture = textures[victim];
+                    StreamResult result = upload(victim, texture.format, texture.extent, texture.tailMip, texture.levelCount, texture.tailData, texture.tailRegions);
+                    stats.residentBytes += result.image.size;
+                    // the old image is released a few frames from now, count it as gone already
+                    stats.residentBytes -= std::min(stats.residentBytes, texture.active.size);
+                    texture.active.size = 0;
+                    texture.streaming = true;
+                    uploading.push_back(result);
+                    stats.evictions++;
+                    return true;
+                }
+
+                void retire(StreamImage& image){
+                    Retired entry;
+                    entry.image = image;
+                    entry.frame = frame;
+                    retired.push_back(entry);
+                    image = StreamImage();
+                }
+
+            public:
+                VulkanTextureStreamer() : view(1.0f), projection(1.0f) {}
+                ~VulkanTextureStreamer(){
+                    destroy();
+                }
+
+                /**
+                * Start the loader thread
+                *
+                * @param vulkanDevice Device the images are created on
+                * @param uploadManager Uploads the texture data on the transfer queue
+                * @param framesInFlight Frames that may still sample a replaced image
+                * @param budget (Optional) GPU memory the textures may occupy
+                */
+                void init(VulkanDevice* vulkanDevice, VulkanUploadManager* uploadManager, uint32_t framesInFlight, vk::DeviceSize budget = DEFAULT_TEXTURE_BUDGET){
+                    this->vulkanDevice = vulkanDevice;
+                    this->uploadManager = uploadManager;
+                    this->framesInFlight = framesInFlight;
+                    this->budget = budget;
+                    stats.budget = budget;
+                    running = true;
+                    loader = std::thread(&VulkanTextureStreamer::loaderMain, this);
+                }
+
+                void destroy(){
+                    if (!vulkanDevice){
+                        return;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(requestMutex);
+                        running = false;
+                        requests.clear();
+                    }
+                    requestCondition.notify_all();
+                    if (loader.joinable()){
+                        loader.join();
+                    }
+                    uploadManager->waitIdle();
+                    for (auto& result : results){
+                        destroyImage(result.image);
+                    }
+                    for (auto& result : uploading){
+                        destroyImage(result.image);
+                    }
+                    for (auto& entry : retired){
+                        destroyImage(entry.image);
+                    }
+                    for (auto& texture : textures){
+                        destroyImage(texture.active);
+                    }
+                    results.clear();
+                    uploading.clear();
+                    retired.clear();
+                    textures.clear();
+                    vulkanDevice = nullptr;
+                }
+
+                void setBudget(vk::DeviceSize bytes){
+                    budget = bytes;
+                    stats.budget = bytes;
+                }
+
+                /**
+                * Load a KTX or DDS texture with only its mip tail resident
+                *
+                * @return Handle, the texture has no view until the tail upload finished
+                */
+                TextureHandle load(const std::string& path){
+                    gli::texture2d texture(gli::load(path));
+                    if (texture.empty()){
+                        throw std::runtime_error("failed to load texture " + path);
+                    }
+                    StreamedTexture streamed;
+                    streamed.path = path;
+                    streamed.format = (vk::Format)texture.format();
+                    streamed.extent = vk::Extent2D((uint32_t)texture.extent().x, (uint32_t)texture.extent().y);
+                    streamed.levelCount = (uint32_t)texture.levels();
+                    streamed.tailMip = streamed.levelCount - 1;
+                    for (uint32_t level = 0; level < streamed.levelCount; level++){
+                        if ((uint32_t)std::max(texture[level].extent().x, texture[level].extent().y) <= mipTailSize){
+                            streamed.tailMip = level;
+                            break;
+                        }
+                    }
+                    packLevels(texture, streamed.tailMip, &streamed.tailData, &streamed.tailRegions);
+                    streamed.tailSize = streamed.tailData.size();
+                    streamed.streaming = true;
+                    streamed.lastUsedFrame = frame;
+                    TextureHandle handle = (TextureHandle)textures.size();
+                    textures.push_back(streamed);
+
+                    StreamedTexture& added = textures.back();
+                    StreamResult result = upload(handle, added.format, added.extent, added.tailMip, added.levelCount, added.tailData, added.tailRegions);
+                    stats.residentBytes += result.image.size;
+                    uploading.push_back(result);
+                    stats.textures++;
+                    return handle;
+                }
+
+                /**
+                * Report that a texture is drawn this frame on an object with the given bounding sphere
+                *
+                * @param center World space center of the object
+                * @param radius World space radius of the object
+                * @param uvScale (Optional) How often the texture repeats across the object
+                */
+                void use(TextureHandle handle, const glm::vec3& center, float radius, float uvScale = 1.0f){
+                    StreamedTexture& texture = textures[handle];
+                    texture.lastUsedFrame = frame;
+                    glm::vec4 viewPos = view * glm::vec4(center, 1.0f);
+                    // right handed view space, the camera looks down -z
+                    float distance = -viewPos.z;
+                    if (distance <= radius){
+                        // camera inside or right in front of the bounds
+                        texture.desiredMip = 0;
+                        return;
+                    }
+                    float pixels = radius * projection[1][1] / distance * viewportHeight;
+                    float texels = (float)std::max(texture.extent.width, texture.extent.height);
+                    float mip = std::log2(std::max(texels / std::max(pixels * uvScale, 1.0f), 1.0f));
+                    uint32_t desired = std::min((uint32_t)mip, texture.tailMip);
+                    texture.desiredMip = std::min(texture.desiredMip, desired);
+                }
+
+                /**
+                * Swap in finished uploads, start new stream requests from the uses of the last frame and evict under
+                * pressure. Call once per frame before recording, then report the uses of the new frame
+                *
+                * @param view View matrix of the camera for the coming frame
+                * @param projection Projection matrix of the camera for the coming frame
+                * @param viewport Size of the render target in pixels
+                */
+                void update(const glm::mat4& view, const glm::mat4& projection, vk::Extent2D viewport){
+                    frame++;
+
+                    // loader thread results: the image exists and its upload was submitted
+                    {
+                        std::lock_guard<std::mutex> lock(resultMutex);
+                        for (auto& result : results){
+                            if (!result.ok){
+                                textures[result.handle].streaming = false;
+                                textures[result.handle].failed = true;
+                                continue;
+                            }
+                            stats.residentBytes += result.image.size;
+                            uploading.push_back(result);
+                        }
+                        results.clear();
+                    }
+
+                    // swap in images whose transfer completed, the old image may still be sampled by frames in flight
+                    for (size_t i = 0; i < uploading.size();){
+                        StreamResult& result = uploading[i];
+                        if (!uploadManager->isComplete(result.ticket)){
+                            i++;
+                            continue;
+                        }
+                        StreamedTexture& texture = textures[result.handle];
+                        if (texture.active.image && result.image.baseMip < texture.active.baseMip){
+                            stats.mipsStreamed += texture.active.baseMip - result.image.baseMip;
+                            stats.bytesStreamed += result.image.size;
+                        }
+                        stats.residentBytes -= std::min(stats.residentBytes, texture.active.size);
+                        retire(texture.active);
+                        texture.active = result.image;
+                        texture.generation++;
+                        texture.streaming = false;
+                        uploading[i] = uploading.back();
+                        uploading.pop_back();
+                    }
+
+                    for (size_t i = 0; i < retired.size();){
+                        if (retired[i].frame + framesInFlight < frame){
+                            destroyImage(retired[i].image);
+                            retired[i] = retired.back();
+                            retired.pop_back();
+                        }else{
+                            i++;
+                        }
+                    }
+
+                    // textures that need finer mips than resident, most missing detail first
+                    std::vector<TextureHandle> candidates;
+                    for (TextureHandle handle = 0; handle < textures.size(); handle++){
+                        StreamedTexture& texture = textures[handle];
+                        if (!texture.streaming && !texture.failed && texture.active.image && texture.desiredMip < texture.active.baseMip){
+                            candidates.push_back(handle);
+                        }
+                    }
+                    std::sort(candidates.begin(), candidates.end(), [this](TextureHandle a, TextureHandle b){
+                        return textures[a].active.baseMip - textures[a].desiredMip > textures[b].active.baseMip - textures[b].desiredMip;
+                    });
+                    for (auto handle : candidates){
+                        if (stats.streaming >= MAX_TEXTURE_STREAM_REQUESTS){
+                            break;
+                        }
+                        StreamedTexture& texture = textures[handle];
+                        uint32_t mip = texture.desiredMip;
+                        // the new image has to fit next to the old one until the swap
+                        while (stats.residentBytes + estimateSize(texture, mip) > budget){
+                            if (!evictOne()){
+                                break;
+                            }
+                        }
+                        while (mip < texture.active.baseMip && stats.residentBytes + estimateSize(texture, mip) > budget){
+                            mip++;
+                        }
+                        if (mip != texture.desiredMip){
+                            stats.budgetClamps++;
+                        }
+                        if (mip >= texture.active.baseMip || estimateSize(texture, mip) > uploadManager->getRingSize()){
+                            continue;
+                        }
+                        texture.streaming = true;
+                        StreamRequest request;
+                        request.handle = handle;
+                        request.path = texture.path;
+                        request.mip = mip;
+                        {
+                            std::lock_guard<std::mutex> lock(requestMutex);
+                            requests.push_back(request);
+                        }
+                        requestCondition.notify_one();
+                        stats.streaming++;
+                    }
+
+                    stats.streaming = 0;
+                    for (auto& texture : textures){
+                        stats.streaming += texture.streaming ? 1 : 0;
+                        texture.desiredMip = UINT32_MAX;
+                    }
+                    this->view = view;
+                    this->projection = projection;
+                    viewportHeight = (float)viewport.height;
+                }
+
+                /** @brief View of the resident levels, null until the mip tail arrived */
+                vk::ImageView getImageView(TextureHandle handle) const { return textures[handle].active.view; }
+                /** @brief Changes whenever getImageView() returns a different view */
+                uint32_t getGeneration(TextureHandle handle) const { return textures[handle].generation; }
+                /** @brief Finest mip currently resident, relative to the full texture */
+                uint32_t getResidentMip(TextureHandle handle) const { return textures[handle].active.baseMip; }
+                const TextureStreamerStats& getStats() const { return stats; }
+
+                void printStats(std::ostream& out) const {
+                    out << "texture streamer: " << stats.textures << " textures, " << (stats.residentBytes >> 20) << "/" << (stats.budget >> 20) << " MiB, "
+                        << stats.streaming << " streaming, " << stats.mipsStreamed << " mips streamed, " << stats.evictions << " evictions, "
+                        << stats.budgetClamps << " clamped by budget" << std::endl;
+                }
+        };
+    }
+}
+
+#endif
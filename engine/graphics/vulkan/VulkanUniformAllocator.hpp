@@ -0,0 +1,188 @@
+#ifndef TRB_GFX_VulkanUniformAllocator_H_
+#define TRB_GFX_VulkanUniformAllocator_H_
+
+#include "vulkan/vulkan.hpp"
+
+#include <stdexcept>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+
+// Bytes of per frame uniform data of one frame slot
+#define DEFAULT_UNIFORM_ARENA_SIZE (1024 * 1024)
+
+namespace trb{
+    namespace grfx{
+
+        struct UniformStats{
+            uint32_t allocations = 0;
+            /** @brief Bytes handed out, alignment padding included */
+            vk::DeviceSize bytes = 0;
+            /** @brief Bytes flushed, zero on coherent memory */
+            vk::DeviceSize flushed = 0;
+        };
+
+        /** @brief A range of this frame's uniform data, bind it through its dynamic offset */
+        struct UniformAllocation{
+            void* data = nullptr;
+            uint32_t offset = 0;
+        };
+
+        /**
+        * @brief Linear allocator of per frame uniform data in one persistently mapped buffer
+        *
+        * The buffer is split into one region per frame slot. A frame bumps a pointer through the region of its
+        * slot, every range starts at minUniformBufferOffsetAlignment, and the region is rewound in beginFrame()
+        * once the GPU is done with the slot. Ranges are addressed by dynamic offsets into the whole buffer, so a
+        * single eUniformBufferDynamic descriptor (getDescriptor()) serves every frame and every draw. On non
+        * coherent memory the written part of the region is flushed once in flush(), widened to nonCoherentAtomSize.
+        *
+        * allocate() is lock free and may be called from the recording workers, beginFrame() and flush() may not
+        * run concurrently with it.
+        */
+        class VulkanUniformAllocator{
+            private:
+                VulkanDevice* vulkanDevice = nullptr;
+                Buffer buffer;
+                bool coherent = true;
+                vk::DeviceSize alignment = 1;
+                vk::DeviceSize atomSize = 1;
+                /** @brief Bytes of one frame slot, a multiple of the alignment and the atom size */
+                vk::DeviceSize regionSize = 0;
+                uint32_t frameCount = 0;
+                vk::DeviceSize regionBase = 0;
+                std::atomic<vk::DeviceSize> head;
+                std::atomic<uint32_t> allocations;
+                vk::DeviceSize flushedEnd = 0;
+                vk::DeviceSize flushedBytes = 0;
+                UniformStats lastStats;
+
+                static vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment){
+                    return (value + alignment - 1) / alignment * alignment;
+                }
+
+            public:
+                VulkanUniformAllocator() : head(0), allocations(0) {}
+
+                /**
+                * @param frameCount Frame slots of the frames in flight pipeline
+                * @param size Bytes of uniform data one frame may allocate
+                */
+                void init(VulkanDevice* vulkanDevice, uint32_t frameCount, vk::DeviceSize size = DEFAULT_UNIFORM_ARENA_SIZE){
+                    this->vulkanDevice = vulkanDevice;
+                    this->frameCount = frameCount;
+                    const vk::PhysicalDeviceLimits& limits = vulkanDevice->properties.limits;
+                    alignment = std::max(limits.minUniformBufferOffsetAlignment, (vk::DeviceSize)1);
+                    atomSize = std::max(limits.nonCoherentAtomSize, (vk::DeviceSize)1);
+                    regionSize = alignUp(alignUp(size, alignment), atomSize);
+                    if (regionSize * frameCount > UINT32_MAX){
+                        throw std::runtime_error("uniform arena does not fit dynamic offsets!");
+                    }
+
+                    vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible, &buffer, regionSize * frameCount);
+                    if (buffer.map() != vk::Result::eSuccess){
+                        throw std::runtime_error("could not map uniform arena");
+                    }
+                    // the memory type picked for host visible may or may not be coherent
+                    uint32_t memoryTypeIndex = buffer.allocation.block->memoryTypeIndex;
+                    coherent = (bool)(vulkanDevice->memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent);
+                    beginFrame(0);
+                }
+
+                /** @brief The device must be idle */
+                void destroy(){
+                    if (buffer.buffer){
+                        buffer.unmap();
+                        buffer.destroy();
+                    }
+                }
+
+                /** @brief Rewind the region of a frame slot whose fence has signaled */
+                void beginFrame(uint32_t slot){
+                    lastStats.allocations = allocations.load();
+                    lastStats.bytes = std::min(head.load(), regionSize);
+                    lastStats.flushed = flushedBytes;
+                    regionBase = slot * regionSize;
+                    head = 0;
+                    allocations = 0;
+                    flushedEnd = 0;
+                    flushedBytes = 0;
+                }
+
+                /** @brief Size bytes for this frame, throws once the frame's region is used up */
+                UniformAllocation allocate(vk::DeviceSize size){
+                    vk::DeviceSize offset = head.fetch_add(alignUp(size, alignment));
+                    if (offset + size > regionSize){
+                        throw std::runtime_error("uniform arena of the frame is exhausted!");
+                    }
+                    allocations++;
+                    UniformAllocation allocation;
+                    allocation.data = (char*)buffer.mapped + regionBase + offset;
+                    allocation.offset = (uint32_t)(regionBase + offset);
+                    return allocation;
+                }
+
+                /** @brief Copy data into this frame's uniform data, returns the dynamic offset */
+                uint32_t push(const void* data, vk::DeviceSize size){
+                    UniformAllocation allocation = allocate(size);
+                    memcpy(allocation.data, data, (size_t)size);
+                    return allocation.offset;
+                }
+
+                template <typename T>
+                uint32_t push(const T& value){
+                    return push(&value, sizeof(T));
+                }
+
+                /**
+                * Make the ranges allocated since the last flush visible to the device, call once before the frame
+                * is submitted. No-op on coherent memory
+                */
+                void flush(){
+                    vk::DeviceSize offset, size;
+                    getFlushRange(&offset, &size);
+                    if (coherent || size == 0){
+                        return;
+                    }
+                    buffer.flush(size, offset);
+                    flushedBytes += size;
+                    flushedEnd = std::min(head.load(), regionSize);
+                }
+
+                /**
+                * Range of the buffer the next flush() writes back on non coherent memory: everything allocated since
+                * the last flush, widened to whole atoms. Size 0 when nothing was allocated since
+                */
+                void getFlushRange(vk::DeviceSize* offset, vk::DeviceSize* size) const {
+                    vk::DeviceSize end = std::min(head.load(), regionSize);
+                    // the region itself starts and ends on atom boundaries
+                    vk::DeviceSize begin = flushedEnd / atomSize * atomSize;
+                    *offset = regionBase + begin;
+                    *size = end > flushedEnd ? std::min(alignUp(end, atomSize), regionSize) - begin : 0;
+                }
+
+                /**
+                * Descriptor of an eUniformBufferDynamic binding, the dynamic offset of a range selects what it reads
+                *
+                * @param range Size of the uniform block the shader declares
+                */
+                vk::DescriptorBufferInfo getDescriptor(vk::DeviceSize range) const {
+                    return vk::DescriptorBufferInfo(buffer.buffer, 0, range);
+                }
+
+                vk::Buffer getBuffer() const { return buffer.buffer; }
+                vk::DeviceSize getAlignment() const { return alignment; }
+                vk::DeviceSize getAtomSize() const { return atomSize; }
+                vk::DeviceSize getCapacity() const { return regionSize; }
+                bool isCoherent() const { return coherent; }
+
+                /** @brief Counters of the last completed frame */
+                const UniformStats& getStats() const { return lastStats; }
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,487 @@
+#ifndef TRB_GFX_VulkanUploadManager_H_
+#define TRB_GFX_VulkanUploadManager_H_
+
+#include "vulkan/vulkan.hpp"
+
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <functional>
+#include <cstring>
+#include <algorithm>
+
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+
+// Default size of the persistently mapped staging ring (32 MiB)
+#define DEFAULT_STAGING_RING_SIZE (32ull * 1024 * 1024)
+// Offset alignment of staging ranges, covers optimalBufferCopyOffsetAlignment and texel block sizes
+#define STAGING_COPY_ALIGNMENT 16ull
+
+namespace trb{
+    namespace grfx{
+
+        /** @brief Handle for a batch of uploads, poll with VulkanUploadManager::isComplete */
+        typedef uint64_t UploadTicket;
+        /** @brief Writes the upload data straight into its reserved staging memory */
+        typedef std::function<void(void* staging)> StagingFillFunc;
+
+        struct UploadStats{
+            uint64_t bytesUploaded = 0;
+            uint64_t copiesRecorded = 0;
+            uint64_t batchesSubmitted = 0;
+            /** @brief Number of times the ring was full and the CPU had to wait on the GPU */
+            uint64_t ringStalls = 0;
+        };
+
+        /**
+        * @brief Streams buffer and image data to the device through a persistently mapped staging ring
+        *
+        * Copies are batched into a single command buffer per submit() on the transfer queue family
+        * (a dedicated DMA queue when the device exposes one). Nothing blocks on the GPU: callers get an
+        * UploadTicket back and poll it. When the transfer family differs from the graphics family the
+        * queue family ownership is released on the transfer queue and the matching acquire barriers
+        * are recorded into a graphics command buffer with recordAcquireBarriers().
+        */
+        class VulkanUploadManager{
+            private:
+                struct Batch{
+                    UploadTicket ticket = 0;
+                    vk::CommandBuffer commandBuffer;
+                    vk::Fence fence;
+                    // ring head once this batch was submitted, becomes the new tail when it retires
+                    vk::DeviceSize ringEnd = 0;
+                    std::vector<vk::BufferMemoryBarrier> bufferAcquires;
+                    std::vector<vk::ImageMemoryBarrier> imageAcquires;
+                };
+
+                VulkanDevice* vulkanDevice = nullptr;
+                vk::Device device;
+                vk::Queue transferQueue;
+                uint32_t transferFamily = 0;
+                uint32_t graphicsFamily = 0;
+                vk::CommandPool commandPool;
+
+                Buffer staging;
+                uint8_t* ring = nullptr;
+                vk::DeviceSize ringSize = 0;
+                vk::DeviceSize head = 0;
+                vk::DeviceSize tail = 0;
+
+                // batch currently being recorded, submitted on submit()
+                Batch* open = nullptr;
+                std::deque<Batch*> inFlight;
+                std::vector<vk::Fence> freeFences;
+                UploadTicket nextTicket = 1;
+                UploadTicket completedTicket = 0;
+
+                std::vector<vk::BufferMemoryBarrier> pendingBufferAcquires;
+                std::vector<vk::ImageMemoryBarrier> pendingImageAcquires;
+
+                std::mutex mutex;
+                UploadStats stats;
+
+                bool ownershipTransfer() const { return transferFamily != graphicsFamily; }
+
+                Batch* openBatch(){
+                    if (open){
+                        return open;
+                    }
+                    open = new Batch();
+                    open->ticket = nextTicket++;
+
+                    vk::CommandBufferAllocateInfo allocInfo;
+                    allocInfo.commandPool = commandPool;
+                    allocInfo.level = vk::CommandBufferLevel::ePrimary;
+                    allocInfo.commandBufferCount = 1;
+                    if (device.allocateCommandBuffers(&allocInfo, &open->commandBuffer) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to allocate upload command buffer!");
+                    }
+                    vk::CommandBufferBeginInfo beginInfo;
+                    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+                    open->commandBuffer.begin(&beginInfo);
+                    return open;
+                }
+
+                bool ringIdle() const {
+                    return inFlight.empty() && !open;
+                }
+
+                /** @brief Find space for size bytes in the ring without waiting */
+                bool tryRingAllocate(vk::DeviceSize size, vk::DeviceSize *offset){
+                    if (ringIdle()){
+                        head = tail = 0;
+                    }
+                    vk::DeviceSize start = alignUp(head, STAGING_COPY_ALIGNMENT);
+                    bool full = (head == tail) && !ringIdle();
+                    if (full){
+                        return false;
+                    }
+                    if (head >= tail){
+                        // free space is [head, ringSize) and [0, tail)
+                        if (start + size <= ringSize){
+                            *offset = start;
+                            head = start + size;
+                            return true;
+                        }
+                        if (size < tail){
+                            *offset = 0;
+                            head = size;
+                            return true;
+                        }
+                        return false;
+                    }
+                    // free space is [head, tail)
+                    if (start + size < tail){
+                        *offset = start;
+                        head = start + size;
+                        return true;
+                    }
+                    return false;
+                }
+
+                /** @brief Reserve staging memory, submitting and retiring batches until it fits */
+                vk::DeviceSize ringAllocate(vk::DeviceSize size){
+                    if (size > ringSize){
+                        throw std::runtime_error("upload does not fit into the staging ring");
+                    }
+                    vk::DeviceSize offset;
+                    if (tryRingAllocate(size, &offset)){
+                        return offset;
+                    }
+                    // the open batch owns ring space too, push it out so it can retire
+                    submitLocked();
+                    retire(false);
+                    while (!tryRingAllocate(size, &offset)){
+                        stats.ringStalls++;
+                        retire(true);
+                    }
+                    return offset;
+                }
+
+                /** @brief Retire finished batches in submission order, optionally waiting for the oldest one */
+                void retire(bool waitOldest){
+                    while (!inFlight.empty()){
+                        Batch* batch = inFlight.front();
+                        if (waitOldest){
+                            if (device.waitForFences(1, &batch->fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT) != vk::Result::eSuccess){
+                                throw std::runtime_error("failed to wait for upload fence");
+                            }
+                            waitOldest = false;
+                        }else if (device.getFenceStatus(batch->fence) != vk::Result::eSuccess){
+                            break;
+                        }
+                        inFlight.pop_front();
+                        tail = batch->ringEnd;
+                        completedTicket = batch->ticket;
+                        pendingBufferAcquires.insert(pendingBufferAcquires.end(), batch->bufferAcquires.begin(), batch->bufferAcquires.end());
+                        pendingImageAcquires.insert(pendingImageAcquires.end(), batch->imageAcquires.begin(), batch->imageAcquires.end());
+                        device.resetFences(1, &batch->fence);
+                        freeFences.push_back(batch->fence);
+                        device.freeCommandBuffers(commandPool, 1, &batch->commandBuffer);
+                        delete batch;
+                    }
+                }
+
+                UploadTicket submitLocked(){
+                    if (!open){
+                        return nextTicket - 1;
+                    }
+                    Batch* batch = open;
+                    open = nullptr;
+                    batch->commandBuffer.end();
+                    batch->ringEnd = head;
+
+                    if (freeFences.empty()){
+                        vk::FenceCreateInfo fenceInfo;
+                        vk::Fence fence;
+                        if (device.createFence(&fenceInfo, nullptr, &fence) != vk::Result::eSuccess){
+                            throw std::runtime_error("failed to create upload fence");
+                        }
+                        freeFences.push_back(fence);
+                    }
+                    batch->fence = freeFences.back();
+                    freeFences.pop_back();
+
+                    vk::SubmitInfo submitInfo;
+                    submitInfo.commandBufferCount = 1;
+                    submitInfo.pCommandBuffers = &batch->commandBuffer;
+                    if (transferQueue.submit(1, &submitInfo, batch->fence) != vk::Result::eSuccess){
+                        throw std::runtime_error("failed to submit upload batch");
+                    }
+                    inFlight.push_back(batch);
+                    stats.batchesSubmitted++;
+                    return batch->ticket;
+                }
+
+                /** @brief Close a buffer upload, handing the range over to the graphics queue family if needed */
+                UploadTicket releaseBuffer(Buffer* dst, vk::DeviceSize size, vk::DeviceSize dstOffset){
+                    Batch* batch = openBatch();
+                    if (ownershipTransfer()){
+                        // release on the transfer queue, the acquire half is recorded on the graphics queue
+                        vk::BufferMemoryBarrier barrier;
+                        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+                        barrier.srcQueueFamilyIndex = transferFamily;
+                        barrier.dstQueueFamilyIndex = graphicsFamily;
+                        barrier.buffer = dst->buffer;
+                        barrier.offset = dstOffset;
+                        barrier.size = size;
+                        batch->commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+                            vk::DependencyFlags(), 0, nullptr, 1, &barrier, 0, nullptr);
+                        barrier.srcAccessMask = vk::AccessFlags();
+                        barrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead |
+                            vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eShaderRead;
+                        batch->bufferAcquires.push_back(barrier);
+                    }
+                    return batch->ticket;
+                }
+
+            public:
+                VulkanUploadManager(){}
+                ~VulkanUploadManager(){
+                    destroy();
+                }
+
+                /**
+                * Create the staging ring and command pool on the transfer queue family
+                *
+                * @param vulkanDevice Device created with a transfer queue (see VulkanDevice::createLogicalDevice)
+                * @param stagingSize (Optional) Size of the persistently mapped staging ring in bytes
+                */
+                void init(VulkanDevice* vulkanDevice, vk::DeviceSize stagingSize = DEFAULT_STAGING_RING_SIZE){
+                    this->vulkanDevice = vulkanDevice;
+                    device = vulkanDevice->device;
+                    graphicsFamily = (uint32_t)vulkanDevice->queueFamilyIndices.graphicsFamily;
+                    transferFamily = vulkanDevice->queueFamilyIndices.transferFamily >= 0 ? (uint32_t)vulkanDevice->queueFamilyIndices.transferFamily : graphicsFamily;
+                    device.getQueue(transferFamily, 0, &transferQueue);
+                    commandPool = vulkanDevice->createCommandPool(transferFamily, vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+
+                    vulkanDevice->createBuffer(vk::BufferUsageFlagBits::eTransferSrc,
+                        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                        &staging, stagingSize);
+                    if (staging.map() != vk::Result::eSuccess){
+                        throw std::runtime_error("could not map staging ring");
+                    }
+                    ring = (uint8_t*)staging.mapped;
+                    ringSize = stagingSize;
+                    head = tail = 0;
+                }
+
+                /**
+                * Wait for all uploads and release the staging ring, fences and command pool
+                */
+                void destroy(){
+                    if (!device){
+                        return;
+                    }
+                    waitIdle();
+                    for (auto fence : freeFences){
+                        device.destroyFence(fence, nullptr);
+                    }
+                    freeFences.clear();
+                    staging.unmap();
+                    staging.destroy();
+                    device.destroyCommandPool(commandPool, nullptr);
+                    ring = nullptr;
+                    device = vk::Device();
+                }
+
+                /**
+                * Queue a copy of host data into a device buffer
+                *
+                * @param dst Destination buffer, must have been created with eTransferDst usage
+                * @param data Source data, copied into the staging ring before the call returns
+                * @param size Size of the data in bytes
+                * @param dstOffset (Optional) Byte offset into the destination buffer
+                *
+                * @return Ticket of the batch that carries the copy
+                */
+                UploadTicket uploadBuffer(Buffer* dst, const void* data, vk::DeviceSize size, vk::DeviceSize dstOffset = 0){
+                    std::lock_guard<std::mutex> lock(mutex);
+                    // split uploads bigger than half the ring so they can stream through it
+                    vk::DeviceSize chunkSize = ringSize / 2;
+                    vk::DeviceSize done = 0;
+                    while (done < size){
+                        vk::DeviceSize bytes = std::min(chunkSize, size - done);
+                        vk::DeviceSize offset = ringAllocate(bytes);
+                        memcpy(ring + offset, (const uint8_t*)data + done, bytes);
+
+                        Batch* batch = openBatch();
+                        vk::BufferCopy region;
+                        region.srcOffset = offset;
+                        region.dstOffset = dstOffset + done;
+                        region.size = bytes;
+                        batch->commandBuffer.copyBuffer(staging.buffer, dst->buffer, 1, &region);
+                        stats.copiesRecorded++;
+                        done += bytes;
+                    }
+                    stats.bytesUploaded += size;
+                    return releaseBuffer(dst, size, dstOffset);
+                }
+
+                /**
+                * Queue a buffer upload whose data is written straight into the staging ring (decompression, file reads)
+                *
+                * @param dst Destination buffer, must have been created with eTransferDst usage
+                * @param size Size of the data in bytes, at most the ring size
+                * @param fill Writes size bytes to the staging pointer, runs on the calling thread with the manager locked
+                * @param dstOffset (Optional) Byte offset into the destination buffer
+                *
+                * @return Ticket of the batch that carries the copy
+                */
+                UploadTicket uploadBuffer(Buffer* dst, vk::DeviceSize size, const StagingFillFunc& fill, vk::DeviceSize dstOffset = 0){
+                    std::lock_guard<std::mutex> lock(mutex);
+                    vk::DeviceSize offset = ringAllocate(size);
+                    fill(ring + offset);
+
+                    Batch* batch = openBatch();
+                    vk::BufferCopy region;
+                    region.srcOffset = offset;
+                    region.dstOffset = dstOffset;
+                    region.size = size;
+                    batch->commandBuffer.copyBuffer(staging.buffer, dst->buffer, 1, &region);
+                    stats.copiesRecorded++;
+                    stats.bytesUploaded += size;
+                    return releaseBuffer(dst, size, dstOffset);
+                }
+
+                /**
+                * Queue a copy of host data into (a subresource range of) a device image
+                *
+                * @param image Destination image, must have been created with eTransferDst usage
+                * @param data Source data, copied into the staging ring before the call returns
+                * @param size Size of the data in bytes
+                * @param regions Copy regions, bufferOffset is relative to data
+                * @param range Subresource range covered by the regions
+                * @param finalLayout Layout the image is left in for the graphics queue
+                *
+                * @return Ticket of the batch that carries the copy
+                */
+                UploadTicket uploadImage(vk::Image image, const void* data, vk::DeviceSize size, const std::vector<vk::BufferImageCopy>& regions,
+                                         const vk::ImageSubresourceRange& range, vk::ImageLayout finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal){
+                    return uploadImage(image, size, [data, size](void* staging){ memcpy(staging, data, (size_t)size); }, regions, range, finalLayout);
+                }
+
+                /**
+                * Queue an image upload whose data is written straight into the staging ring
+                *
+                * @param fill Writes size bytes to the staging pointer, runs on the calling thread with the manager locked
+                */
+                UploadTicket uploadImage(vk::Image image, vk::DeviceSize size, const StagingFillFunc& fill, const std::vector<vk::BufferImageCopy>& regions,
+                                         const vk::ImageSubresourceRange& range, vk::ImageLayout finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal){
+                    std::lock_guard<std::mutex> lock(mutex);
+                    vk::DeviceSize offset = ringAllocate(size);
+                    fill(ring + offset);
+
+                    Batch* batch = openBatch();
+                    vk::ImageMemoryBarrier toTransfer;
+                    toTransfer.srcAccessMask = vk::AccessFlags();
+                    toTransfer.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+                    toTransfer.oldLayout = vk::ImageLayout::eUndefined;
+                    toTransfer.newLayout = vk::ImageLayout::eTransferDstOptimal;
+                    toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    toTransfer.image = image;
+                    toTransfer.subresourceRange = range;
+                    batch->commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+                        vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+                    std::vector<vk::BufferImageCopy> copies(regions);
+                    for (auto& copy : copies){
+                        copy.bufferOffset += offset;
+                    }
+                    batch->commandBuffer.copyBufferToImage(staging.buffer, image, vk::ImageLayout::eTransferDstOptimal, (uint32_t)copies.size(), copies.data());
+                    stats.copiesRecorded++;
+                    stats.bytesUploaded += size;
+
+                    vk::ImageMemoryBarrier toFinal;
+                    toFinal.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+                    toFinal.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+                    toFinal.newLayout = finalLayout;
+                    toFinal.image = image;
+                    toFinal.subresourceRange = range;
+                    if (ownershipTransfer()){
+                        // release + layout transition, the graphics queue repeats the transition in its acquire barrier
+                        toFinal.srcQueueFamilyIndex = transferFamily;
+                        toFinal.dstQueueFamilyIndex = graphicsFamily;
+                        batch->commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+                            vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &toFinal);
+                        toFinal.srcAccessMask = vk::AccessFlags();
+                        toFinal.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+                        batch->imageAcquires.push_back(toFinal);
+                    }else{
+                        toFinal.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+                        toFinal.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                        toFinal.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                        batch->commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands,
+                            vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &toFinal);
+                    }
+                    return batch->ticket;
+                }
+
+                /**
+                * Submit every copy queued since the last submit as one batch on the transfer queue
+                *
+                * @return Ticket of the submitted batch
+                */
+                UploadTicket submit(){
+                    std::lock_guard<std::mutex> lock(mutex);
+                    return submitLocked();
+                }
+
+                /**
+                * Retire finished batches without waiting. Call once per frame
+                */
+                void poll(){
+                    std::lock_guard<std::mutex> lock(mutex);
+                    retire(false);
+                }
+
+                /** @brief True once the batch has finished executing on the transfer queue */
+                bool isComplete(UploadTicket ticket){
+                    std::lock_guard<std::mutex> lock(mutex);
+                    retire(false);
+                    return ticket <= completedTicket;
+                }
+
+                /**
+                * Record the queue family acquire barriers of all completed batches into a graphics command buffer.
+                * Resources of a completed ticket are usable by commands recorded after this call
+                *
+                * @param commandBuffer Command buffer on the graphics queue family
+                */
+                void recordAcquireBarriers(vk::CommandBuffer commandBuffer){
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (pendingBufferAcquires.empty() && pendingImageAcquires.empty()){
+                        return;
+                    }
+                    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(),
+                        0, nullptr,
+                        (uint32_t)pendingBufferAcquires.size(), pendingBufferAcquires.data(),
+                        (uint32_t)pendingImageAcquires.size(), pendingImageAcquires.data());
+                    pendingBufferAcquires.clear();
+                    pendingImageAcquires.clear();
+                }
+
+                /**
+                * Submit outstanding copies and block until every batch has finished (loading screens, shutdown)
+                */
+                void waitIdle(){
+                    std::lock_guard<std::mutex> lock(mutex);
+                    submitLocked();
+                    while (!inFlight.empty()){
+                        retire(true);
+                    }
+                }
+
+                const UploadStats& getStats() const { return stats; }
+                bool hasDedicatedTransferQueue() const { return ownershipTransfer(); }
+                /** @brief Largest single upload that fits into the staging ring */
+                vk::DeviceSize getRingSize() const { return ringSize; }
+        };
+    }
+}
+
+#endif
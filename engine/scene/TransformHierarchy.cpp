@@ -0,0 +1,267 @@
+#include "TransformHierarchy.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_SSE 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define TRANSFORM_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace{
+
+    /** @brief Removed with an ancestor while sorting */
+    const int32_t REMOVED = -2;
+
+    template <typename T>
+    void permute(std::vector<T>& values, const std::vector<int32_t>& targets, uint32_t count){
+        std::vector<T> sorted(count);
+        for (uint32_t i = 0; i < values.size(); i++){
+            if (targets[i] >= 0){
+                sorted[targets[i]] = values[i];
+            }
+        }
+        values.swap(sorted);
+    }
+
+    /** @brief Column major affine matrix of scale, then rotation, then translation */
+    inline void compose(const glm::vec3& t, const glm::quat& q, const glm::vec3& s, float* m){
+        float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+        float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+        float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+        m[0] = (1.0f - 2.0f * (yy + zz)) * s.x;
+        m[1] = 2.0f * (xy + wz) * s.x;
+        m[2] = 2.0f * (xz - wy) * s.x;
+        m[3] = 0.0f;
+        m[4] = 2.0f * (xy - wz) * s.y;
+        m[5] = (1.0f - 2.0f * (xx + zz)) * s.y;
+        m[6] = 2.0f * (yz + wx) * s.y;
+        m[7] = 0.0f;
+        m[8] = 2.0f * (xz + wy) * s.z;
+        m[9] = 2.0f * (yz - wx) * s.z;
+        m[10] = (1.0f - 2.0f * (xx + yy)) * s.z;
+        m[11] = 0.0f;
+        m[12] = t.x;
+        m[13] = t.y;
+        m[14] = t.z;
+        m[15] = 1.0f;
+    }
+
+    /** @brief out = parent * local for an affine local matrix, the last row of local is skipped */
+    inline void multiplyAffine(const float* parent, const float* local, float* out){
+#if defined(TRANSFORM_SSE)
+        __m128 c0 = _mm_loadu_ps(parent), c1 = _mm_loadu_ps(parent + 4), c2 = _mm_loadu_ps(parent + 8), c3 = _mm_loadu_ps(parent + 12);
+        for (int j = 0; j < 3; j++){
+            const float* l = local + j * 4;
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(l[0])), _mm_mul_ps(c1, _mm_set1_ps(l[1]))), _mm_mul_ps(c2, _mm_set1_ps(l[2])));
+            _mm_storeu_ps(out + j * 4, r);
+        }
+        const float* t = local + 12;
+        __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(t[0])), _mm_mul_ps(c1, _mm_set1_ps(t[1]))), _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(t[2])), c3));
+        _mm_storeu_ps(out + 12, r);
+#elif defined(TRANSFORM_NEON)
+        float32x4_t c0 = vld1q_f32(parent), c1 = vld1q_f32(parent + 4), c2 = vld1q_f32(parent + 8), c3 = vld1q_f32(parent + 12);
+        for (int j = 0; j < 3; j++){
+            const float* l = local + j * 4;
+            vst1q_f32(out + j * 4, vmlaq_n_f32(vmlaq_n_f32(vmulq_n_f32(c0, l[0]), c1, l[1]), c2, l[2]));
+        }
+        const float* t = local + 12;
+        vst1q_f32(out + 12, vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(c3, c0, t[0]), c1, t[1]), c2, t[2]));
+#else
+        for (int j = 0; j < 4; j++){
+            const float* l = local + j * 4;
+            for (int i = 0; i < 4; i++){
+                out[j * 4 + i] = parent[i] * l[0] + parent[4 + i] * l[1] + parent[8 + i] * l[2] + (j == 3 ? parent[12 + i] : 0.0f);
+            }
+        }
+#endif
+    }
+}
+
+trb::scene::TransformId trb::scene::TransformHierarchy::create(TransformId parent){
+    TransformId id;
+    if (!freeIds.empty()){
+        id = freeIds.back();
+        freeIds.pop_back();
+    }
+    else{
+        id = (TransformId)slots.size();
+        slots.push_back(TRANSFORM_NONE);
+    }
+    uint32_t s = (uint32_t)ids.size();
+    int32_t parentSlot = parent == TRANSFORM_NONE ? -1 : (int32_t)slot(parent);
+    slots[id] = s;
+    translations.push_back(glm::vec3(0.0f));
+    rotations.push_back(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+    scales.push_back(glm::vec3(1.0f));
+    worlds.push_back(glm::mat4(1.0f));
+    parents.push_back(parentSlot);
+    dirty.push_back(0);
+    changed.push_back(0);
+    dead.push_back(0);
+    ids.push_back(id);
+    depths.push_back(parentSlot < 0 ? 0 : depths[parentSlot] + 1);
+    touch(s);
+
+    // nodes created breadth first extend the last level or add one, anything else needs sorting
+    uint32_t levels = levelStarts.empty() ? 0 : (uint32_t)levelStarts.size() - 1;
+    if (!reorder && levels > 0 && depths[s] + 1 == levels){
+        levelStarts.back()++;
+    }
+    else if (!reorder && depths[s] == levels){
+        if (levelStarts.empty()){
+            levelStarts.push_back(0);
+        }
+        levelStarts.push_back(s + 1);
+    }
+    else{
+        reorder = true;
+    }
+    return id;
+}
+
+void trb::scene::TransformHierarchy::destroy(TransformId id){
+    if (isAlive(id)){
+        dead[slot(id)] = 1;
+        reorder = true;
+    }
+}
+
+void trb::scene::TransformHierarchy::setParent(TransformId id, TransformId parent){
+    uint32_t s = slot(id);
+    int32_t parentSlot = parent == TRANSFORM_NONE ? -1 : (int32_t)slot(parent);
+    for (int32_t ancestor = parentSlot; ancestor >= 0; ancestor = parents[ancestor]){
+        if ((uint32_t)ancestor == s){
+            throw std::runtime_error("transform parent is the node itself or one of its descendants");
+        }
+    }
+    parents[s] = parentSlot;
+    touch(s);
+    reorder = true;
+}
+
+void trb::scene::TransformHierarchy::sort(){
+    uint32_t count = (uint32_t)ids.size();
+    // depth of every node, after reparenting parents may sit behind their children
+    std::vector<int32_t> depth(count, -1);
+    std::vector<uint32_t> chain;
+    uint32_t levels = 0;
+    for (uint32_t i = 0; i < count; i++){
+        int32_t node = (int32_t)i;
+        while (node >= 0 && depth[node] == -1){
+            chain.push_back((uint32_t)node);
+            node = parents[node];
+        }
+        int32_t d = node < 0 ? -1 : depth[node];
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it){
+            d = d == REMOVED || dead[*it] ? REMOVED : d + 1;
+            depth[*it] = d;
+            if (d >= 0){
+                levels = std::max(levels, (uint32_t)d + 1);
+            }
+        }
+        chain.clear();
+    }
+
+    // counting sort by depth, stable so siblings stay next to each other
+    levelStarts.assign(levels + 1, 0);
+    for (uint32_t i = 0; i < count; i++){
+        if (depth[i] >= 0){
+            levelStarts[depth[i] + 1]++;
+        }
+    }
+    for (uint32_t d = 0; d < levels; d++){
+        levelStarts[d + 1] += levelStarts[d];
+    }
+    std::vector<uint32_t> next(levelStarts.begin(), levelStarts.end() - 1);
+    std::vector<int32_t> targets(count);
+    for (uint32_t i = 0; i < count; i++){
+        if (depth[i] >= 0){
+            targets[i] = (int32_t)next[depth[i]]++;
+        }
+        else{
+            targets[i] = -1;
+            slots[ids[i]] = TRANSFORM_NONE;
+            freeIds.push_back(ids[i]);
+        }
+    }
+    for (uint32_t i = 0; i < count; i++){
+        if (targets[i] >= 0){
+            parents[i] = parents[i] < 0 ? -1 : targets[parents[i]];
+            depths[i] = (uint32_t)depth[i];
+        }
+    }
+    uint32_t kept = levelStarts.back();
+    permute(translations, targets, kept);
+    permute(rotations, targets, kept);
+    permute(scales, targets, kept);
+    permute(worlds, targets, kept);
+    permute(parents, targets, kept);
+    permute(dirty, targets, kept);
+    permute(changed, targets, kept);
+    permute(dead, targets, kept);
+    permute(ids, targets, kept);
+    permute(depths, targets, kept);
+    for (uint32_t i = 0; i < kept; i++){
+        slots[ids[i]] = i;
+    }
+    reorder = false;
+}
+
+uint32_t trb::scene::TransformHierarchy::updateRange(uint32_t begin, uint32_t end){
+    uint32_t updated = 0;
+    float local[16];
+    for (uint32_t i = begin; i < end; i++){
+        int32_t parent = parents[i];
+        uint8_t recompute = dirty[i] | (parent >= 0 ? changed[parent] : 0);
+        changed[i] = recompute;
+        if (!recompute){
+            continue;
+        }
+        dirty[i] = 0;
+        float* world = &worlds[i][0][0];
+        if (parent < 0){
+            compose(translations[i], rotations[i], scales[i], world);
+        }
+        else{
+            compose(translations[i], rotations[i], scales[i], local);
+            multiplyAffine(&worlds[parent][0][0], local, world);
+        }
+        updated++;
+    }
+    return updated;
+}
+
+void trb::scene::TransformHierarchy::update(core::JobSystem* jobs){
+    if (reorder){
+        sort();
+    }
+    stats.nodes = (uint32_t)ids.size();
+    stats.levels = levelStarts.empty() ? 0 : (uint32_t)levelStarts.size() - 1;
+    // with nothing set and nothing changed last time every flag is already clear
+    if (!anyDirty && stats.updated == 0){
+        return;
+    }
+    anyDirty = false;
+    uint32_t updated = 0;
+    for (uint32_t level = 0; level < stats.levels; level++){
+        uint32_t begin = levelStarts[level];
+        uint32_t end = levelStarts[level + 1];
+        if (jobs && end - begin > TRANSFORM_BATCH){
+            std::atomic<uint32_t> levelUpdated(0);
+            // one byte elements keep the flags of different jobs on different cache lines
+            jobs->wait(jobs->parallelFor(end - begin, 1, [&](uint32_t first, uint32_t last){
+                levelUpdated += updateRange(begin + first, begin + last);
+            }, TRANSFORM_BATCH));
+            updated += levelUpdated;
+        }
+        else{
+            updated += updateRange(begin, end);
+        }
+    }
+    stats.updated = updated;
+}
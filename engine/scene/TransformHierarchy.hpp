@@ -0,0 +1,132 @@
+#ifndef TRB_SCENE_TransformHierarchy_H_
+#define TRB_SCENE_TransformHierarchy_H_
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "../core/JobSystem.hpp"
+
+// Nodes one job updates, levels with fewer nodes are updated on the calling thread
+#define TRANSFORM_BATCH 512
+#define TRANSFORM_NONE UINT32_MAX
+
+namespace trb{
+    namespace scene{
+
+        /** @brief Handle of a node, stays the same when the nodes are reordered */
+        typedef uint32_t TransformId;
+
+        struct TransformStats{
+            uint32_t nodes = 0;
+            uint32_t levels = 0;
+            /** @brief World matrices recomputed by the last update */
+            uint32_t updated = 0;
+        };
+
+        /**
+        * @brief Local and world transforms of a node hierarchy
+        *
+        * Translation, rotation, scale and the world matrix live in separate arrays sorted by depth, all roots first,
+        * then their children and so on. update() walks the levels in order, so a parent's world matrix is final when
+        * its children read it, and splits every level over the job system. A node is recomputed when it was set since
+        * the last update or its parent was recomputed, clean subtrees cost one flag test per node.
+        *
+        * Creating, destroying and reparenting nodes only flag the order as stale, the arrays are sorted again on the
+        * next update. Setters and update() must not run at the same time.
+        */
+        class TransformHierarchy{
+            private:
+                // sorted by depth, indexed by slot
+                std::vector<glm::vec3> translations;
+                std::vector<glm::quat> rotations;
+                std::vector<glm::vec3> scales;
+                std::vector<glm::mat4> worlds;
+                /** @brief Slot of the parent, -1 for roots */
+                std::vector<int32_t> parents;
+                /** @brief Set by the setters */
+                std::vector<uint8_t> dirty;
+                /** @brief Set by update() for recomputed world matrices */
+                std::vector<uint8_t> changed;
+                /** @brief Destroyed, removed with its subtree when the arrays are sorted */
+                std::vector<uint8_t> dead;
+                std::vector<TransformId> ids;
+                std::vector<uint32_t> depths;
+
+                std::vector<uint32_t> slots;
+                std::vector<TransformId> freeIds;
+                /** @brief First slot of every depth, one entry more than levels */
+                std::vector<uint32_t> levelStarts;
+                bool reorder = false;
+                bool anyDirty = false;
+                TransformStats stats;
+
+                void sort();
+                /** @brief Recompute the nodes of one level in [begin, end), returns the number recomputed */
+                uint32_t updateRange(uint32_t begin, uint32_t end);
+                uint32_t slot(TransformId id) const { return slots[id]; }
+                void touch(uint32_t slot){
+                    dirty[slot] = 1;
+                    anyDirty = true;
+                }
+
+            public:
+                /**
+                * Add a node with an identity local transform
+                *
+                * @param parent (Optional) TRANSFORM_NONE for a root
+                */
+                TransformId create(TransformId parent = TRANSFORM_NONE);
+
+                /** @brief Remove a node and all of its descendants, their ids are reused */
+                void destroy(TransformId id);
+
+                /** @brief Move a node with its subtree under another parent, the local transform is kept */
+                void setParent(TransformId id, TransformId parent);
+
+                void setLocal(TransformId id, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale){
+                    uint32_t s = slot(id);
+                    translations[s] = translation;
+                    rotations[s] = rotation;
+                    scales[s] = scale;
+                    touch(s);
+                }
+                void setTranslation(TransformId id, const glm::vec3& translation){ translations[slot(id)] = translation; touch(slot(id)); }
+                void setRotation(TransformId id, const glm::quat& rotation){ rotations[slot(id)] = rotation; touch(slot(id)); }
+                void setScale(TransformId id, const glm::vec3& scale){ scales[slot(id)] = scale; touch(slot(id)); }
+
+                /**
+                * Recompute the world matrices of the changed subtrees
+                *
+                * @param jobs (Optional) Split levels of more than TRANSFORM_BATCH nodes over the job system and wait for them
+                */
+                void update(core::JobSystem* jobs = nullptr);
+
+                const glm::vec3& getTranslation(TransformId id) const { return translations[slot(id)]; }
+                const glm::quat& getRotation(TransformId id) const { return rotations[slot(id)]; }
+                const glm::vec3& getScale(TransformId id) const { return scales[slot(id)]; }
+                /** @brief World matrix as of the last update() */
+                const glm::mat4& getWorld(TransformId id) const { return worlds[slot(id)]; }
+                /** @brief Whether the last update() recomputed the world matrix */
+                bool isChanged(TransformId id) const { return changed[slot(id)] != 0; }
+                TransformId getParent(TransformId id) const {
+                    int32_t parent = parents[slot(id)];
+                    return parent < 0 ? TRANSFORM_NONE : ids[parent];
+                }
+                bool isAlive(TransformId id) const { return id < slots.size() && slots[id] != TRANSFORM_NONE && !dead[slots[id]]; }
+
+                /** @brief World matrices in slot order for bulk copies, slots are stable between structural changes */
+                const glm::mat4* getWorlds() const { return worlds.data(); }
+                uint32_t getSlot(TransformId id) const { return slot(id); }
+                uint32_t getCount() const { return (uint32_t)ids.size(); }
+                /** @brief Counters of the last update */
+                const TransformStats& getStats() const { return stats; }
+        };
+    }
+}
+
+#endif
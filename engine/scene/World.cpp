@@ -0,0 +1,210 @@
+#include "World.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+
+namespace{
+
+    trb::scene::ComponentInfo componentInfos[ECS_MAX_COMPONENTS];
+    std::atomic<uint32_t> componentCount(0);
+    std::mutex componentMutex;
+
+    uint32_t alignUp(uint32_t value, uint32_t alignment){
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    trb::scene::Chunk allocateChunk(){
+        trb::scene::Chunk chunk;
+        chunk.memory = new uint8_t[ECS_CHUNK_SIZE + CACHE_LINE_SIZE];
+        chunk.data = chunk.memory + (CACHE_LINE_SIZE - (uintptr_t)chunk.memory % CACHE_LINE_SIZE) % CACHE_LINE_SIZE;
+        return chunk;
+    }
+}
+
+trb::scene::ComponentId trb::scene::registerComponent(const ComponentInfo& info){
+    std::lock_guard<std::mutex> lock(componentMutex);
+    uint32_t id = componentCount.load();
+    if (id >= ECS_MAX_COMPONENTS){
+        throw std::runtime_error("too many component types, raise ECS_MAX_COMPONENTS");
+    }
+    if (info.alignment > CACHE_LINE_SIZE){
+        throw std::runtime_error("component alignment above the chunk alignment");
+    }
+    componentInfos[id] = info;
+    componentCount.store(id + 1);
+    return id;
+}
+
+const trb::scene::ComponentInfo& trb::scene::getComponentInfo(ComponentId id){
+    return componentInfos[id];
+}
+
+trb::scene::Archetype::Archetype(ComponentMask mask) : mask(mask) {
+    uint32_t rowSize = sizeof(Entity);
+    for (ComponentId id = 0; id < ECS_MAX_COMPONENTS; id++){
+        columns[id] = ECS_NO_COLUMN;
+        addEdges[id] = nullptr;
+        removeEdges[id] = nullptr;
+        if (mask & (1ull << id)){
+            components.push_back(id);
+            rowSize += getComponentInfo(id).size;
+        }
+    }
+    // shrink the row count until the padding between the arrays fits too
+    for (capacity = ECS_CHUNK_SIZE / rowSize; capacity > 0; capacity--){
+        uint32_t offset = capacity * sizeof(Entity);
+        for (ComponentId id : components){
+            const ComponentInfo& info = getComponentInfo(id);
+            offset = alignUp(offset, info.alignment);
+            columns[id] = offset;
+            offset += capacity * info.size;
+        }
+        if (offset <= ECS_CHUNK_SIZE){
+            break;
+        }
+    }
+    if (capacity == 0){
+        throw std::runtime_error("components of an entity exceed ECS_CHUNK_SIZE");
+    }
+}
+
+trb::scene::World::World(){
+    root = getArchetype(0);
+}
+
+trb::scene::World::~World(){
+    for (auto& archetype : archetypes){
+        for (Chunk& chunk : archetype->chunks){
+            for (ComponentId id : archetype->components){
+                const ComponentInfo& info = getComponentInfo(id);
+                uint8_t* column = (uint8_t*)archetype->column(chunk, id);
+                for (uint32_t row = 0; row < chunk.count; row++){
+                    info.destruct(column + row * info.size);
+                }
+            }
+            delete[] chunk.memory;
+        }
+    }
+}
+
+trb::scene::Archetype* trb::scene::World::getArchetype(ComponentMask mask){
+    for (auto& archetype : archetypes){
+        if (archetype->mask == mask){
+            return archetype.get();
+        }
+    }
+    archetypes.emplace_back(new Archetype(mask));
+    return archetypes.back().get();
+}
+
+trb::scene::Archetype* trb::scene::World::addEdge(Archetype* archetype, ComponentId id){
+    if (!archetype->addEdges[id]){
+        Archetype* target = getArchetype(archetype->mask | (1ull << id));
+        archetype->addEdges[id] = target;
+        target->removeEdges[id] = archetype;
+    }
+    return archetype->addEdges[id];
+}
+
+trb::scene::Archetype* trb::scene::World::removeEdge(Archetype* archetype, ComponentId id){
+    if (!archetype->removeEdges[id]){
+        Archetype* target = getArchetype(archetype->mask & ~(1ull << id));
+        archetype->removeEdges[id] = target;
+        target->addEdges[id] = archetype;
+    }
+    return archetype->removeEdges[id];
+}
+
+void trb::scene::World::allocateRow(Archetype* archetype, Entity entity, uint32_t* chunk, uint32_t* row){
+    if (archetype->chunks.empty() || archetype->chunks.back().count == archetype->capacity){
+        archetype->chunks.push_back(allocateChunk());
+    }
+    Chunk& last = archetype->chunks.back();
+    *chunk = (uint32_t)archetype->chunks.size() - 1;
+    *row = last.count++;
+    archetype->entities(last)[*row] = entity;
+    archetype->count++;
+}
+
+void trb::scene::World::removeRow(Archetype* archetype, uint32_t chunk, uint32_t row){
+    uint32_t lastChunk = (uint32_t)archetype->chunks.size() - 1;
+    Chunk& last = archetype->chunks[lastChunk];
+    uint32_t lastRow = last.count - 1;
+    if (chunk != lastChunk || row != lastRow){
+        Chunk& hole = archetype->chunks[chunk];
+        for (ComponentId id : archetype->components){
+            const ComponentInfo& info = getComponentInfo(id);
+            info.relocate((uint8_t*)archetype->column(hole, id) + row * info.size, (uint8_t*)archetype->column(last, id) + lastRow * info.size);
+        }
+        Entity moved = archetype->entities(last)[lastRow];
+        archetype->entities(hole)[row] = moved;
+        EntityRecord& record = records[indexOf(moved)];
+        record.chunk = chunk;
+        record.row = row;
+    }
+    archetype->count--;
+    if (--last.count == 0){
+        delete[] last.memory;
+        archetype->chunks.pop_back();
+    }
+}
+
+void trb::scene::World::move(Entity entity, Archetype* target){
+    EntityRecord& record = records[indexOf(entity)];
+    Archetype* source = record.archetype;
+    uint32_t chunk, row;
+    allocateRow(target, entity, &chunk, &row);
+    Chunk& from = source->chunks[record.chunk];
+    Chunk& to = target->chunks[chunk];
+    for (ComponentId id : source->components){
+        const ComponentInfo& info = getComponentInfo(id);
+        uint8_t* component = (uint8_t*)source->column(from, id) + record.row * info.size;
+        if (target->has(id)){
+            info.relocate((uint8_t*)target->column(to, id) + row * info.size, component);
+        }
+        else{
+            info.destruct(component);
+        }
+    }
+    removeRow(source, record.chunk, record.row);
+    record.archetype = target;
+    record.chunk = chunk;
+    record.row = row;
+}
+
+trb::scene::Entity trb::scene::World::create(){
+    uint32_t index;
+    if (!freeIndices.empty()){
+        index = freeIndices.back();
+        freeIndices.pop_back();
+    }
+    else{
+        index = (uint32_t)records.size();
+        records.push_back(EntityRecord());
+    }
+    EntityRecord& record = records[index];
+    Entity entity = ((Entity)record.generation << 32) | index;
+    record.archetype = root;
+    allocateRow(root, entity, &record.chunk, &record.row);
+    entityCount++;
+    return entity;
+}
+
+void trb::scene::World::destroy(Entity entity){
+    if (!isAlive(entity)){
+        return;
+    }
+    EntityRecord& record = records[indexOf(entity)];
+    Archetype* archetype = record.archetype;
+    Chunk& chunk = archetype->chunks[record.chunk];
+    for (ComponentId id : archetype->components){
+        const ComponentInfo& info = getComponentInfo(id);
+        info.destruct((uint8_t*)archetype->column(chunk, id) + record.row * info.size);
+    }
+    removeRow(archetype, record.chunk, record.row);
+    record.archetype = nullptr;
+    record.generation++;
+    freeIndices.push_back(indexOf(entity));
+    entityCount--;
+}
@@ -0,0 +1,346 @@
+#ifndef TRB_SCENE_World_H_
+#define TRB_SCENE_World_H_
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <new>
+#include <type_traits>
+
+#include "../core/JobSystem.hpp"
+
+// Bytes of one archetype chunk, a chunk holds the components of as many entities as fit side by side
+#define ECS_CHUNK_SIZE (16 * 1024)
+// Component types a program can register, one bit each in a ComponentMask
+#define ECS_MAX_COMPONENTS 64
+#define ECS_NULL_ENTITY 0ull
+#define ECS_NO_COLUMN UINT32_MAX
+
+namespace trb{
+    namespace scene{
+
+        /** @brief Generation in the upper and index in the lower 32 bits, stale handles of destroyed entities are detected */
+        typedef uint64_t Entity;
+        typedef uint32_t ComponentId;
+        typedef uint64_t ComponentMask;
+
+        /** @brief How the storage handles a component type without knowing it */
+        struct ComponentInfo{
+            uint32_t size;
+            uint32_t alignment;
+            void (*destruct)(void* component);
+            /** @brief Move construct at to from from and destroy from */
+            void (*relocate)(void* to, void* from);
+
+            template <typename T>
+            static ComponentInfo of(){
+                ComponentInfo info;
+                info.size = sizeof(T);
+                info.alignment = alignof(T);
+                info.destruct = [](void* component){ ((T*)component)->~T(); };
+                info.relocate = [](void* to, void* from){
+                    new (to) T(std::move(*(T*)from));
+                    ((T*)from)->~T();
+                };
+                return info;
+            }
+        };
+
+        /** @brief Assign the next id to a component type, thread safe */
+        ComponentId registerComponent(const ComponentInfo& info);
+        const ComponentInfo& getComponentInfo(ComponentId id);
+
+        /** @brief Id of a component type, assigned on first use */
+        template <typename T>
+        ComponentId componentId(){
+            static const ComponentId id = registerComponent(ComponentInfo::of<typename std::decay<T>::type>());
+            return id;
+        }
+
+        template <typename T>
+        ComponentMask componentBit(){
+            return 1ull << componentId<T>();
+        }
+
+        /** @brief ECS_CHUNK_SIZE bytes: the entity ids of the rows followed by one array per component */
+        struct Chunk{
+            /** @brief Aligned to CACHE_LINE_SIZE inside memory */
+            uint8_t* data = nullptr;
+            uint8_t* memory = nullptr;
+            uint32_t count = 0;
+        };
+
+        /**
+        * @brief Storage of all entities that have exactly the same set of components
+        *
+        * Entities are packed into chunks without holes, only the last chunk is partly filled. Each component has
+        * its own array in a chunk (structure of arrays) so a system touching two components streams through two
+        * contiguous arrays.
+        */
+        class Archetype{
+            public:
+                ComponentMask mask = 0;
+                std::vector<ComponentId> components;
+                /** @brief Byte offset of the array of every component in a chunk, ECS_NO_COLUMN if absent */
+                uint32_t columns[ECS_MAX_COMPONENTS];
+                /** @brief Entities per chunk */
+                uint32_t capacity = 0;
+                uint32_t count = 0;
+                std::vector<Chunk> chunks;
+                /** @brief Archetype with one component more or less, filled in as entities move */
+                Archetype* addEdges[ECS_MAX_COMPONENTS];
+                Archetype* removeEdges[ECS_MAX_COMPONENTS];
+
+                explicit Archetype(ComponentMask mask);
+
+                bool has(ComponentId id) const { return columns[id] != ECS_NO_COLUMN; }
+                Entity* entities(const Chunk& chunk) const { return (Entity*)chunk.data; }
+                void* column(const Chunk& chunk, ComponentId id) const { return chunk.data + columns[id]; }
+                template <typename T>
+                T* column(const Chunk& chunk) const { return (T*)(chunk.data + columns[componentId<T>()]); }
+        };
+
+        class World;
+
+        /**
+        * @brief Iterates the entities that have all of Components, archetype matches are cached
+        *
+        * The query remembers the archetypes it has looked at, new archetypes are checked once when the query runs
+        * next. Entities must not be created, destroyed or change components while a query iterates.
+        */
+        template <typename... Components>
+        class Query{
+            private:
+                World* world;
+                ComponentMask include;
+                ComponentMask exclude = 0;
+                std::vector<Archetype*> archetypes;
+                size_t scanned = 0;
+                std::vector<std::pair<Archetype*, uint32_t>> chunkList;
+
+                template <typename Function>
+                static void eachRow(Function& function, uint32_t count, Components*... arrays){
+                    for (uint32_t i = 0; i < count; i++){
+                        function(arrays[i]...);
+                    }
+                }
+
+                /** @brief Every non-empty chunk of the matching archetypes, the unit of parallel work */
+                void gatherChunks(){
+                    refresh();
+                    chunkList.clear();
+                    for (Archetype* archetype : archetypes){
+                        for (uint32_t c = 0; c < archetype->chunks.size(); c++){
+                            chunkList.push_back(std::make_pair(archetype, c));
+                        }
+                    }
+                }
+
+            public:
+                explicit Query(World* world);
+
+                /** @brief Skip entities that have T */
+                template <typename T>
+                Query& without(){
+                    exclude |= componentBit<T>();
+                    archetypes.clear();
+                    scanned = 0;
+                    return *this;
+                }
+
+                /** @brief Pick up archetypes created since the last run */
+                void refresh();
+
+                /**
+                * Call function(uint32_t count, const Entity* entities, Components*... arrays) for every chunk
+                */
+                template <typename Function>
+                void eachChunk(Function function){
+                    refresh();
+                    for (Archetype* archetype : archetypes){
+                        for (const Chunk& chunk : archetype->chunks){
+                            function(chunk.count, (const Entity*)archetype->entities(chunk), archetype->template column<Components>(chunk)...);
+                        }
+                    }
+                }
+
+                /** @brief Call function(Components&...) for every entity */
+                template <typename Function>
+                void each(Function function){
+                    refresh();
+                    for (Archetype* archetype : archetypes){
+                        for (const Chunk& chunk : archetype->chunks){
+                            eachRow(function, chunk.count, archetype->template column<Components>(chunk)...);
+                        }
+                    }
+                }
+
+                /** @brief eachChunk() with the chunks spread over the job system, function runs concurrently */
+                template <typename Function>
+                void parallelEachChunk(core::JobSystem* jobs, Function function){
+                    gatherChunks();
+                    jobs->wait(jobs->parallelFor((uint32_t)chunkList.size(), CACHE_LINE_SIZE, [&](uint32_t begin, uint32_t end){
+                        for (uint32_t i = begin; i < end; i++){
+                            Archetype* archetype = chunkList[i].first;
+                            const Chunk& chunk = archetype->chunks[chunkList[i].second];
+                            function(chunk.count, (const Entity*)archetype->entities(chunk), archetype->template column<Components>(chunk)...);
+                        }
+                    }, 1));
+                }
+
+                /** @brief each() with the chunks spread over the job system, function runs concurrently */
+                template <typename Function>
+                void parallelEach(core::JobSystem* jobs, Function function){
+                    gatherChunks();
+                    jobs->wait(jobs->parallelFor((uint32_t)chunkList.size(), CACHE_LINE_SIZE, [&](uint32_t begin, uint32_t end){
+                        for (uint32_t i = begin; i < end; i++){
+                            Archetype* archetype = chunkList[i].first;
+                            const Chunk& chunk = archetype->chunks[chunkList[i].second];
+                            eachRow(function, chunk.count, archetype->template column<Components>(chunk)...);
+                        }
+                    }, 1));
+                }
+
+                /** @brief Entities the query currently matches */
+                uint32_t count(){
+                    refresh();
+                    uint32_t total = 0;
+                    for (Archetype* archetype : archetypes){
+                        total += archetype->count;
+                    }
+                    return total;
+                }
+        };
+
+        /**
+        * @brief Entities and their components, stored by archetype
+        *
+        * Adding or removing a component moves the entity to the archetype of its new component set, the archetypes
+        * remember these transitions so repeated moves skip the lookup. Component types need to be move constructible.
+        */
+        class World{
+            private:
+                struct EntityRecord{
+                    Archetype* archetype = nullptr;
+                    uint32_t chunk = 0;
+                    uint32_t row = 0;
+                    uint32_t generation = 1;
+                };
+
+                std::vector<std::unique_ptr<Archetype>> archetypes;
+                Archetype* root = nullptr;
+                std::vector<EntityRecord> records;
+                std::vector<uint32_t> freeIndices;
+                uint32_t entityCount = 0;
+
+                static uint32_t indexOf(Entity entity){ return (uint32_t)entity; }
+                static uint32_t generationOf(Entity entity){ return (uint32_t)(entity >> 32); }
+
+                Archetype* getArchetype(ComponentMask mask);
+                Archetype* addEdge(Archetype* archetype, ComponentId id);
+                Archetype* removeEdge(Archetype* archetype, ComponentId id);
+                /** @brief Append a row for entity to the last chunk of archetype */
+                void allocateRow(Archetype* archetype, Entity entity, uint32_t* chunk, uint32_t* row);
+                /** @brief Fill the hole of a row whose components are gone with the last row of the archetype */
+                void removeRow(Archetype* archetype, uint32_t chunk, uint32_t row);
+                /** @brief Move an entity to target, components target lacks are destroyed, new ones are left unconstructed */
+                void move(Entity entity, Archetype* target);
+
+                template <typename T>
+                T* slot(Entity entity){
+                    const EntityRecord& record = records[indexOf(entity)];
+                    return record.archetype->template column<T>(record.archetype->chunks[record.chunk]) + record.row;
+                }
+
+            public:
+                World();
+                ~World();
+                World(const World&) = delete;
+                World& operator=(const World&) = delete;
+
+                Entity create();
+
+                /** @brief Create an entity with its components in place, one move into the final archetype */
+                template <typename... Components>
+                Entity create(Components... components){
+                    Entity entity = create();
+                    ComponentMask mask = 0;
+                    int bits[] = { 0, ((mask |= componentBit<Components>()), 0)... };
+                    (void)bits;
+                    move(entity, getArchetype(mask));
+                    int constructed[] = { 0, (new (slot<Components>(entity)) Components(std::move(components)), 0)... };
+                    (void)constructed;
+                    return entity;
+                }
+
+                void destroy(Entity entity);
+
+                bool isAlive(Entity entity) const {
+                    uint32_t index = indexOf(entity);
+                    return index < records.size() && records[index].generation == generationOf(entity) && records[index].archetype;
+                }
+
+                /** @brief Add a component or overwrite the one the entity has */
+                template <typename T>
+                T& add(Entity entity, T component = T()){
+                    ComponentId id = componentId<T>();
+                    Archetype* archetype = records[indexOf(entity)].archetype;
+                    if (archetype->has(id)){
+                        T* existing = slot<T>(entity);
+                        *existing = std::move(component);
+                        return *existing;
+                    }
+                    move(entity, addEdge(archetype, id));
+                    return *new (slot<T>(entity)) T(std::move(component));
+                }
+
+                template <typename T>
+                void remove(Entity entity){
+                    ComponentId id = componentId<T>();
+                    Archetype* archetype = records[indexOf(entity)].archetype;
+                    if (archetype->has(id)){
+                        move(entity, removeEdge(archetype, id));
+                    }
+                }
+
+                template <typename T>
+                bool has(Entity entity) const {
+                    return isAlive(entity) && records[indexOf(entity)].archetype->has(componentId<T>());
+                }
+
+                /** @brief Component of an entity, nullptr if it has none. Valid until the entity changes archetype */
+                template <typename T>
+                T* get(Entity entity){
+                    return has<T>(entity) ? slot<T>(entity) : nullptr;
+                }
+
+                template <typename... Components>
+                Query<Components...> query(){
+                    return Query<Components...>(this);
+                }
+
+                const std::vector<std::unique_ptr<Archetype>>& getArchetypes() const { return archetypes; }
+                uint32_t getEntityCount() const { return entityCount; }
+        };
+
+        template <typename... Components>
+        Query<Components...>::Query(World* world) : world(world), include(0) {
+            int bits[] = { 0, ((include |= componentBit<Components>()), 0)... };
+            (void)bits;
+        }
+
+        template <typename... Components>
+        void Query<Components...>::refresh(){
+            const auto& all = world->getArchetypes();
+            for (; scanned < all.size(); scanned++){
+                Archetype* archetype = all[scanned].get();
+                if ((archetype->mask & include) == include && (archetype->mask & exclude) == 0){
+                    archetypes.push_back(archetype);
+                }
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef TRB_TOOLS_CookDatabase_H_
+#define TRB_TOOLS_CookDatabase_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+#include "FileSystem.hpp"
+
+#define COOK_DATABASE_HEADER "TRBCOOKDB 1"
+
+namespace trb{
+    namespace tools{
+
+        /** @brief 64 bit FNV-1a, continue a hash by passing it back in as seed */
+        inline uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ull){
+            const uint8_t* bytes = (const uint8_t*)data;
+            uint64_t hash = seed;
+            for (size_t i = 0; i < size; i++){
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        /** @brief Content hash of a file, 0 if it can not be read */
+        inline uint64_t hashFile(const std::string& path){
+            FILE* file = fopen(path.c_str(), "rb");
+            if (!file){
+                return 0;
+            }
+            uint64_t hash = 14695981039346656037ull;
+            std::vector<char> buffer(1 << 20);
+            size_t read;
+            while ((read = fread(buffer.data(), 1, buffer.size(), file)) > 0){
+                hash = hashBytes(buffer.data(), read, hash);
+            }
+            fclose(file);
+            return hash;
+        }
+
+        /**
+        * @brief A file a cooked asset was built from
+        *
+        * Size and mtime are a cheap first check, the content hash decides when they changed: touching a file or
+        * checking it out again does not trigger a re-cook.
+        */
+        struct CookDependency{
+            std::string path;
+            uint64_t size = 0;
+            int64_t mtime = 0;
+            uint64_t hash = 0;
+
+            /** @brief Fill size, mtime and hash from the file on disk */
+            bool capture(){
+                return fileStat(path, &size, &mtime) && (hash = hashFile(path)) != 0;
+            }
+        };
+
+        struct CookRecord{
+            std::string source;
+            std::string output;
+            /** @brief Hash of the cooker version and settings the output was built with */
+            uint64_t settings = 0;
+            std::vector<CookDependency> dependencies;
+        };
+
+        /**
+        * @brief What was cooked from what, persisted next to the cooked assets
+        *
+        * Text file, one "S source output settings" line per record followed by its "D path size mtime hash" lines,
+        * fields separated by tabs.
+        */
+        class CookDatabase{
+            private:
+                std::map<std::string, CookRecord> records;
+
+            public:
+                /** @brief Load a database, a missing or unreadable file gives an empty one */
+                void load(const std::string& path){
+                    records.clear();
+                    std::ifstream in(path);
+                    std::string line;
+                    if (!std::getline(in, line) || line != COOK_DATABASE_HEADER){
+                        return;
+                    }
+                    CookRecord* record = nullptr;
+                    while (std::getline(in, line)){
+                        std::vector<std::string> fields;
+                        std::stringstream stream(line);
+                        std::string field;
+                        while (std::getline(stream, field, '\t')){
+                            fields.push_back(field);
+                        }
+                        if (fields.size() == 4 && fields[0] == "S"){
+                            record = &records[fields[1]];
+                            record->source = fields[1];
+                            record->output = fields[2];
+                            record->settings = strtoull(fields[3].c_str(), nullptr, 16);
+                        }else if (fields.size() == 5 && fields[0] == "D" && record){
+                            CookDependency dependency;
+                            dependency.path = fields[1];
+                            dependency.size = strtoull(fields[2].c_str(), nullptr, 10);
+                            dependency.mtime = strtoll(fields[3].c_str(), nullptr, 10);
+                            dependency.hash = strtoull(fields[4].c_str(), nullptr, 16);
+                            record->dependencies.push_back(dependency);
+                        }
+                    }
+                }
+
+                /** @brief Write to a temporary file and rename it over path, so an interrupted cook keeps the old database */
+                bool save(const std::string& path) const {
+                    std::string tmp = path + ".tmp";
+                    {
+                        std::ofstream out(tmp, std::ios::trunc);
+                        out << COOK_DATABASE_HEADER << "\n";
+                        for (auto& it : records){
+                            const CookRecord& record = it.second;
+                            out << "S\t" << record.source << "\t" << record.output << "\t" << std::hex << record.settings << std::dec << "\n";
+                            for (auto& dependency : record.dependencies){
+                                out << "D\t" << dependency.path << "\t" << dependency.size << "\t" << dependency.mtime << "\t"
+                                    << std::hex << dependency.hash << std::dec << "\n";
+                            }
+                        }
+                        out.close();
+                        if (!out){
+                            std::remove(tmp.c_str());
+                            return false;
+                        }
+                    }
+                    return std::rename(tmp.c_str(), path.c_str()) == 0;
+                }
+
+                /** @return Record of a source, nullptr if it was never cooked */
+                CookRecord* find(const std::string& source){
+                    auto it = records.find(source);
+                    return it == records.end() ? nullptr : &it->second;
+                }
+                void set(const CookRecord& record){
+                    records[record.source] = record;
+                }
+                void remove(const std::string& source){
+                    records.erase(source);
+                }
+                std::vector<std::string> getSources() const {
+                    std::vector<std::string> sources;
+                    for (auto& it : records){
+                        sources.push_back(it.first);
+                    }
+                    return sources;
+                }
+        };
+    }
+}
+
+#endif
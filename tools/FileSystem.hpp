@@ -0,0 +1,104 @@
+#ifndef TRB_TOOLS_FileSystem_H_
+#define TRB_TOOLS_FileSystem_H_
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace trb{
+    namespace tools{
+
+        /** @brief Append the regular files below root to files, as paths relative to root */
+        inline void listFiles(const std::string& root, std::vector<std::string>& files, const std::string& relative = ""){
+            std::string dirPath = relative.empty() ? root : root + "/" + relative;
+            DIR* dir = opendir(dirPath.c_str());
+            if (!dir){
+                throw std::runtime_error("failed to open directory " + dirPath);
+            }
+            while (dirent* entry = readdir(dir)){
+                std::string name = entry->d_name;
+                if (name == "." || name == ".."){
+                    continue;
+                }
+                std::string path = relative.empty() ? name : relative + "/" + name;
+                struct stat st;
+                if (stat((root + "/" + path).c_str(), &st) != 0){
+                    continue;
+                }
+                if (S_ISDIR(st.st_mode)){
+                    listFiles(root, files, path);
+                }else if (S_ISREG(st.st_mode)){
+                    files.push_back(path);
+                }
+            }
+            closedir(dir);
+        }
+
+        /** @brief Whole file contents, throws if it can not be read */
+        inline std::vector<char> readFile(const std::string& path){
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            if (!file.is_open()){
+                throw std::runtime_error("failed to open file " + path);
+            }
+            std::vector<char> data((size_t)file.tellg());
+            file.seekg(0);
+            file.read(data.data(), data.size());
+            return data;
+        }
+
+        /**
+        * Size and modification time of a file
+        *
+        * @return false if the file does not exist
+        */
+        inline bool fileStat(const std::string& path, uint64_t* size, int64_t* mtime){
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0){
+                return false;
+            }
+            *size = (uint64_t)st.st_size;
+#if defined(__APPLE__)
+            *mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+            *mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+            return true;
+        }
+
+        /** @brief mkdir -p of the directory part of path */
+        inline void makeParentDirectories(const std::string& path){
+            for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)){
+                if (mkdir(path.substr(0, slash).c_str(), 0755) != 0 && errno != EEXIST){
+                    throw std::runtime_error("failed to create directory " + path.substr(0, slash));
+                }
+            }
+        }
+
+        /** @brief Lower case extension including the dot, empty if there is none */
+        inline std::string extension(const std::string& path){
+            size_t dot = path.rfind('.');
+            size_t slash = path.rfind('/');
+            if (dot == std::string::npos || (slash != std::string::npos && dot < slash)){
+                return "";
+            }
+            std::string ext = path.substr(dot);
+            std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+            return ext;
+        }
+
+        /** @brief Directory part of path without the trailing slash, "." if there is none */
+        inline std::string directory(const std::string& path){
+            size_t slash = path.rfind('/');
+            return slash == std::string::npos ? "." : path.substr(0, slash);
+        }
+    }
+}
+
+#endif
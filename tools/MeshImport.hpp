@@ -0,0 +1,231 @@
+#ifndef TRB_TOOLS_MeshImport_H_
+#define TRB_TOOLS_MeshImport_H_
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+#include "assimp/Importer.hpp"
+#include "assimp/IOSystem.hpp"
+#include "assimp/IOStream.hpp"
+#include "assimp/scene.h"
+#include "assimp/postprocess.h"
+
+#include "asset/Mesh.hpp"
+
+// Post processing every cooked mesh gets, this is also what a runtime assimp load would have to run
+#define MESH_IMPORT_FLAGS (aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_GenSmoothNormals | \
+                           aiProcess_CalcTangentSpace | aiProcess_SortByPType)
+
+namespace trb{
+    namespace tools{
+
+        /** @brief Plain stdio file for RecordingIOSystem */
+        class StdioStream : public Assimp::IOStream{
+            private:
+                FILE* file;
+
+            public:
+                StdioStream(FILE* file) : file(file) {}
+                ~StdioStream(){
+                    fclose(file);
+                }
+                size_t Read(void* buffer, size_t size, size_t count){
+                    return fread(buffer, size, count, file);
+                }
+                size_t Write(const void* buffer, size_t size, size_t count){
+                    return fwrite(buffer, size, count, file);
+                }
+                aiReturn Seek(size_t offset, aiOrigin origin){
+                    int whence = origin == aiOrigin_SET ? SEEK_SET : origin == aiOrigin_CUR ? SEEK_CUR : SEEK_END;
+                    return fseek(file, (long)offset, whence) == 0 ? aiReturn_SUCCESS : aiReturn_FAILURE;
+                }
+                size_t Tell() const {
+                    return (size_t)ftell(file);
+                }
+                size_t FileSize() const {
+                    long position = ftell(file);
+                    fseek(file, 0, SEEK_END);
+                    long size = ftell(file);
+                    fseek(file, position, SEEK_SET);
+                    return (size_t)size;
+                }
+                void Flush(){
+                    fflush(file);
+                }
+        };
+
+        /**
+        * @brief File system for assimp that remembers every file an import opened
+        *
+        * Materials, external textures and similar side files end up in the list, which makes them dependencies
+        * of the cooked mesh.
+        */
+        class RecordingIOSystem : public Assimp::IOSystem{
+            private:
+                std::vector<std::string>* opened;
+
+            public:
+                RecordingIOSystem(std::vector<std::string>* opened) : opened(opened) {}
+
+                bool Exists(const char* path) const {
+                    FILE* file = fopen(path, "rb");
+                    if (file){
+                        fclose(file);
+                    }
+                    return file != nullptr;
+                }
+                char getOsSeparator() const {
+                    return '/';
+                }
+                Assimp::IOStream* Open(const char* path, const char* mode = "rb"){
+                    FILE* file = fopen(path, mode);
+                    if (!file){
+                        return nullptr;
+                    }
+                    if (std::find(opened->begin(), opened->end(), path) == opened->end()){
+                        opened->push_back(path);
+                    }
+                    return new StdioStream(file);
+                }
+                void Close(Assimp::IOStream* stream){
+                    delete stream;
+                }
+        };
+
+        /**
+        * Convert an assimp scene into a MeshData, every triangle mesh of the scene becomes a submesh
+        *
+        * @param scene Imported scene
+        * @param mesh Receives the mesh, bounds included
+        * @param split Store positions in their own stream (depth and shadow passes only fetch those) instead of
+        *        interleaving all attributes
+        */
+        inline void convertScene(const aiScene* scene, asset::MeshData* mesh, bool split){
+            bool hasUv = false, hasTangents = false;
+            uint32_t vertexCount = 0;
+            for (unsigned int m = 0; m < scene->mNumMeshes; m++){
+                const aiMesh* source = scene->mMeshes[m];
+                if (!(source->mPrimitiveTypes & aiPrimitiveType_TRIANGLE)){
+                    continue;
+                }
+                hasUv |= source->HasTextureCoords(0);
+                hasTangents |= source->HasTangentsAndBitangents();
+                vertexCount += source->mNumVertices;
+            }
+
+            *mesh = asset::MeshData();
+            mesh->vertexCount = vertexCount;
+            mesh->streams.resize(split ? 2 : 1);
+            uint32_t stream = 0;
+            auto addAttribute = [&](uint32_t semantic, uint32_t format){
+                asset::TmeshAttribute attribute;
+                attribute.semantic = semantic;
+                attribute.format = format;
+                attribute.stream = stream;
+                attribute.offset = mesh->streams[stream].stride;
+                mesh->streams[stream].stride += asset::formatSize(format);
+                mesh->attributes.push_back(attribute);
+            };
+            addAttribute(asset::eTmeshPosition, VK_FORMAT_R32G32B32_SFLOAT);
+            stream = split ? 1 : 0;
+            addAttribute(asset::eTmeshNormal, VK_FORMAT_R32G32B32_SFLOAT);
+            if (hasTangents){
+                addAttribute(asset::eTmeshTangent, VK_FORMAT_R32G32B32A32_SFLOAT);
+            }
+            if (hasUv){
+                addAttribute(asset::eTmeshUv0, VK_FORMAT_R32G32_SFLOAT);
+            }
+            for (auto& s : mesh->streams){
+                s.data.assign((size_t)s.stride * vertexCount, 0);
+            }
+
+            uint32_t baseVertex = 0;
+            for (unsigned int m = 0; m < scene->mNumMeshes; m++){
+                const aiMesh* source = scene->mMeshes[m];
+                if (!(source->mPrimitiveTypes & aiPrimitiveType_TRIANGLE)){
+                    continue;
+                }
+                for (unsigned int v = 0; v < source->mNumVertices; v++){
+                    for (auto& attribute : mesh->attributes){
+                        float value[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+                        switch (attribute.semantic){
+                            case asset::eTmeshPosition:
+                                memcpy(value, &source->mVertices[v], 3 * sizeof(float));
+                                break;
+                            case asset::eTmeshNormal:
+                                if (source->HasNormals()){
+                                    memcpy(value, &source->mNormals[v], 3 * sizeof(float));
+                                }
+                                break;
+                            case asset::eTmeshTangent:
+                                if (source->HasTangentsAndBitangents() && source->HasNormals()){
+                                    const aiVector3D& t = source->mTangents[v];
+                                    aiVector3D b = source->mNormals[v] ^ t;
+                                    value[0] = t.x;
+                                    value[1] = t.y;
+                                    value[2] = t.z;
+                                    // handedness, the shader rebuilds the bitangent as cross(n, t) * w
+                                    value[3] = (b * source->mBitangents[v]) < 0.0f ? -1.0f : 1.0f;
+                                }
+                                break;
+                            case asset::eTmeshUv0:
+                                if (source->HasTextureCoords(0)){
+                                    memcpy(value, &source->mTextureCoords[0][v], 2 * sizeof(float));
+                                }
+                                break;
+                        }
+                        asset::MeshData::Stream& s = mesh->streams[attribute.stream];
+                        memcpy(s.data.data() + (size_t)(baseVertex + v) * s.stride + attribute.offset, value, asset::formatSize(attribute.format));
+                    }
+                }
+
+                asset::TmeshSubmesh submesh;
+                memset(&submesh, 0, sizeof(submesh));
+                submesh.firstIndex = (uint32_t)mesh->indices.size();
+                submesh.vertexOffset = (int32_t)baseVertex;
+                submesh.material = source->mMaterialIndex;
+                for (unsigned int f = 0; f < source->mNumFaces; f++){
+                    const aiFace& face = source->mFaces[f];
+                    if (face.mNumIndices != 3){
+                        continue;
+                    }
+                    mesh->indices.insert(mesh->indices.end(), face.mIndices, face.mIndices + 3);
+                }
+                submesh.indexCount = (uint32_t)mesh->indices.size() - submesh.firstIndex;
+                mesh->submeshes.push_back(submesh);
+                baseVertex += source->mNumVertices;
+            }
+            mesh->computeBounds();
+        }
+
+        /**
+        * Import a model file with assimp
+        *
+        * @param dependencies (Optional) Receives every file the import read, the model itself included
+        *
+        * @return false if assimp can not read the file, error receives its message
+        */
+        inline bool importMesh(const std::string& path, asset::MeshData* mesh, bool split, std::string* error = nullptr,
+                               std::vector<std::string>* dependencies = nullptr){
+            Assimp::Importer importer;
+            if (dependencies){
+                // owned and deleted by the importer
+                importer.SetIOHandler(new RecordingIOSystem(dependencies));
+            }
+            const aiScene* scene = importer.ReadFile(path, MESH_IMPORT_FLAGS);
+            if (!scene){
+                if (error){
+                    *error = importer.GetErrorString();
+                }
+                return false;
+            }
+            convertScene(scene, mesh, split);
+            return true;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,186 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "core/JobSystem.hpp"
+#include "graphics/Bvh.hpp"
+
+// Build, update and query throughput of the BVH
+//
+//   bvh_bench [objects] [ray grid size]
+//
+// Camera rays are generated in 2x2 pixel quads so every packet is coherent, random rays show the incoherent case.
+// Packet results are checked against single ray traversal, query results against a linear scan.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double milliseconds(Clock::time_point start){
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static bool traceRays(const char* name, const trb::grfx::Bvh& bvh, const std::vector<trb::grfx::BvhRay>& rays, trb::core::JobSystem* jobs){
+    std::vector<trb::grfx::BvhRayHit> single(rays.size()), packets(rays.size());
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < rays.size(); i++){
+        bvh.raycast(rays[i], &single[i]);
+    }
+    double singleTime = milliseconds(start);
+    start = Clock::now();
+    bvh.raycast(rays.data(), (uint32_t)rays.size(), packets.data());
+    double packetTime = milliseconds(start);
+    start = Clock::now();
+    bvh.raycast(rays.data(), (uint32_t)rays.size(), packets.data(), jobs);
+    double jobTime = milliseconds(start);
+
+    uint32_t hits = 0, mismatches = 0;
+    for (size_t i = 0; i < rays.size(); i++){
+        hits += single[i].handle != BVH_NULL_HANDLE ? 1 : 0;
+        mismatches += single[i].distance != packets[i].distance ? 1 : 0;
+    }
+    auto rate = [&](double ms){ return rays.size() / ms / 1000.0; };
+    printf("%s: %zu rays, %u hit\n", name, rays.size(), hits);
+    printf("  single  %8.2f ms, %6.2f Mrays/s\n", singleTime, rate(singleTime));
+    printf("  packets %8.2f ms, %6.2f Mrays/s\n", packetTime, rate(packetTime));
+    printf("  jobs    %8.2f ms, %6.2f Mrays/s\n", jobTime, rate(jobTime));
+    if (mismatches){
+        printf("  %u packet results differ from single rays\n", mismatches);
+    }
+    return mismatches == 0;
+}
+
+int main(int argc, char** argv){
+    uint32_t objects = argc > 1 ? (uint32_t)atoi(argv[1]) : 100000;
+    uint32_t grid = argc > 2 ? (uint32_t)atoi(argv[2]) : 512;
+    const float worldSize = 1000.0f;
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-worldSize * 0.5f, worldSize * 0.5f);
+    std::uniform_real_distribution<float> size(0.5f, 5.0f);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<glm::vec3> mins(objects), maxs(objects);
+    for (uint32_t i = 0; i < objects; i++){
+        glm::vec3 center(position(random), position(random), position(random));
+        glm::vec3 extent(size(random), size(random), size(random));
+        mins[i] = center - extent;
+        maxs[i] = center + extent;
+    }
+
+    trb::core::JobSystem* jobs = trb::core::JobSystem::create();
+    trb::grfx::Bvh bvh;
+    Clock::time_point start = Clock::now();
+    bvh.build(mins.data(), maxs.data(), objects);
+    printf("%u objects, %u workers\n", objects, jobs->getWorkerCount());
+    printf("SAH build %.2f ms, %u nodes, SAH cost %.1f\n", milliseconds(start), bvh.getNodeCount(), bvh.getSahCost());
+
+    // camera rays, pixel quads next to each other so a packet holds a 2x2 quad
+    glm::vec3 eye(0.0f, 0.0f, worldSize * 0.6f);
+    glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, worldSize * 2.0f);
+    glm::mat4 inverse = glm::inverse(projection * view);
+    std::vector<trb::grfx::BvhRay> rays;
+    rays.reserve((size_t)grid * grid);
+    for (uint32_t y = 0; y < grid; y += 2){
+        for (uint32_t x = 0; x < grid; x += 2){
+            for (uint32_t q = 0; q < 4; q++){
+                glm::vec2 ndc((x + (q & 1) + 0.5f) / grid * 2.0f - 1.0f, (y + (q >> 1) + 0.5f) / grid * 2.0f - 1.0f);
+                glm::vec4 target = inverse * glm::vec4(ndc, 1.0f, 1.0f);
+                trb::grfx::BvhRay ray;
+                ray.origin = eye;
+                ray.direction = glm::normalize(glm::vec3(target) / target.w - eye);
+                rays.push_back(ray);
+            }
+        }
+    }
+    bool ok = traceRays("camera rays", bvh, rays, jobs);
+    for (auto& ray : rays){
+        ray.origin = glm::vec3(position(random), position(random), position(random));
+        ray.direction = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(1e-4f));
+    }
+    ok &= traceRays("random rays", bvh, rays, jobs);
+
+    // volume queries against a linear scan
+    const uint32_t queries = 10000;
+    std::vector<trb::grfx::BvhHandle> results;
+    uint64_t found = 0;
+    start = Clock::now();
+    for (uint32_t q = 0; q < queries; q++){
+        glm::vec3 center(position(random), position(random), position(random));
+        results.clear();
+        bvh.queryAabb(center - glm::vec3(20.0f), center + glm::vec3(20.0f), &results);
+        found += results.size();
+        if (q % 1000 == 0){
+            size_t expected = 0;
+            for (uint32_t i = 0; i < objects; i++){
+                expected += glm::all(glm::lessThanEqual(mins[i], center + glm::vec3(20.0f))) && glm::all(glm::greaterThanEqual(maxs[i], center - glm::vec3(20.0f)));
+            }
+            ok &= expected == results.size();
+        }
+    }
+    double aabbTime = milliseconds(start);
+    start = Clock::now();
+    for (uint32_t q = 0; q < queries; q++){
+        results.clear();
+        bvh.querySphere(glm::vec3(position(random), position(random), position(random)), 20.0f, &results);
+        found += results.size();
+    }
+    double sphereTime = milliseconds(start);
+    trb::grfx::Frustum frustum;
+    frustum.update(view, glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, worldSize * 0.5f));
+    start = Clock::now();
+    results.clear();
+    bvh.queryFrustum(frustum, &results);
+    double frustumTime = milliseconds(start);
+    size_t expected = 0;
+    for (uint32_t i = 0; i < objects; i++){
+        expected += frustum.intersectsBox((mins[i] + maxs[i]) * 0.5f, (maxs[i] - mins[i]) * 0.5f) ? 1 : 0;
+    }
+    ok &= expected == results.size();
+    printf("aabb queries %.2f us, sphere queries %.2f us, frustum query %.3f ms (%zu visible), %llu found\n",
+        aabbTime * 1000.0 / queries, sphereTime * 1000.0 / queries, frustumTime, results.size(), (unsigned long long)found);
+
+    // a tenth of the objects moves: refit all at once, one by one, or take them out and put them back in
+    uint32_t moving = objects / 10;
+    std::uniform_real_distribution<float> step(-10.0f, 10.0f);
+    start = Clock::now();
+    for (uint32_t i = 0; i < moving; i++){
+        glm::vec3 offset(step(random), step(random), step(random));
+        mins[i] += offset;
+        maxs[i] += offset;
+        bvh.setBounds(i, mins[i], maxs[i]);
+    }
+    bvh.refit();
+    double refitTime = milliseconds(start);
+    start = Clock::now();
+    for (uint32_t i = 0; i < moving; i++){
+        bvh.update(i, mins[i], maxs[i] + glm::vec3(0.1f));
+    }
+    double updateTime = milliseconds(start);
+    start = Clock::now();
+    for (uint32_t i = 0; i < moving; i++){
+        bvh.remove(i);
+    }
+    for (uint32_t i = 0; i < moving; i++){
+        bvh.insert(mins[i], maxs[i]);
+    }
+    double reinsertTime = milliseconds(start);
+    float editedCost = bvh.getSahCost();
+    start = Clock::now();
+    bvh.rebuild();
+    printf("%u moving: refit %.2f ms, update %.2f ms, remove + insert %.2f ms (SAH cost %.1f), rebuild %.2f ms (SAH cost %.1f)\n",
+        moving, refitTime, updateTime, reinsertTime, editedCost, milliseconds(start), bvh.getSahCost());
+
+    jobs->shutdown();
+    if (!ok){
+        printf("query results differ from the reference\n");
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,326 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include <gli/gli.hpp>
+#include <gli/generate_mipmaps.hpp>
+
+#include "core/JobSystem.hpp"
+#include "asset/Mesh.hpp"
+#include "asset/MeshOptimizer.hpp"
+#include "asset/MeshSimplifier.hpp"
+#include "MeshImport.hpp"
+#include "CookDatabase.hpp"
+#include "FileSystem.hpp"
+
+// Cooks a source asset tree into runtime assets
+//
+//   cooker <source dir> <output dir> [--split] [--no-optimize] [--force]
+//
+// Models (anything assimp reads) become vertex cache, overdraw and fetch optimized .tmesh with a chain
+// of levels of detail, dds/ktx/kmg textures become .ktx with a full mip chain, everything else is copied.
+// The output directory holds a database of what each output was built from, only sources whose
+// contents, side files or cook settings changed are cooked again.
+
+// Bump when the output of a cook step changes, every asset is re-cooked
+#define COOKER_VERSION 3
+#define COOK_DATABASE_FILE ".cookdb"
+
+enum CookKind{
+    eCookMesh,
+    eCookTexture,
+    eCookCopy
+};
+
+struct CookItem{
+    std::string source;
+    CookKind kind;
+    std::string output;
+    uint64_t settings = 0;
+    bool stale = false;
+    bool failed = false;
+    // the database record, updated in place when a check or cook changed it
+    trb::tools::CookRecord record;
+    bool recordChanged = false;
+};
+
+static std::mutex logMutex;
+
+static CookKind classify(const std::string& path){
+    static const char* meshes[] = { ".obj", ".fbx", ".dae", ".gltf", ".glb", ".3ds", ".blend", ".ply", ".stl", ".x", ".md5mesh" };
+    static const char* textures[] = { ".dds", ".ktx", ".kmg" };
+    std::string ext = trb::tools::extension(path);
+    for (const char* mesh : meshes){
+        if (ext == mesh){
+            return eCookMesh;
+        }
+    }
+    for (const char* texture : textures){
+        if (ext == texture){
+            return eCookTexture;
+        }
+    }
+    return eCookCopy;
+}
+
+static std::string outputPath(const std::string& source, CookKind kind){
+    if (kind == eCookCopy){
+        return source;
+    }
+    std::string base = source.substr(0, source.size() - trb::tools::extension(source).size());
+    return base + (kind == eCookMesh ? ".tmesh" : ".ktx");
+}
+
+/** @brief Decide whether item has to be cooked, hashes only the files whose size or mtime changed */
+static void check(CookItem& item, const std::string& outputRoot){
+    trb::tools::CookRecord& record = item.record;
+    uint64_t size;
+    int64_t mtime;
+    if (record.source.empty() || record.settings != item.settings || record.output != item.output ||
+        !trb::tools::fileStat(outputRoot + "/" + item.output, &size, &mtime)){
+        item.stale = true;
+        return;
+    }
+    for (auto& dependency : record.dependencies){
+        if (!trb::tools::fileStat(dependency.path, &size, &mtime)){
+            item.stale = true;
+            return;
+        }
+        if (size == dependency.size && mtime == dependency.mtime){
+            continue;
+        }
+        if (size != dependency.size || trb::tools::hashFile(dependency.path) != dependency.hash){
+            item.stale = true;
+            return;
+        }
+        // touched but not changed, remember the new mtime so the next run does not hash it again
+        dependency.mtime = mtime;
+        item.recordChanged = true;
+    }
+}
+
+static void cookTexture(const std::string& source, const std::string& output){
+    gli::texture texture = gli::load(source);
+    if (texture.empty()){
+        throw std::runtime_error("gli can not load " + source);
+    }
+    // the texture streamer wants every level, build them for plain 8 bit textures that come without
+    bool mipmappable = texture.format() == gli::FORMAT_RGBA8_UNORM_PACK8 || texture.format() == gli::FORMAT_RGBA8_SRGB_PACK8;
+    if (texture.target() == gli::TARGET_2D && texture.levels() == 1 && mipmappable){
+        gli::texture2d base(texture);
+        gli::texture2d full(base.format(), base.extent(), gli::levels(base.extent()));
+        memcpy(full[0].data(), base[0].data(), base[0].size());
+        texture = gli::generate_mipmaps(full, 0, full.max_level(), gli::FILTER_LINEAR);
+    }
+    if (!gli::save_ktx(texture, output)){
+        throw std::runtime_error("failed to write " + output);
+    }
+}
+
+static void cook(CookItem& item, const std::string& sourceRoot, const std::string& outputRoot, bool split, bool optimize){
+    std::string source = sourceRoot + "/" + item.source;
+    std::string output = outputRoot + "/" + item.output;
+    // written next to the output and renamed over it, a failed cook never leaves a half written asset
+    std::string tmp = output + ".tmp";
+    trb::tools::makeParentDirectories(output);
+
+    std::vector<std::string> dependencies;
+    if (item.kind == eCookMesh){
+        trb::asset::MeshData mesh;
+        std::string error;
+        if (!trb::tools::importMesh(source, &mesh, split, &error, &dependencies)){
+            throw std::runtime_error(error);
+        }
+        if (optimize){
+            trb::asset::MeshOptimizerStats stats = trb::asset::optimizeMesh(&mesh);
+            std::lock_guard<std::mutex> lock(logMutex);
+            printf("optimized %s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %u -> %u vertices, %u clusters\n", item.source.c_str(),
+                stats.before.acmr(), stats.after.acmr(), stats.before.atvr(), stats.after.atvr(), stats.verticesBefore, stats.verticesAfter, stats.clusters);
+        }
+        trb::asset::MeshLodStats lods = trb::asset::generateLods(&mesh);
+        if (lods.triangles.size() > 1){
+            std::string chain;
+            for (size_t i = 0; i < lods.triangles.size(); i++){
+                char level[64];
+                snprintf(level, sizeof(level), "%s%llu (%g)", i ? ", " : "", (unsigned long long)lods.triangles[i], lods.errors[i]);
+                chain += level;
+            }
+            std::lock_guard<std::mutex> lock(logMutex);
+            printf("lods %s: %s triangles (error)\n", item.source.c_str(), chain.c_str());
+        }
+        mesh.write(tmp);
+    }else if (item.kind == eCookTexture){
+        cookTexture(source, tmp);
+    }else{
+        std::vector<char> data = trb::tools::readFile(source);
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), (std::streamsize)data.size());
+        out.close();
+        if (!out){
+            throw std::runtime_error("failed to write " + output);
+        }
+    }
+    if (std::rename(tmp.c_str(), output.c_str()) != 0){
+        std::remove(tmp.c_str());
+        throw std::runtime_error("failed to write " + output);
+    }
+
+    if (std::find(dependencies.begin(), dependencies.end(), source) == dependencies.end()){
+        dependencies.insert(dependencies.begin(), source);
+    }
+    trb::tools::CookRecord& record = item.record;
+    record.source = item.source;
+    record.output = item.output;
+    record.settings = item.settings;
+    record.dependencies.clear();
+    for (auto& path : dependencies){
+        trb::tools::CookDependency dependency;
+        dependency.path = path;
+        if (!dependency.capture()){
+            throw std::runtime_error("dependency " + path + " vanished while cooking");
+        }
+        record.dependencies.push_back(dependency);
+    }
+    item.recordChanged = true;
+}
+
+int main(int argc, char** argv){
+    std::vector<std::string> paths;
+    bool split = false, optimize = true, force = false;
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if (arg == "--split"){
+            split = true;
+        }else if (arg == "--no-optimize"){
+            optimize = false;
+        }else if (arg == "--force"){
+            force = true;
+        }else{
+            paths.push_back(arg);
+        }
+    }
+    if (paths.size() != 2){
+        std::cerr << "usage: cooker <source dir> <output dir> [--split] [--no-optimize] [--force]" << std::endl;
+        return 1;
+    }
+    std::string sourceRoot = paths[0];
+    std::string outputRoot = paths[1];
+    std::string databasePath = outputRoot + "/" + COOK_DATABASE_FILE;
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::string> sources;
+    try{
+        trb::tools::listFiles(sourceRoot, sources);
+        trb::tools::makeParentDirectories(databasePath);
+    }catch (const std::exception& e){
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    std::sort(sources.begin(), sources.end());
+
+    trb::tools::CookDatabase database;
+    if (!force){
+        database.load(databasePath);
+    }
+
+    std::vector<CookItem> items(sources.size());
+    std::map<std::string, std::string> outputs;
+    uint32_t conflicts = 0;
+    for (size_t i = 0; i < sources.size(); i++){
+        CookItem& item = items[i];
+        item.source = sources[i];
+        item.kind = classify(item.source);
+        item.output = outputPath(item.source, item.kind);
+        // e.g. rock.dds and rock.ktx, the first one in sorted order wins
+        auto inserted = outputs.insert(std::make_pair(item.output, item.source));
+        if (!inserted.second){
+            std::cerr << "skipped " << item.source << ": " << inserted.first->second << " cooks to " << item.output << " as well" << std::endl;
+            item.failed = true;
+            conflicts++;
+            continue;
+        }
+        char settings[64];
+        bool mesh = item.kind == eCookMesh;
+        snprintf(settings, sizeof(settings), "%d %d %d %d", COOKER_VERSION, (int)item.kind, mesh && split ? 1 : 0, mesh && optimize ? 1 : 0);
+        item.settings = trb::tools::hashBytes(settings, strlen(settings));
+        if (trb::tools::CookRecord* record = database.find(item.source)){
+            item.record = *record;
+        }
+    }
+
+    trb::core::JobSystem* jobs = trb::core::JobSystem::create();
+    // one item per job, a single model import can take seconds
+    jobs->wait(jobs->parallelFor((uint32_t)items.size(), CACHE_LINE_SIZE, [&](uint32_t begin, uint32_t end){
+        for (uint32_t i = begin; i < end; i++){
+            if (!items[i].failed){
+                check(items[i], outputRoot);
+            }
+        }
+    }));
+
+    std::vector<CookItem*> stale;
+    for (auto& item : items){
+        if (item.stale){
+            stale.push_back(&item);
+        }
+    }
+    std::atomic<uint32_t> failed(conflicts);
+    jobs->wait(jobs->parallelFor((uint32_t)stale.size(), CACHE_LINE_SIZE, [&](uint32_t begin, uint32_t end){
+        for (uint32_t i = begin; i < end; i++){
+            CookItem& item = *stale[i];
+            try{
+                cook(item, sourceRoot, outputRoot, split, optimize);
+                std::lock_guard<std::mutex> lock(logMutex);
+                std::cout << "cooked " << item.source << " -> " << item.output << std::endl;
+            }catch (const std::exception& e){
+                // no record, so the next run tries again
+                item.failed = true;
+                item.recordChanged = false;
+                failed++;
+                std::lock_guard<std::mutex> lock(logMutex);
+                std::cerr << "failed " << item.source << ": " << e.what() << std::endl;
+            }
+        }
+    }));
+    jobs->shutdown();
+
+    bool databaseChanged = force;
+    for (auto& item : items){
+        if (item.failed){
+            databaseChanged |= database.find(item.source) != nullptr;
+            database.remove(item.source);
+        }else if (item.recordChanged){
+            database.set(item.record);
+            databaseChanged = true;
+        }
+    }
+    // sources that are gone take their outputs with them
+    uint32_t removed = 0;
+    for (auto& source : database.getSources()){
+        if (!std::binary_search(sources.begin(), sources.end(), source)){
+            const std::string& output = database.find(source)->output;
+            if (!outputs.count(output)){
+                std::remove((outputRoot + "/" + output).c_str());
+            }
+            database.remove(source);
+            removed++;
+            databaseChanged = true;
+        }
+    }
+    if (databaseChanged && !database.save(databasePath)){
+        std::cerr << "failed to write " << databasePath << std::endl;
+        return 1;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << sources.size() << " sources: " << stale.size() + conflicts - failed << " cooked, " << sources.size() - stale.size() - conflicts
+        << " up to date, " << failed << " failed, " << removed << " removed (" << seconds << " s)" << std::endl;
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "core/JobSystem.hpp"
+#include "graphics/Frustum.hpp"
+
+// Frustum culling throughput of every supported instruction set, single threaded and on the job system
+//
+//   cull_bench [objects] [iterations]
+//
+// Objects are scattered through a cube around the camera, about 5% of them end up visible. Every path is
+// checked against the scalar result before it is timed.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+template <typename Volumes>
+static bool bench(const char* name, const trb::grfx::Frustum& frustum, const Volumes& volumes, int iterations, trb::core::JobSystem* jobs){
+    static const trb::grfx::CullPath paths[] = { trb::grfx::eCullScalar, trb::grfx::eCullSse, trb::grfx::eCullAvx2, trb::grfx::eCullNeon };
+    std::vector<uint32_t> reference(volumes.size());
+    std::vector<uint32_t> visible(volumes.size());
+    trb::grfx::FrustumCuller scalar(trb::grfx::eCullScalar);
+    uint32_t expected = scalar.cull(frustum, volumes, reference.data());
+    printf("%s: %u objects, %u visible\n", name, volumes.size(), expected);
+
+    double baseline = 0.0;
+    for (trb::grfx::CullPath path : paths){
+        if (!trb::grfx::isCullPathSupported(path)){
+            continue;
+        }
+        trb::grfx::FrustumCuller culler(path);
+        for (int threaded = 0; threaded < 2; threaded++){
+            trb::core::JobSystem* system = threaded ? jobs : nullptr;
+            uint32_t count = culler.cull(frustum, volumes, visible.data(), system);
+            if (count != expected || !std::equal(reference.begin(), reference.begin() + count, visible.begin())){
+                printf("  %s%s: result differs from the scalar path\n", trb::grfx::getCullPathName(path), threaded ? " jobs" : "");
+                return false;
+            }
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < iterations; i++){
+                culler.cull(frustum, volumes, visible.data(), system);
+            }
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / iterations;
+            if (baseline == 0.0){
+                baseline = ms;
+            }
+            printf("  %-6s %-7s %8.3f ms, %6.2f ns/object, %5.2fx\n", trb::grfx::getCullPathName(path), threaded ? "jobs" : "single",
+                ms, ms * 1e6 / volumes.size(), baseline / ms);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv){
+    uint32_t objects = argc > 1 ? (uint32_t)atoi(argv[1]) : 100000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 200;
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> size(0.5f, 5.0f);
+    trb::grfx::BoundingSpheres spheres;
+    trb::grfx::BoundingBoxes boxes;
+    spheres.resize(objects);
+    boxes.resize(objects);
+    for (uint32_t i = 0; i < objects; i++){
+        glm::vec3 center(position(random), position(random), position(random));
+        glm::vec3 extent(size(random), size(random), size(random));
+        spheres.set(i, center, glm::length(extent));
+        boxes.set(i, center - extent, center + extent);
+    }
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.3f, 0.1f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 400.0f);
+    trb::grfx::Frustum frustum;
+    frustum.update(view, projection);
+
+    trb::core::JobSystem* jobs = trb::core::JobSystem::create();
+    printf("best path %s, %u workers\n", trb::grfx::getCullPathName(trb::grfx::getBestCullPath()), jobs->getWorkerCount());
+    bool ok = bench("spheres", frustum, spheres, iterations, jobs) && bench("boxes", frustum, boxes, iterations, jobs);
+    jobs->shutdown();
+    return ok ? 0 : 1;
+}
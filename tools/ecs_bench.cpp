@@ -0,0 +1,234 @@
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include "core/JobSystem.hpp"
+#include "scene/World.hpp"
+
+// Entity component system iteration throughput against heap allocated objects with a virtual update
+//
+//   ecs_bench [entities] [iterations]
+//
+// Every entity has a position and a velocity, half of them an acceleration and a tenth a tag that splits them
+// into more archetypes. Structural changes are checked against a plain map first, then the systems are checked
+// against the objects and timed per entity, per chunk and per chunk on the job system.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct Position{ glm::vec3 value; };
+struct Velocity{ glm::vec3 value; };
+struct Acceleration{ glm::vec3 value; };
+struct Tag{ uint32_t value; };
+
+/** @brief Counts live instances so leaked or doubly destroyed components show up */
+struct Tracked{
+    static int live;
+    std::vector<uint32_t> payload;
+    Tracked(uint32_t value = 0) : payload(1, value) { live++; }
+    Tracked(const Tracked& other) : payload(other.payload) { live++; }
+    Tracked(Tracked&& other) : payload(std::move(other.payload)) { live++; }
+    Tracked& operator=(const Tracked& other){ payload = other.payload; return *this; }
+    ~Tracked(){ live--; }
+};
+int Tracked::live = 0;
+
+static const float dt = 1.0f / 60.0f;
+
+/** @brief The object oriented baseline, one heap allocation per object and a virtual call per update */
+class Object{
+    public:
+        glm::vec3 position;
+        glm::vec3 velocity;
+        virtual ~Object(){}
+        virtual void update(){ position += velocity * dt; }
+};
+
+class AcceleratedObject : public Object{
+    public:
+        glm::vec3 acceleration;
+        void update() override { velocity += acceleration * dt; position += velocity * dt; }
+};
+
+static double milliseconds(Clock::time_point start){
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/** @brief Random adds, removes and destroys mirrored in a map, every component read back afterwards */
+static bool checkStructure(){
+    std::mt19937 random(7);
+    bool ok = true;
+    {
+        trb::scene::World world;
+        struct Expected{ bool hasTag = false; uint32_t tag = 0; bool hasTracked = false; uint32_t tracked = 0; float x = 0.0f; };
+        std::unordered_map<trb::scene::Entity, Expected> expected;
+        std::vector<trb::scene::Entity> alive;
+        std::vector<trb::scene::Entity> dead;
+        for (uint32_t step = 0; step < 200000; step++){
+            uint32_t action = random() % 8;
+            if (alive.empty() || action == 0 || action == 6){
+                float x = (float)(random() % 1000);
+                trb::scene::Entity entity = world.create(Position{ glm::vec3(x) });
+                expected[entity].x = x;
+                alive.push_back(entity);
+                continue;
+            }
+            uint32_t pick = random() % alive.size();
+            trb::scene::Entity entity = alive[pick];
+            Expected& e = expected[entity];
+            uint32_t value = random();
+            switch (action){
+                case 1: world.add<Tag>(entity, Tag{ value }); e.hasTag = true; e.tag = value; break;
+                case 2: world.remove<Tag>(entity); e.hasTag = false; break;
+                case 3: world.add<Tracked>(entity, Tracked(value)); e.hasTracked = true; e.tracked = value; break;
+                case 4: world.remove<Tracked>(entity); e.hasTracked = false; break;
+                case 5:
+                    world.destroy(entity);
+                    expected.erase(entity);
+                    alive[pick] = alive.back();
+                    alive.pop_back();
+                    dead.push_back(entity);
+                    break;
+                default: break;
+            }
+        }
+        uint32_t tags = 0;
+        for (trb::scene::Entity entity : alive){
+            const Expected& e = expected[entity];
+            Tag* tag = world.get<Tag>(entity);
+            Tracked* tracked = world.get<Tracked>(entity);
+            Position* position = world.get<Position>(entity);
+            ok &= position && position->value.x == e.x;
+            ok &= (tag != nullptr) == e.hasTag && (!tag || tag->value == e.tag);
+            ok &= (tracked != nullptr) == e.hasTracked && (!tracked || tracked->payload[0] == e.tracked);
+            tags += e.hasTag ? 1 : 0;
+        }
+        for (trb::scene::Entity entity : dead){
+            ok &= !world.isAlive(entity) && !world.get<Position>(entity);
+        }
+        auto tagged = world.query<Position, Tag>();
+        auto untagged = world.query<Position>().without<Tag>();
+        ok &= world.getEntityCount() == alive.size() && tagged.count() == tags && untagged.count() == alive.size() - tags;
+        printf("structure: %u entities, %u archetypes, %u tagged, %d tracked\n", world.getEntityCount(),
+            (uint32_t)world.getArchetypes().size(), tags, Tracked::live);
+    }
+    ok &= Tracked::live == 0;
+    if (!ok){
+        printf("structure: components differ from the expected values\n");
+    }
+    return ok;
+}
+
+int main(int argc, char** argv){
+    uint32_t count = argc > 1 ? (uint32_t)atoi(argv[1]) : 1000000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 20;
+    bool ok = checkStructure();
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    trb::scene::World world;
+    std::vector<std::unique_ptr<Object>> objects(count);
+    std::vector<trb::scene::Entity> entities(count);
+    std::vector<const Object*> created(count);
+    Clock::time_point start = Clock::now();
+    for (uint32_t i = 0; i < count; i++){
+        glm::vec3 position(unit(random), unit(random), unit(random));
+        glm::vec3 velocity(unit(random), unit(random), unit(random));
+        glm::vec3 acceleration(unit(random), unit(random), unit(random));
+        Object* object = i % 2 ? new AcceleratedObject() : new Object();
+        object->position = position;
+        object->velocity = velocity;
+        if (i % 2){
+            ((AcceleratedObject*)object)->acceleration = acceleration;
+            entities[i] = world.create(Position{ position }, Velocity{ velocity }, Acceleration{ acceleration });
+        }
+        else{
+            entities[i] = world.create(Position{ position }, Velocity{ velocity });
+        }
+        if (i % 10 == 0){
+            world.add<Tag>(entities[i], Tag{ i });
+        }
+        objects[i].reset(object);
+        created[i] = object;
+    }
+    double createMs = milliseconds(start);
+    // objects live wherever the allocator put them and are visited in no particular order, like a scene graph
+    std::shuffle(objects.begin(), objects.end(), random);
+
+    trb::core::JobSystem* jobs = trb::core::JobSystem::create();
+    printf("%u entities in %u archetypes created in %.1f ms, %u workers\n", world.getEntityCount(),
+        (uint32_t)world.getArchetypes().size(), createMs, jobs->getWorkerCount());
+
+    auto accelerate = world.query<Velocity, Acceleration>();
+    auto move = world.query<Position, Velocity>();
+    auto perEntity = [&](){
+        accelerate.each([](Velocity& v, const Acceleration& a){ v.value += a.value * dt; });
+        move.each([](Position& p, const Velocity& v){ p.value += v.value * dt; });
+    };
+    auto perChunk = [&](){
+        accelerate.eachChunk([](uint32_t n, const trb::scene::Entity*, Velocity* v, Acceleration* a){
+            for (uint32_t i = 0; i < n; i++){
+                v[i].value += a[i].value * dt;
+            }
+        });
+        move.eachChunk([](uint32_t n, const trb::scene::Entity*, Position* p, Velocity* v){
+            for (uint32_t i = 0; i < n; i++){
+                p[i].value += v[i].value * dt;
+            }
+        });
+    };
+    auto parallel = [&](){
+        accelerate.parallelEach(jobs, [](Velocity& v, const Acceleration& a){ v.value += a.value * dt; });
+        move.parallelEach(jobs, [](Position& p, const Velocity& v){ p.value += v.value * dt; });
+    };
+    auto virtualUpdate = [&](){
+        for (auto& object : objects){
+            object->update();
+        }
+    };
+
+    // one step of every system variant against three object updates, the float operations are the same
+    perEntity();
+    perChunk();
+    parallel();
+    for (int i = 0; i < 3; i++){
+        virtualUpdate();
+    }
+    uint32_t wrong = 0;
+    for (uint32_t i = 0; i < count; i++){
+        const Position* p = world.get<Position>(entities[i]);
+        const Velocity* v = world.get<Velocity>(entities[i]);
+        wrong += p->value != created[i]->position || v->value != created[i]->velocity ? 1 : 0;
+    }
+    if (wrong){
+        printf("%u entities differ from the objects\n", wrong);
+        ok = false;
+    }
+
+    struct Variant{ const char* name; std::function<void()> run; };
+    Variant variants[] = { { "virtual", virtualUpdate }, { "each", perEntity }, { "chunks", perChunk }, { "jobs", parallel } };
+    double baseline = 0.0;
+    for (const Variant& variant : variants){
+        start = Clock::now();
+        for (int i = 0; i < iterations; i++){
+            variant.run();
+        }
+        double ms = milliseconds(start) / iterations;
+        if (baseline == 0.0){
+            baseline = ms;
+        }
+        printf("  %-8s %8.3f ms, %5.2f ns/entity, %5.2fx\n", variant.name, ms, ms * 1e6 / count, baseline / ms);
+    }
+    jobs->shutdown();
+    return ok ? 0 : 1;
+}
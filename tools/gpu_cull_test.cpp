@@ -0,0 +1,149 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cfloat>
+#include <iterator>
+#include <string>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "graphics/Frustum.hpp"
+#include "graphics/vulkan/VulkanDevice.hpp"
+#include "graphics/vulkan/VulkanGpuCuller.hpp"
+
+// GPU culling checked against the CPU culler, runs headless on any Vulkan device (lavapipe works)
+//
+//   gpu_cull_test [objects] [shader]
+//
+// Culls the same scene as cull_bench once recorded into a graphics command buffer and once submitted to the
+// compute queue, and compares the instances in the indirect commands with FrustumCuller. Spheres touching a
+// plane within float precision may go either way.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double milliseconds(Clock::time_point start){
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/** @brief Visible instances as the shader wrote them next to the commands, firstInstance may be 0 on the device */
+static std::vector<uint32_t> visibleInstances(trb::grfx::VulkanGpuCuller& culler, uint32_t frame, uint32_t* drawCount){
+    std::vector<uint32_t> visible;
+    *drawCount = culler.readVisibleInstances(frame, &visible);
+    std::sort(visible.begin(), visible.end());
+    return visible;
+}
+
+static bool compare(const char* name, const std::vector<uint32_t>& gpu, uint32_t drawCount, const std::vector<uint32_t>& cpu,
+                    const trb::grfx::Frustum& frustum, const trb::grfx::BoundingSpheres& spheres, double ms){
+    std::vector<uint32_t> differences;
+    std::set_symmetric_difference(gpu.begin(), gpu.end(), cpu.begin(), cpu.end(), std::back_inserter(differences));
+    uint32_t mismatches = 0;
+    for (uint32_t i : differences){
+        glm::vec3 center(spheres.x[i], spheres.y[i], spheres.z[i]);
+        float closest = FLT_MAX;
+        for (auto& plane : frustum.planes){
+            closest = std::min(closest, std::fabs(glm::dot(glm::vec3(plane), center) + plane.w + spheres.radius[i]));
+        }
+        mismatches += closest > 1e-3f ? 1 : 0;
+    }
+    printf("  %-8s %8.3f ms, %u visible, draw count %u, %zu on a plane, %u wrong\n", name, ms, (uint32_t)gpu.size(), drawCount,
+        differences.size() - mismatches, mismatches);
+    return mismatches == 0 && drawCount == gpu.size();
+}
+
+int main(int argc, char** argv){
+    uint32_t objects = argc > 1 ? (uint32_t)atoi(argv[1]) : 100000;
+    std::string shader = argc > 2 ? argv[2] : GPU_CULL_SHADER_PATH;
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> size(0.5f, 5.0f);
+    trb::grfx::BoundingSpheres spheres;
+    spheres.resize(objects);
+    for (uint32_t i = 0; i < objects; i++){
+        glm::vec3 center(position(random), position(random), position(random));
+        glm::vec3 extent(size(random), size(random), size(random));
+        spheres.set(i, center, glm::length(extent));
+    }
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.3f, 0.1f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 400.0f);
+    trb::grfx::Frustum frustum;
+    frustum.update(view, projection);
+
+    std::vector<uint32_t> cpu(objects);
+    trb::grfx::FrustumCuller cpuCuller;
+    cpu.resize(cpuCuller.cull(frustum, spheres, cpu.data()));
+
+    vk::ApplicationInfo appInfo("gpu_cull_test", 1, "turbulence", 1, VK_API_VERSION_1_0);
+    vk::InstanceCreateInfo instanceInfo;
+    instanceInfo.pApplicationInfo = &appInfo;
+    vk::Instance instance;
+    if (vk::createInstance(&instanceInfo, nullptr, &instance) != vk::Result::eSuccess){
+        printf("failed to create a Vulkan instance\n");
+        return 1;
+    }
+
+    bool ok = true;
+    {
+        trb::grfx::VulkanDevice device;
+        device.init(instance);
+        vk::Queue queue;
+        device.device.getQueue((uint32_t)device.queueFamilyIndices.graphicsFamily, 0, &queue);
+
+        trb::grfx::VulkanGpuCuller culler;
+        culler.init(&device, 2, objects, 1, shader);
+        uint32_t draw = culler.addDraw(36, 0, 0);
+        for (uint32_t frame = 0; frame < 2; frame++){
+            trb::grfx::GpuCullInstance* instances = culler.getInstances(frame);
+            for (uint32_t i = 0; i < objects; i++){
+                instances[i].sphere = glm::vec4(spheres.x[i], spheres.y[i], spheres.z[i], spheres.radius[i]);
+                instances[i].draw = draw;
+            }
+        }
+        printf("%s, %u objects, %u visible on the CPU, %s commands, graphics family %d, compute family %d\n",
+            device.properties.deviceName, objects, (uint32_t)cpu.size(), culler.isCompact() ? "compact" : "per instance",
+            device.queueFamilyIndices.graphicsFamily, device.queueFamilyIndices.computeFamily);
+
+        // recorded into a graphics command buffer
+        Clock::time_point start = Clock::now();
+        vk::CommandBuffer cmd = device.createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
+        culler.cull(cmd, 0, frustum, objects);
+        device.flushCommandBuffer(cmd, queue);
+        double ms = milliseconds(start);
+        uint32_t drawCount;
+        std::vector<uint32_t> gpu = visibleInstances(culler, 0, &drawCount);
+        ok &= compare("graphics", gpu, drawCount, cpu, frustum, spheres, ms);
+
+        // submitted to the compute family, an empty graphics submit waits for it like a frame would
+        start = Clock::now();
+        vk::Semaphore culled = culler.submit(1, frustum, objects);
+        vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eDrawIndirect;
+        vk::SubmitInfo submitInfo;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &culled;
+        submitInfo.pWaitDstStageMask = &waitStage;
+        if (queue.submit(1, &submitInfo, vk::Fence()) != vk::Result::eSuccess){
+            throw std::runtime_error("failed to submit");
+        }
+        queue.waitIdle();
+        ms = milliseconds(start);
+        gpu = visibleInstances(culler, 1, &drawCount);
+        ok &= compare("compute", gpu, drawCount, cpu, frustum, spheres, ms);
+
+        device.device.waitIdle();
+        culler.destroy();
+    }
+    instance.destroy(nullptr);
+    if (!ok){
+        printf("GPU results differ from the CPU culler\n");
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,242 @@
+#include <iostream>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "asset/Mesh.hpp"
+#include "asset/MeshSimplifier.hpp"
+#include "graphics/LodSelector.hpp"
+
+// LOD chain generation and level selection
+//
+//   lod_test [subdivisions] [objects]
+//
+// An icosphere is simplified into a LOD chain. The error stored for every level has to cover the distance of every
+// original vertex from the simplified surface, found by brute force over all triangles of the level. Objects in a
+// row away from the camera are then given levels: coarser with distance, within the pixel error, and without
+// flipping back and forth around a switch distance. Prints the triangles the levels save and the selection throughput.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+/** @brief What LodSelector reads of a mesh, the part of grfx::Mesh that does not need Vulkan */
+struct LodMesh{
+    std::vector<float> lodErrors;
+    std::vector<uint32_t> lodTriangles;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+};
+
+static bool check(const char* name, bool result){
+    printf("  %-48s %s\n", name, result ? "ok" : "FAILED");
+    return result;
+}
+
+/** @brief Unit icosphere, every vertex shared by the triangles around it */
+static void icosphere(uint32_t subdivisions, std::vector<glm::vec3>& positions, std::vector<uint32_t>& indices){
+    const float t = (1.0f + std::sqrt(5.0f)) * 0.5f;
+    positions = {
+        { -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+        { 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+        { t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 }
+    };
+    indices = {
+        0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11, 1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+        3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9, 4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1
+    };
+    for (auto& p : positions){
+        p = glm::normalize(p);
+    }
+    for (uint32_t s = 0; s < subdivisions; s++){
+        std::map<uint64_t, uint32_t> midpoints;
+        auto midpoint = [&](uint32_t a, uint32_t b){
+            uint64_t key = a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+            auto found = midpoints.find(key);
+            if (found != midpoints.end()){
+                return found->second;
+            }
+            positions.push_back(glm::normalize(positions[a] + positions[b]));
+            midpoints[key] = (uint32_t)positions.size() - 1;
+            return (uint32_t)positions.size() - 1;
+        };
+        std::vector<uint32_t> finer;
+        for (size_t i = 0; i < indices.size(); i += 3){
+            uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            uint32_t ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+            uint32_t triangles[] = { a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca };
+            finer.insert(finer.end(), triangles, triangles + 12);
+        }
+        indices.swap(finer);
+    }
+}
+
+static float segmentDistance(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b){
+    glm::vec3 ab = b - a;
+    float t = glm::dot(ab, ab) > 0.0f ? glm::clamp(glm::dot(p - a, ab) / glm::dot(ab, ab), 0.0f, 1.0f) : 0.0f;
+    return glm::length(p - (a + ab * t));
+}
+
+/** @brief Distance from p to triangle abc through the plane and the edges, not the closed form the simplifier uses */
+static float triangleDistance(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c){
+    glm::vec3 normal = glm::cross(b - a, c - a);
+    if (glm::dot(normal, normal) > 0.0f){
+        normal = glm::normalize(normal);
+        glm::vec3 projected = p - normal * glm::dot(p - a, normal);
+        // inside when the projection is on the same side of all three edges
+        bool inside = glm::dot(glm::cross(b - a, projected - a), normal) >= 0.0f && glm::dot(glm::cross(c - b, projected - b), normal) >= 0.0f &&
+            glm::dot(glm::cross(a - c, projected - c), normal) >= 0.0f;
+        if (inside){
+            return std::fabs(glm::dot(p - a, normal));
+        }
+    }
+    return std::min(segmentDistance(p, a, b), std::min(segmentDistance(p, b, c), segmentDistance(p, c, a)));
+}
+
+int main(int argc, char** argv){
+    uint32_t subdivisions = argc > 1 ? (uint32_t)atoi(argv[1]) : 4;
+    uint32_t objects = argc > 2 ? (uint32_t)atoi(argv[2]) : 100000;
+    bool ok = true;
+
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+    icosphere(subdivisions, positions, indices);
+
+    trb::asset::MeshData mesh;
+    mesh.vertexCount = (uint32_t)positions.size();
+    mesh.streams.resize(1);
+    mesh.streams[0].stride = sizeof(glm::vec3);
+    mesh.streams[0].data.resize(positions.size() * sizeof(glm::vec3));
+    memcpy(mesh.streams[0].data.data(), positions.data(), mesh.streams[0].data.size());
+    trb::asset::TmeshAttribute position = { trb::asset::eTmeshPosition, VK_FORMAT_R32G32B32_SFLOAT, 0, 0 };
+    mesh.attributes.push_back(position);
+    mesh.indices = indices;
+    trb::asset::TmeshSubmesh submesh = {};
+    submesh.indexCount = (uint32_t)indices.size();
+    mesh.submeshes.push_back(submesh);
+    mesh.computeBounds();
+
+    Clock::time_point start = Clock::now();
+    trb::asset::MeshLodStats lods = trb::asset::generateLods(&mesh);
+    double generateMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    printf("icosphere, %u vertices, %u triangles, %u levels in %.2f ms\n", mesh.vertexCount, (uint32_t)indices.size() / 3, mesh.lodCount, generateMs);
+
+    bool fewer = true, ordered = true, covered = true;
+    for (uint32_t l = 0; l < mesh.lodCount; l++){
+        const trb::asset::TmeshLod& lod = mesh.lods[l];
+        float worst = 0.0f;
+        if (l > 0){
+            fewer &= lods.triangles[l] < lods.triangles[l - 1];
+            ordered &= lod.error >= mesh.lods[l - 1].error;
+            // every original vertex against every triangle of the level
+            for (const glm::vec3& p : positions){
+                float nearest = FLT_MAX;
+                for (uint32_t i = lod.firstIndex; i < lod.firstIndex + lod.indexCount; i += 3){
+                    const glm::vec3& a = positions[mesh.indices[i]];
+                    const glm::vec3& b = positions[mesh.indices[i + 1]];
+                    const glm::vec3& c = positions[mesh.indices[i + 2]];
+                    // no point of the triangle is closer than this, skip it when it can not be the nearest
+                    float bound = std::min(glm::length(p - a), std::min(glm::length(p - b), glm::length(p - c)));
+                    if (bound - std::max(glm::length(b - a), glm::length(c - a)) < nearest){
+                        nearest = std::min(nearest, triangleDistance(p, a, b, c));
+                    }
+                }
+                worst = std::max(worst, nearest);
+            }
+            covered &= worst <= lod.error * 1.001f + 1e-6f;
+        }
+        printf("  level %u: %6u triangles, error %.5f stored, %.5f measured\n", l, (uint32_t)lods.triangles[l], lod.error, worst);
+    }
+    ok &= check("every level has fewer triangles", fewer);
+    ok &= check("errors grow with the level", ordered);
+    ok &= check("stored errors cover the measured distance", covered);
+
+    LodMesh lodMesh;
+    lodMesh.lodErrors = lods.errors;
+    lodMesh.lodTriangles.assign(lods.triangles.begin(), lods.triangles.end());
+    lodMesh.boundsMin = glm::vec3(mesh.boundsMin[0], mesh.boundsMin[1], mesh.boundsMin[2]);
+    lodMesh.boundsMax = glm::vec3(mesh.boundsMax[0], mesh.boundsMax[1], mesh.boundsMax[2]);
+
+    const float viewportHeight = 1080.0f;
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 10000.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    float pixelScale = projection[1][1] * viewportHeight * 0.5f;
+    float radius = glm::length(lodMesh.boundsMax - lodMesh.boundsMin) * 0.5f;
+    auto at = [](float distance){
+        return glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -distance));
+    };
+
+    // a row of spheres from 2 to 2000 units away, one frame
+    printf("selection\n");
+    trb::grfx::LodSelector selector;
+    const uint32_t row = 1000;
+    std::vector<uint32_t> levels(row);
+    selector.beginFrame(view, projection, viewportHeight);
+    bool monotonic = true, withinError = true, coarsest = true;
+    for (uint32_t i = 0; i < row; i++){
+        float distance = 2.0f + 2.0f * i;
+        levels[i] = selector.select(i, lodMesh, at(distance));
+        monotonic &= i == 0 || levels[i] >= levels[i - 1];
+        float projected = pixelScale / (distance - radius);
+        withinError &= levels[i] == 0 || lodMesh.lodErrors[levels[i]] * projected <= DEFAULT_LOD_PIXEL_ERROR;
+        // a coarser level would have fit, the selector drew more than it had to
+        coarsest &= levels[i] + 1 == mesh.lodCount || lodMesh.lodErrors[levels[i] + 1] * projected > DEFAULT_LOD_PIXEL_ERROR;
+    }
+    selector.beginFrame(view, projection, viewportHeight);
+    const trb::grfx::LodSelectorStats& rowStats = selector.getStats();
+    ok &= check("levels get coarser with distance", monotonic);
+    ok &= check("levels stay within the pixel error", withinError);
+    ok &= check("the coarsest fitting level is drawn", coarsest);
+    ok &= check("far objects reach the coarsest level", levels[row - 1] == mesh.lodCount - 1);
+    printf("  %u objects, %llu triangles drawn, %llu saved by LOD (%.1f%%)\n", rowStats.objects, (unsigned long long)rowStats.trianglesDrawn,
+        (unsigned long long)rowStats.trianglesSaved, 100.0 * rowStats.trianglesSaved / std::max<uint64_t>(rowStats.trianglesDrawn + rowStats.trianglesSaved, 1));
+
+    // an object wobbling around the distance where level 1 starts to fit
+    float switchDistance = pixelScale * lodMesh.lodErrors[1] / DEFAULT_LOD_PIXEL_ERROR + radius;
+    auto flips = [&](float hysteresis){
+        trb::grfx::LodSelector wobble(DEFAULT_LOD_PIXEL_ERROR, hysteresis);
+        uint32_t changes = 0, last = INVALID_LOD;
+        for (uint32_t frame = 0; frame < 100; frame++){
+            wobble.beginFrame(view, projection, viewportHeight);
+            uint32_t lod = wobble.select(0, lodMesh, at(switchDistance * (frame & 1 ? 0.98f : 1.02f)));
+            changes += last != INVALID_LOD && lod != last ? 1 : 0;
+            last = lod;
+        }
+        return changes;
+    };
+    uint32_t withHysteresis = flips(DEFAULT_LOD_HYSTERESIS), without = flips(0.0f);
+    printf("  level changes over 100 frames around a switch distance: %u, %u without hysteresis\n", withHysteresis, without);
+    ok &= check("hysteresis keeps the level around a switch", withHysteresis <= 1 && without > withHysteresis);
+
+    // throughput with every object at its own distance
+    std::vector<glm::mat4> transforms(objects);
+    for (uint32_t i = 0; i < objects; i++){
+        transforms[i] = at(2.0f + (float)(i % row) * 2.0f + (float)(i / row) * 0.01f);
+    }
+    trb::grfx::LodSelector timed;
+    double best = DBL_MAX;
+    uint64_t sink = 0;
+    for (int iteration = 0; iteration < 10; iteration++){
+        timed.beginFrame(view, projection, viewportHeight);
+        start = Clock::now();
+        for (uint32_t i = 0; i < objects; i++){
+            sink += timed.select(i, lodMesh, transforms[i]);
+        }
+        best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+    printf("  select %.3f ms for %u objects (%.1f ns/object), checksum %llu\n", best, objects, best * 1e6 / objects, (unsigned long long)sink);
+
+    if (!ok){
+        printf("lod results are wrong\n");
+    }
+    return ok ? 0 : 1;
+}
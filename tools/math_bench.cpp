@@ -0,0 +1,206 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "core/BatchMath.hpp"
+#include "graphics/Frustum.hpp"
+
+// Batched math kernels of every supported instruction set against plain glm loops
+//
+//   math_bench [count] [iterations]
+//
+// Every path has to match the scalar path to the bit and glm within a relative tolerance of 1e-5 (most kernels
+// match glm to the bit too, the table says which). Then the glm loop and every path are timed.
+
+typedef std::chrono::high_resolution_clock Clock;
+using namespace trb::core;
+
+struct Kernel{
+    const char* name;
+    /** @brief The same work one value at a time with glm */
+    std::function<void()> reference;
+    std::function<void()> run;
+    /** @brief Results of the last reference or run call as floats */
+    std::function<std::vector<float>()> results;
+    /** @brief Results allowed to differ from glm by more than the tolerance, per million values */
+    uint32_t allowedPerMillion;
+};
+
+static double timeMs(const std::function<void()>& function, int iterations){
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < iterations; i++){
+        function();
+    }
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count() / iterations;
+}
+
+/** @brief Largest relative error and number of values off by more than 1e-5 */
+static float relativeError(const std::vector<float>& a, const std::vector<float>& b, uint32_t* wrong){
+    float error = 0.0f;
+    *wrong = 0;
+    for (size_t i = 0; i < a.size(); i++){
+        float e = std::fabs(a[i] - b[i]) / std::max(1.0f, std::fabs(b[i]));
+        error = std::max(error, e);
+        *wrong += e > 1e-5f ? 1 : 0;
+    }
+    return error;
+}
+
+int main(int argc, char** argv){
+    uint32_t count = argc > 1 ? (uint32_t)atoi(argv[1]) : 100003;
+    int iterations = argc > 2 ? atoi(argv[2]) : 50;
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    auto randomRotation = [&](){
+        return glm::normalize(glm::quat(unit(random), unit(random), unit(random), unit(random)));
+    };
+
+    MatrixArray a(count), b(count), out(count);
+    FloatArray x(count), y(count), z(count), ox(count), oy(count), oz(count);
+    FloatArray boxes[6], outBoxes[6];
+    FloatArray qx(count), qy(count), qz(count), qw(count), radius(count);
+    std::vector<uint8_t> inside(count);
+    for (int k = 0; k < 6; k++){
+        boxes[k].resize(count);
+        outBoxes[k].resize(count);
+    }
+    for (uint32_t i = 0; i < count; i++){
+        glm::vec3 t(position(random), position(random), position(random));
+        a[i] = glm::translate(glm::mat4(1.0f), t) * glm::mat4_cast(randomRotation()) * glm::scale(glm::mat4(1.0f), glm::vec3(1.0f + unit(random) * 0.5f));
+        b[i] = glm::translate(glm::mat4(1.0f), -t) * glm::mat4_cast(randomRotation());
+        x[i] = position(random);
+        y[i] = position(random);
+        z[i] = position(random);
+        for (int k = 0; k < 6; k++){
+            boxes[k][i] = k < 3 ? position(random) : std::fabs(unit(random)) * 5.0f;
+        }
+        glm::quat q = randomRotation();
+        qx[i] = q.x;
+        qy[i] = q.y;
+        qz[i] = q.z;
+        qw[i] = q.w;
+        radius[i] = std::fabs(unit(random)) * 5.0f;
+    }
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.3f, 0.1f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 150.0f);
+    glm::mat4 viewProjection = projection * view;
+    trb::grfx::Frustum frustum;
+    frustum.update(view, projection);
+    const float* boxIn[6] = { boxes[0].data(), boxes[1].data(), boxes[2].data(), boxes[3].data(), boxes[4].data(), boxes[5].data() };
+    float* boxOut[6] = { outBoxes[0].data(), outBoxes[1].data(), outBoxes[2].data(), outBoxes[3].data(), outBoxes[4].data(), outBoxes[5].data() };
+
+    auto matrices = [&](){ return std::vector<float>((const float*)out.data(), (const float*)out.data() + count * 16); };
+    auto points = [&](){
+        std::vector<float> r(ox.begin(), ox.end());
+        r.insert(r.end(), oy.begin(), oy.end());
+        r.insert(r.end(), oz.begin(), oz.end());
+        return r;
+    };
+    Kernel kernels[] = {
+        { "mat4 * mat4",
+          [&](){ for (uint32_t i = 0; i < count; i++) out[i] = a[i] * b[i]; },
+          [&](){ multiplyMatrices(a.data(), b.data(), out.data(), count); },
+          matrices, 0 },
+        { "viewproj * mat4",
+          [&](){ for (uint32_t i = 0; i < count; i++) out[i] = viewProjection * a[i]; },
+          [&](){ multiplyMatrices(viewProjection, a.data(), out.data(), count); },
+          matrices, 0 },
+        { "points",
+          [&](){
+              for (uint32_t i = 0; i < count; i++){
+                  glm::vec4 p = a[0] * glm::vec4(x[i], y[i], z[i], 1.0f);
+                  ox[i] = p.x; oy[i] = p.y; oz[i] = p.z;
+              }
+          },
+          [&](){ transformPoints(a[0], x.data(), y.data(), z.data(), ox.data(), oy.data(), oz.data(), count); },
+          points, 0 },
+        { "vectors",
+          [&](){
+              for (uint32_t i = 0; i < count; i++){
+                  glm::vec4 p = a[0] * glm::vec4(x[i], y[i], z[i], 0.0f);
+                  ox[i] = p.x; oy[i] = p.y; oz[i] = p.z;
+              }
+          },
+          [&](){ transformVectors(a[0], x.data(), y.data(), z.data(), ox.data(), oy.data(), oz.data(), count); },
+          points, 0 },
+        { "boxes",
+          [&](){
+              glm::mat3 absolute(glm::abs(glm::vec3(a[0][0])), glm::abs(glm::vec3(a[0][1])), glm::abs(glm::vec3(a[0][2])));
+              for (uint32_t i = 0; i < count; i++){
+                  glm::vec4 c = a[0] * glm::vec4(boxes[0][i], boxes[1][i], boxes[2][i], 1.0f);
+                  glm::vec3 e = absolute * glm::vec3(boxes[3][i], boxes[4][i], boxes[5][i]);
+                  outBoxes[0][i] = c.x; outBoxes[1][i] = c.y; outBoxes[2][i] = c.z;
+                  outBoxes[3][i] = e.x; outBoxes[4][i] = e.y; outBoxes[5][i] = e.z;
+              }
+          },
+          [&](){ transformBoxes(a[0], boxIn, boxOut, count); },
+          [&](){
+              std::vector<float> r;
+              for (int k = 0; k < 6; k++){
+                  r.insert(r.end(), outBoxes[k].begin(), outBoxes[k].end());
+              }
+              return r;
+          }, 0 },
+        { "quat -> mat4",
+          [&](){ for (uint32_t i = 0; i < count; i++) out[i] = glm::mat4_cast(glm::quat(qw[i], qx[i], qy[i], qz[i])); },
+          [&](){ quaternionsToMatrices(qx.data(), qy.data(), qz.data(), qw.data(), out.data(), count); },
+          matrices, 0 },
+        { "sphere planes",
+          [&](){ for (uint32_t i = 0; i < count; i++) inside[i] = frustum.intersectsSphere(glm::vec3(x[i], y[i], z[i]), radius[i]) ? 1 : 0; },
+          [&](){ testSpheres(frustum.planes, trb::grfx::Frustum::ePlaneCount, x.data(), y.data(), z.data(), radius.data(), inside.data(), count); },
+          // spheres touching a plane within float precision may go either way between glm and the kernels
+          [&](){ return std::vector<float>(inside.begin(), inside.end()); }, 100 },
+    };
+
+    static const MathPath paths[] = { eMathScalar, eMathSse41, eMathAvx2, eMathNeon };
+    printf("%u values, best path %s\n", count, getMathPathName(getBestMathPath()));
+    bool ok = true;
+    for (const Kernel& kernel : kernels){
+        kernel.reference();
+        std::vector<float> expected = kernel.results();
+        setMathPath(eMathScalar);
+        kernel.run();
+        std::vector<float> scalar = kernel.results();
+        bool exact = memcmp(expected.data(), scalar.data(), expected.size() * sizeof(float)) == 0;
+        uint32_t wrong;
+        float error = relativeError(scalar, expected, &wrong);
+        bool tolerable = (uint64_t)wrong * 1000000 <= (uint64_t)kernel.allowedPerMillion * expected.size();
+        printf("%s: glm %s (max relative error %g, %u off)\n", kernel.name, exact ? "matched to the bit" : tolerable ? "within tolerance" : "DIFFERS",
+            error, wrong);
+        ok &= tolerable;
+        double baseline = timeMs(kernel.reference, iterations);
+        printf("  %-7s %8.3f ms, %6.2f ns/value\n", "glm", baseline, baseline * 1e6 / count);
+        for (MathPath path : paths){
+            if (!isMathPathSupported(path)){
+                continue;
+            }
+            setMathPath(path);
+            kernel.run();
+            std::vector<float> result = kernel.results();
+            if (memcmp(result.data(), scalar.data(), scalar.size() * sizeof(float)) != 0){
+                printf("  %s: result differs from the scalar path\n", getMathPathName(path));
+                ok = false;
+                continue;
+            }
+            double ms = timeMs(kernel.run, iterations);
+            printf("  %-7s %8.3f ms, %6.2f ns/value, %5.2fx\n", getMathPathName(path), ms, ms * 1e6 / count, baseline / ms);
+        }
+    }
+    setMathPath(getBestMathPath());
+    return ok ? 0 : 1;
+}
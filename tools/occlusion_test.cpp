@@ -0,0 +1,250 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cfloat>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "core/JobSystem.hpp"
+#include "graphics/Frustum.hpp"
+#include "graphics/OcclusionCuller.hpp"
+
+// Correctness and throughput of the software occlusion culler
+//
+//   occlusion_test [buildings] [objects] [iterations]
+//
+// Known answers against a single wall, then a city block: the depth buffer is compared with a brute force
+// double precision rasterizer, every culled object is checked against the full resolution depth buffer and
+// the job system results have to match the single threaded ones exactly.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double milliseconds(Clock::time_point start){
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/** @brief Unit cube from -1 to 1, 12 triangles */
+static const float cubePositions[] = {
+    -1, -1, -1,   1, -1, -1,   1, 1, -1,   -1, 1, -1,
+    -1, -1,  1,   1, -1,  1,   1, 1,  1,   -1, 1,  1
+};
+static const uint16_t cubeIndices[] = {
+    0, 2, 1, 0, 3, 2,   4, 5, 6, 4, 6, 7,   0, 1, 5, 0, 5, 4,
+    3, 6, 2, 3, 7, 6,   0, 4, 7, 0, 7, 3,   1, 2, 6, 1, 6, 5
+};
+
+static bool check(const char* name, bool result){
+    printf("  %-40s %s\n", name, result ? "ok" : "FAILED");
+    return result;
+}
+
+/** @brief Depth of every pixel center covered by the transformed cubes, no clipping so they must be in front of the camera */
+static std::vector<float> referenceDepth(const glm::mat4& viewProjection, const std::vector<glm::mat4>& transforms, uint32_t width, uint32_t height){
+    std::vector<float> depth(width * height, 1.0f);
+    for (auto& transform : transforms){
+        glm::dmat4 m = glm::dmat4(viewProjection) * glm::dmat4(transform);
+        for (uint32_t t = 0; t < 36; t += 3){
+            glm::dvec3 v[3];
+            for (uint32_t k = 0; k < 3; k++){
+                const float* p = cubePositions + 3 * cubeIndices[t + k];
+                glm::dvec4 clip = m * glm::dvec4(p[0], p[1], p[2], 1.0);
+                v[k] = glm::dvec3((clip.x / clip.w * 0.5 + 0.5) * width, (clip.y / clip.w * 0.5 + 0.5) * height, clip.z / clip.w);
+            }
+            double area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+            if (area == 0.0){
+                continue;
+            }
+            for (uint32_t y = 0; y < height; y++){
+                for (uint32_t x = 0; x < width; x++){
+                    glm::dvec2 p(x + 0.5, y + 0.5);
+                    double w[3];
+                    for (uint32_t k = 0; k < 3; k++){
+                        const glm::dvec3& a = v[(k + 1) % 3];
+                        const glm::dvec3& b = v[(k + 2) % 3];
+                        w[k] = ((b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x)) / area;
+                    }
+                    if (w[0] >= 0.0 && w[1] >= 0.0 && w[2] >= 0.0){
+                        float z = (float)(w[0] * v[0].z + w[1] * v[1].z + w[2] * v[2].z);
+                        depth[y * width + x] = std::min(depth[y * width + x], z);
+                    }
+                }
+            }
+        }
+    }
+    return depth;
+}
+
+/** @brief A culled box must be behind the depth buffer at every pixel of its rectangle */
+static bool culledBehindDepth(const trb::grfx::OcclusionCuller& culler, const glm::mat4& viewProjection, const glm::vec3& min, const glm::vec3& max){
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = FLT_MAX;
+    for (uint32_t i = 0; i < 8; i++){
+        glm::vec4 p = viewProjection * glm::vec4(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z, 1.0f);
+        minX = std::min(minX, (p.x / p.w * 0.5f + 0.5f) * culler.getWidth());
+        maxX = std::max(maxX, (p.x / p.w * 0.5f + 0.5f) * culler.getWidth());
+        minY = std::min(minY, (p.y / p.w * 0.5f + 0.5f) * culler.getHeight());
+        maxY = std::max(maxY, (p.y / p.w * 0.5f + 0.5f) * culler.getHeight());
+        nearest = std::min(nearest, p.z / p.w);
+    }
+    const float* depth = culler.getDepth();
+    for (int32_t y = std::max(0, (int32_t)std::floor(minY)); y <= std::min((int32_t)culler.getHeight() - 1, (int32_t)std::floor(maxY)); y++){
+        for (int32_t x = std::max(0, (int32_t)std::floor(minX)); x <= std::min((int32_t)culler.getWidth() - 1, (int32_t)std::floor(maxX)); x++){
+            if (depth[y * culler.getWidth() + x] >= nearest){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv){
+    uint32_t buildings = argc > 1 ? (uint32_t)atoi(argv[1]) : 400;
+    uint32_t objects = argc > 2 ? (uint32_t)atoi(argv[2]) : 100000;
+    int iterations = argc > 3 ? atoi(argv[3]) : 50;
+
+    trb::core::JobSystem* jobs = trb::core::JobSystem::create();
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.5f, 1000.0f);
+    bool ok = true;
+
+    // a wall across the view 20 units ahead
+    {
+        printf("wall\n");
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::mat4 wall = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -20.0f)), glm::vec3(15.0f, 10.0f, 0.5f));
+        trb::grfx::OcclusionCuller culler;
+        culler.beginFrame(view, projection);
+        culler.addOccluder(cubePositions, 3 * sizeof(float), 8, cubeIndices, 36, 2, wall);
+        culler.render();
+        ok &= check("box behind the wall is hidden", !culler.isVisible(glm::vec3(-1.0f, -1.0f, -32.0f), glm::vec3(1.0f, 1.0f, -30.0f)));
+        ok &= check("box in front of the wall is visible", culler.isVisible(glm::vec3(-1.0f, -1.0f, -12.0f), glm::vec3(1.0f, 1.0f, -10.0f)));
+        ok &= check("box touching the wall is visible", culler.isVisible(glm::vec3(-1.0f, -1.0f, -20.0f), glm::vec3(1.0f, 1.0f, -19.0f)));
+        ok &= check("box behind and beside the wall is visible", culler.isVisible(glm::vec3(40.0f, -1.0f, -52.0f), glm::vec3(44.0f, 1.0f, -50.0f)));
+        ok &= check("box peeking over the wall is visible", culler.isVisible(glm::vec3(-1.0f, 12.0f, -42.0f), glm::vec3(1.0f, 30.0f, -40.0f)));
+        ok &= check("box around the camera is visible", culler.isVisible(glm::vec3(-1.0f), glm::vec3(1.0f)));
+
+        // the same wall crossing the near plane has to be clipped, not dropped
+        glm::mat4 close = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -2.0f)), glm::vec3(15.0f, 10.0f, 2.0f));
+        culler.beginFrame(view, projection);
+        culler.addOccluder(cubePositions, 3 * sizeof(float), 8, cubeIndices, 36, 2, close);
+        culler.render();
+        ok &= check("wall through the near plane still hides", !culler.isVisible(glm::vec3(-1.0f, -1.0f, -32.0f), glm::vec3(1.0f, 1.0f, -30.0f)));
+    }
+
+    // city block: buildings on a grid in front of the camera, objects scattered between and behind them
+    printf("city, %u buildings, %u objects, %u workers\n", buildings, objects, jobs->getWorkerCount());
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    glm::vec3 eye(0.0f, 2.0f, 0.0f);
+    glm::mat4 view = glm::lookAt(eye, glm::vec3(0.2f, 1.5f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 viewProjection = projection * view;
+    std::vector<glm::mat4> transforms;
+    uint32_t side = (uint32_t)std::ceil(std::sqrt((float)buildings));
+    for (uint32_t i = 0; i < buildings; i++){
+        glm::vec3 center(((float)(i % side) - side * 0.5f) * 20.0f, 0.0f, -15.0f - (float)(i / side) * 20.0f);
+        glm::vec3 extent(3.0f + unit(random) * 5.0f, 5.0f + unit(random) * 25.0f, 3.0f + unit(random) * 5.0f);
+        center.y = extent.y;
+        transforms.push_back(glm::scale(glm::translate(glm::mat4(1.0f), center), extent));
+    }
+    trb::grfx::BoundingBoxes boxes;
+    boxes.resize(objects);
+    float span = side * 20.0f;
+    for (uint32_t i = 0; i < objects; i++){
+        glm::vec3 center((unit(random) - 0.5f) * span, unit(random) * 4.0f, -5.0f - unit(random) * span);
+        glm::vec3 extent(0.5f + unit(random) * 1.5f);
+        boxes.set(i, center - extent, center + extent);
+    }
+
+    trb::grfx::OcclusionCuller culler;
+    auto render = [&](trb::core::JobSystem* system){
+        culler.beginFrame(view, projection);
+        for (auto& transform : transforms){
+            culler.addOccluder(cubePositions, 3 * sizeof(float), 8, cubeIndices, 36, 2, transform);
+        }
+        culler.render(system);
+    };
+
+    // depth against the reference, which does not clip: only buildings fully in front of the camera
+    std::vector<glm::mat4> inFront;
+    for (auto& transform : transforms){
+        bool front = true;
+        for (uint32_t v = 0; v < 8; v++){
+            glm::vec4 clip = viewProjection * transform * glm::vec4(cubePositions[3 * v], cubePositions[3 * v + 1], cubePositions[3 * v + 2], 1.0f);
+            front = front && clip.z > 0.0f && std::fabs(clip.x) < clip.w * OCCLUSION_GUARD_BAND && std::fabs(clip.y) < clip.w * OCCLUSION_GUARD_BAND;
+        }
+        if (front){
+            inFront.push_back(transform);
+        }
+    }
+    culler.beginFrame(view, projection);
+    for (auto& transform : inFront){
+        culler.addOccluder(cubePositions, 3 * sizeof(float), 8, cubeIndices, 36, 2, transform);
+    }
+    culler.render();
+    std::vector<float> reference = referenceDepth(viewProjection, inFront, culler.getWidth(), culler.getHeight());
+    uint32_t pixels = culler.getWidth() * culler.getHeight(), differences = 0;
+    for (uint32_t i = 0; i < pixels; i++){
+        differences += std::fabs(culler.getDepth()[i] - reference[i]) > 1e-4f ? 1 : 0;
+    }
+    printf("  %u of %u pixels differ from the reference rasterizer\n", differences, pixels);
+    // pixel centers exactly on an edge may go either way
+    ok &= check("depth matches the reference", differences <= pixels / 1000);
+
+    // the whole city, single threaded against jobs
+    render(nullptr);
+    std::vector<float> single(culler.getDepth(), culler.getDepth() + pixels);
+    std::vector<uint32_t> frustumVisible(objects);
+    trb::grfx::Frustum frustum;
+    frustum.update(view, projection);
+    trb::grfx::FrustumCuller frustumCuller;
+    uint32_t inView = frustumCuller.cull(frustum, boxes, frustumVisible.data());
+    std::vector<uint32_t> visible(inView), visibleJobs(inView);
+    uint32_t visibleCount = culler.cull(boxes, frustumVisible.data(), inView, visible.data());
+    render(jobs);
+    ok &= check("jobs rasterize the same depth", std::equal(single.begin(), single.end(), culler.getDepth()));
+    uint32_t visibleJobsCount = culler.cull(boxes, frustumVisible.data(), inView, visibleJobs.data(), jobs);
+    ok &= check("jobs cull the same objects", visibleJobsCount == visibleCount && std::equal(visible.begin(), visible.begin() + visibleCount, visibleJobs.begin()));
+
+    uint32_t wrong = 0;
+    for (uint32_t i = 0, v = 0; i < inView; i++){
+        uint32_t object = frustumVisible[i];
+        if (v < visibleCount && visible[v] == object){
+            v++;
+            continue;
+        }
+        glm::vec3 center(boxes.centerX[object], boxes.centerY[object], boxes.centerZ[object]);
+        glm::vec3 extent(boxes.extentX[object], boxes.extentY[object], boxes.extentZ[object]);
+        wrong += culledBehindDepth(culler, viewProjection, center - extent, center + extent) ? 0 : 1;
+    }
+    ok &= check("culled objects are behind the depth buffer", wrong == 0);
+    printf("  %u in the frustum, %u visible, %u occluded\n", inView, visibleCount, inView - visibleCount);
+
+    // throughput
+    for (int threaded = 0; threaded < 2; threaded++){
+        trb::core::JobSystem* system = threaded ? jobs : nullptr;
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < iterations; i++){
+            render(system);
+        }
+        double renderTime = milliseconds(start) / iterations;
+        start = Clock::now();
+        for (int i = 0; i < iterations; i++){
+            culler.cull(boxes, frustumVisible.data(), inView, visible.data(), system);
+        }
+        double cullTime = milliseconds(start) / iterations;
+        printf("  %-7s render %7.3f ms (%u triangles), test %7.3f ms (%.1f ns/object)\n", threaded ? "jobs" : "single", renderTime,
+            culler.getStats().triangles, cullTime, cullTime * 1e6 / inView);
+    }
+
+    jobs->shutdown();
+    if (!ok){
+        printf("occlusion results are wrong\n");
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,157 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include "core/JobSystem.hpp"
+#include "graphics/vulkan/VulkanDevice.hpp"
+#include "graphics/vulkan/VulkanCommandRecorder.hpp"
+#include "graphics/vulkan/VulkanRenderGraph.hpp"
+
+// Parallel command recording through a render graph pass, scaling with the worker count, headless (lavapipe works)
+//
+//   record_bench [draws] [iterations]
+//
+// Records the same path a frame takes: a recorded pass of the render graph begins its render pass with secondary
+// command buffers and the command recorder fills them on the workers. Without shaders a draw is its state
+// changes, a scissor and a 64 byte push constant block, which is what dominates recording a real draw on the CPU.
+// Every draw has to be recorded exactly once and the result has to submit.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static bool check(const char* name, bool result){
+    printf("  %-52s %s\n", name, result ? "ok" : "FAILED");
+    return result;
+}
+
+int main(int argc, char** argv){
+    uint32_t draws = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 50;
+
+    vk::ApplicationInfo appInfo("record_bench", 1, "turbulence", 1, VK_API_VERSION_1_0);
+    vk::InstanceCreateInfo instanceInfo;
+    instanceInfo.pApplicationInfo = &appInfo;
+    vk::Instance instance;
+    if (vk::createInstance(&instanceInfo, nullptr, &instance) != vk::Result::eSuccess){
+        printf("failed to create a Vulkan instance\n");
+        return 1;
+    }
+
+    bool ok = true;
+    trb::core::JobSystem* jobs = trb::core::JobSystem::create(1);
+    {
+        trb::grfx::VulkanDevice device;
+        device.init(instance);
+        vk::Queue queue;
+        device.device.getQueue((uint32_t)device.queueFamilyIndices.graphicsFamily, 0, &queue);
+
+        // push constants need a layout but no pipeline
+        vk::PushConstantRange pushRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4));
+        vk::PipelineLayoutCreateInfo layoutInfo;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushRange;
+        vk::PipelineLayout layout;
+        if (device.device.createPipelineLayout(&layoutInfo, nullptr, &layout) != vk::Result::eSuccess){
+            throw std::runtime_error("failed to create pipeline layout");
+        }
+        vk::CommandPool pool = device.createCommandPool(device.queueFamilyIndices.graphicsFamily);
+        vk::CommandBufferAllocateInfo allocInfo(pool, vk::CommandBufferLevel::ePrimary, 1);
+        vk::CommandBuffer primary;
+        if (device.device.allocateCommandBuffers(&allocInfo, &primary) != vk::Result::eSuccess){
+            throw std::runtime_error("failed to allocate command buffer");
+        }
+
+        std::vector<glm::mat4> transforms(draws);
+        for (uint32_t i = 0; i < draws; i++){
+            transforms[i] = glm::mat4(1.0f);
+            transforms[i][3] = glm::vec4((float)(i % 100), (float)(i / 100), 0.0f, 1.0f);
+        }
+        std::vector<std::atomic<uint32_t> > recorded(draws);
+        const vk::Extent2D extent(256, 256);
+
+        trb::grfx::VulkanCommandRecorder recorder;
+        trb::grfx::VulkanRenderGraph graph;
+        graph.init(&device, nullptr, &recorder);
+        trb::grfx::RenderGraphResource target = graph.createImage("target", vk::Format::eR8G8B8A8Unorm, extent);
+        graph.markOutput(target);
+        graph.addRecordedPass("scene", [&](trb::grfx::VulkanRenderGraph::PassBuilder& builder){
+            builder.writeColor(target, true);
+        }, [&](const trb::grfx::VulkanRenderGraph&){
+            return draws;
+        }, [&](vk::CommandBuffer commandBuffer, uint32_t first, uint32_t count){
+            vk::Viewport viewport(0.0f, 0.0f, (float)extent.width, (float)extent.height, 0.0f, 1.0f);
+            commandBuffer.setViewport(0, 1, &viewport);
+            for (uint32_t i = first; i < first + count; i++){
+                vk::Rect2D scissor(vk::Offset2D((int32_t)(i % extent.width), 0), vk::Extent2D(1, extent.height));
+                commandBuffer.setScissor(0, 1, &scissor);
+                commandBuffer.pushConstants(layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4), &transforms[i]);
+                recorded[i]++;
+            }
+        });
+        printf("%s, %u draws, %d iterations\n", device.properties.deviceName, draws, iterations);
+
+        uint32_t maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+        double baseline = 0.0;
+        bool once = true, chunked = true, submitted = true;
+        for (uint32_t threads = 1; ; threads = std::min(threads * 2, maxThreads)){
+            jobs->shutdown();
+            jobs->init(threads);
+            recorder.destroy();
+            recorder.init(&device, 1, jobs);
+
+            double recordMs = 0.0;
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < iterations; i++){
+                for (auto& count : recorded){
+                    count = 0;
+                }
+                recorder.beginFrame(0);
+                vk::CommandBufferBeginInfo beginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+                primary.begin(&beginInfo);
+                graph.execute(primary);
+                primary.end();
+                recordMs += recorder.getStats().recordTime;
+            }
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / iterations;
+            recordMs /= iterations;
+            baseline = baseline == 0.0 ? recordMs : baseline;
+
+            // the last recording has to be complete and has to execute
+            for (auto& count : recorded){
+                once &= count == 1;
+            }
+            const trb::grfx::RecorderStats& stats = recorder.getStats();
+            chunked &= stats.chunks > 0 && stats.secondaryBuffersAllocated >= stats.chunks;
+            vk::SubmitInfo submitInfo;
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &primary;
+            submitted &= queue.submit(1, &submitInfo, vk::Fence()) == vk::Result::eSuccess;
+            queue.waitIdle();
+
+            printf("  %2u workers %8.3f ms record, %8.3f ms frame, %4u chunks, %5.2fx\n", threads, recordMs, ms, stats.chunks, baseline / recordMs);
+            if (threads == maxThreads){
+                break;
+            }
+        }
+        ok &= check("every draw is recorded exactly once", once);
+        ok &= check("draws are split into secondary command buffers", chunked);
+        ok &= check("the recorded frames submit", submitted);
+
+        device.device.waitIdle();
+        recorder.destroy();
+        graph.reset();
+        device.device.destroyCommandPool(pool, nullptr);
+        device.device.destroyPipelineLayout(layout, nullptr);
+    }
+    jobs->shutdown();
+    instance.destroy(nullptr);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,75 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "asset/Mesh.hpp"
+#include "MeshImport.hpp"
+
+// Load time of a model through assimp against the same model cooked to .tmesh
+//
+//   tmesh_bench <model> [iterations] [--split]
+//
+// The assimp side is what a runtime import would cost: parse, post process and convert to the vertex layout.
+// The .tmesh side maps the file, validates it and copies the data block once, standing in for the copy into
+// the mapped buffer VulkanDevice::createBuffer does. The page cache is warm for both.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double milliseconds(Clock::time_point start){
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+int main(int argc, char** argv){
+    if (argc < 2){
+        std::cerr << "usage: tmesh_bench <model> [iterations] [--split]" << std::endl;
+        return 1;
+    }
+    std::string model = argv[1];
+    int iterations = 10;
+    bool split = false;
+    for (int i = 2; i < argc; i++){
+        if (std::string(argv[i]) == "--split"){
+            split = true;
+        }else{
+            iterations = std::max(1, atoi(argv[i]));
+        }
+    }
+    std::string cooked = model + ".tmesh";
+
+    trb::asset::MeshData data;
+    std::string error;
+    if (!trb::tools::importMesh(model, &data, split, &error)){
+        std::cerr << "assimp failed to load " << model << ": " << error << std::endl;
+        return 1;
+    }
+    data.write(cooked);
+    std::cout << model << ": " << data.vertexCount << " vertices, " << data.indices.size() / 3 << " triangles, "
+        << data.submeshes.size() << " submeshes, " << data.streams.size() << " streams" << std::endl;
+
+    double assimpTime = 0.0;
+    for (int i = 0; i < iterations; i++){
+        Clock::time_point start = Clock::now();
+        trb::tools::importMesh(model, &data, split);
+        assimpTime += milliseconds(start);
+    }
+
+    double tmeshTime = 0.0;
+    std::vector<uint8_t> gpu;
+    for (int i = 0; i < iterations; i++){
+        Clock::time_point start = Clock::now();
+        trb::asset::MeshFile file;
+        file.open(cooked);
+        const trb::asset::MeshView& view = file.getView();
+        gpu.resize((size_t)view.getDataSize());
+        memcpy(gpu.data(), view.getData(), gpu.size());
+        tmeshTime += milliseconds(start);
+    }
+
+    std::cout << "  assimp import: " << assimpTime / iterations << " ms" << std::endl;
+    std::cout << "  .tmesh load  : " << tmeshTime / iterations << " ms (" << gpu.size() << " bytes)" << std::endl;
+    std::cout << "  speedup      : " << assimpTime / tmeshTime << "x" << std::endl;
+    return 0;
+}
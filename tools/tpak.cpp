@@ -0,0 +1,71 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+
+#include "core/JobSystem.hpp"
+#include "asset/AssetPack.hpp"
+#include "FileSystem.hpp"
+
+// Packs a directory tree into a .tpak archive, or lists an existing one
+//
+//   tpak <directory> <output.tpak> [chunk KiB]
+//   tpak -l <archive.tpak>
+
+static int list(const std::string& filename){
+    trb::asset::AssetPack pack;
+    pack.open(filename);
+    for (uint32_t i = 0; i < pack.getEntryCount(); i++){
+        const trb::asset::TpakEntry* entry = pack.getEntry(i);
+        std::cout << pack.getPath(entry) << "  " << entry->size << " -> " << entry->storedSize
+            << (pack.isCompressed(entry) ? " lz4 (" + std::to_string(entry->chunkCount) + " chunks)" : " stored") << std::endl;
+    }
+    return 0;
+}
+
+static int build(const std::string& root, const std::string& output, uint32_t chunkSize){
+    std::vector<std::string> files;
+    trb::tools::listFiles(root, files);
+    // stable archive layout for the same input
+    std::sort(files.begin(), files.end());
+
+    trb::core::JobSystem* jobs = trb::core::JobSystem::create();
+    trb::asset::AssetPackBuilder builder;
+    builder.begin(output, chunkSize);
+    for (auto& path : files){
+        std::vector<char> data = trb::tools::readFile(root + "/" + path);
+        if (!builder.add(path, data.data(), data.size(), jobs)){
+            throw std::runtime_error("failed to add " + path + " (duplicate path hash?)");
+        }
+    }
+    builder.finish();
+    jobs->shutdown();
+
+    std::cout << files.size() << " files, " << builder.getRawBytes() << " bytes -> " << builder.getStoredBytes()
+        << " bytes (" << (builder.getRawBytes() ? 100.0 * builder.getStoredBytes() / builder.getRawBytes() : 100.0) << "%)" << std::endl;
+    return 0;
+}
+
+int main(int argc, char** argv){
+    try{
+        if (argc == 3 && std::string(argv[1]) == "-l"){
+            return list(argv[2]);
+        }
+        if (argc == 3 || argc == 4){
+            uint32_t chunkSize = argc == 4 ? (uint32_t)atoi(argv[3]) * 1024 : 0;
+            if (chunkSize == 0){
+                chunkSize = TPAK_DEFAULT_CHUNK_SIZE;
+            }
+            return build(argv[1], argv[2], chunkSize);
+        }
+    }catch (const std::exception& e){
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    std::cerr << "usage: tpak <directory> <output.tpak> [chunk KiB]" << std::endl;
+    std::cerr << "       tpak -l <archive.tpak>" << std::endl;
+    return 1;
+}
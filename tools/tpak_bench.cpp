@@ -0,0 +1,114 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "core/JobSystem.hpp"
+#include "asset/AssetPack.hpp"
+
+// Read throughput of loose files against the same files in a .tpak built from them
+//
+//   tpak_bench <directory> <archive.tpak> [iterations]
+//
+// Every pass reads every file once. The first pass warms the page cache, so the numbers compare
+// the cost of open/read syscalls and decompression rather than the disk.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double seconds(Clock::time_point start){
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void report(const char* name, uint64_t bytes, double time){
+    std::cout << "  " << name << ": " << time * 1000.0 << " ms, " << bytes / time / (1024.0 * 1024.0) << " MiB/s" << std::endl;
+}
+
+int main(int argc, char** argv){
+    if (argc < 3){
+        std::cerr << "usage: tpak_bench <directory> <archive.tpak> [iterations]" << std::endl;
+        return 1;
+    }
+    std::string root = argv[1];
+    int iterations = argc > 3 ? atoi(argv[3]) : 5;
+
+    trb::core::JobSystem* jobs = trb::core::JobSystem::create();
+    trb::asset::AssetPack pack;
+    try{
+        pack.open(argv[2]);
+    }catch (const std::exception& e){
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> paths;
+    uint64_t bytes = 0;
+    uint64_t largest = 0;
+    for (uint32_t i = 0; i < pack.getEntryCount(); i++){
+        const trb::asset::TpakEntry* entry = pack.getEntry(i);
+        paths.push_back(pack.getPath(entry));
+        bytes += entry->size;
+        largest = entry->size > largest ? entry->size : largest;
+    }
+    std::vector<char> buffer((size_t)largest);
+    std::cout << paths.size() << " files, " << bytes / (1024.0 * 1024.0) << " MiB, " << jobs->getWorkerCount() << " workers" << std::endl;
+
+    double loose = 0.0, serial = 0.0, parallel = 0.0, mapped = 0.0;
+    for (int it = 0; it <= iterations; it++){
+        Clock::time_point start = Clock::now();
+        for (auto& path : paths){
+            std::ifstream file(root + "/" + path, std::ios::binary | std::ios::ate);
+            size_t size = (size_t)file.tellg();
+            file.seekg(0);
+            file.read(buffer.data(), size);
+        }
+        double looseTime = seconds(start);
+
+        start = Clock::now();
+        for (auto& path : paths){
+            pack.read(pack.find(path), buffer.data());
+        }
+        double serialTime = seconds(start);
+
+        start = Clock::now();
+        for (auto& path : paths){
+            pack.read(pack.find(path), buffer.data(), jobs);
+        }
+        double parallelTime = seconds(start);
+
+        // what a loader sees: stored payloads are used in place, only compressed ones are expanded
+        start = Clock::now();
+        volatile uint8_t sink = 0;
+        for (auto& path : paths){
+            const trb::asset::TpakEntry* entry = pack.find(path);
+            const uint8_t* data = (const uint8_t*)pack.data(entry);
+            if (data){
+                for (uint64_t offset = 0; offset < entry->size; offset += 4096){
+                    sink = sink + data[offset];
+                }
+            }else{
+                pack.read(entry, buffer.data(), jobs);
+            }
+        }
+        double mappedTime = seconds(start);
+
+        // iteration 0 only warms the caches
+        if (it > 0){
+            loose += looseTime;
+            serial += serialTime;
+            parallel += parallelTime;
+            mapped += mappedTime;
+        }
+    }
+
+    bytes *= iterations;
+    report("loose files         ", bytes, loose);
+    report("pack, serial read   ", bytes, serial);
+    report("pack, parallel read ", bytes, parallel);
+    report("pack, zero copy     ", bytes, mapped);
+
+    jobs->shutdown();
+    return 0;
+}
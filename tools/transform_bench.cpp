@@ -0,0 +1,158 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "core/JobSystem.hpp"
+#include "scene/TransformHierarchy.hpp"
+
+// Transform hierarchy update time with every root moved, every tenth node moved and nothing moved
+//
+//   transform_bench [nodes] [iterations]
+//
+// Nodes hang below random recent nodes, which gives a bushy tree a few dozen levels deep. World matrices are
+// checked against glm after building, after every timed case and after reparenting and destroying subtrees.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+using trb::scene::TransformId;
+
+/** @brief World matrix by walking up the parents with glm, memoized in reference */
+static const glm::mat4& referenceWorld(const trb::scene::TransformHierarchy& hierarchy, TransformId id, std::vector<glm::mat4>& reference,
+                                       std::vector<uint8_t>& known){
+    if (!known[id]){
+        glm::mat4 local = glm::translate(glm::mat4(1.0f), hierarchy.getTranslation(id)) * glm::mat4_cast(hierarchy.getRotation(id)) *
+            glm::scale(glm::mat4(1.0f), hierarchy.getScale(id));
+        TransformId parent = hierarchy.getParent(id);
+        reference[id] = parent == TRANSFORM_NONE ? local : referenceWorld(hierarchy, parent, reference, known) * local;
+        known[id] = 1;
+    }
+    return reference[id];
+}
+
+static bool check(const char* name, const trb::scene::TransformHierarchy& hierarchy, const std::vector<TransformId>& ids){
+    std::vector<glm::mat4> reference(ids.size());
+    std::vector<uint8_t> known(ids.size(), 0);
+    uint32_t wrong = 0, alive = 0;
+    for (TransformId id : ids){
+        if (!hierarchy.isAlive(id)){
+            continue;
+        }
+        alive++;
+        const glm::mat4& expected = referenceWorld(hierarchy, id, reference, known);
+        const glm::mat4& world = hierarchy.getWorld(id);
+        float error = 0.0f;
+        for (int c = 0; c < 4; c++){
+            for (int r = 0; r < 4; r++){
+                error = std::max(error, std::fabs(world[c][r] - expected[c][r]) / std::max(1.0f, std::fabs(expected[c][r])));
+            }
+        }
+        wrong += error > 1e-4f ? 1 : 0;
+    }
+    if (wrong || alive != hierarchy.getCount()){
+        printf("%s: %u of %u world matrices differ from glm, %u nodes stored\n", name, wrong, alive, hierarchy.getCount());
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv){
+    uint32_t count = argc > 1 ? (uint32_t)atoi(argv[1]) : 50000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 200;
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> size(0.8f, 1.25f);
+    auto randomRotation = [&](){
+        return glm::normalize(glm::quat(unit(random), unit(random), unit(random), unit(random)));
+    };
+
+    trb::scene::TransformHierarchy hierarchy;
+    std::vector<TransformId> ids(count);
+    std::vector<TransformId> roots;
+    for (uint32_t i = 0; i < count; i++){
+        TransformId parent = i < 64 ? TRANSFORM_NONE : ids[i - 1 - random() % std::min(i, 4096u)];
+        ids[i] = hierarchy.create(parent);
+        hierarchy.setLocal(ids[i], glm::vec3(unit(random), unit(random), unit(random)), randomRotation(), glm::vec3(size(random)));
+        if (parent == TRANSFORM_NONE){
+            roots.push_back(ids[i]);
+        }
+    }
+    trb::core::JobSystem* jobs = trb::core::JobSystem::create();
+    Clock::time_point start = Clock::now();
+    hierarchy.update(jobs);
+    double buildMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    printf("%u nodes, %u levels, first update with sorting %.3f ms, %u workers\n", hierarchy.getCount(), hierarchy.getStats().levels,
+        buildMs, jobs->getWorkerCount());
+    bool ok = check("build", hierarchy, ids);
+
+    std::vector<TransformId> tenth;
+    for (uint32_t i = 0; i < count; i += 10){
+        tenth.push_back(ids[i]);
+    }
+    struct Case{ const char* name; const std::vector<TransformId>* touched; };
+    std::vector<TransformId> none;
+    Case cases[] = { { "all", &roots }, { "tenth", &tenth }, { "clean", &none } };
+    for (const Case& c : cases){
+        for (int threaded = 0; threaded < 2; threaded++){
+            trb::core::JobSystem* system = threaded ? jobs : nullptr;
+            double ms = 0.0;
+            uint32_t updated = 0;
+            for (int i = 0; i < iterations; i++){
+                for (TransformId id : *c.touched){
+                    hierarchy.setRotation(id, randomRotation());
+                }
+                hierarchy.update(system);
+                // the first clean update still clears the flags of the previous case
+                hierarchy.update(system);
+                start = Clock::now();
+                for (TransformId id : *c.touched){
+                    hierarchy.setTranslation(id, hierarchy.getTranslation(id) + glm::vec3(0.001f));
+                }
+                hierarchy.update(system);
+                ms += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+                updated = hierarchy.getStats().updated;
+            }
+            ms /= iterations;
+            printf("  %-6s %-7s %8.3f ms, %6u recomputed, %6.2f ns/node\n", c.name, threaded ? "jobs" : "single", ms, updated,
+                updated ? ms * 1e6 / updated : 0.0);
+            ok &= check(c.name, hierarchy, ids);
+        }
+    }
+
+    // move every 100th node under another subtree unless that would form a cycle, then drop a few subtrees
+    uint32_t moved = 0;
+    for (uint32_t i = 100; i < count; i += 100){
+        TransformId parent = ids[random() % count];
+        bool cycle = false;
+        for (TransformId a = parent; a != TRANSFORM_NONE && !cycle; a = hierarchy.getParent(a)){
+            cycle = a == ids[i];
+        }
+        if (!cycle){
+            hierarchy.setParent(ids[i], parent);
+            moved++;
+        }
+    }
+    for (uint32_t i = 0; i < 16; i++){
+        hierarchy.destroy(ids[64 + random() % (count - 64)]);
+    }
+    start = Clock::now();
+    hierarchy.update(jobs);
+    double sortMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    printf("%u nodes moved, %u left after destroying 16 subtrees, %u levels, update with sorting %.3f ms\n", moved, hierarchy.getCount(),
+        hierarchy.getStats().levels, sortMs);
+    ok &= check("structure", hierarchy, ids);
+
+    jobs->shutdown();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "graphics/vulkan/VulkanDevice.hpp"
+#include "graphics/vulkan/VulkanUniformAllocator.hpp"
+
+// Per frame uniform allocator checked on a real device, headless (lavapipe works)
+//
+//   uniform_test [frames] [arena bytes]
+//
+// Offsets have to respect minUniformBufferOffsetAlignment and stay inside the region of their frame slot, beginFrame()
+// has to rewind exactly that region, an exhausted region has to throw, and the flush range has to cover what was
+// allocated in whole nonCoherentAtomSize atoms. Concurrent allocations from several threads must not overlap.
+
+static bool check(const char* name, bool result){
+    printf("  %-52s %s\n", name, result ? "ok" : "FAILED");
+    return result;
+}
+
+/** @brief Every allocation on its alignment, inside the region of slot and not overlapping any other */
+static bool validRanges(std::vector<std::pair<uint32_t, vk::DeviceSize> > ranges, vk::DeviceSize alignment, vk::DeviceSize regionBase,
+                        vk::DeviceSize capacity){
+    std::sort(ranges.begin(), ranges.end());
+    for (size_t i = 0; i < ranges.size(); i++){
+        vk::DeviceSize offset = ranges[i].first;
+        if (offset % alignment != 0 || offset < regionBase || offset + ranges[i].second > regionBase + capacity){
+            return false;
+        }
+        if (i > 0 && ranges[i - 1].first + ranges[i - 1].second > offset){
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv){
+    uint32_t frames = argc > 1 ? (uint32_t)atoi(argv[1]) : 3;
+    vk::DeviceSize arena = argc > 2 ? (vk::DeviceSize)atoi(argv[2]) : 64 * 1024;
+
+    vk::ApplicationInfo appInfo("uniform_test", 1, "turbulence", 1, VK_API_VERSION_1_0);
+    vk::InstanceCreateInfo instanceInfo;
+    instanceInfo.pApplicationInfo = &appInfo;
+    vk::Instance instance;
+    if (vk::createInstance(&instanceInfo, nullptr, &instance) != vk::Result::eSuccess){
+        printf("failed to create a Vulkan instance\n");
+        return 1;
+    }
+
+    bool ok = true;
+    {
+        trb::grfx::VulkanDevice device;
+        device.init(instance);
+
+        trb::grfx::VulkanUniformAllocator uniforms;
+        uniforms.init(&device, frames, arena);
+        vk::DeviceSize alignment = uniforms.getAlignment(), atomSize = uniforms.getAtomSize(), capacity = uniforms.getCapacity();
+        printf("%s, %u frames of %llu bytes, alignment %llu, atom %llu, %s memory\n", device.properties.deviceName, frames,
+            (unsigned long long)capacity, (unsigned long long)alignment, (unsigned long long)atomSize, uniforms.isCoherent() ? "coherent" : "non coherent");
+        ok &= check("alignment is the device limit", alignment == std::max(device.properties.limits.minUniformBufferOffsetAlignment, (vk::DeviceSize)1));
+        ok &= check("regions end on alignment and atom boundaries", capacity >= arena && capacity % alignment == 0 && capacity % atomSize == 0);
+
+        // odd sizes in every slot, the data pointer and the offset have to agree
+        bool rewound = true, pointers = true, ranges = true;
+        char* base = nullptr;
+        for (uint32_t frame = 0; frame < frames * 2; frame++){
+            uint32_t slot = frame % frames;
+            uniforms.beginFrame(slot);
+            std::vector<std::pair<uint32_t, vk::DeviceSize> > allocated;
+            for (vk::DeviceSize size = 1; size < 300; size += 37){
+                trb::grfx::UniformAllocation allocation = uniforms.allocate(size);
+                if (!base){
+                    base = (char*)allocation.data - allocation.offset;
+                }
+                pointers &= (char*)allocation.data == base + allocation.offset;
+                memset(allocation.data, (int)frame, (size_t)size);
+                allocated.push_back(std::make_pair(allocation.offset, size));
+            }
+            rewound &= allocated[0].first == slot * capacity;
+            ranges &= validRanges(allocated, alignment, slot * capacity, capacity);
+        }
+        ok &= check("offsets are aligned, inside the slot and disjoint", ranges);
+        ok &= check("beginFrame rewinds to the start of the slot", rewound);
+        ok &= check("data pointers match the dynamic offsets", pointers);
+
+        uint32_t value = 0x12345678u;
+        uint32_t offset = uniforms.push(value);
+        uint32_t stored;
+        memcpy(&stored, base + offset, sizeof(stored));
+        ok &= check("push copies to the dynamic offset", stored == value);
+
+        // exactly as many chunks as the region holds, then an exception
+        uniforms.beginFrame(0);
+        vk::DeviceSize chunk = alignment * 4;
+        uint32_t fitted = 0;
+        bool threw = false;
+        try{
+            for (;;){
+                uniforms.allocate(chunk);
+                fitted++;
+            }
+        }catch (const std::runtime_error&){
+            threw = true;
+        }
+        ok &= check("an exhausted region throws", threw && fitted == capacity / chunk);
+        bool recovered = true;
+        uniforms.beginFrame(1 % frames);
+        try{
+            recovered = uniforms.allocate(chunk).offset == (1 % frames) * capacity;
+        }catch (const std::runtime_error&){
+            recovered = false;
+        }
+        ok &= check("the next frame allocates again", recovered);
+
+        // flush ranges: everything since the last flush, in whole atoms, inside the region
+        uniforms.beginFrame(frames - 1);
+        vk::DeviceSize regionBase = (frames - 1) * capacity;
+        vk::DeviceSize flushOffset, flushSize;
+        uniforms.getFlushRange(&flushOffset, &flushSize);
+        bool flushes = flushSize == 0;
+        vk::DeviceSize flushedTotal = 0, allocatedEnd = 0;
+        for (int batch = 0; batch < 4; batch++){
+            vk::DeviceSize batchBegin = 0;
+            for (int i = 0; i < 3; i++){
+                trb::grfx::UniformAllocation allocation = uniforms.allocate(24 + batch * 40);
+                batchBegin = i == 0 ? allocation.offset : batchBegin;
+                allocatedEnd = allocation.offset + 24 + batch * 40;
+            }
+            uniforms.getFlushRange(&flushOffset, &flushSize);
+            flushes &= flushOffset % atomSize == 0 && flushSize % atomSize == 0 && flushOffset <= batchBegin;
+            flushes &= flushOffset >= regionBase && flushOffset + flushSize <= regionBase + capacity;
+            flushes &= flushOffset + flushSize >= allocatedEnd;
+            flushedTotal += flushSize;
+            uniforms.flush();
+            if (!uniforms.isCoherent()){
+                // flush() moved on, the next range starts at most an atom before where this one ended
+                vk::DeviceSize nextOffset, nextSize;
+                uniforms.getFlushRange(&nextOffset, &nextSize);
+                flushes &= nextSize == 0 && nextOffset + atomSize >= allocatedEnd;
+            }
+        }
+        uniforms.beginFrame(0);
+        ok &= check("flush ranges cover the allocations in whole atoms", flushes);
+        if (!uniforms.isCoherent()){
+            ok &= check("flushed bytes are counted", uniforms.getStats().flushed == flushedTotal);
+        } else{
+            ok &= check("coherent memory flushes nothing", uniforms.getStats().flushed == 0);
+        }
+
+        // workers allocate concurrently while recording
+        const uint32_t threadCount = 4;
+        vk::DeviceSize size = std::max(alignment, (vk::DeviceSize)16);
+        uint32_t perThread = (uint32_t)std::min<vk::DeviceSize>(capacity / (size * threadCount), 256);
+        std::vector<std::vector<std::pair<uint32_t, vk::DeviceSize> > > perWorker(threadCount);
+        std::vector<std::thread> threads;
+        for (uint32_t t = 0; t < threadCount; t++){
+            threads.push_back(std::thread([&, t](){
+                for (uint32_t i = 0; i < perThread; i++){
+                    perWorker[t].push_back(std::make_pair(uniforms.allocate(size).offset, size));
+                }
+            }));
+        }
+        for (auto& thread : threads){
+            thread.join();
+        }
+        std::vector<std::pair<uint32_t, vk::DeviceSize> > all;
+        for (auto& worker : perWorker){
+            all.insert(all.end(), worker.begin(), worker.end());
+        }
+        uniforms.beginFrame(1 % frames);
+        ok &= check("concurrent allocations are disjoint", validRanges(all, alignment, 0, capacity));
+        ok &= check("concurrent allocations are counted", uniforms.getStats().allocations == threadCount * perThread);
+
+        device.device.waitIdle();
+        uniforms.destroy();
+    }
+    instance.destroy(nullptr);
+
+    if (!ok){
+        printf("uniform allocator results are wrong\n");
+    }
+    return ok ? 0 : 1;
+}